@@ -45,6 +45,31 @@ static char *SccsId = "elmon " VERSION;
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/file.h>
+#include <sys/un.h>
+#include <sys/timerfd.h>
+#include "elmon_shm.h"
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define URING	/* batch the /proc reads, see proc_batch() */
+#endif
+#endif
+#endif
 
 #define FLIP(variable) if(variable) variable=0; else variable=1;
 
@@ -86,9 +111,27 @@ int loop2 = 0;
 int loop_options = 0;
 int tempInt = 0;
 
+/* Sections the collector thread has to gather data for, one bit per
+ * SHOW_ number, kept up to date by add_option() and remove_option().
+ */
+unsigned long long collect_options = 0;
+
+void collectors_wanted(unsigned long long before, unsigned long long now);
+
+void publish_options(){
+unsigned long long before = collect_options;
+unsigned long long mask = 0;
+int i;
+        for(i = 0; i < optionCount; i++)
+                mask |= 1ULL << enabled_options[i];
+        __atomic_store_n(&collect_options, mask, __ATOMIC_RELAXED);
+        collectors_wanted(before, mask);
+}
+
 int enabled_option(int item){
-        for(loop1 = 0; loop1 < optionCount; loop1++){
-                if(enabled_options[loop1] == item){
+int i;
+        for(i = 0; i < optionCount; i++){
+                if(enabled_options[i] == item){
                         return 1;
                 }
         }
@@ -99,6 +142,7 @@ void add_option(int item){
         if (enabled_option(item) == 0){
                 enabled_options[optionCount] = item;
                 optionCount++;
+                publish_options();
         }
 }
 
@@ -109,6 +153,7 @@ void remove_option(int item){
                                 enabled_options[loop2] = enabled_options[loop2+1];
                         }
                         optionCount--;
+                        publish_options();
                         break;
                 }
         }
@@ -154,7 +199,10 @@ void flip(int item){
 #define P_LOADAVG   	5
 #define P_NFS   	6
 #define P_NFSD   	7
-#define P_NUMBER	8 /* one more than the max */
+#define P_VMSTAT	8
+#define P_DISKSTATS	9
+#define P_NETDEV	10
+#define P_NUMBER	11 /* one more than the max */
 
 char *month[12] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN",
                     "JUL", "AUG", "SEP", "OCT", "NOV", "DEC" };
@@ -193,28 +241,45 @@ void error(char *err)
 /* /proc/cpuinfo can be 512 bytes per CPU and we allow 256 CPUs */
 /* and 20 lines per CPU so boost the buffers for this one */
 #define PROC_MAXBUF   (1024*4)
+#define PROC_BIGBUF   (1024*64) /* vmstat, diskstats and net/dev grow with the kernel, disks and adapters */
 #define CPUINFO_MAXBUF (512*256)
 #define PROC_MAXLINES (20*256*sizeof(char *))
 
+/* The files the collectors may read every interval */
+#define PROC_BATCH	((1 << P_STAT) | (1 << P_MEMINFO) | (1 << P_VMSTAT) | (1 << P_UPTIME) | \
+			 (1 << P_LOADAVG) | (1 << P_DISKSTATS) | (1 << P_NETDEV))
+
 int reread =0;
 struct {
-	FILE *fp;
+	int fd;		/* kept open, -1 if not */
 	char *filename;
+	int size;	/* of buf */
+	int len;	/* read into buf, -1 if the read failed */
+	int batched;	/* buf is from proc_batch() and not used yet */
+	double stamp;	/* the middle of the read, on CLOCK_MONOTONIC */
 	int lines;
 	char *line[PROC_MAXLINES];
 	char *buf;
 } proc[P_NUMBER];
 
+long proc_syscalls = 0;	/* made reading the files, for --bench-io */
+
+double monotime(void);
+
 void proc_init()
 {
 int i;
-	/* Initialise the file pointers */
+	/* Initialise the file descriptors */
 	for(i=0;i<P_NUMBER;i++) {
-		proc[i].fp = 0;
+		proc[i].fd = -1;
+		proc[i].batched = 0;
 		if(i == P_CPUINFO)
-			proc[i].buf  = (char *)malloc(CPUINFO_MAXBUF);
+			proc[i].size = CPUINFO_MAXBUF;
+		else if(i == P_VMSTAT || i == P_DISKSTATS || i == P_NETDEV)
+			proc[i].size = PROC_BIGBUF;
 		else
-			proc[i].buf  = (char *)malloc(PROC_MAXBUF);
+			proc[i].size = PROC_MAXBUF;
+		proc[i].buf  = (char *)malloc(proc[i].size);
 	}
 	proc[P_CPUINFO].filename = "/proc/cpuinfo";
 	proc[P_STAT].filename    = "/proc/stat";
@@ -224,31 +289,270 @@ int i;
 	proc[P_LOADAVG].filename = "/proc/loadavg";
 	proc[P_NFS].filename     = "/proc/net/rpc/nfs";
 	proc[P_NFSD].filename    = "/proc/net/rpc/nfsd";
+	proc[P_VMSTAT].filename  = "/proc/vmstat";
+	proc[P_DISKSTATS].filename = "/proc/diskstats";
+	proc[P_NETDEV].filename  = "/proc/net/dev";
 }
 
-void proc_read(int num)
+/* Have the whole of file num in its buffer, returns how much there is or
+ * -1.  Either proc_batch() has just read it or it is one pread() from
+ * the start, which is all a /proc file needs to give the lot again, and
+ * the buffer grows if that fills it.
+ */
+int proc_fill(int num)
 {
-int i;
-int size;
-int found;
 char buf[1024];
-int bytes;
+double t;
 
-	if(proc[num].fp == 0) {
-		if( (proc[num].fp = fopen(proc[num].filename,"r")) == NULL) {
+	if(proc[num].batched) {
+		proc[num].batched = 0;
+		return proc[num].len;
+	}
+	if(proc[num].fd == -1) {
+		proc_syscalls++;
+		if((proc[num].fd = open(proc[num].filename, O_RDONLY)) == -1) {
 			sprintf(buf, "failed to open file %s", proc[num].filename);
 			error(buf);
-			proc[num].fp = 0;
-			return;
+			return proc[num].len = -1;
+		}
+	}
+	t = monotime();
+	for(;;) {
+		proc_syscalls++;
+		proc[num].len = pread(proc[num].fd, proc[num].buf, proc[num].size - 1, 0);
+		if(proc[num].len < proc[num].size - 1)
+			break;
+		proc[num].size *= 2;	/* it may not all be there, grow and read it again */
+		proc[num].buf = REALLOC(proc[num].buf, proc[num].size);
+	}
+	if(proc[num].len >= 0)
+		proc[num].buf[proc[num].len] = 0;
+	proc[num].stamp = (t + monotime()) / 2.0;
+	if(reread) {
+		proc_syscalls++;
+		close(proc[num].fd);
+		proc[num].fd = -1;
+	}
+	return proc[num].len;
+}
+
+/* File num for the readers that fgets() their way through it, from memory */
+FILE *proc_stream(int num)
+{
+	if(proc_fill(num) <= 0)
+		return NULL;
+	return fmemopen(proc[num].buf, proc[num].len, "r");
+}
+
+#ifdef URING
+/* With NMONURING=1 the files in PROC_BATCH are read in one go through an
+ * io_uring, one io_uring_enter() for the lot instead of a pread() each.
+ * They stay open and are registered with the ring along with their
+ * buffers, so the kernel does not look the files up or pin the pages each
+ * time.  It is little enough to do with the system calls directly and need
+ * no liburing.  It is not the default: /proc files cannot be read without
+ * blocking, so the kernel hands each read to a worker thread and that
+ * costs more than the system calls saved, see --bench-io.  Without
+ * io_uring in the kernel or when it is switched off proc_batch() uses
+ * pread().
+ */
+int uring_on = 0;	/* NMONURING=1 */
+
+struct {
+	int fd;			/* -2 not set up yet, -1 none */
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	int slot[P_NUMBER];	/* registered file and buffer, -1 if not */
+	int size[P_NUMBER];	/* of the buffer registered, proc_fill() may grow it */
+	int files;		/* registered */
+} uring = { -2 };
+
+void uring_teardown()
+{
+	if(uring.fd < 0)
+		return;
+	if(uring.sqes != MAP_FAILED)
+		munmap(uring.sqes, uring.sqes_size);
+	if(uring.cq_ring != MAP_FAILED && uring.cq_ring != uring.sq_ring)
+		munmap(uring.cq_ring, uring.cq_size);
+	if(uring.sq_ring != MAP_FAILED)
+		munmap(uring.sq_ring, uring.sq_size);
+	close(uring.fd);	/* which drops the registered files and buffers */
+	uring.fd = -1;
+}
+
+/* Register the buffers of the registered files, again once proc_fill()
+ * has grown one
+ */
+int uring_buffers(int again)
+{
+struct iovec iov[P_NUMBER];
+int num;
+
+	for(num = 0; num < P_NUMBER; num++)
+		if(uring.slot[num] != -1) {
+			iov[uring.slot[num]].iov_base = proc[num].buf;
+			iov[uring.slot[num]].iov_len = uring.size[num] = proc[num].size;
 		}
+	if(again)
+		syscall(__NR_io_uring_register, uring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	return syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_BUFFERS, iov, uring.files);
+}
+
+void uring_setup()
+{
+struct io_uring_params params;
+int fds[P_NUMBER];
+int num;
+int n = 0;
+
+	uring.fd = -1;
+	if(reread)
+		return;
+	memset(&params, 0, sizeof(params));
+	if((uring.fd = syscall(__NR_io_uring_setup, P_NUMBER, &params)) < 0) {
+		uring.fd = -1;
+		return;
 	}
-	rewind(proc[num].fp);
-	if(num == P_CPUINFO)
-		bytes = CPUINFO_MAXBUF -1;
+	uring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if((params.features & IORING_FEAT_SINGLE_MMAP) && uring.cq_size > uring.sq_size)
+		uring.sq_size = uring.cq_size;
+	uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring.sq_ring = mmap(NULL, uring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		uring.cq_ring = uring.sq_ring;
 	else
-		bytes = PROC_MAXBUF -1;
-	size = fread(proc[num].buf, 1, bytes, proc[num].fp);
-	proc[num].buf[size]=0;
+		uring.cq_ring = mmap(NULL, uring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+	uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+	if(uring.sq_ring == MAP_FAILED || uring.cq_ring == MAP_FAILED || uring.sqes == MAP_FAILED) {
+		uring_teardown();
+		return;
+	}
+	uring.sq_tail  = (unsigned *)((char *)uring.sq_ring + params.sq_off.tail);
+	uring.sq_mask  = (unsigned *)((char *)uring.sq_ring + params.sq_off.ring_mask);
+	uring.sq_array = (unsigned *)((char *)uring.sq_ring + params.sq_off.array);
+	uring.cq_head  = (unsigned *)((char *)uring.cq_ring + params.cq_off.head);
+	uring.cq_tail  = (unsigned *)((char *)uring.cq_ring + params.cq_off.tail);
+	uring.cq_mask  = (unsigned *)((char *)uring.cq_ring + params.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)((char *)uring.cq_ring + params.cq_off.cqes);
+
+	/* NFS is only there with the modules loaded, later ones use pread() */
+	for(num = 0; num < P_NUMBER; num++) {
+		uring.slot[num] = -1;
+		if(!((PROC_BATCH | (1 << P_NFS) | (1 << P_NFSD)) & (1 << num)))
+			continue;
+		if(proc[num].fd == -1 && (proc[num].fd = open(proc[num].filename, O_RDONLY)) == -1)
+			continue;
+		fds[n] = proc[num].fd;
+		uring.slot[num] = n++;
+	}
+	uring.files = n;
+	if(n == 0
+	|| syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_FILES, fds, n) < 0
+	|| uring_buffers(0) < 0)
+		uring_teardown();
+}
+
+/* Submit a fixed read of each registered file in mask and wait for them all */
+void uring_batch(int mask)
+{
+struct io_uring_sqe *sqe;
+struct io_uring_cqe *cqe;
+unsigned tail;
+unsigned head;
+double t;
+int num;
+int n = 0;
+
+	for(num = 0; num < P_NUMBER; num++)
+		if(uring.slot[num] != -1 && uring.size[num] != proc[num].size && uring_buffers(1) < 0) {
+			uring_teardown();
+			return;
+		}
+	tail = *uring.sq_tail;
+	for(num = 0; num < P_NUMBER; num++) {
+		if(!(mask & (1 << num)) || uring.slot[num] == -1)
+			continue;
+		sqe = &uring.sqes[tail & *uring.sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = uring.slot[num];
+		sqe->off = 0;
+		sqe->addr = (unsigned long)proc[num].buf;
+		sqe->len = proc[num].size - 1;
+		sqe->buf_index = uring.slot[num];
+		sqe->user_data = num;
+		uring.sq_array[tail & *uring.sq_mask] = tail & *uring.sq_mask;
+		tail++;
+		n++;
+	}
+	if(n == 0)
+		return;
+	__atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+	t = monotime();
+	proc_syscalls++;
+	if(syscall(__NR_io_uring_enter, uring.fd, n, n, IORING_ENTER_GETEVENTS, NULL, 0) != n) {
+		uring_teardown();	/* and leave it to pread() from now on */
+		return;
+	}
+	t = (t + monotime()) / 2.0;
+	head = *uring.cq_head;
+	while(head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &uring.cqes[head & *uring.cq_mask];
+		num = cqe->user_data;
+		if(cqe->res >= 0 && cqe->res < proc[num].size - 1) {	/* else pread() and grow */
+			proc[num].len = cqe->res;
+			proc[num].buf[proc[num].len] = 0;
+			proc[num].stamp = t;
+			proc[num].batched = 1;
+		}
+		head++;
+	}
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+#endif /* URING */
+
+/* Read the files in mask, 1 << P_STAT and so on, for the proc_read() and
+ * proc_stream() calls that follow
+ */
+void proc_batch(int mask)
+{
+int num;
+
+#ifdef URING
+	if(uring.fd == -2 && uring_on)
+		uring_setup();
+	if(uring.fd >= 0)
+		uring_batch(mask);
+#endif /* URING */
+	for(num = 0; num < P_NUMBER; num++)
+		if((mask & (1 << num)) && !proc[num].batched) {
+			proc_fill(num);
+			proc[num].batched = 1;
+		}
+}
+
+void proc_read(int num)
+{
+int i;
+int size;
+int found;
+
+	if((size = proc_fill(num)) < 0)
+		return;
 	proc[num].lines=0;
 	proc[num].line[0]=&proc[num].buf[0];
 	if(num == P_VERSION) {
@@ -286,10 +590,6 @@ int bytes;
 		if(proc[num].lines==PROC_MAXLINES-1)
 			break;
 	}
-	if(reread) {
-		fclose( proc[num].fp);
-		proc[num].fp = 0;
-	}
 }
 
 #include <dirent.h>
@@ -343,6 +643,7 @@ struct procsinfo {
                 unsigned long statm_drs;        /* data/stack */
                 unsigned long statm_lrs;        /* library */
                 unsigned long statm_dt;         /* dirty pages */
+		double pi_stamp;		/* CLOCK_MONOTONIC when stat was read */
 };
 
 
@@ -353,15 +654,22 @@ struct procsinfo {
 #include <net/if.h>
 
 int debug =0;
+char	*rec_in_name = NULL;	/* -P or --to-nmon reads this recording */
+int	play_speed = 1;		/* -P 1, 10 or 0 = as fast as it goes */
+int	play_hold = 0;		/* the screen is paused, so is the player */
+int	play_end = 0;		/* set by the player at the end of the recording */
+long long play_seek = 0;	/* > 0 go to snapshot play_seek - 1, < 0 to time -play_seek ms */
+char	*play_from = NULL;	/* --to-nmon only converts from here */
+char	*play_to = NULL;	/* to here */
 time_t  timer;			/* used to work out the hour/min/second */
 
 /* Counts of resources */
 int	cpus = 1;  	/* number of CPUs in system (lets hope its more than zero!) */
 int	max_cpus = 1;  	/* highest number of CPUs in DLPAR */
-int	networks = 0;  	/* number of networks in system  */
+__thread int networks = 0;  	/* number of networks in system  */
 int	partitions = 0;  	/* number of partitions in system  */
 int	partitions_short = 0;  	/* partitions file data short form (i.e. data missing) */
-int	disks    = 0;  	/* number of disks in system  */
+__thread int disks    = 0;  	/* number of disks in system  */
 int	seconds  = -1; 	/* pause interval */
 int	maxloops = -1;  /* stop after this number of updates */
 char	hostname[256];
@@ -413,6 +721,10 @@ int maxcols = 0;
 #define SHOW_VM 18
 #define SHOW_DGROUP 19
 #define SHOW_DISKMAP 20
+#define SHOW_IRQ 21
+#define SHOW_PSI 22
+#define SHOW_CGROUP 23
+#define SHOW_NUMA 24
 
 /* Mode of output variables */
 int	show_aaa     = 1;
@@ -444,7 +756,6 @@ int	menu_sY     = 1;
 //The keymap array is used by the help menu and contains the keyboard key that is associated with the menu location.  
 char keymap[5][9];
 
-#define RRD if(show_rrd)  
 
 double ignore_procdisk_threshold = 0.1;
 double ignore_io_threshold      = 0.1;
@@ -467,2323 +778,5095 @@ int	colour = 1;	/* 1 = using colour curses and
 					attroff(A_STANDOUT); }
 FILE *fp;	/* filepointer for spreadsheet output */
 
+#define BANNER(pad,string) {mvwhline(pad, 0, 0, ACS_HLINE,maxcols-2); \
+                                        wmove(pad,0,0); \
+                                        wattron(pad,A_STANDOUT); \
+                                        wprintw(pad," "); \
+                                        wprintw(pad,string); \
+                                        wprintw(pad," "); \
+                                        wattroff(pad,A_STANDOUT); }
+
 
+/* Every line of a snapshot has the same tag, so it is only worked out
+ * again when the snapshot changes
+ */
 char *timestamp(int loop, time_t eon)
 {
 static char string[64];
+static int last_loop = -1;
+static time_t last_eon = -1;
+
+	if(loop == last_loop && eon == last_eon)
+		return string;
 	if(show_rrd)
 		sprintf(string,"%ld",(long)eon);
 	else
 		sprintf(string,"T%04d",loop);
+	last_loop = loop;
+	last_eon = eon;
 	return string;
 }
 #define LOOP timestamp(loop,timer)
 
-char *easy[5] = {"not found",0,0,0,0};
-char *lsb_release[5] = {"not found",0,0,0,0};
+/* With a lot of disks -f writes tens of thousands of numbers a snapshot.
+ * Rather than a printf each, the busy sections append them to fmt with
+ * these and hand fp a whole section at once with fmt_flush().
+ */
+struct {
+	char	*data;
+	long	len;
+	long	size;
+} fmt;
 
-void find_release()
+void fmt_need(long n)
 {
-FILE *pop;
+	if(fmt.len + n > fmt.size) {
+		fmt.size = (fmt.len + n) * 2;
+		fmt.data = REALLOC(fmt.data, fmt.size);
+	}
+}
+
+void fmt_str(char *s)
+{
+long n = strlen(s);
+
+	fmt_need(n);
+	memcpy(&fmt.data[fmt.len], s, n);
+	fmt.len += n;
+}
+
+/* v the way printf("%.*f") has it, in the C locale elmon runs in.  Up to
+ * two decimals are done here, the rare values that are all but halfway
+ * between two of them, huge ones and more decimals are left to snprintf
+ * so the text is always the same.
+ */
+void fmt_num(double v, int prec)
+{
+static double scale[3] = {1.0, 10.0, 100.0};
+char digits[32];
+double a = signbit(v) ? -v : v;
+long long r = 0;
+double frac = 0.0;
+int n = 0;
 int i;
-char tmpstr[71];
 
-	pop = popen("cat /etc/*ease 2>/dev/null", "r");
-	if(pop != NULL) {
-		tmpstr[0]=0;
-	    	for(i=0;i<4;i++) {
-			if(fgets(tmpstr, 70, pop) == NULL) 
-				break;
-			tmpstr[strlen(tmpstr)-1]=0; /* remove newline */
-			easy[i] = malloc(strlen(tmpstr)+1);
-			strcpy(easy[i],tmpstr);
-		}
-		pclose(pop);
+	if(prec >= 0 && prec <= 2 && a < 1.0e9) {	/* false for NaN too */
+		r = (long long)(a * scale[prec]);
+		frac = a * scale[prec] - r;
 	}
-	pop = popen("/usr/bin/lsb_release -idrc 2>/dev/null", "r");
-	if(pop != NULL) {
-		tmpstr[0]=0;
-	    	for(i=0;i<4;i++) {
-			if(fgets(tmpstr, 70, pop) == NULL) 
-				break;
-			tmpstr[strlen(tmpstr)-1]=0; /* remove newline */
-			lsb_release[i] = malloc(strlen(tmpstr)+1);
-			strcpy(lsb_release[i],tmpstr);
-		}
-		pclose(pop);
+	if(prec < 0 || prec > 2 || !(a < 1.0e9) || (frac > 0.4999 && frac < 0.5001)) {
+		n = snprintf(NULL, 0, "%.*f", prec, v);
+		fmt_need(n + 1);
+		fmt.len += snprintf(&fmt.data[fmt.len], n + 1, "%.*f", prec, v);
+		return;
 	}
+	fmt_need(32);
+	if(frac > 0.5)
+		r++;
+	for(i = 0; i < prec; i++) {
+		digits[n++] = '0' + r % 10;
+		r /= 10;
+	}
+	if(prec > 0)
+		digits[n++] = '.';
+	do {
+		digits[n++] = '0' + r % 10;
+		r /= 10;
+	} while(r > 0);
+	if(signbit(v))
+		fmt.data[fmt.len++] = '-';
+	while(n > 0)
+		fmt.data[fmt.len++] = digits[--n];
 }
 
-void helpmenuitem(WINDOW* pad, char *key, char *description, int x, int y, int enabled, int menu_Y, int menu_X){
-	if (!strcmp(key, "space")){
-		keymap[menu_X][menu_Y] = ' '; 
-	} else{
-		keymap[menu_X][menu_Y] = *key; 
+/* s with a \ before any of the characters in special, for the names in
+ * Influx line protocol, and control characters as spaces
+ */
+void fmt_escape(char *s, char *special)
+{
+	for(; *s; s++) {
+		fmt_need(2);
+		if(strchr(special, *s) != NULL)
+			fmt.data[fmt.len++] = '\\';
+		fmt.data[fmt.len++] = (unsigned char)*s < ' ' ? ' ' : *s;
 	}
-	COLOUR wattrset(pad, COLOR_PAIR(2) | A_BOLD); 
-	mvwprintw(pad, x, y, "%s:", key);
-	if (enabled){
-		COLOUR wattrset(pad, COLOR_PAIR(2)); 
-	} else{
-		COLOUR wattrset(pad, COLOR_PAIR(0)); 
+}
+
+/* s as a JSON string */
+void fmt_json(char *s)
+{
+	fmt_need(1);
+	fmt.data[fmt.len++] = '"';
+	for(; *s; s++) {
+		fmt_need(6);
+		if(*s == '"' || *s == '\\') {
+			fmt.data[fmt.len++] = '\\';
+			fmt.data[fmt.len++] = *s;
+		} else if((unsigned char)*s < ' ')
+			fmt.len += sprintf(&fmt.data[fmt.len], "\\u%04x", *s);
+		else
+			fmt.data[fmt.len++] = *s;
 	}
-	if (menu_sX == menu_X && menu_sY == menu_Y){
-                wattron(pad,A_STANDOUT); 
+	fmt_need(1);
+	fmt.data[fmt.len++] = '"';
+}
+
+void fmt_flush()
+{
+	if(fmt.len > 0 && fwrite(fmt.data, 1, fmt.len, fp) != fmt.len)
+		/* as with fprintf, a full disk shows up as missing lines */ ;
+	fmt.len = 0;
+}
+
+/* Each section hands -f output a record: enc_begin() with the section
+ * and the rrd file it goes to (NULL if none), enc_key() for sections
+ * with a line per process, cgroup and the like, then the columns one
+ * at a time and enc_end().  The encoder picked with -O turns that into
+ * text in fmt, so a new format is an entry in encoders[] rather than
+ * another printf at every section.  The CSV headers, ZZZZ lines and
+ * BBB sections are only written for the nmon CSV.
+ */
+struct encoder {
+	char	*name;
+	void	(*begin)(char *section, char *rrd);
+	void	(*key)(char *col, char *s);
+	void	(*num)(char *col, double v, int prec);
+	void	(*text)(char *col, char *s);
+	void	(*none)(char *col, char *csv);	/* no value, csv is what nmon puts */
+	void	(*end)(void);
+};
+
+long	enc_start;	/* where the record began in fmt */
+int	enc_skip;	/* this encoder has no place for the record */
+int	enc_cols;	/* values so far in the record */
+
+/* nmon CSV: SECTION[,key],T0001,v,v,... */
+void enc_csv_time()
+{
+	if(enc_cols++ == 0) {
+		fmt_str(",");
+		fmt_str(LOOP);
 	}
-	mvwprintw(pad, x, y + strlen(key) + 2, "%s", description);
-        wattroff(pad,A_STANDOUT); 
-	COLOUR wattrset(pad, COLOR_PAIR(0)); 
 }
 
-void displayhelpmenu(WINDOW* pad){
-			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
-                        #ifdef NCURSES_MOUSE_VERSION
-                        if (mouse){
-                                mvwprintw(pad, 0,0, "  ---Use keys below, arrow keys to select, or mouse to toggle stats on/off---");
-                        }else{
-                                mvwprintw(pad, 0, 0,  "  --- Use keys below or arrow keys to select to toggle statistics on/off ---");
-                        }    
-                        #else
-                                mvwprintw(pad, 0, 0,  "  --- Use keys below or arrow keys to select to toggle statistics on/off ---");
-                        #endif
-			COLOUR wattrset(pad, COLOR_PAIR(0)); 
+void enc_csv_begin(char *section, char *rrd)
+{
+	fmt_str(section);
+}
 
-                        helpmenuitem(pad, "h", "Close Help ", 1, 1, 0, 1, 1 ); 
-                        helpmenuitem(pad, "l", "Long Term CPU Avg ", 1, 15, enabled_option(SHOW_LONGTERM), 1, 2 ); 
-                        helpmenuitem(pad, "m", "Memory/Swap Stats  ", 1, 36, enabled_option(SHOW_MEMORY), 1, 3 ); 
-                        helpmenuitem(pad, "M", "Memory/Swap Graph", 1, 58, enabled_option(SHOW_MEMORY_GRAPH), 1, 4 ); 
+void enc_csv_key(char *col, char *s)
+{
+int n;
 
-                        helpmenuitem(pad, "V", "Virt Mem   ", 2, 1, enabled_option(SHOW_VM), 2, 1 ); 
-                        helpmenuitem(pad, "n", "Network Stats     ", 2, 15, enabled_option(SHOW_NET), 2, 2 ); 
-                        helpmenuitem(pad, "j", "Filesystem Usage   ", 2, 36, enabled_option(SHOW_JFS), 2, 3 ); 
-                        helpmenuitem(pad, "k", "Kernel/Load Stats", 2, 58, enabled_option(SHOW_KERNEL), 2, 4 );
+	fmt_str(",");
+	if(strcmp(col, "PID") == 0)	/* nmon has them as 7 digits */
+		for(n = strlen(s); n < 7; n++)
+			fmt_str("0");
+	fmt_str(s);
+}
 
-                        helpmenuitem(pad, "N", "NFS        ", 3, 1, enabled_option(SHOW_NFS), 3, 1 ); 
-                        helpmenuitem(pad, "o", "Disks %Busy Map    ", 3, 15, enabled_option(SHOW_DISKMAP), 3, 2 ); 
-                        if (show_disk_mode == SHOW_DISK_GRAPH) { 
-                                helpmenuitem(pad, "d", "Disk I/O Graphs     ", 3, 36, 1, 3, 3 ); 
-                        }else{
-                                helpmenuitem(pad, "d", "Disk I/O Graphs     ", 3, 36, 0, 3, 3 ); 
-                        }    
-                        if (show_disk_mode == SHOW_DISK_STATS) { 
-                                helpmenuitem(pad, "D", "Disk I/O Stats   ", 3, 58, 1, 3, 4 ); 
-                        }else{
-                                helpmenuitem(pad, "D", "Disk I/O Stats   ", 3, 58, 0, 3, 4 ); 
-                        }
+void enc_csv_num(char *col, double v, int prec)
+{
+	enc_csv_time();
+	fmt_need(1);
+	fmt.data[fmt.len++] = ',';
+	fmt_num(v, prec);
+}
 
-                        helpmenuitem(pad, "c", "CPU         ", 4, 1, enabled_option(SHOW_SMP), 4, 1 ); 
-                        helpmenuitem(pad, "g", "Disk Groups       ", 4, 15, enabled_option(SHOW_DGROUP), 4, 2 ); 
-                        helpmenuitem(pad, "r", "System Info        ", 4, 36, enabled_option(SHOW_CPU), 4, 3 ); 
-                        helpmenuitem(pad, "v", "Verbose Display  ", 4, 58, enabled_option(SHOW_VERBOSE), 4, 4 ); 
+void enc_csv_text(char *col, char *s)
+{
+	enc_csv_time();
+	fmt_str(",");
+	fmt_str(s);
+}
 
-			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
-                        mvwprintw(pad, 5, 0,  "                          --- Top Process Mode ---                                ");
-			COLOUR wattrset(pad, COLOR_PAIR(0)); 
+void enc_csv_none(char *col, char *csv)
+{
+	enc_csv_text(col, csv);
+}
 
-                        helpmenuitem(pad, "t", "Top Procs  ", 6, 1, enabled_option(SHOW_TOP), 5, 1 ); 
-                        if (show_topmode == 1 && enabled_option(SHOW_TOP)) {
-                                helpmenuitem(pad, "1", "Basic Top Mode    ", 6, 15, 1, 5, 2 ); 
-                        } else{
-                                helpmenuitem(pad, "1", "Basic Top Mode    ", 6, 15, 0, 5, 2 ); 
-                        }    
-                        if (show_topmode == 3 && enabled_option(SHOW_TOP)) {
-                                helpmenuitem(pad, "3", "CPU Top Mode       ", 6, 36, 1, 5, 3 ); 
-                        } else{
-                                helpmenuitem(pad, "3", "CPU Top Mode       ", 6, 36, 0, 5, 3 ); 
-                        }    
-                        helpmenuitem(pad, "u", "Show Command Args", 6, 58, show_args, 5, 4 ); 
+void enc_csv_end()
+{
+	enc_csv_time();
+	fmt_str("\n");
+}
 
-			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
-                        mvwprintw(pad, 7, 0,  "                              --- Controls ---                                ");
-			COLOUR wattrset(pad, COLOR_PAIR(0)); 
+/* rrdtool update <file> <time>:v:v:... only for sections with a file */
+void enc_rrd_begin(char *section, char *rrd)
+{
+	if(rrd == NULL) {
+		enc_skip = 1;
+		return;
+	}
+	fmt_str("rrdtool update ");
+	fmt_str(rrd);
+	fmt_str(" ");
+	fmt_str(LOOP);
+}
 
-                        helpmenuitem(pad, "q", "Quit       ", 8, 1, 0, 6, 1 ); 
-                        helpmenuitem(pad, "b", "Black/White Mode  ", 8, 15, 0, 6, 2 ); 
-                        helpmenuitem(pad, "C", "Single-Column View ", 8, 36, !show_columns, 6, 3 ); 
-                        helpmenuitem(pad, "space", "Refresh Now  ", 8, 58, 0, 6, 4 ); 
+void enc_rrd_key(char *col, char *s)
+{
+}
 
-                        helpmenuitem(pad, ".", "Only show busy disk/processes   ", 9, 1, !show_all, 7, 1 ); 
-                        helpmenuitem(pad, "0", "Reset Peak Counts to Zero (peak = '>') ", 9, 36, 0, 7, 2 ); 
+void enc_rrd_num(char *col, double v, int prec)
+{
+	fmt_need(1);
+	fmt.data[fmt.len++] = ':';
+	fmt_num(v, prec);
+}
 
-                        helpmenuitem(pad, "+", "Double Screen Refresh Time      ", 10, 1, 0, 8, 1 ); 
-                        helpmenuitem(pad, "-", "Half Screen Refresh Time               ", 10, 36, 0, 8, 2 ); 
+void enc_rrd_text(char *col, char *s)
+{
 }
 
-void display(WINDOW* pad, int rows) {
-	if (show_columns) {
-        	if (COLS >= 246){
-        	        if (x_1+2+(rows)>LINES-1){
-        	                if (x_2+2+(rows)>LINES-1) {
-        	                        if (x_3+2+(rows)>LINES-1){
-        	                                if (x_1 <= x_2 && x_1 <= x_3 ) {
-        	                                        use_x_1++;
-        	                                } else if (x_2 <= x_1 && x_2 <= x_3) {
-        	                                        use_x_2++;
-        	                                }else{
-        	                                        use_x_3++;
-        	                                }
-        	                        }else{
-        	                                use_x_3++;
-        	                        }
-        	                }else{
-        	                        use_x_2++;
-        	                }
-        	        }else {
-        	                use_x_1++;
-        	        }
-        	} else if (COLS >= 164) {
-        	        if (x_1+2+(rows)>LINES-1){
-        	                if (x_2+2+(rows)>LINES-1){
-        	                        if (x_1 <= x_2) {
-        	                                use_x_1++;
-        	                        } else{
-        	                                use_x_2++;
-        	                        }
-        	                }else{
-        	                        use_x_2++;
-        	                }
-        	        }else{
-        	                use_x_1++;
-        	        }
-        	}else{
-        	        use_x_1++;
-        	}
+void enc_rrd_none(char *col, char *csv)
+{
+	fmt_str(":U");
+}
 
-	        if (last_num_col == 1){
-	                maxcols = COLS;
-	        }else if (last_num_col == 2){
-	                maxcols = COLS/2;
-	        }else {
-	                maxcols = COLS/3;
-	        }
-	}else{
-		use_x_1++;
-		maxcols = COLS;
+void enc_rrd_end()
+{
+	fmt_str("\n");
+}
+
+/* JSON Lines: {"section":"CPU_ALL","host":..,"snapshot":1,"time":..,"User%":1.5,...} */
+void enc_json_col(char *col)
+{
+	fmt_str(",");
+	fmt_json(col);
+	fmt_str(":");
+}
+
+void enc_json_begin(char *section, char *rrd)
+{
+	fmt_str("{\"section\":");
+	fmt_json(section);
+	fmt_str(",\"host\":");
+	fmt_json(hostname);
+	fmt_str(",\"snapshot\":");
+	fmt_num(loop, 0);
+	fmt_str(",\"time\":");
+	fmt_num(timer, 0);
+}
+
+void enc_json_key(char *col, char *s)
+{
+	enc_json_col(col);
+	fmt_json(s);
+}
+
+void enc_json_num(char *col, double v, int prec)
+{
+	enc_json_col(col);
+	if(isfinite(v))
+		fmt_num(v, prec);
+	else
+		fmt_str("null");
+}
+
+void enc_json_text(char *col, char *s)
+{
+	if(*col == 0 || *s == 0)	/* the nmon blank columns */
+		return;
+	enc_json_col(col);
+	fmt_json(s);
+}
+
+void enc_json_none(char *col, char *csv)
+{
+	enc_json_col(col);
+	fmt_str("null");
+}
+
+void enc_json_end()
+{
+	fmt_str("}\n");
+}
+
+/* Influx line protocol: SECTION,host=h[,key=k] col=v,col=v <time in ns> */
+void enc_influx_begin(char *section, char *rrd)
+{
+	fmt_escape(section, ", ");
+	fmt_str(",host=");
+	fmt_escape(hostname, ",= ");
+}
+
+void enc_influx_key(char *col, char *s)
+{
+	if(*s == 0)
+		return;
+	fmt_str(",");
+	fmt_escape(col, ",= ");
+	fmt_str("=");
+	fmt_escape(s, ",= ");
+}
+
+void enc_influx_col(char *col)
+{
+	fmt_str(enc_cols++ ? "," : " ");
+	fmt_escape(col, ",= ");
+	fmt_str("=");
+}
+
+void enc_influx_num(char *col, double v, int prec)
+{
+	if(!isfinite(v))
+		return;
+	enc_influx_col(col);
+	fmt_num(v, prec);
+}
+
+void enc_influx_text(char *col, char *s)
+{
+	if(*col == 0 || *s == 0)
+		return;
+	enc_influx_col(col);
+	fmt_str("\"");
+	fmt_escape(s, "\"\\");
+	fmt_str("\"");
+}
+
+void enc_influx_none(char *col, char *csv)
+{
+}
+
+void enc_influx_end()
+{
+	if(enc_cols == 0) {	/* a line needs at least one field */
+		enc_skip = 1;
+		return;
 	}
+	fmt_str(" ");
+	fmt_num(timer, 0);
+	fmt_str("000000000\n");
+}
 
+/* Prometheus text format for -M.  Instead of text per record the samples
+ * are kept for the whole snapshot and prom_publish() writes them grouped
+ * by metric, elmon_<section>_<column> in lower case with % as pct and /
+ * as per.  Sections whose columns are disks, filesystems or interfaces,
+ * or that come as a numbered set like CPU01, put that in a label instead.
+ */
+#define PROM_COLUMN	1	/* each column is a label value */
+#define PROM_SPLIT	2	/* the columns are <value>-read... and <value>-write... */
+#define PROM_NUMBER	3	/* the digits after the section name are */
+#define PROM_TOP	20	/* busiest processes in the TOP metrics */
+
+int	top_max = 0;		/* -M, -Q and -Y: TOP lines for only the busiest processes */
+
+struct prom_map {
+	char	*section;	/* then nothing but digits */
+	char	*label;
+	int	how;
+} prom_map[] = {
+	{ "DISKBUSY",	"disk",		PROM_COLUMN },
+	{ "DISKREAD",	"disk",		PROM_COLUMN },
+	{ "DISKWRITE",	"disk",		PROM_COLUMN },
+	{ "DISKXFER",	"disk",		PROM_COLUMN },
+	{ "DISKBSIZE",	"disk",		PROM_COLUMN },
+	{ "DGBUSY",	"group",	PROM_COLUMN },
+	{ "DGREAD",	"group",	PROM_COLUMN },
+	{ "DGWRITE",	"group",	PROM_COLUMN },
+	{ "DGSIZE",	"group",	PROM_COLUMN },
+	{ "DGXFER",	"group",	PROM_COLUMN },
+	{ "JFSFILE",	"filesystem",	PROM_COLUMN },
+	{ "NET",	"interface",	PROM_SPLIT },
+	{ "NETPACKET",	"interface",	PROM_SPLIT },
+	{ "CPUTICKS",	"cpu",		PROM_NUMBER },
+	{ "CPU",	"cpu",		PROM_NUMBER },
+	{ NULL }
+};
 
-        if (use_x_1 > 0){
-                if(x_1+2+(rows)>LINES)
-                        pnoutrefresh(pad, 0,0,x_1,1,LINES-2,maxcols-2);
-                else
-                        pnoutrefresh(pad, 0,0,x_1,1,x_1+rows+1,maxcols-2);
-                x_1=x_1+(rows);
-                use_x_1 = 0;
-        }
-        if (use_x_2 > 0){
-                if(x_2+2+(rows)>LINES) {
-                        pnoutrefresh(pad, 0,0,x_2,maxcols,LINES-2,maxcols*2-2);
-                }else {
-                        pnoutrefresh(pad, 0,0,x_2,maxcols,x_2+rows+1,maxcols*2-2);
-                }
-                mvvline(1,maxcols-1,0,LINES-2);
-                wnoutrefresh(stdscr);
-                x_2=x_2+(rows);
-                use_x_2 = 0;
-        }
-        if (use_x_3 > 0){
-                if(x_3+2+(rows)>LINES) {
-                        pnoutrefresh(pad, 0,0,x_3,maxcols*2,LINES-2,maxcols*3-2);
-                }else {
-                        pnoutrefresh(pad, 0,0,x_3,maxcols*2,x_3+rows+1,maxcols*3-2);
-                }
-                mvwvline(stdscr,1,maxcols*2-1,0,LINES-2);
-                wnoutrefresh(stdscr);
-                x_3=x_3+(rows);
-                use_x_3 = 0;
-        }
+struct prom_metric {
+	char	*name;
+	char	*lines;		/* its samples in this snapshot */
+	size_t	len;
+	size_t	size;
+	int	next;		/* in the hash chain, -1 at the end */
+};
 
-       	if (x_3 > 1 ){
-       	        num_col = 3;
-       	} else if (x_2 > 1){
-       	        num_col = 2;
-       	} else{
-       	        num_col = 1;
-       	}
+#define PROM_HASH	1024
 
-        if(x_1+2>LINES || x_2+2>LINES || x_3+2>LINES) {
-                mvwprintw(stdscr,LINES-1,10,"Warning: Some Statistics may not shown");
-        }
+struct prom_metric *prom_metric = NULL;
+int	prom_metrics = 0;
+int	prom_metrics_max = 0;
+int	prom_hash[PROM_HASH];	/* index + 1 of the first metric, 0 for none */
+
+struct prom_sample {
+	int	metric;
+	char	label[256];	/* from prom_map, or empty */
+	char	value[40];
+	int	next;		/* with the same hash in this record */
+};
+
+struct prom_sample *prom_sample = NULL;
+int	prom_samples = 0;
+int	prom_samples_max = 0;
+struct prom_map *prom_sec;	/* for the record's section, or NULL */
+char	prom_section[64];	/* as it goes in the metric names */
+char	prom_labels[4096];	/* of the record */
+int	prom_labels_len;
+int	prom_record = 0;
+int	prom_seen[PROM_HASH];	/* index + 1 of a sample of this record */
+int	prom_seen_record[PROM_HASH];
+
+/* s onto the end of d with only a-z, 0-9 and single _ */
+void prom_name(char *d, int size, char *s)
+{
+int n = strlen(d);
+char *w;
+
+	for(; *s; s++) {
+		if(*s == '%')
+			w = "_pct_";
+		else if(*s == '/')
+			w = "_per_";
+		else if(isalnum((unsigned char)*s)) {
+			if(n < size - 1)
+				d[n++] = tolower((unsigned char)*s);
+			continue;
+		} else
+			w = "_";
+		for(; *w; w++)
+			if(n < size - 1 && (*w != '_' || (n > 0 && d[n - 1] != '_')))
+				d[n++] = *w;
+	}
+	while(n > 0 && d[n - 1] == '_')
+		n--;
+	d[n] = 0;
 }
 
+/* name="value" with the value escaped, returns its length or -1 if it
+ * does not fit in size
+ */
+int prom_pair(char *d, int size, char *name, char *value)
+{
+char label[64];
+int n;
 
-/* Full Args Mode stuff here */
+	label[0] = 0;
+	prom_name(label, sizeof(label), name);
+	if(isdigit((unsigned char)label[0]) || label[0] == 0)
+		return -1;
+	if((n = snprintf(d, size, "%s=\"", label)) >= size)
+		return -1;
+	for(; *value; value++) {
+		if(n + 3 >= size)
+			return -1;
+		if(*value == '\\' || *value == '"')
+			d[n++] = '\\';
+		if(*value == '\n') {
+			d[n++] = '\\';
+			d[n++] = 'n';
+		} else
+			d[n++] = *value;
+	}
+	d[n++] = '"';
+	d[n] = 0;
+	return n;
+}
 
-#define ARGSMAX 1024*8
-#define CMDLEN 4096
+void prom_label(char *name, char *value)
+{
+int n;
 
-struct {
-	int pid;
-	char *args;
-} arglist[ARGSMAX];
+	if(*value == 0)
+		return;
+	if(prom_labels_len > 0)
+		prom_labels[prom_labels_len++] = ',';
+	if((n = prom_pair(&prom_labels[prom_labels_len], sizeof(prom_labels) - prom_labels_len, name, value)) < 0)
+		n = (prom_labels_len > 0) ? -1 : 0;	/* leave it out */
+	prom_labels_len += n;
+	prom_labels[prom_labels_len] = 0;
+}
 
-void args_output(int pid, int loop, char *progname)
+int prom_find(char *name)
 {
-FILE *pop;
+unsigned int h = 0;
+char *s;
 int i;
-char tmpstr[CMDLEN];
-static int arg_first_time = 1;
 
-	if(pid == 0)
-		return; /* ignore init */
-	for(i=0;i<ARGSMAX-1;i++ ) {   /* clear data out */
-		if(arglist[i].pid == pid){
-			return;
-		}
-		if(arglist[i].pid == 0) /* got to empty slot */
+	for(s = name; *s; s++)
+		h = h * 31 + (unsigned char)*s;
+	h %= PROM_HASH;
+	for(i = prom_hash[h] - 1; i >= 0; i = prom_metric[i].next)
+		if(strcmp(prom_metric[i].name, name) == 0)
+			return i;
+	if(prom_metrics == prom_metrics_max) {
+		prom_metrics_max = prom_metrics_max ? prom_metrics_max * 2 : 256;
+		prom_metric = REALLOC(prom_metric, sizeof(struct prom_metric) * prom_metrics_max);
+	}
+	i = prom_metrics++;
+	memset(&prom_metric[i], 0, sizeof(struct prom_metric));
+	prom_metric[i].name = strdup(name);
+	prom_metric[i].next = prom_hash[h] - 1;
+	prom_hash[h] = i + 1;
+	return i;
+}
+
+void enc_prom_begin(char *section, char *rrd)
+{
+struct prom_map *m;
+int n = 0;
+
+	for(m = prom_map; m->section != NULL; m++) {
+		n = strlen(m->section);
+		if(strncmp(section, m->section, n) == 0 && section[n + strspn(&section[n], "0123456789")] == 0)
 			break;
 	}
-	sprintf(tmpstr,"ps -p %d -o args 2>/dev/null", pid);
-	pop = popen(tmpstr, "r");
-	if(pop == NULL) {
-		return;
-	} else {
-		if(fgets(tmpstr, CMDLEN, pop) == NULL) { /* throw away header */
-			pclose(pop);
-			return;
-		}
-		tmpstr[0]=0;
-		if(fgets(tmpstr, CMDLEN, pop) == NULL) {
-			pclose(pop);
-			return;
-		}
-		tmpstr[strlen(tmpstr)-1]=0;
-		if(tmpstr[strlen(tmpstr)-1]== ' ')
-			tmpstr[strlen(tmpstr)-1]=0;
-		arglist[i].pid = pid;
-		if(arg_first_time) {
-			fprintf(fp,"UARG,+Time,PID,ProgName,FullCommand\n");
-			arg_first_time = 0;
-		}
-		fprintf(fp,"UARG,%s,%07d,%s,%s\n",LOOP,pid,progname,tmpstr);
-		pclose(pop);
-		return;
+	prom_sec = m->section ? m : NULL;
+	prom_section[0] = 0;
+	prom_name(prom_section, sizeof(prom_section), prom_sec ? prom_sec->section : section);
+	prom_samples = 0;
+	prom_record++;
+	prom_labels_len = 0;
+	prom_label("host", hostname);
+	if(prom_sec != NULL && prom_sec->how == PROM_NUMBER && section[n] != 0) {
+		snprintf(prom_labels + prom_labels_len, sizeof(prom_labels) - prom_labels_len,
+			",%s=\"%d\"", prom_sec->label, atoi(&section[n]));
+		prom_labels_len += strlen(prom_labels + prom_labels_len);
 	}
 }
 
-void args_load()
+void enc_prom_key(char *col, char *s)
 {
-FILE *pop;
+	prom_label(col, s);
+}
+
+void enc_prom_num(char *col, double v, int prec)
+{
+struct prom_sample *sm;
+char name[256];
+char *stat = col;
+char *c;
+unsigned int h;
+long start;
+int len;
 int i;
-char tmpstr[CMDLEN];
 
-	for(i=0;i<ARGSMAX;i++ ) {   /* clear data out */
-		if(arglist[i].pid == -1)
-			break;
-		if(arglist[i].pid != 0){
-			arglist[i].pid = -1;
-			free(arglist[i].args);
+	if(prom_samples == prom_samples_max) {
+		prom_samples_max = prom_samples_max ? prom_samples_max * 2 : 256;
+		prom_sample = REALLOC(prom_sample, sizeof(struct prom_sample) * prom_samples_max);
+	}
+	sm = &prom_sample[prom_samples];
+	sm->label[0] = 0;
+	if(prom_sec != NULL && prom_sec->how == PROM_COLUMN) {
+		stat = "";
+		prom_pair(sm->label, sizeof(sm->label), prom_sec->label, col);
+	} else if(prom_sec != NULL && prom_sec->how == PROM_SPLIT) {
+		for(c = col + strlen(col); c > col; c--)
+			if(strncmp(c, "-read", 5) == 0 || strncmp(c, "-write", 6) == 0)
+				break;
+		if(c > col) {
+			snprintf(name, sizeof(name), "%.*s", (int)(c - col), col);
+			prom_pair(sm->label, sizeof(sm->label), prom_sec->label, name);
+			stat = c + 1;
 		}
 	}
-	pop = popen("ps -eo pid,args 2>/dev/null", "r");
-	if(pop == NULL) {
-		return;
-	} else {
-		if(fgets(tmpstr, CMDLEN, pop) == NULL) { /* throw away header */
-			pclose(pop);
+	snprintf(name, sizeof(name), "elmon_%s_", prom_section);
+	prom_name(name, sizeof(name), stat);
+	sm->metric = prom_find(name);
+
+	/* a filesystem mounted twice would be the same series twice, which
+	 * fails the whole scrape, so only the first one goes in
+	 */
+	for(h = sm->metric, c = sm->label; *c; c++)
+		h = h * 31 + (unsigned char)*c;
+	h %= PROM_HASH;
+	if(prom_seen_record[h] != prom_record) {
+		prom_seen_record[h] = prom_record;
+		prom_seen[h] = 0;
+	}
+	for(i = prom_seen[h] - 1; i >= 0; i = prom_sample[i].next)
+		if(prom_sample[i].metric == sm->metric && strcmp(prom_sample[i].label, sm->label) == 0)
 			return;
-		}
-		for(i=0;i<ARGSMAX;i++ ) {
-			tmpstr[0]=0;
-			if(fgets(tmpstr, CMDLEN, pop) == NULL) {
-				pclose(pop);
-				return;
-			}
-			tmpstr[strlen(tmpstr)-1]=0;
-			if(tmpstr[strlen(tmpstr)-1]== ' ')
-				tmpstr[strlen(tmpstr)-1]=0;
-			arglist[i].pid = atoi(tmpstr);
-			arglist[i].args = malloc(strlen(tmpstr));
-			strcpy(arglist[i].args,&tmpstr[6]);
-		}
-		pclose(pop);
+	sm->next = prom_seen[h] - 1;
+	prom_seen[h] = prom_samples + 1;
+	if(isnan(v))
+		strcpy(sm->value, "NaN");
+	else if(isinf(v))
+		strcpy(sm->value, v > 0 ? "+Inf" : "-Inf");
+	else {	/* the number as fmt_num() has it, then fmt back as it was */
+		start = fmt.len;
+		fmt_num(v, prec);
+		len = fmt.len - start < (long)sizeof(sm->value) ? fmt.len - start : (long)sizeof(sm->value) - 1;
+		memcpy(sm->value, &fmt.data[start], len);
+		sm->value[len] = 0;
+		fmt.len = start;
 	}
+	prom_samples++;
 }
 
-char *args_lookup(int pid, char *progname)
+void enc_prom_text(char *col, char *s)
+{
+	if(*col != 0)
+		prom_label(col, s);
+}
+
+void enc_prom_none(char *col, char *csv)
 {
+}
+
+void enc_prom_end()
+{
+struct prom_metric *m;
+struct prom_sample *sm;
+size_t need;
 int i;
-	for(i=0;i<ARGSMAX;i++) {
-		if(arglist[i].pid == pid)
-			return arglist[i].args;
-		if(arglist[i].pid == -1)
-			return progname;
+
+	for(i = 0; i < prom_samples; i++) {
+		sm = &prom_sample[i];
+		m = &prom_metric[sm->metric];
+		need = strlen(m->name) + prom_labels_len + strlen(sm->label) + strlen(sm->value) + 6;
+		if(m->len + need > m->size) {
+			m->size = (m->len + need) * 2;
+			m->lines = REALLOC(m->lines, m->size);
+		}
+		m->len += sprintf(m->lines + m->len, "%s{%s%s%s} %s\n", m->name,
+			prom_labels, sm->label[0] ? "," : "", sm->label, sm->value);
 	}
-	return progname;
 }
-/* end args mode stuff here */
 
-void   linux_bbbp(char *name, char *cmd, char *err)
-{
-        int   i;
-        int   len;
-#define STRLEN 4096
-        char   str[STRLEN];
-        FILE * pop;
-        static int   lineno = 0;
+/* Not one of -O, the records only go to the -M server */
+struct encoder enc_prom = { "prom", enc_prom_begin, enc_prom_key, enc_prom_num, enc_prom_text, enc_prom_none, enc_prom_end };
 
-        pop = popen(cmd, "r");
-        if (pop == NULL) {
-                fprintf(fp, "BBBP,%03d,%s failed to run %s\n", lineno++, cmd, err);
-        } else {
-                fprintf(fp, "BBBP,%03d,%s\n", lineno++, name);
-                for (i = 0; i < 2048 && (fgets(str, STRLEN, pop) != NULL); i++) { /* 2048=sanity check only */
-                        len = strlen(str);
-			if(len>STRLEN) len=STRLEN;
-                        if (str[len-1] == '\n') /*strip off the newline */
-                                str[len-1] = 0;
-                        /* fix lsconf style output so it does not confuse spread sheets */
-                        if(str[0] == '+') str[0]='p';
-                        if(str[0] == '*') str[0]='m';
-                        if(str[0] == '-') str[0]='n';
-                        if(str[0] == '/') str[0]='d';
-                        if(str[0] == '=') str[0]='e';
-                        fprintf(fp, "BBBP,%03d,%s,\"%s\"\n", lineno++, name, str);
-                }
-                pclose(pop);
-        }
+/* Graphite plaintext and StatsD gauges for -Q, a line per value named
+ * elmon.<host>.<section>[.<key>].<column> with the parts as prom_name()
+ * has them: elmon.db1.diskbusy.sda 12.3 <time> or elmon.db1.diskbusy.sda:12.3|g
+ */
+char	push_path[512];		/* of the record, up to the column */
+
+void enc_push_part(char *s)
+{
+int n = strlen(push_path);
+
+	if(n < sizeof(push_path) - 2) {
+		push_path[n++] = '.';
+		push_path[n] = 0;
+		prom_name(push_path, sizeof(push_path), s);
+	}
 }
 
-#define WARNING "needs root permission or file not present"
+void enc_push_begin(char *section, char *rrd)
+{
+	strcpy(push_path, "elmon");
+	enc_push_part(hostname);
+	enc_push_part(section);
+}
 
-/* Global name of programme for printing it */
-char	*progname;
+void enc_push_key(char *col, char *s)
+{
+	if(*s != 0)
+		enc_push_part(s);
+}
 
-/* Main data structure for collected stats.
- * Two versions are previous and current data.
- * Often its the difference that is printed.
- * The pointers are swaped i.e. current becomes the previous
- * and the previous over written rather than moving data around.
+void enc_push_name(char *col)
+{
+	fmt_str(push_path);
+	fmt_str(".");
+	fmt_need(strlen(col) * 5 + 1);
+	fmt.data[fmt.len] = 0;
+	prom_name(&fmt.data[fmt.len], strlen(col) * 5 + 1, col);
+	fmt.len += strlen(&fmt.data[fmt.len]);
+}
+
+void enc_graphite_num(char *col, double v, int prec)
+{
+	if(!isfinite(v))
+		return;
+	enc_push_name(col);
+	fmt_str(" ");
+	fmt_num(v, prec);
+	fmt_str(" ");
+	fmt_num(timer, 0);
+	fmt_str("\n");
+}
+
+void enc_statsd_num(char *col, double v, int prec)
+{
+	if(!isfinite(v))
+		return;
+	if(v < 0) {	/* a signed gauge is a change, so from 0 */
+		enc_push_name(col);
+		fmt_str(":0|g\n");
+	}
+	enc_push_name(col);
+	fmt_str(":");
+	fmt_num(v, prec);
+	fmt_str("|g\n");
+}
+
+void enc_push_text(char *col, char *s)
+{
+}
+
+void enc_push_none(char *col, char *csv)
+{
+}
+
+void enc_push_end()
+{
+}
+
+/* Not one of -O either, -Q picks one */
+struct encoder enc_graphite = { "graphite", enc_push_begin, enc_push_key, enc_graphite_num, enc_push_text, enc_push_none, enc_push_end };
+struct encoder enc_statsd = { "statsd", enc_push_begin, enc_push_key, enc_statsd_num, enc_push_text, enc_push_none, enc_push_end };
+
+/* -Y: the snapshot as the table in shared memory elmon_shm.h describes.
+ * The entries go straight into the buffer the readers are not on and
+ * shm_publish() points them at it when the snapshot is complete.
  */
-struct cpu_stat {
-	long long user;
-	long long sys;
-	long long wait; 
-	long long idle;
-	long long irq;
-	long long softirq;
-	long long steal;
-	long long nice;
-	long long intr;
-	long long ctxt;
-	long long btime;
-	long long procs;
-	long long running;
-	long long blocked;
-	float uptime;
-	float idletime;
-	float mins1;
-	float mins5;
-	float mins15;
-};
+char	*shm_name = NULL;	/* -Y */
+struct elmon_shm *shm_segment = NULL;
+struct elmon_shm_buffer *shm_writing = NULL;	/* between the first record and shm_publish() */
+char	shm_section[ELMON_SHM_SECTION];
+char	shm_key[ELMON_SHM_KEY];
 
-#define ulong unsigned long
-struct dsk_stat {	
-	char	dk_name[32];
-	int	dk_major;
-	int	dk_minor;
-	long	dk_noinfo;
-	ulong	dk_reads;
-	ulong	dk_rmerge;
-	ulong	dk_rmsec;
-	ulong	dk_rkb;
-	ulong	dk_writes;
-	ulong	dk_wmerge;
-	ulong	dk_wmsec;
-	ulong	dk_wkb;
-	ulong	dk_xfers;
-	ulong	dk_bsize;
-	ulong	dk_time;
-	ulong	dk_inflight;
-	ulong	dk_11;
-	ulong	dk_partition;
-	ulong	dk_blocks; /* in /proc/partitions only */
-	ulong	dk_use;
-	ulong	dk_aveq;
-};
+void enc_shm_begin(char *section, char *rrd)
+{
+uint64_t seq;
+
+	if(shm_writing == NULL) {
+		shm_writing = &shm_segment->buffer[!shm_segment->latest];
+		seq = shm_writing->seq;
+		seq += (seq & 1) ? 2 : 1;	/* odd, also after an elmon that stopped half way */
+		__atomic_store_n(&shm_writing->seq, seq, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		shm_writing->count = 0;
+		shm_writing->truncated = 0;
+	}
+	snprintf(shm_section, sizeof(shm_section), "%s", section);
+	shm_key[0] = 0;
+}
 
-struct mem_stat {
-	long memtotal;
-	long memfree;
-	long memshared;
-	long buffers;
-	long cached;
-	long swapcached;
-	long active;
-	long inactive;
-	long hightotal;
-	long highfree;
-	long lowtotal;
-	long lowfree;
-	long swaptotal;
-	long swapfree;
-#ifdef LARGEMEM
-	long dirty;
-	long writeback;
-	long mapped;
-	long slab;
-	long committed_as;
-	long pagetables;
-	long hugetotal;
-	long hugefree;
-	long hugesize;
-#else
-	long bigfree;
-#endif /*LARGEMEM*/
-};
+void enc_shm_key(char *col, char *s)
+{
+int n = strlen(shm_key);
 
-struct vm_stat {
-long long nr_dirty;
-long long nr_writeback;
-long long nr_unstable;
-long long nr_page_table_pages;
-long long nr_mapped;
-long long nr_slab;
-long long pgpgin;
-long long pgpgout;
-long long pswpin;
-long long pswpout;
-long long pgalloc_high;
-long long pgalloc_normal;
-long long pgalloc_dma;
-long long pgfree;
-long long pgactivate;
-long long pgdeactivate;
-long long pgfault;
-long long pgmajfault;
-long long pgrefill_high;
-long long pgrefill_normal;
-long long pgrefill_dma;
-long long pgsteal_high;
-long long pgsteal_normal;
-long long pgsteal_dma;
-long long pgscan_kswapd_high;
-long long pgscan_kswapd_normal;
-long long pgscan_kswapd_dma;
-long long pgscan_direct_high;
-long long pgscan_direct_normal;
-long long pgscan_direct_dma;
-long long pginodesteal;
-long long slabs_scanned;
-long long kswapd_steal;
-long long kswapd_inodesteal;
-long long pageoutrun;
-long long allocstall;
-long long pgrotated;
-};
+	snprintf(&shm_key[n], sizeof(shm_key) - n, "%s%s", n ? "," : "", s);
+}
 
+struct elmon_shm_entry *enc_shm_entry(char *col)
+{
+struct elmon_shm_entry *e;
 
+	if(shm_writing->count == ELMON_SHM_ENTRIES) {
+		shm_writing->truncated++;
+		return NULL;
+	}
+	e = &shm_writing->entry[shm_writing->count++];
+	memcpy(e->section, shm_section, sizeof(e->section));
+	memcpy(e->key, shm_key, sizeof(e->key));
+	snprintf(e->column, sizeof(e->column), "%s", col);
+	e->text[0] = 0;
+	return e;
+}
 
-char *nfs_v2_names[18] = {
-	"null", "getattr", "setattr", "root", "lookup", "readlink",
-	"read", "wrcache", "write", "create", "remove", "rename",
-	"link", "symlink", "mkdir", "rmdir", "readdir", "fsstat"};
+void enc_shm_num(char *col, double v, int prec)
+{
+struct elmon_shm_entry *e;
 
-char *nfs_v3_names[22] ={
-	 "null", "getattr", "setattr", "lookup", "access", "readlink",
-	 "read", "write", "create", "mkdir", "symlink", "mknod", 
-	 "remove", "rmdir", "rename", "link", "readdir", "readdirplus",
-	 "fsstat", "fsinfo", "pathconf", "commit"};
+	if((e = enc_shm_entry(col)) != NULL)
+		e->value = v;
+}
 
-struct nfs_stat {
-	long v2c[18];	/* verison2 client */
-	long v3c[22];	/* verison3 client */
-	long v2s[18];	/* verison2 server */
-	long v3s[22];	/* verison3 server */
-};
+void enc_shm_text(char *col, char *s)
+{
+struct elmon_shm_entry *e;
 
-#define NETMAX 32
-struct net_stat {
-	unsigned long if_name[17];
-	unsigned long long if_ibytes;
-	unsigned long long if_obytes;
-	unsigned long long if_ipackets;
-	unsigned long long if_opackets;
-	unsigned long if_ierrs;
-	unsigned long if_oerrs;
-	unsigned long if_idrop;   
-	unsigned long if_ififo;   
-	unsigned long if_iframe;   
-	unsigned long if_odrop;   
-	unsigned long if_ofifo;   
-	unsigned long if_ocarrier;   
-	unsigned long if_ocolls;   
-} ;
-#ifdef PARTITIONS
-#define PARTMAX 256
-struct part_stat {
-	int part_major;
-	int part_minor;
-	unsigned long part_blocks;
-	char part_name[16];
-	unsigned long part_rio;
-	unsigned long part_rmerge;
-	unsigned long part_rsect;
-	unsigned long part_ruse;
-	unsigned long part_wio;
-	unsigned long part_wmerge;
-	unsigned long part_wsect;
-	unsigned long part_wuse;
-	unsigned long part_run;
-	unsigned long part_use;
-	unsigned long part_aveq;
-};
-#endif /*PARTITIONS*/
+	if(*col != 0 && (e = enc_shm_entry(col)) != NULL) {
+		e->value = NAN;
+		snprintf(e->text, sizeof(e->text), "%s", s);
+	}
+}
 
+void enc_shm_none(char *col, char *csv)
+{
+struct elmon_shm_entry *e;
 
-#ifdef POWER
+	if((e = enc_shm_entry(col)) != NULL)
+		e->value = NAN;
+}
 
-int lparcfg_reread=1;
+void enc_shm_end()
+{
+}
 
-struct {
-char version_string[16];		/*lparcfg 1.3 */
-int version;
-char serial_number[16];			/*HAL,0210033EA*/
-char system_type[16];			/*HAL,9124-720*/
-int  partition_id;			/*11*/
-/* 
-R4=0x14
-R5=0x0
-R6=0x800b0000
-R7=0x1000000040004
-*/
-int BoundThrds;				/*=1*/
-int CapInc;				/*=1*/
-long long DisWheRotPer;			/*=2070000*/
-int MinEntCap;				/*=10*/
-int MinEntCapPerVP;			/*=10*/
-int MinMem;				/*=2048*/
-int DesMem;				/*=4096*/
-int MinProcs;				/*=1*/
-int partition_max_entitled_capacity;	/*=400*/
-int system_potential_processors;	/*=4*/
-		/**/
-int partition_entitled_capacity;	/*=20*/
-int system_active_processors;		/*=4*/
-int pool_capacity;			/*=4*/
-int unallocated_capacity_weight;	/*=0*/
-int capacity_weight;			/*=0*/
-int capped;				/*=1*/
-int unallocated_capacity;		/*=0*/
-long long pool_idle_time;		/*=0*/
-long long pool_idle_saved;
-long long pool_idle_diff;
-int pool_num_procs;			/*=0*/
-long long purr;				/*=0*/
-long long purr_saved;
-long long purr_diff;
-long long timebase;
-int partition_active_processors;	/*=1*/
-int partition_potential_processors;	/*=40*/
-int shared_processor_mode;		/*=1*/
-} lparcfg;
+struct encoder enc_shm = { "shm", enc_shm_begin, enc_shm_key, enc_shm_num, enc_shm_text, enc_shm_none, enc_shm_end };
 
-int lpar_count=0;
+/* Make or take over the segment now, so a mistake is reported before
+ * elmon goes into the background
+ */
+void shm_create()
+{
+struct stat st;
+void *m;
+int fd;
+
+	if((fd = shm_open(shm_name, O_RDWR | O_CREAT, 0644)) == -1
+	|| flock(fd, LOCK_EX | LOCK_NB) == -1
+	|| fstat(fd, &st) == -1
+	|| (st.st_size != sizeof(struct elmon_shm) && ftruncate(fd, sizeof(struct elmon_shm)) == -1)
+	|| (m = mmap(NULL, sizeof(struct elmon_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("elmon: -Y failed to set up the shared memory");
+		printf("elmon: shared memory name=%s\n", shm_name);
+		exit(49);
+	}
+	/* the lock is held while elmon runs, so the descriptor stays open */
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	shm_segment = m;
+	if(shm_segment->magic != ELMON_SHM_MAGIC || shm_segment->version != ELMON_SHM_VERSION) {
+		memset(shm_segment, 0, sizeof(struct elmon_shm));
+		shm_segment->version = ELMON_SHM_VERSION;
+		__atomic_store_n(&shm_segment->magic, ELMON_SHM_MAGIC, __ATOMIC_RELEASE);
+	}
+	shm_segment->interval_ms = seconds * 100;	/* seconds is in tenths */
+}
 
-#define LPAR_LINE_MAX   50
-#define LPAR_LINE_WIDTH 80
-char lpar_buffer[LPAR_LINE_MAX][LPAR_LINE_WIDTH];
+/* End of a snapshot, the readers get the buffer just written */
+void shm_publish()
+{
+	if(shm_writing == NULL)
+		return;
+	shm_segment->pid = getpid();	/* after going into the background */
+	shm_writing->snapshot = loop;
+	shm_writing->time = timer;
+	__atomic_store_n(&shm_writing->seq, shm_writing->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&shm_segment->latest, shm_writing - shm_segment->buffer, __ATOMIC_RELEASE);
+	shm_writing = NULL;
+}
 
-int lpar_sanity=55;
+/* -R: each section with an rrd file keeps a round robin archive instead,
+ * <file>.rra in place of <file>.rrd.  The archive is made at its full
+ * size and mapped, and an update writes one row of each tier in place.
+ * That is a few stores per value, and the disk used never grows.  A row
+ * holds the average and the maximum of the snapshots in its step, plus
+ * the time the step began and per column how many snapshots had a value
+ * for it, so one without (an nmon blank) does not pull the average down.  That time says whether the row is from this
+ * time round, so a gap needs nothing done.  elmon --rra-dump prints an
+ * archive as CSV.
+ */
+#define RRA_MAGIC	"ELMONRRA"
+#define RRA_VERSION	2
+#define RRA_TIERS	8
+#define RRA_COLS	256	/* a record with more keeps the first ones */
+#define RRA_NAME	32
+#define RRA_ROWS	(10 * 1000 * 1000)	/* in a tier at most */
+#define RRA_ROW(cols)	((1 + 3 * (cols)) * 8)	/* start, averages, maximums, counts */
+
+struct rra_tier {
+	int64_t	step;		/* seconds a row covers */
+	int64_t	rows;
+	int64_t	offset;		/* of its first row in the file */
+};
 
-char *locate(char *s)
+struct rra_head {
+	char	magic[8];
+	int32_t	version;
+	int32_t	columns;
+	int32_t	tiers;
+	int32_t	unused;
+	int64_t	last;		/* time of the last update */
+	struct rra_tier tier[RRA_TIERS];
+	/* then the column names, RRA_NAME bytes each, and the rows of each tier */
+};
+
+struct rra_file {
+	char	*name;
+	struct rra_head *head;	/* NULL until it is mapped */
+	size_t	size;
+	struct rra_file *next;
+};
+
+char	*rra_spec = "1m:1d,5m:1w,1h:1y";	/* -A */
+int	rra_tiers;
+int64_t	rra_step[RRA_TIERS];
+int64_t	rra_rows[RRA_TIERS];
+struct rra_file *rra_files = NULL;
+struct rra_file *rra_cur;	/* of the record */
+int	rra_cols;
+char	rra_name[RRA_COLS][RRA_NAME];
+double	rra_value[RRA_COLS];
+
+/* 90, 90s, 5m, 2h, 1d, 1w or 1y in seconds, -1 if it is none of those */
+int64_t rra_seconds(char *s, char **end)
+{
+int64_t n;
+
+	n = strtoll(s, end, 10);
+	switch(**end) {
+	case 's': (*end)++; break;
+	case 'm': n *= 60; (*end)++; break;
+	case 'h': n *= 3600; (*end)++; break;
+	case 'd': n *= 86400; (*end)++; break;
+	case 'w': n *= 7 * 86400; (*end)++; break;
+	case 'y': n *= 365 * 86400; (*end)++; break;
+	}
+	return n > 0 ? n : -1;
+}
+
+/* -A step:keep,...  so 1m:1d is a day of one minute rows */
+int rra_parse(char *spec)
+{
+char *s = spec;
+int64_t step;
+int64_t keep;
+
+	for(rra_tiers = 0; rra_tiers < RRA_TIERS; ) {
+		if((step = rra_seconds(s, &s)) < 0 || *s++ != ':'
+		|| (keep = rra_seconds(s, &s)) < step || keep / step > RRA_ROWS)
+			return -1;
+		rra_step[rra_tiers] = step;
+		rra_rows[rra_tiers++] = keep / step;
+		if(*s == 0)
+			return 0;
+		if(*s++ != ',')
+			return -1;
+	}
+	return -1;
+}
+
+/* The file size for cols columns and where each tier starts */
+size_t rra_size(int cols, int64_t *offset)
 {
+size_t size;
 int i;
-int len;
-	len=strlen(s);
-	for(i=0;i<lpar_count;i++)
-		if( !strncmp(s,lpar_buffer[i],len))
-			return lpar_buffer[i];
-	return "";
+
+	size = sizeof(struct rra_head) + cols * RRA_NAME;
+	for(i = 0; i < rra_tiers; i++) {
+		offset[i] = size;
+		size += rra_rows[i] * RRA_ROW(cols);
+	}
+	return size;
 }
 
-#define NUMBER_NOT_VALID -999
+/* Whether the mapped archive has the record's columns and -A's tiers */
+int rra_same(struct rra_head *h)
+{
+int i;
 
-long long read_longlong(char *s)
+	if(memcmp(h->magic, RRA_MAGIC, 8) != 0 || h->version != RRA_VERSION
+	|| h->columns != rra_cols || h->tiers != rra_tiers)
+		return 0;
+	for(i = 0; i < rra_tiers; i++)
+		if(h->tier[i].step != rra_step[i] || h->tier[i].rows != rra_rows[i])
+			return 0;
+	return memcmp(h + 1, rra_name, rra_cols * RRA_NAME) == 0;
+}
+
+/* Map the archive of f for the record.  One made for other columns or
+ * tiers is kept as <file>.old and a new one started.
+ */
+void rra_map(struct rra_file *f)
 {
-long long x;
-int ret;
-int len;
+struct rra_head *h;
+struct stat st;
+int64_t offset[RRA_TIERS];
+char old[1024];
+size_t size;
+void *m;
+int fd;
 int i;
-char *str;
-	str = locate(s);
-	len=strlen(str);
-	if(len == 0) {
-		return NUMBER_NOT_VALID;
+
+	if(f->head != NULL) {
+		munmap(f->head, f->size);
+		f->head = NULL;
 	}
-	for(i=0;i<len;i++) {
-		if(str[i] == '=') {
-			ret = sscanf(&str[i+1], "%lld", &x);
-			if(ret != 1) {
-				fprintf(stderr,"sscanf for %s failed returned = %d line=%s\n", s, ret, str);
-				return -1;
-			}
-			return x;
+	size = rra_size(rra_cols, offset);
+	if((fd = open(f->name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+		return;
+	if(fstat(fd, &st) == -1)
+		st.st_size = 0;
+	if(st.st_size == size
+	&& (m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+		if(rra_same(m)) {
+			close(fd);
+			f->head = m;
+			f->size = size;
+			return;
 		}
+		munmap(m, size);
 	}
-	fprintf(stderr,"read_long_long failed returned line=%s\n", str);
-	return -2;
+	if(st.st_size > 0) {
+		snprintf(old, sizeof(old), "%s.old", f->name);
+		rename(f->name, old);
+		close(fd);
+		if((fd = open(f->name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+			return;
+	}
+	/* all the blocks now, so a full disk is not a SIGBUS later */
+	if(ftruncate(fd, size) == -1 || posix_fallocate(fd, 0, size) != 0
+	|| (m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		unlink(f->name);
+		return;
+	}
+	close(fd);
+	h = m;
+	h->version = RRA_VERSION;
+	h->columns = rra_cols;
+	h->tiers = rra_tiers;
+	for(i = 0; i < rra_tiers; i++) {
+		h->tier[i].step = rra_step[i];
+		h->tier[i].rows = rra_rows[i];
+		h->tier[i].offset = offset[i];
+	}
+	memcpy(h + 1, rra_name, rra_cols * RRA_NAME);
+	memcpy(h->magic, RRA_MAGIC, 8);
+	f->head = h;
+	f->size = size;
 }
 
+/* The row of tier i for time t */
+int64_t *rra_row(struct rra_head *h, int i, int64_t t)
+{
+	return (int64_t *)((char *)h + h->tier[i].offset
+		+ (t / h->tier[i].step) % h->tier[i].rows * RRA_ROW(h->columns));
+}
 
-int proc_lparcfg()
+void rra_update(struct rra_head *h)
 {
-static FILE *fp = (FILE *)-1;
-char *str;
-	if( fp == (FILE *)-1) {
-           if( (fp = fopen("/proc/ppc64/lparcfg","r")) == NULL) {
-		error("failed to open - /proc/ppc64/lparcfg");
-		fp = (FILE *)-1;
-		return 0;
-	   }
+int64_t *row;
+int64_t *n;
+int64_t start;
+double *avg;
+double *max;
+double v;
+int i;
+int j;
+
+	for(i = 0; i < h->tiers; i++) {
+		start = timer - timer % h->tier[i].step;
+		row = rra_row(h, i, start);
+		avg = (double *)&row[1];
+		max = avg + h->columns;
+		n = (int64_t *)(max + h->columns);
+		if(row[0] != start) {	/* the first snapshot of the step */
+			row[0] = start;
+			for(j = 0; j < h->columns; j++) {
+				avg[j] = max[j] = NAN;
+				n[j] = 0;
+			}
+		}
+		for(j = 0; j < h->columns; j++) {
+			if(!isfinite(v = rra_value[j]))
+				continue;
+			if(n[j]++ == 0) {
+				avg[j] = max[j] = v;
+			} else {
+				avg[j] += (v - avg[j]) / n[j];
+				if(v > max[j])
+					max[j] = v;
+			}
+		}
 	}
+	h->last = timer;
+}
 
-	for(lpar_count=0;lpar_count<LPAR_LINE_MAX-1;lpar_count++) {
-		if(fgets(lpar_buffer[lpar_count],LPAR_LINE_WIDTH-1,fp) == NULL)
-			break; 
+void enc_rra_begin(char *section, char *rrd)
+{
+char name[1024];
+int n;
+
+	rra_cur = NULL;
+	rra_cols = 0;
+	if(rrd == NULL) {
+		enc_skip = 1;
+		return;
 	}
-	if(lparcfg_reread) {
-		fclose(fp);
-		fp = (FILE *)-1;
-	} else rewind(fp);
+	n = strlen(rrd);
+	if(n > 4 && strcmp(&rrd[n - 4], ".rrd") == 0)
+		n -= 4;
+	snprintf(name, sizeof(name), "%.*s.rra", n, rrd);
+	for(rra_cur = rra_files; rra_cur != NULL; rra_cur = rra_cur->next)
+		if(strcmp(rra_cur->name, name) == 0)
+			return;
+	rra_cur = MALLOC(sizeof(struct rra_file));
+	memset(rra_cur, 0, sizeof(struct rra_file));
+	rra_cur->name = MALLOC(strlen(name) + 1);
+	strcpy(rra_cur->name, name);
+	rra_cur->next = rra_files;
+	rra_files = rra_cur;
+}
 
-	str=locate("lparcfg");  	sscanf(str, "lparcfg %s", lparcfg.version_string);
-	str=locate("serial_number");	sscanf(str, "serial_number=%s", lparcfg.serial_number);
-	str=locate("system_type");	sscanf(str, "system_type=%s", lparcfg.system_type);
+void enc_rra_key(char *col, char *s)
+{
+}
 
-#define GETDATA(variable) lparcfg.variable = read_longlong( __STRING(variable) );
+void enc_rra_num(char *col, double v, int prec)
+{
+	if(rra_cols == RRA_COLS)
+		return;
+	strncpy(rra_name[rra_cols], col, RRA_NAME);
+	rra_value[rra_cols++] = v;
+}
 
-	GETDATA(partition_id);
-	GETDATA(BoundThrds);
-	GETDATA(CapInc);
-	GETDATA(DisWheRotPer);
-	GETDATA(MinEntCap);
-	GETDATA(MinEntCapPerVP);
-	GETDATA(MinMem);
-	GETDATA(DesMem);
-	GETDATA(MinProcs);
-	GETDATA(partition_max_entitled_capacity);
-	GETDATA(system_potential_processors);
-	GETDATA(partition_entitled_capacity);
-	GETDATA(system_active_processors);
-	GETDATA(pool_capacity);
-	GETDATA(unallocated_capacity_weight);
-	GETDATA(capacity_weight);
-	GETDATA(capped);
-	GETDATA(unallocated_capacity);
-	lparcfg.pool_idle_saved = lparcfg.pool_idle_time;
-	GETDATA(pool_idle_time);
-	lparcfg.pool_idle_diff = lparcfg.pool_idle_time - lparcfg.pool_idle_saved;
-	GETDATA(pool_num_procs);
-	lparcfg.purr_saved = lparcfg.purr;
-	GETDATA(purr);
-	lparcfg.purr_diff = lparcfg.purr - lparcfg.purr_saved;
-	GETDATA(partition_active_processors);
-	GETDATA(partition_potential_processors);
-	GETDATA(shared_processor_mode);
-	return 1;
+void enc_rra_text(char *col, char *s)
+{
 }
-#endif /*POWER*/
 
+void enc_rra_none(char *col, char *csv)
+{
+	enc_rra_num(col, NAN, 0);
+}
 
-#define DISKMIN 256
-#define DISKMAX diskmax
-int diskmax = DISKMIN;
+void enc_rra_end()
+{
+	if(rra_cols == 0)
+		return;
+	if(rra_cur->head == NULL || !rra_same(rra_cur->head))
+		rra_map(rra_cur);
+	if(rra_cur->head != NULL)
+		rra_update(rra_cur->head);
+}
 
-#define CPUMAX 128
+/* Not one of -O, -R picks it */
+struct encoder enc_rra = { "rra", enc_rra_begin, enc_rra_key, enc_rra_num, enc_rra_text, enc_rra_none, enc_rra_end };
 
-struct data {
-	struct dsk_stat *dk;
-	struct cpu_stat cpu_total;
-	struct cpu_stat cpuN[CPUMAX];
-	struct mem_stat mem;
-	struct vm_stat vm;
-	struct nfs_stat nfs;
-	struct net_stat ifnets[NETMAX];
-#ifdef PARTITIONS
-	struct part_stat parts[PARTMAX];
-#endif /*PARTITIONS*/
+/* elmon --rra-dump <file> [step]: the rows of each tier, or of the one
+ * with that step, oldest first as CSV
+ */
+void rra_dump(char *file, char *step)
+{
+struct rra_head *h;
+struct stat st;
+char *names;
+char *end;
+int64_t want = 0;
+int64_t last;
+int64_t t;
+int64_t *row;
+double *v;
+void *m;
+int fd;
+int i;
+int j;
 
-	struct timeval tv;
-	double time;
-	struct procsinfo *procs;
+	if(step != NULL && (want = rra_seconds(step, &end)) < 0) {
+		printf("elmon: --rra-dump needs a step like 5m\n");
+		exit(48);
+	}
+	if((fd = open(file, O_RDONLY)) == -1 || fstat(fd, &st) == -1
+	|| st.st_size < sizeof(struct rra_head)
+	|| (m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("elmon: failed to read the archive");
+		printf("elmon: archive=%s\n", file);
+		exit(47);
+	}
+	h = m;
+	if(memcmp(h->magic, RRA_MAGIC, 8) != 0 || h->version != RRA_VERSION
+	|| h->columns < 1 || h->columns > RRA_COLS || h->tiers < 1 || h->tiers > RRA_TIERS
+	|| h->tier[h->tiers - 1].offset + h->tier[h->tiers - 1].rows * RRA_ROW(h->columns) > st.st_size) {
+		printf("elmon: %s is not an archive of this elmon\n", file);
+		exit(47);
+	}
+	names = (char *)(h + 1);
+	for(i = 0; i < h->tiers; i++) {
+		if(want != 0 && h->tier[i].step != want)
+			continue;
+		printf("# %s %llds rows, %lld of them\n", file,
+			(long long)h->tier[i].step, (long long)h->tier[i].rows);
+		printf("time");
+		for(j = 0; j < h->columns; j++)
+			printf(",%.*s avg", RRA_NAME, &names[j * RRA_NAME]);
+		for(j = 0; j < h->columns; j++)
+			printf(",%.*s max", RRA_NAME, &names[j * RRA_NAME]);
+		printf("\n");
+		last = h->last - h->last % h->tier[i].step;
+		for(t = last - (h->tier[i].rows - 1) * h->tier[i].step; t <= last; t += h->tier[i].step) {
+			if(t <= 0 || (row = rra_row(h, i, t))[0] != t)
+				continue;
+			printf("%lld", (long long)t);
+			for(j = 0, v = (double *)&row[1]; j < 2 * h->columns; j++)
+				if(isnan(v[j]))
+					printf(",");
+				else
+					printf(",%.3f", v[j]);
+			printf("\n");
+		}
+	}
+	munmap(m, st.st_size);
+	close(fd);
+}
 
-	int    nprocs;
-} database[2], *p, *q;
+#define ENC_CSV		0
+#define ENC_RRD		1
+#define ENC_JSON	2
+#define ENC_INFLUX	3
+struct encoder encoders[] = {
+	{ "csv",    enc_csv_begin,    enc_csv_key,    enc_csv_num,    enc_csv_text,    enc_csv_none,    enc_csv_end },
+	{ "rrd",    enc_rrd_begin,    enc_rrd_key,    enc_rrd_num,    enc_rrd_text,    enc_rrd_none,    enc_rrd_end },
+	{ "json",   enc_json_begin,   enc_json_key,   enc_json_num,   enc_json_text,   enc_json_none,   enc_json_end },
+	{ "influx", enc_influx_begin, enc_influx_key, enc_influx_num, enc_influx_text, enc_influx_none, enc_influx_end },
+	{ NULL }
+};
+struct encoder *enc = &encoders[ENC_CSV];
+struct encoder *enc_tee = NULL;	/* -u keeps the table -Y has too */
+
+/* -a: sample every -a seconds but write every -s.  Each value written is
+ * the average of the samples in the interval, and each section without a
+ * key gets three more records, <SECTION>MIN, <SECTION>MAX and
+ * <SECTION>P95.  A series keeps a count, sum, minimum and maximum and the
+ * five P-squared markers (Jain and Chlamtac) for the percentile, so the
+ * memory is the same however many samples there are.
+ */
+#define ROLL_SERIES	16384	/* more than this are written as sampled */
+#define ROLL_NAME	168
+#define ROLL_COLS	512	/* of a record that get MIN, MAX and P95 */
+#define ROLL_HEADED	4096
+#define ROLL_P		0.95
+#define ROLL_TEXT	-1	/* roll_col.slot of enc_text() */
+#define ROLL_NONE	-2	/* and of enc_none() */
+
+struct roll {
+	char	name[ROLL_NAME];	/* section, key and column */
+	long	n;
+	double	sum;
+	double	min;
+	double	max;
+	double	q[5];		/* marker heights, until there are five the samples sorted */
+	double	pos[5];		/* marker positions */
+	double	want[5];	/* where they should be */
+};
 
+struct roll_col {
+	char	col[64];
+	char	csv[16];	/* for ROLL_NONE */
+	int	slot;
+	int	prec;
+};
 
-long long read_vmline(FILE *fp, char  *s)
+int	roll_base = 0;		/* -a in tenths of a second, 0 = sample every -s */
+int	roll_every = 1;		/* samples to a snapshot written */
+int	roll_tick = 1;		/* this sample is written */
+int	roll_on = 0;		/* the record being written is rolled up */
+int	roll_once = 0;		/* out_next(): its records are written once a snapshot as they are */
+struct roll *roll_pool = NULL;
+int	roll_used;
+int	roll_hash[ROLL_SERIES * 2];	/* roll_pool slots, -1 if free */
+char	roll_section[32];
+char	roll_key[64];
+struct roll_col roll_cols[ROLL_COLS];	/* of the record, when it is written */
+int	roll_ncols;
+char	roll_headed[ROLL_HEADED][32];	/* companion sections with a CSV header line */
+int	roll_nheaded;
+
+/* Start the next interval afresh, which also forgets processes that ended */
+void roll_reset()
 {
-char buffer[4096];
-int len;
- int ret;
-long long var;
+	if(roll_pool == NULL)
+		return;
+	memset(roll_hash, -1, sizeof(roll_hash));
+	roll_used = 0;
+}
 
-	if(fgets(buffer,4096-1,fp) == NULL)
-		return -1;
-	len = strlen(s) +1;
-	var = -1;
-	ret = sscanf(&buffer[len],"%lld", &var);
-	if(ret == 1)
-		return var;
-	else
+/* The series of a column of the record, -1 if there is no room left */
+int roll_find(char *col)
+{
+char name[ROLL_NAME];
+unsigned int h = 5381;
+char *s;
+int i;
+
+	snprintf(name, sizeof(name), "%s\t%s\t%.64s", roll_section, roll_key, col);
+	for(s = name; *s != 0; s++)
+		h = h * 33 + (unsigned char)*s;
+	for(i = h % (ROLL_SERIES * 2); roll_hash[i] != -1; i = (i + 1) % (ROLL_SERIES * 2))
+		if(strcmp(roll_pool[roll_hash[i]].name, name) == 0)
+			return roll_hash[i];
+	if(roll_used == ROLL_SERIES)
 		return -1;
+	strcpy(roll_pool[roll_used].name, name);
+	roll_pool[roll_used].n = 0;
+	roll_hash[i] = roll_used;
+	return roll_used++;
 }
 
-#define GETVM(variable) p->vm.variable = read_vmline(fp, __STRING(variable) );
-
-int read_vmstat()
+void roll_add(struct roll *r, double v)
 {
-static FILE *fp = (FILE *)-1;
+static double step[5] = { 0.0, ROLL_P / 2, ROLL_P, (1 + ROLL_P) / 2, 1.0 };
+double d;
+double qp;
+int i;
+int k;
 
-	if( fp == (FILE *)-1) {
-           if( (fp = fopen("/proc/vmstat","r")) == NULL) {
-		error("failed to open - /proc/vmstat");
-		fp = (FILE *)-1;
-		return -1;
-	   }
+	if(!isfinite(v))
+		return;
+	if(r->n == 0) {
+		r->sum = 0.0;
+		r->min = r->max = v;
+	}
+	r->sum += v;
+	if(v < r->min)
+		r->min = v;
+	if(v > r->max)
+		r->max = v;
+	if(r->n < 5) {	/* keep the first five in order */
+		for(i = r->n; i > 0 && r->q[i - 1] > v; i--)
+			r->q[i] = r->q[i - 1];
+		r->q[i] = v;
+		if(++r->n == 5)
+			for(i = 0; i < 5; i++) {
+				r->pos[i] = i + 1;
+				r->want[i] = 1 + 4 * step[i];
+			}
+		return;
+	}
+	r->n++;
+	if(v < r->q[0]) {
+		r->q[0] = v;
+		k = 0;
+	} else if(v >= r->q[4]) {
+		r->q[4] = v;
+		k = 3;
+	} else {
+		for(k = 0; v >= r->q[k + 1]; k++)
+			;
+	}
+	for(i = k + 1; i < 5; i++)
+		r->pos[i]++;
+	for(i = 0; i < 5; i++)
+		r->want[i] += step[i];
+	/* move the middle markers that are a whole position out, on a parabola if that stays in order */
+	for(i = 1; i < 4; i++) {
+		d = r->want[i] - r->pos[i];
+		if((d >= 1.0 && r->pos[i + 1] - r->pos[i] > 1.0) || (d <= -1.0 && r->pos[i - 1] - r->pos[i] < -1.0)) {
+			k = d > 0 ? 1 : -1;
+			qp = r->q[i] + k / (r->pos[i + 1] - r->pos[i - 1])
+				* ((r->pos[i] - r->pos[i - 1] + k) * (r->q[i + 1] - r->q[i]) / (r->pos[i + 1] - r->pos[i])
+				+ (r->pos[i + 1] - r->pos[i] - k) * (r->q[i] - r->q[i - 1]) / (r->pos[i] - r->pos[i - 1]));
+			if(r->q[i - 1] < qp && qp < r->q[i + 1])
+				r->q[i] = qp;
+			else
+				r->q[i] += k * (r->q[i + k] - r->q[i]) / (r->pos[i + k] - r->pos[i]);
+			r->pos[i] += k;
+		}
 	}
-	GETVM(nr_dirty);
-	GETVM(nr_writeback);
-	GETVM(nr_unstable);
-	GETVM(nr_page_table_pages);
-	GETVM(nr_mapped);
-	GETVM(nr_slab);
-	GETVM(pgpgin);
-	GETVM(pgpgout);
-	GETVM(pswpin);
-	GETVM(pswpout);
-	GETVM(pgalloc_high);
-	GETVM(pgalloc_normal);
-	GETVM(pgalloc_dma);
-	GETVM(pgfree);
-	GETVM(pgactivate);
-	GETVM(pgdeactivate);
-	GETVM(pgfault);
-	GETVM(pgmajfault);
-	GETVM(pgrefill_high);
-	GETVM(pgrefill_normal);
-	GETVM(pgrefill_dma);
-	GETVM(pgsteal_high);
-	GETVM(pgsteal_normal);
-	GETVM(pgsteal_dma);
-	GETVM(pgscan_kswapd_high);
-	GETVM(pgscan_kswapd_normal);
-	GETVM(pgscan_kswapd_dma);
-	GETVM(pgscan_direct_high);
-	GETVM(pgscan_direct_normal);
-	GETVM(pgscan_direct_dma);
-	GETVM(pginodesteal);
-	GETVM(slabs_scanned);
-	GETVM(kswapd_steal);
-	GETVM(kswapd_inodesteal);
-	GETVM(pageoutrun);
-	GETVM(allocstall);
-	GETVM(pgrotated);
-	fclose(fp);
-	fp=(FILE *)-1;
-/*
-	rewind(fp);
-*/
-	return 1;
 }
 
+double roll_p95(struct roll *r)
+{
+	return r->n < 5 ? r->max : r->q[2];
+}
 
-/* These macro simplify the access to the Main data structure */
-#define DKDELTA(member) ( (q->dk[i].member > p->dk[i].member) ? 0 : (p->dk[i].member - q->dk[i].member))
-#define SIDELTA(member) ( (q->si.member > p->si.member)       ? 0 : (p->si.member - q->si.member))
+void roll_begin(char *section)
+{
+	snprintf(roll_section, sizeof(roll_section), "%s", section);
+	roll_key[0] = 0;
+	roll_ncols = 0;
+}
 
-#define IFNAME 64
+void roll_key_add(char *s)
+{
+int n = strlen(roll_key);
 
-#define TIMEDELTA(member,index1,index2) ((p->procs[index1].member) - (q->procs[index2].member))
-#define COUNTDELTA(member) ( (q->procs[topper[j].other].member > p->procs[i].member) ? 0 : (p->procs[i].member  - q->procs[topper[j].other].member) )
+	snprintf(&roll_key[n], sizeof(roll_key) - n, "%s%s", n ? "," : "", s);
+}
 
-#define TIMED(member) ((double)(p->procs[i].member.tv_sec)) 
+/* Note a column of a record being written, for its MIN, MAX and P95 */
+void roll_col(char *col, int slot, int prec, char *csv)
+{
+struct roll_col *c;
 
-double mem_peak = 0;
-double swap_peak = 0;
-double *cpu_peak; /* ptr to array  - 1 for each cpu - 0 = average for machine */
-double *disk_busy_peak;
-double *disk_rate_peak;
-double net_read_peak[NETMAX];
-double net_write_peak[NETMAX];
-int aiorunning;
-int aiorunning_max = 0;
-int aiocount;
-int aiocount_max = 0;
-float aiotime;
-float aiotime_max =0.0;
+	if(!roll_tick || roll_ncols == ROLL_COLS)
+		return;
+	c = &roll_cols[roll_ncols++];
+	snprintf(c->col, sizeof(c->col), "%s", col);
+	snprintf(c->csv, sizeof(c->csv), "%s", csv);
+	c->slot = slot;
+	c->prec = prec;
+}
 
-char *dskgrp(int i)
+/* Add a sample, returns the average so far */
+double roll_num(char *col, double v, int prec)
 {
-static char error_string[] = { "Too-Many-Disks" };
-static char *string[16] = {"",   "1",  "2",  "3", 
-			   "4",  "5",  "6",  "7", 
-			   "8",  "9",  "10", "11", 
-			   "12", "13", "14", "15"};
+struct roll *r;
+int slot;
 
-	i = (int)((float)i/(float)disks_per_line);
-	if(0 <= i && i <= 15 ) 
-		return string[i];
-	return error_string;
+	if((slot = roll_find(col)) == -1) {
+		roll_col(col, ROLL_NONE, prec, "");
+		return v;
+	}
+	r = &roll_pool[slot];
+	roll_add(r, v);
+	roll_col(col, slot, prec, "");
+	return r->n > 0 ? r->sum / r->n : v;
 }
 
-/* command checking against a list */
+/* The CSV header line of a companion section the first time it is written */
+void roll_heading(char *section, char *what)
+{
+int i;
 
-#define CMDMAX 64
+	for(i = 0; i < roll_nheaded; i++)
+		if(strcmp(roll_headed[i], section) == 0)
+			return;
+	if(roll_nheaded == ROLL_HEADED)
+		return;
+	snprintf(roll_headed[roll_nheaded++], sizeof(roll_headed[0]), "%s", section);
+	fmt_str(section);
+	fmt_str(",");
+	fmt_str(roll_section);
+	fmt_str(" ");
+	fmt_str(what);
+	fmt_str(" of the samples ");
+	fmt_str(run_name);
+	for(i = 0; i < roll_ncols; i++) {
+		fmt_str(",");
+		fmt_str(roll_cols[i].col);
+	}
+	fmt_str("\n");
+}
 
-char *cmdlist[CMDMAX];
-int cmdfound = 0;
+/* After a record without a key is written, its MIN, MAX and P95 */
+void roll_end()
+{
+static char *stat[3] = { "MIN", "MAX", "P95" };
+static char *what[3] = { "minimum", "maximum", "95th percentile" };
+char section[40];
+struct roll_col *c;
+struct roll *r;
+double v;
+int i;
+int j;
 
-int cmdcheck(char *cmd)
+	for(i = 0; i < 3; i++) {
+		snprintf(section, sizeof(section), "%s%s", roll_section, stat[i]);
+		if(enc == &encoders[ENC_CSV] && show_headings)
+			roll_heading(section, what[i]);
+		enc_start = fmt.len;
+		enc_skip = 0;
+		enc_cols = 0;
+		enc->begin(section, NULL);
+		for(j = 0; j < roll_ncols && !enc_skip; j++) {
+			c = &roll_cols[j];
+			if(c->slot == ROLL_TEXT) {
+				enc->text(c->col, "");
+			} else if(c->slot == ROLL_NONE) {
+				enc->none(c->col, c->csv);
+			} else {
+				r = &roll_pool[c->slot];
+				v = r->n == 0 ? NAN : i == 0 ? r->min : i == 1 ? r->max : roll_p95(r);
+				enc->num(c->col, v, c->prec);
+			}
+		}
+		if(!enc_skip)
+			enc->end();
+		else
+			fmt.len = enc_start;
+	}
+}
+
+void enc_begin(char *section, char *rrd)
 {
-	int i;
-#ifdef CMDDEBUG
-	fprintf(stderr,"cmdfound=%d\n",cmdfound);
-	for(i=0;i<cmdfound;i++)
-		fprintf(stderr,"cmdlist[%d]=\"%s\"\n",i,cmdlist[i]);
-#endif /* CMDDEBUG */
-	for(i=0;i<cmdfound;i++) {
-		if(strlen(cmdlist[i]) == 0)
-			continue;
-		if( !strncmp(cmdlist[i],cmd,strlen(cmdlist[i])) )
-			return 1;
+	enc_start = fmt.len;
+	enc_skip = 0;
+	enc_cols = 0;
+	roll_on = (roll_every > 1 && !roll_once);
+	if(roll_on) {
+		roll_begin(section);
+		if(!roll_tick) {	/* a sample only */
+			enc_skip = 1;
+			return;
+		}
 	}
-	return 0;
+	enc->begin(section, rrd);
+	if(enc_tee != NULL)
+		enc_tee->begin(section, rrd);
 }
 
-/* Convert secs + micro secs to a double */
-double	doubletime(void)
+void enc_key(char *col, char *s)
 {
+	if(roll_on)
+		roll_key_add(s);
+	if(!enc_skip)
+		enc->key(col, s);
+	if(enc_tee != NULL)
+		enc_tee->key(col, s);
+}
 
-	gettimeofday(&p->tv, 0);
-	return((double)p->tv.tv_sec + p->tv.tv_usec * 1.0e-6);
+void enc_num(char *col, double v, int prec)
+{
+	if(roll_on)
+		v = roll_num(col, v, prec);
+	if(!enc_skip)
+		enc->num(col, v, prec);
+	if(enc_tee != NULL)
+		enc_tee->num(col, v, prec);
 }
 
-int stat8 = 0; /* used to determine the number of variables on a line */
+void enc_text(char *col, char *s)
+{
+	if(roll_on)
+		roll_col(col, ROLL_TEXT, 0, "");
+	if(!enc_skip)
+		enc->text(col, s);
+	if(enc_tee != NULL)
+		enc_tee->text(col, s);
+}
 
-void proc_cpu()
+void enc_none(char *col, char *csv)
 {
-int i;
-static int intr_line = 0;
-static int ctxt_line = 0;
-static int btime_line= 0;
-static int proc_line = 0;
-static int run_line  = 0;
-static int block_line= 0;
-static int proc_cpu_first_time = 1;
-long long user;
-long long nice;
-long long sys;
-long long idle;
-long long iowait;
-long long hardirq;
-long long softirq;
-long long steal;
+	if(roll_on)
+		roll_col(col, ROLL_NONE, 0, csv);
+	if(!enc_skip)
+		enc->none(col, csv);
+	if(enc_tee != NULL)
+		enc_tee->none(col, csv);
+}
 
-	if(proc_cpu_first_time) {
-		stat8 = sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld %lld %lld %lld %lld", 
-			&user,
-			&nice,
-			&sys,
-			&idle,
-			&iowait,
-			&hardirq,
-			&softirq,
-			&steal);
-		proc_cpu_first_time = 0;
-	}
-	user = nice = sys = idle = iowait = hardirq = softirq = steal = 0;
-	if(stat8 == 8) {
-		sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld %lld %lld %lld %lld", 
-			&user,
-			&nice,
-			&sys,
-			&idle,
-			&iowait,
-			&hardirq,
-			&softirq,
-			&steal);
-	} else { /* stat 4 variables here as older Linux proc */
-		sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld", 
-			&user,
-			&nice,
-			&sys,
-			&idle);
-	}
-	p->cpu_total.user = user + nice;
-	p->cpu_total.wait = iowait; /* in the case of 4 variables = 0 */
-	p->cpu_total.sys  = sys;
-	/* p->cpu_total.sys  = sys + hardirq + softirq + steal;*/
-	p->cpu_total.idle = idle;
-	
-	p->cpu_total.irq     = hardirq;
-	p->cpu_total.softirq = softirq;
-	p->cpu_total.steal   = steal;
-	p->cpu_total.nice    = nice;
-#ifdef DEBUG
-	if(debug)fprintf(stderr,"XX user=%lld wait=%lld sys=%lld idle=%lld\n",
-			p->cpu_total.user,
-			p->cpu_total.wait,
-			p->cpu_total.sys,
-			p->cpu_total.idle);
-#endif /*DEBUG*/
+void enc_end()
+{
+	if(!enc_skip)
+		enc->end();
+	if(enc_tee != NULL)
+		enc_tee->end();
+	if(enc_skip)
+		fmt.len = enc_start;
+	if(roll_on && roll_tick && roll_key[0] == 0)
+		roll_end();
+	fmt_flush();
+}
 
-	for(i=0;i<cpus;i++ ) {
-	    user = nice = sys = idle = iowait = hardirq = softirq = steal = 0;
-	    if(stat8 == 8) {
-		sscanf(&proc[P_STAT].line[i+1][5], 
-			"%lld %lld %lld %lld %lld %lld %lld %lld", 
-		&user,
-		&nice,
-		&sys,
-		&idle,
-		&iowait,
-		&hardirq,
-		&softirq,
-		&steal);
-	    } else {
-		sscanf(&proc[P_STAT].line[i+1][5], "%lld %lld %lld %lld", 
-		&user,
-		&nice,
-		&sys,
-		&idle);
-	    }
-		p->cpuN[i].user = user + nice;
-		p->cpuN[i].wait = iowait;
-		p->cpuN[i].sys  = sys;
-		/*p->cpuN[i].sys  = sys + hardirq + softirq + steal;*/
-		p->cpuN[i].idle = idle;
+char *easy[5] = {"not found",0,0,0,0};
+char *lsb_release[5] = {"not found",0,0,0,0};
 
-		p->cpuN[i].irq     = hardirq;
-		p->cpuN[i].softirq = softirq;
-		p->cpuN[i].steal   = steal;
-		p->cpuN[i].nice    = nice;
-	}
+void find_release()
+{
+FILE *pop;
+int i;
+char tmpstr[71];
 
-	if(intr_line == 0) {
-		if(proc[P_STAT].line[i+1][0] == 'p' &&
-		   proc[P_STAT].line[i+1][1] == 'a' &&
-		   proc[P_STAT].line[i+1][2] == 'g' &&
-		   proc[P_STAT].line[i+1][3] == 'e' ) {
-			/* 2.4 kernel */
-			intr_line = i+3;
-			ctxt_line = i+5;
-			btime_line= i+6;
-			proc_line = i+7;
-			run_line  = i+8;
-			block_line= i+9;
-		}else {
-			/* 2.6 kernel */
-			intr_line = i+1;
-			ctxt_line = i+2;
-			btime_line= i+3;
-			proc_line = i+4;
-			run_line  = i+5;
-			block_line= i+6;
+	pop = popen("cat /etc/*ease 2>/dev/null", "r");
+	if(pop != NULL) {
+		tmpstr[0]=0;
+	    	for(i=0;i<4;i++) {
+			if(fgets(tmpstr, 70, pop) == NULL) 
+				break;
+			tmpstr[strlen(tmpstr)-1]=0; /* remove newline */
+			easy[i] = malloc(strlen(tmpstr)+1);
+			strcpy(easy[i],tmpstr);
 		}
+		pclose(pop);
 	}
-	p->cpu_total.intr = -1;
-	p->cpu_total.ctxt = -1;
-	p->cpu_total.btime = -1;
-	p->cpu_total.procs = -1;
-	p->cpu_total.running = -1;
-	p->cpu_total.blocked = -1;
-	if(proc[P_STAT].lines >= intr_line)
-	sscanf(&proc[P_STAT].line[intr_line][0], "intr %lld", &p->cpu_total.intr);
-	if(proc[P_STAT].lines >= ctxt_line)
-	sscanf(&proc[P_STAT].line[ctxt_line][0], "ctxt %lld", &p->cpu_total.ctxt);
-	if(proc[P_STAT].lines >= btime_line)
-	sscanf(&proc[P_STAT].line[btime_line][0], "btime %lld", &p->cpu_total.btime);
-	if(proc[P_STAT].lines >= proc_line)
-	sscanf(&proc[P_STAT].line[proc_line][0], "processes %lld", &p->cpu_total.procs);
-	if(proc[P_STAT].lines >= run_line)
-	sscanf(&proc[P_STAT].line[run_line][0], "procs_running %lld", &p->cpu_total.running);
-	if(proc[P_STAT].lines >= block_line)
-	sscanf(&proc[P_STAT].line[block_line][0], "procs_blocked %lld", &p->cpu_total.blocked);
-}
-
-void proc_nfs()
-{
-int i;
-int j;
-    if(proc[P_NFS].fp != 0) {
-	/* line readers "proc2 18 num num etc" */
-	for(j=0,i=8;i<strlen(proc[P_NFS].line[2]);i++) {
-		if(proc[P_NFS].line[2][i] == ' ') {
-			p->nfs.v2c[j] =atol(&proc[P_NFS].line[2][i+1]);
-			j++;
+	pop = popen("/usr/bin/lsb_release -idrc 2>/dev/null", "r");
+	if(pop != NULL) {
+		tmpstr[0]=0;
+	    	for(i=0;i<4;i++) {
+			if(fgets(tmpstr, 70, pop) == NULL) 
+				break;
+			tmpstr[strlen(tmpstr)-1]=0; /* remove newline */
+			lsb_release[i] = malloc(strlen(tmpstr)+1);
+			strcpy(lsb_release[i],tmpstr);
 		}
+		pclose(pop);
 	}
-	/* line readers "proc3 22 num num etc" */
-	for(j=0,i=8;i<strlen(proc[P_NFS].line[3]);i++) {
-		if(proc[P_NFS].line[3][i] == ' ') {
-			p->nfs.v3c[j] =atol(&proc[P_NFS].line[3][i+1]);
-			j++;
-		}
+}
+
+void helpmenuitem(WINDOW* pad, char *key, char *description, int x, int y, int enabled, int menu_Y, int menu_X){
+	if (!strcmp(key, "space")){
+		keymap[menu_X][menu_Y] = ' '; 
+	} else{
+		keymap[menu_X][menu_Y] = *key; 
 	}
-    }
-	/* line readers "proc2 18 num num etc" */
-    if(proc[P_NFSD].fp != 0) {
-	for(j=0,i=8;i<strlen(proc[P_NFSD].line[7]);i++) {
-		if(proc[P_NFSD].line[2][i] == ' ') {
-			p->nfs.v2s[j] =atol(&proc[P_NFSD].line[2][i+1]);
-			j++;
-		}
+	COLOUR wattrset(pad, COLOR_PAIR(2) | A_BOLD); 
+	mvwprintw(pad, x, y, "%s:", key);
+	if (enabled){
+		COLOUR wattrset(pad, COLOR_PAIR(2)); 
+	} else{
+		COLOUR wattrset(pad, COLOR_PAIR(0)); 
 	}
-	/* line readers "proc3 22 num num etc" */
-	for(j=0,i=8;i<strlen(proc[P_NFSD].line[8]);i++) {
-		if(proc[P_NFS].line[3][i] == ' ') {
-			p->nfs.v3s[j] =atol(&proc[P_NFSD].line[3][i+1]);
-			j++;
-		}
+	if (menu_sX == menu_X && menu_sY == menu_Y){
+                wattron(pad,A_STANDOUT); 
 	}
-    }
+	mvwprintw(pad, x, y + strlen(key) + 2, "%s", description);
+        wattroff(pad,A_STANDOUT); 
+	COLOUR wattrset(pad, COLOR_PAIR(0)); 
 }
 
-void proc_kernel()
-{
-int i;
-	p->cpu_total.uptime=0.0;
-	p->cpu_total.idletime=0.0;
-	p->cpu_total.uptime=atof(proc[P_UPTIME].line[0]);
-	for(i=0;i<strlen(proc[P_UPTIME].line[0]);i++) {
-		if(proc[P_UPTIME].line[0][i] == ' ') {
-			p->cpu_total.idletime=atof(&proc[P_UPTIME].line[0][i+1]);
-			break;
-		}
-	}
-
-        sscanf(&proc[P_LOADAVG].line[0][0], "%f %f %f", 
-		&p->cpu_total.mins1,
-		&p->cpu_total.mins5,
-		&p->cpu_total.mins15);
+void displayhelpmenu(WINDOW* pad){
+			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
+                        #ifdef NCURSES_MOUSE_VERSION
+                        if (mouse){
+                                mvwprintw(pad, 0,0, "  ---Use keys below, arrow keys to select, or mouse to toggle stats on/off---");
+                        }else{
+                                mvwprintw(pad, 0, 0,  "  --- Use keys below or arrow keys to select to toggle statistics on/off ---");
+                        }    
+                        #else
+                                mvwprintw(pad, 0, 0,  "  --- Use keys below or arrow keys to select to toggle statistics on/off ---");
+                        #endif
+			COLOUR wattrset(pad, COLOR_PAIR(0)); 
 
-}
+                        helpmenuitem(pad, "h", "Close Help ", 1, 1, 0, 1, 1 ); 
+                        helpmenuitem(pad, "l", "Long Term CPU Avg ", 1, 15, enabled_option(SHOW_LONGTERM), 1, 2 ); 
+                        helpmenuitem(pad, "m", "Memory/Swap Stats  ", 1, 36, enabled_option(SHOW_MEMORY), 1, 3 ); 
+                        helpmenuitem(pad, "M", "Memory/Swap Graph", 1, 58, enabled_option(SHOW_MEMORY_GRAPH), 1, 4 ); 
 
-char *proc_find_sb(char * p)
-{
-	for(; *p != 0;p++)
-		if(*p == ' ' && *(p+1) == '(')
-			return p;
-	return 0;
-}
+                        helpmenuitem(pad, "V", "Virt Mem   ", 2, 1, enabled_option(SHOW_VM), 2, 1 ); 
+                        helpmenuitem(pad, "n", "Network Stats     ", 2, 15, enabled_option(SHOW_NET), 2, 2 ); 
+                        helpmenuitem(pad, "j", "Filesystem Usage   ", 2, 36, enabled_option(SHOW_JFS), 2, 3 ); 
+                        helpmenuitem(pad, "k", "Kernel/Load Stats", 2, 58, enabled_option(SHOW_KERNEL), 2, 4 );
 
-#define DISK_MODE_IO 1
-#define DISK_MODE_DISKSTATS 2
-#define DISK_MODE_PARTITIONS 3
+                        helpmenuitem(pad, "N", "NFS        ", 3, 1, enabled_option(SHOW_NFS), 3, 1 ); 
+                        helpmenuitem(pad, "o", "Disks %Busy Map    ", 3, 15, enabled_option(SHOW_DISKMAP), 3, 2 ); 
+                        if (show_disk_mode == SHOW_DISK_GRAPH) { 
+                                helpmenuitem(pad, "d", "Disk I/O Graphs     ", 3, 36, 1, 3, 3 ); 
+                        }else{
+                                helpmenuitem(pad, "d", "Disk I/O Graphs     ", 3, 36, 0, 3, 3 ); 
+                        }    
+                        if (show_disk_mode == SHOW_DISK_STATS) { 
+                                helpmenuitem(pad, "D", "Disk I/O Stats   ", 3, 58, 1, 3, 4 ); 
+                        }else{
+                                helpmenuitem(pad, "D", "Disk I/O Stats   ", 3, 58, 0, 3, 4 ); 
+                        }
 
-int disk_mode = 0;
+                        helpmenuitem(pad, "c", "CPU         ", 4, 1, enabled_option(SHOW_SMP), 4, 1 ); 
+                        helpmenuitem(pad, "g", "Disk Groups       ", 4, 15, enabled_option(SHOW_DGROUP), 4, 2 ); 
+                        helpmenuitem(pad, "r", "System Info        ", 4, 36, enabled_option(SHOW_CPU), 4, 3 ); 
+                        helpmenuitem(pad, "v", "Verbose Display  ", 4, 58, enabled_option(SHOW_VERBOSE), 4, 4 ); 
 
-void proc_disk_io(double elapsed)
-{
-int diskline;
-int i;
-int ret;
-char *str;
-int fudged_busy;
+			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
+                        mvwprintw(pad, 5, 0,  "                          --- Top Process Mode ---                                ");
+			COLOUR wattrset(pad, COLOR_PAIR(0)); 
 
-	disks = 0;
-	for(diskline=0;diskline<proc[P_STAT].lines;diskline++) {
-		if(strncmp("disk_io", proc[P_STAT].line[diskline],7) == 0) 
-			break;
-	}
-	for(i=8;i<strlen(proc[P_STAT].line[diskline]);i++) {
-		if( proc[P_STAT].line[diskline][i] == ':')
-			disks++;
-	}
+                        helpmenuitem(pad, "t", "Top Procs  ", 6, 1, enabled_option(SHOW_TOP), 5, 1 ); 
+                        if (show_topmode == 1 && enabled_option(SHOW_TOP)) {
+                                helpmenuitem(pad, "1", "Basic Top Mode    ", 6, 15, 1, 5, 2 ); 
+                        } else{
+                                helpmenuitem(pad, "1", "Basic Top Mode    ", 6, 15, 0, 5, 2 ); 
+                        }    
+                        if (show_topmode == 3 && enabled_option(SHOW_TOP)) {
+                                helpmenuitem(pad, "3", "CPU Top Mode       ", 6, 36, 1, 5, 3 ); 
+                        } else{
+                                helpmenuitem(pad, "3", "CPU Top Mode       ", 6, 36, 0, 5, 3 ); 
+                        }    
+                        helpmenuitem(pad, "u", "Show Command Args", 6, 58, show_args, 5, 4 ); 
 
-	str=&proc[P_STAT].line[diskline][0];
-	for(i=0;i<disks;i++) {
-		str=proc_find_sb(str);
-		if(str == 0)
-			break;
-		ret = sscanf(str, " (%d,%d):(%ld,%ld,%ld,%ld,%ld", 
-			&p->dk[i].dk_major,
-			&p->dk[i].dk_minor,
-			&p->dk[i].dk_noinfo,
-			&p->dk[i].dk_reads,
-			&p->dk[i].dk_rkb,
-			&p->dk[i].dk_writes,
-			&p->dk[i].dk_wkb);
-		if(ret != 7)
-			exit(7);
-		p->dk[i].dk_xfers = p->dk[i].dk_noinfo;
-		/* blocks  are 512 bytes*/
-		p->dk[i].dk_rkb = p->dk[i].dk_rkb/2;
-		p->dk[i].dk_wkb = p->dk[i].dk_wkb/2;
+			COLOUR wattrset(pad, COLOR_PAIR(0) | A_BOLD); 
+                        mvwprintw(pad, 7, 0,  "                              --- Controls ---                                ");
+			COLOUR wattrset(pad, COLOR_PAIR(0)); 
 
-		p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
+                        helpmenuitem(pad, "q", "Quit       ", 8, 1, 0, 6, 1 ); 
+                        helpmenuitem(pad, "b", "Black/White Mode  ", 8, 15, 0, 6, 2 ); 
+                        helpmenuitem(pad, "C", "Single-Column View ", 8, 36, !show_columns, 6, 3 ); 
+                        helpmenuitem(pad, "space", "Refresh Now  ", 8, 58, 0, 6, 4 ); 
 
-		/* assume a disk does 200 op per second */
-		fudged_busy = (p->dk[i].dk_reads + p->dk[i].dk_writes)/2;
-		if(fudged_busy > 100*elapsed)
-			p->dk[i].dk_time += 100*elapsed;
-		p->dk[i].dk_time = fudged_busy;
+                        helpmenuitem(pad, ".", "Only show busy disk/processes   ", 9, 1, !show_all, 7, 1 ); 
+                        helpmenuitem(pad, "0", "Reset Peak Counts to Zero (peak = '>') ", 9, 36, 0, 7, 2 ); 
 
-		sprintf(p->dk[i].dk_name,"dev-%d-%d",p->dk[i].dk_major,p->dk[i].dk_minor);
-/*	fprintf(stderr,"disk=%d name=\"%s\" major=%d minor=%d\n", i,p->dk[i].dk_name, p->dk[i].dk_major,p->dk[i].dk_minor); */
-		str++;
-	}
+                        helpmenuitem(pad, "+", "Double Screen Refresh Time      ", 10, 1, 0, 8, 1 ); 
+                        helpmenuitem(pad, "-", "Half Screen Refresh Time               ", 10, 36, 0, 8, 2 ); 
 }
 
-void proc_diskstats(double elapsed)
-{
-static FILE *fp = (FILE *)-1;
-char buf[1024];
-int i;
-int ret;
+void display(WINDOW* pad, int rows) {
+	if (show_columns) {
+        	if (COLS >= 246){
+        	        if (x_1+2+(rows)>LINES-1){
+        	                if (x_2+2+(rows)>LINES-1) {
+        	                        if (x_3+2+(rows)>LINES-1){
+        	                                if (x_1 <= x_2 && x_1 <= x_3 ) {
+        	                                        use_x_1++;
+        	                                } else if (x_2 <= x_1 && x_2 <= x_3) {
+        	                                        use_x_2++;
+        	                                }else{
+        	                                        use_x_3++;
+        	                                }
+        	                        }else{
+        	                                use_x_3++;
+        	                        }
+        	                }else{
+        	                        use_x_2++;
+        	                }
+        	        }else {
+        	                use_x_1++;
+        	        }
+        	} else if (COLS >= 164) {
+        	        if (x_1+2+(rows)>LINES-1){
+        	                if (x_2+2+(rows)>LINES-1){
+        	                        if (x_1 <= x_2) {
+        	                                use_x_1++;
+        	                        } else{
+        	                                use_x_2++;
+        	                        }
+        	                }else{
+        	                        use_x_2++;
+        	                }
+        	        }else{
+        	                use_x_1++;
+        	        }
+        	}else{
+        	        use_x_1++;
+        	}
 
-	if( fp == (FILE *)-1) {
-           if( (fp = fopen("/proc/diskstats","r")) == NULL) {
-		error("failed to open - /proc/diskstats");
-		disks=0;
-		return;
-	   }
-	}
-/*
-   2    0 fd0 1 0 2 13491 0 0 0 0 0 13491 13491
-   3    0 hda 41159 53633 1102978 620181 39342 67538 857108 4042631 0 289150 4668250
-   3    1 hda1 58209 58218 0 0
-   3    2 hda2 148 4794 10 20
-   3    3 hda3 65 520 0 0
-   3    4 hda4 35943 1036092 107136 857088
-  22    0 hdc 167 5394 22308 32250 0 0 0 0 0 22671 32250 <-- USB !!
-   8    0 sda 990 2325 4764 6860 9 3 12 417 0 6003 7277
-   8    1 sda1 3264 4356 12 12
-*/
-	for(i=0;i<DISKMAX;) {
-		if(fgets(buf,1024,fp) == NULL)
-			break;
-		/* zero the data ready for reading */
-		p->dk[i].dk_major = 
-		p->dk[i].dk_minor =
-		p->dk[i].dk_name[0] =
-		p->dk[i].dk_reads =
-		p->dk[i].dk_rmerge =
-		p->dk[i].dk_rkb =
-		p->dk[i].dk_rmsec =
-		p->dk[i].dk_writes =
-		p->dk[i].dk_wmerge =
-		p->dk[i].dk_wkb =
-		p->dk[i].dk_wmsec =
-		p->dk[i].dk_inflight =
-		p->dk[i].dk_time =
-		p->dk[i].dk_11 =0;
+	        if (last_num_col == 1){
+	                maxcols = COLS;
+	        }else if (last_num_col == 2){
+	                maxcols = COLS/2;
+	        }else {
+	                maxcols = COLS/3;
+	        }
+	}else{
+		use_x_1++;
+		maxcols = COLS;
+	}
 
-		ret = sscanf(&buf[0], "%d %d %s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-			&p->dk[i].dk_major,
-			&p->dk[i].dk_minor,
-			&p->dk[i].dk_name[0],
-			&p->dk[i].dk_reads,
-			&p->dk[i].dk_rmerge,
-			&p->dk[i].dk_rkb,
-			&p->dk[i].dk_rmsec,
-			&p->dk[i].dk_writes,
-			&p->dk[i].dk_wmerge,
-			&p->dk[i].dk_wkb,
-			&p->dk[i].dk_wmsec,
-			&p->dk[i].dk_inflight,
-			&p->dk[i].dk_time,
-			&p->dk[i].dk_11 );
-		if(ret == 7) { /* suffle the data around due to missing columns for partitions */
-			p->dk[i].dk_partition = 1;
-			p->dk[i].dk_wkb = p->dk[i].dk_rmsec;
-			p->dk[i].dk_writes = p->dk[i].dk_rkb;
-			p->dk[i].dk_rkb = p->dk[i].dk_rmerge;
-			p->dk[i].dk_rmsec=0;
-			p->dk[i].dk_rmerge=0;
-	
-		}
-		else if(ret == 14) p->dk[i].dk_partition = 0;
-		else fprintf(stderr,"disk sscanf wanted 14 but returned=%d line=%s\n", 
-	 			ret,buf);
 
-		p->dk[i].dk_rkb /= 2; /* sectors = 512 bytes */
-		p->dk[i].dk_wkb /= 2;
-		/*p->dk[i].dk_xfers = p->dk[i].dk_rkb + p->dk[i].dk_wkb;*/
-		p->dk[i].dk_xfers = p->dk[i].dk_reads + p->dk[i].dk_writes;
-		if(p->dk[i].dk_xfers == 0)
-			p->dk[i].dk_bsize = 0;
-		else
-			p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
+        if (use_x_1 > 0){
+                if(x_1+2+(rows)>LINES)
+                        pnoutrefresh(pad, 0,0,x_1,1,LINES-2,maxcols-2);
+                else
+                        pnoutrefresh(pad, 0,0,x_1,1,x_1+rows+1,maxcols-2);
+                x_1=x_1+(rows);
+                use_x_1 = 0;
+        }
+        if (use_x_2 > 0){
+                if(x_2+2+(rows)>LINES) {
+                        pnoutrefresh(pad, 0,0,x_2,maxcols,LINES-2,maxcols*2-2);
+                }else {
+                        pnoutrefresh(pad, 0,0,x_2,maxcols,x_2+rows+1,maxcols*2-2);
+                }
+                mvvline(1,maxcols-1,0,LINES-2);
+                wnoutrefresh(stdscr);
+                x_2=x_2+(rows);
+                use_x_2 = 0;
+        }
+        if (use_x_3 > 0){
+                if(x_3+2+(rows)>LINES) {
+                        pnoutrefresh(pad, 0,0,x_3,maxcols*2,LINES-2,maxcols*3-2);
+                }else {
+                        pnoutrefresh(pad, 0,0,x_3,maxcols*2,x_3+rows+1,maxcols*3-2);
+                }
+                mvwvline(stdscr,1,maxcols*2-1,0,LINES-2);
+                wnoutrefresh(stdscr);
+                x_3=x_3+(rows);
+                use_x_3 = 0;
+        }
 
-		p->dk[i].dk_time /= 10.0; /* in milli-seconds to make it upto 100%, 1000/100 = 10 */
-	
-		if(p->dk[i].dk_reads != 0 || p->dk[i].dk_writes != 0) 
-			i++;	
+       	if (x_3 > 1 ){
+       	        num_col = 3;
+       	} else if (x_2 > 1){
+       	        num_col = 2;
+       	} else{
+       	        num_col = 1;
+       	}
+
+        if(x_1+2>LINES || x_2+2>LINES || x_3+2>LINES) {
+                mvwprintw(stdscr,LINES-1,10,"Warning: Some Statistics may not shown");
+        }
+}
+
+
+/* Full Args Mode stuff here */
+
+#define ARGSMAX 1024*8
+#define CMDLEN 4096
+
+struct {
+	int pid;
+	char *args;
+} arglist[ARGSMAX];
+
+void args_output(int pid, int loop, char *progname)
+{
+FILE *pop;
+int i;
+char tmpstr[CMDLEN];
+char id[16];
+static int arg_first_time = 1;
+
+	if(pid == 0)
+		return; /* ignore init */
+	for(i=0;i<ARGSMAX-1;i++ ) {   /* clear data out */
+		if(arglist[i].pid == pid){
+			return;
+		}
+		if(arglist[i].pid == 0) /* got to empty slot */
+			break;
+	}
+	sprintf(tmpstr,"ps -p %d -o args 2>/dev/null", pid);
+	pop = popen(tmpstr, "r");
+	if(pop == NULL) {
+		return;
+	} else {
+		if(fgets(tmpstr, CMDLEN, pop) == NULL) { /* throw away header */
+			pclose(pop);
+			return;
+		}
+		tmpstr[0]=0;
+		if(fgets(tmpstr, CMDLEN, pop) == NULL) {
+			pclose(pop);
+			return;
+		}
+		tmpstr[strlen(tmpstr)-1]=0;
+		if(tmpstr[strlen(tmpstr)-1]== ' ')
+			tmpstr[strlen(tmpstr)-1]=0;
+		arglist[i].pid = pid;
+		if(arg_first_time) {
+			if(show_headings)
+				fprintf(fp,"UARG,+Time,PID,ProgName,FullCommand\n");
+			arg_first_time = 0;
+		}
+		snprintf(id, sizeof(id), "%07d", pid);
+		enc_begin("UARG", NULL);
+		enc_text("PID", id);
+		enc_text("ProgName", progname);
+		enc_text("FullCommand", tmpstr);
+		enc_end();
+		pclose(pop);
+		return;
 	}
-	if(reread) {
-		fclose(fp);
-		fp = (FILE *)-1;
-	} else rewind(fp);
-	disks = i;
 }
 
-void strip_spaces(char *s)
+void args_load()
 {
-char *p;
-int spaced=1;
+FILE *pop;
+int i;
+char tmpstr[CMDLEN];
 
-	p=s;
-	for(p=s;*p!=0;p++) {
-		if(*p == ':')
-			*p=' ';
-		if(*p != ' ') {
-			*s=*p;
-			s++;
-			spaced=0;
-		} else if(spaced) {
-			/* do no thing as this is second space */
-			} else {
-				*s=*p;
-				s++;
-				spaced=1;
+	for(i=0;i<ARGSMAX;i++ ) {   /* clear data out */
+		if(arglist[i].pid == -1)
+			break;
+		if(arglist[i].pid != 0){
+			arglist[i].pid = -1;
+			free(arglist[i].args);
+		}
+	}
+	pop = popen("ps -eo pid,args 2>/dev/null", "r");
+	if(pop == NULL) {
+		return;
+	} else {
+		if(fgets(tmpstr, CMDLEN, pop) == NULL) { /* throw away header */
+			pclose(pop);
+			return;
+		}
+		for(i=0;i<ARGSMAX;i++ ) {
+			tmpstr[0]=0;
+			if(fgets(tmpstr, CMDLEN, pop) == NULL) {
+				pclose(pop);
+				return;
 			}
+			tmpstr[strlen(tmpstr)-1]=0;
+			if(tmpstr[strlen(tmpstr)-1]== ' ')
+				tmpstr[strlen(tmpstr)-1]=0;
+			arglist[i].pid = atoi(tmpstr);
+			arglist[i].args = malloc(strlen(tmpstr));
+			strcpy(arglist[i].args,&tmpstr[6]);
+		}
+		pclose(pop);
+	}
+}
 
+char *args_lookup(int pid, char *progname)
+{
+int i;
+	for(i=0;i<ARGSMAX;i++) {
+		if(arglist[i].pid == pid)
+			return arglist[i].args;
+		if(arglist[i].pid == -1)
+			return progname;
 	}
-	*s = 0;
+	return progname;
 }
+/* end args mode stuff here */
 
-void proc_partitions(double elapsed)
+/* Container attribution stuff here
+ * The container, pod or systemd unit of a process comes from
+ * /proc/<pid>/cgroup.  That is read once per process lifetime, cached on
+ * (pid, start time) so a reused pid is not given the old owner.
+ */
+#define CONTAINER_LEN 24
+#define CONTAINER_SWEEP 100	/* snapshots between dropping exited processes */
+
+struct container {
+	int	pid;		/* 0 = empty slot */
+	unsigned long start_time;
+	int	seen;
+	char	name[CONTAINER_LEN];
+} *containers = NULL;
+int	containers_size = 0;	/* power of 2 */
+int	containers_used = 0;
+int	containers_swept = 0;
+int	show_containers = 0;	/* -K rollup in spreadsheet mode */
+
+int ishex(char c)
 {
-static FILE *fp = (FILE *)-1;
-char buf[1024];
-int i = 0;
-int ret;
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
 
-	if( fp == (FILE *)-1) {
-           if( (fp = fopen("/proc/partitions","r")) == NULL) {
-		error("failed to open - /proc/partitions");
-		partitions=0;
+/* Shorten a cgroup path to something that fits in a column:
+ *	.../docker-<64 hex>.scope	docker:<12 hex>
+ *	.../cri-containerd-<id>.scope	cri-containerd:<12 hex>, crio and libpod too
+ *	/docker/<64 hex>		docker:<12 hex>
+ *	/kubepods/.../pod<uid>/<id>	k8s:<12 hex>
+ *	.../kubepods-...-pod<uid>.slice	pod:<uid>
+ *	.../<unit>.service		<unit>.service
+ *	/				-
+ */
+void container_name(char *path, char *name)
+{
+char buf[1024];
+char *comp[32];
+char *s;
+char *id;
+int n;
+int i;
+int run;
+
+	strncpy(buf, path, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	for(n = 0, s = strtok(buf, "/\n"); s != NULL && n < 32; s = strtok(NULL, "/\n"))
+		comp[n++] = s;
+	if(n == 0) {
+		strcpy(name, "-");
 		return;
-	   }
 	}
-	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
-	if(fgets(buf,1024,fp) == NULL) goto end;
-/*
-major minor  #blocks  name     rio rmerge rsect ruse wio wmerge wsect wuse running use aveq
-
-  33     0    1052352 hde 2855 15 2890 4760 0 0 0 0 -4 7902400 11345292
-  33     1    1050304 hde1 2850 0 2850 3930 0 0 0 0 0 3930 3930
-   3     0   39070080 hda 9287 19942 226517 90620 8434 25707 235554 425790 -12 7954830 33997658
-   3     1   31744408 hda1 651 90 5297 2030 0 0 0 0 0 2030 2030
-   3     2    6138720 hda2 7808 19561 218922 79430 7299 20529 222872 241980 0 59950 321410
-   3     3     771120 hda3 13 41 168 80 0 0 0 0 0 80 80
-   3     4          1 hda4 0 0 0 0 0 0 0 0 0 0 0
-   3     5     408208 hda5 812 241 2106 9040 1135 5178 12682 183810 0 11230 192850
-*/
-	for(i=0;i<DISKMAX;i++) {
-		if(fgets(buf,1024,fp) == NULL)
-			break;
-		strip_spaces(buf);
-		ret = sscanf(&buf[0], "%d %d %lu %s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-			&p->dk[i].dk_major,
-			&p->dk[i].dk_minor,
-			&p->dk[i].dk_blocks,
-		(char *)&p->dk[i].dk_name,
-			&p->dk[i].dk_reads,
-			&p->dk[i].dk_rmerge,
-			&p->dk[i].dk_rkb,
-			&p->dk[i].dk_rmsec,
-			&p->dk[i].dk_writes,
-			&p->dk[i].dk_wmerge,
-			&p->dk[i].dk_wkb,
-			&p->dk[i].dk_wmsec,
-			&p->dk[i].dk_inflight,
-			&p->dk[i].dk_use,
-			&p->dk[i].dk_aveq
-			);
-		p->dk[i].dk_rkb /= 2; /* sectors = 512 bytes */
-		p->dk[i].dk_wkb /= 2;
-		p->dk[i].dk_xfers = p->dk[i].dk_rkb + p->dk[i].dk_wkb;
-		if(p->dk[i].dk_xfers == 0)
-			p->dk[i].dk_bsize = 0;
+	for(i = n - 1; i >= 0; i--) {
+		/* a container id is a run of 64 hex digits */
+		for(s = comp[i], run = 0; *s && run < 64; s++)
+			run = ishex(*s) ? run + 1 : 0;
+		if(run < 64)
+			continue;
+		id = s - 64;
+		if(id > comp[i] + 1) {
+			id[-1] = 0;	/* drop the '-' before the id */
+			snprintf(name, CONTAINER_LEN, "%s:%.12s", comp[i], id);
+		} else if(i > 0 && strncmp(comp[i - 1], "pod", 3) != 0)
+			snprintf(name, CONTAINER_LEN, "%s:%.12s", comp[i - 1], id);
 		else
-			p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
-
-		p->dk[i].dk_time /= 10.0; /* in milli-seconds to make it upto 100%, 1000/100 = 10 */
-	
-		if(ret != 15) {
-#ifdef DEBUG
-			if(debug)fprintf(stderr,"sscanf wanted 15 returned = %d line=%s\n", ret,buf);
-#endif /*DEBUG*/
-			partitions_short = 1;
-		} else partitions_short = 0;
-	}
-	end:
-	if(reread) {
-		fclose(fp);
-		fp = (FILE *)-1;
-	} else rewind(fp);
-	disks = i;
-}
-
-void proc_disk(double elapsed)
-{
-struct stat buf;
-int ret;
-	if(disk_mode == 0) {
-		ret = stat("/proc/diskstats", &buf);
-		if(ret == 0) {
-			disk_mode=DISK_MODE_DISKSTATS;
-		} else {
-	               ret = stat("/proc/partitions", &buf);
-			if(ret == 0) {
-				disk_mode=DISK_MODE_PARTITIONS;
-			} else {
-				disk_mode=DISK_MODE_IO;
-			}
-		}
+			snprintf(name, CONTAINER_LEN, "k8s:%.12s", id);
+		return;
 	}
-	switch(disk_mode){
-	case DISK_MODE_IO: 		proc_disk_io(elapsed);   break;
-	case DISK_MODE_DISKSTATS: 	proc_diskstats(elapsed); break;
-	case DISK_MODE_PARTITIONS: 	proc_partitions(elapsed); break;
+	/* not in a container: name the pod or the systemd unit */
+	s = comp[n - 1];
+	if(strncmp(s, "kubepods", 8) == 0 && (id = strstr(s, "-pod")) != NULL) {
+		if( (s = strstr(id, ".slice")) != NULL)
+			*s = 0;
+		snprintf(name, CONTAINER_LEN, "pod:%s", id + 4);
+		return;
 	}
+	snprintf(name, CONTAINER_LEN, "%s", s);
 }
-#undef isdigit
-#define isdigit(ch) ( ( '0' <= (ch)  &&  (ch) >= '9')? 0: 1 )
 
-long proc_mem_search( char *s)
+/* Pick the most telling line of /proc/<pid>/cgroup: the cgroup v2 one,
+ * else a v1 cpu controller or the systemd one, and name it.
+ */
+void container_read(int pid, char *name)
 {
-int i;
-int j;
+char filename[64];
+char buf[4096];
+char *line;
+char *path;
+char *best = NULL;
+int best_score = 0;
+int score;
+int fd;
 int len;
-	len=strlen(s);
-	for(i=0;i<proc[P_MEMINFO].lines;i++ ) {
-		if( !strncmp(s, proc[P_MEMINFO].line[i],len) ) {
-			for(j=len;
-				!isdigit(proc[P_MEMINFO].line[i][j]) &&
-				proc[P_MEMINFO].line[i][j] != 0;
-				j++)
-				/* do nothing */ ;
-			return atol( &proc[P_MEMINFO].line[i][j]);
+
+	if(rec_in_name != NULL) {	/* the process is long gone */
+		strcpy(name, "-");
+		return;
+	}
+	strcpy(name, "?");
+	sprintf(filename, "/proc/%d/cgroup", pid);
+	if( (fd = open(filename, O_RDONLY)) == -1)
+		return;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(len <= 0)
+		return;
+	buf[len] = 0;
+	for(line = strtok(buf, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		/* hierarchy-ID:controller-list:cgroup-path */
+		if( (path = strchr(line, ':')) == NULL || (path = strchr(path + 1, ':')) == NULL)
+			continue;
+		path++;
+		if(strcmp(path, "/") == 0)
+			score = 0;
+		else if(strncmp(line, "0::", 3) == 0)
+			score = 4;
+		else if(strstr(line, ":cpu,") || strstr(line, ":cpu:") || strstr(line, ",cpu:"))
+			score = 3;
+		else if(strstr(line, ":name=systemd:"))
+			score = 2;
+		else
+			score = 1;
+		if(best == NULL || score > best_score) {
+			best = path;
+			best_score = score;
 		}
 	}
-	return -1;
-}
-
-void proc_mem()
-{
-	p->mem.memtotal   = proc_mem_search("MemTotal");
-	p->mem.memfree    = proc_mem_search("MemFree");
-	p->mem.memshared  = proc_mem_search("MemShared");
-	p->mem.buffers    = proc_mem_search("Buffers");
-	p->mem.cached     = proc_mem_search("Cached");
-	p->mem.swapcached = proc_mem_search("SwapCached");
-	p->mem.active     = proc_mem_search("Active");
-	p->mem.inactive   = proc_mem_search("Inactive");
-	p->mem.hightotal  = proc_mem_search("HighTotal");
-	p->mem.highfree   = proc_mem_search("HighFree");
-	p->mem.lowtotal   = proc_mem_search("LowTotal");
-	p->mem.lowfree    = proc_mem_search("LowFree");
-	p->mem.swaptotal  = proc_mem_search("SwapTotal");
-	p->mem.swapfree   = proc_mem_search("SwapFree");
-#ifdef LARGEMEM
-	p->mem.dirty         = proc_mem_search("Dirty");
-	p->mem.writeback     = proc_mem_search("Writeback");
-	p->mem.mapped        = proc_mem_search("Mapped");
-	p->mem.slab          = proc_mem_search("Slab");
-	p->mem.committed_as  = proc_mem_search("Committed_AS");
-	p->mem.pagetables    = proc_mem_search("PageTables");
-	p->mem.hugetotal     = proc_mem_search("HugePages_Total");
-	p->mem.hugefree      = proc_mem_search("HugePages_Free");
-	p->mem.hugesize      = proc_mem_search("Hugepagesize");
-#else
-	p->mem.bigfree       = proc_mem_search("BigFree");
-#endif /*LARGEMEM*/
+	if(best != NULL)
+		container_name(best, name);
 }
 
-int current_snaps;
-#define MAX_SNAPS 400
-#define MAX_SNAP_ROWS 20
-#define SNAP_OFFSET 6
-
-
-int next_cpu_snap = 0;
-int cpu_snap_all = 0;
-
-struct {
-	double user;
-	double kernel;
-	double iowait;
-	double idle;
-} cpu_snap[MAX_SNAPS];
-
-int snap_average()
+/* Rebuild the hash table with room for growth, dropping processes that
+ * were not looked up since the last sweep.
+ */
+void container_rehash(int size, int keep)
 {
+struct container *old = containers;
+int old_size = containers_size;
+unsigned int h;
 int i;
-int end;
-int total = 0;
-
-	if(cpu_snap_all)
-		end = current_snaps;
-	else
-		end = next_cpu_snap;
 
-	for(i=0;i<end;i++) {
-		total = total + cpu_snap[i].user + cpu_snap[i].kernel;
+	containers = MALLOC(sizeof(struct container) * size);
+	memset(containers, 0, sizeof(struct container) * size);
+	containers_size = size;
+	containers_used = 0;
+	for(i = 0; i < old_size; i++) {
+		if(old[i].pid == 0 || old[i].seen < keep)
+			continue;
+		for(h = (old[i].pid * 2654435761U) & (size - 1); containers[h].pid != 0; h = (h + 1) & (size - 1))
+			;
+		containers[h] = old[i];
+		containers_used++;
 	}
-	return (total / end) ;
+	free(old);
 }
 
-void snap_clear()
+/* Call once per snapshot before the lookups so the table never moves
+ * while names returned by container_lookup() are in use.
+ */
+void container_reserve(int procs)
 {
-int i;
-	for(i=0;i<current_snaps;i++) {
-		cpu_snap[i].user = 0;
-		cpu_snap[i].kernel = 0;
-		cpu_snap[i].iowait = 0;
-		cpu_snap[i].idle = 0;
+int size;
+
+	if(loop - containers_swept >= CONTAINER_SWEEP) {
+		container_rehash(containers_size ? containers_size : 1024, containers_swept);
+		containers_swept = loop;
 	}
-	next_cpu_snap=0;
-	cpu_snap_all=0;
+	for(size = containers_size ? containers_size : 1024; (containers_used + procs) * 2 >= size; )
+		size *= 2;
+	if(size != containers_size)
+		container_rehash(size, 0);
 }
 
-void plot_snap(WINDOW *pad)
+char *container_lookup(int pid, unsigned long start_time)
 {
-int i;
-int j;
-	if (cursed) {
-		mvwprintw(pad,0, 0, " CPU +");
-		int counter;
-		for (counter=0; counter < current_snaps - 1; counter++){
-			wprintw(pad, "-");
-		}
-		wprintw(pad, "+");
-		mvwprintw(pad,1, 0,"100%%-|");
-		mvwprintw(pad,2, 1, "95%%-|");
-		mvwprintw(pad,3, 1, "90%%-|");
-		mvwprintw(pad,4, 1, "85%%-|");
-		mvwprintw(pad,5, 1, "80%%-|");
-		mvwprintw(pad,6, 1, "75%%-|");
-		mvwprintw(pad,7, 1, "70%%-|");
-		mvwprintw(pad,8, 1, "65%%-|");
-		mvwprintw(pad,9, 1, "60%%-|");
-		mvwprintw(pad,10, 1, "55%%-|");
-		mvwprintw(pad,11, 1, "50%%-|");
-		mvwprintw(pad,12, 1, "45%%-|");
-		mvwprintw(pad,13, 1, "40%%-|");
-		mvwprintw(pad,14, 1, "35%%-|");
-		mvwprintw(pad,15, 1, "30%%-|");
-		mvwprintw(pad,16, 1, "25%%-|");
-		mvwprintw(pad,17, 1, "20%%-|");
-		mvwprintw(pad,18, 1,"15%%-|");
-		mvwprintw(pad,19, 1,"10%%-|");
-		mvwprintw(pad,20, 1," 5%%-|");
-
- 		if (colour){
- 			mvwprintw(pad,21, 4, " +--------------------");
- 			COLOUR wattrset(pad, COLOR_PAIR(2));
- 			mvwprintw(pad,21, 26, "User%%");
- 			COLOUR wattrset(pad, COLOR_PAIR(0));
- 			mvwprintw(pad,21, 30, "---------");
- 			COLOUR wattrset(pad, COLOR_PAIR(1));
- 			mvwprintw(pad,21, 39, "System%%");
- 			COLOUR wattrset(pad, COLOR_PAIR(0));
- 			mvwprintw(pad,21, 45, "---------");
- 			COLOUR wattrset(pad, COLOR_PAIR(4));
- 			mvwprintw(pad,21, 54, "Wait%%");
- 			COLOUR wattrset(pad, COLOR_PAIR(0));
-			for (counter=0; counter < current_snaps - 54; counter++){
-				wprintw(pad, "-");
-			}
- 			wprintw(pad, "+");
-		} else {
-			mvwprintw(pad,21, 4, " +");
-			for (counter=0; counter < current_snaps - 1; counter++){
-				wprintw(pad, "-");
-			}
-			wprintw(pad, "+");
-		}
+unsigned int h;
 
-		for (j = 0; j < current_snaps; j++) {
-			for (i = 0; i < MAX_SNAP_ROWS; i++) {
-				wmove(pad,MAX_SNAP_ROWS-i, j+SNAP_OFFSET);
-				if( (cpu_snap[j].user / 100 * MAX_SNAP_ROWS) > i+0.5) {
-					COLOUR wattrset(pad,COLOR_PAIR(9));
-					wprintw(pad,"U");
-					COLOUR wattrset(pad,COLOR_PAIR(0));
-				} else if( (cpu_snap[j].user + cpu_snap[j].kernel )/ 100 * MAX_SNAP_ROWS > i+0.5) {
-					COLOUR wattrset(pad,COLOR_PAIR(8));
-					wprintw(pad,"s");
-					COLOUR wattrset(pad,COLOR_PAIR(0));
-				} else if( (cpu_snap[j].user + cpu_snap[j].kernel +cpu_snap[j].iowait )/ 100 * MAX_SNAP_ROWS > i+0.5) {
-					COLOUR wattrset(pad,COLOR_PAIR(10));
-					wprintw(pad,"w");
-					COLOUR wattrset(pad,COLOR_PAIR(0));
-				} else 
-					wprintw(pad," ");
-			}
-		}
-		for (i = 0; i < MAX_SNAP_ROWS; i++) {
-			wmove(pad,MAX_SNAP_ROWS-i, next_cpu_snap+SNAP_OFFSET);
-			wprintw(pad,"|");
-		}
-		wmove(pad,MAX_SNAP_ROWS+1 - (snap_average() /5), next_cpu_snap+SNAP_OFFSET);
-		wprintw(pad,"+");
-		if(dotline) {
-		    for (i = 0; i < current_snaps; i++) {
-			wmove(pad,MAX_SNAP_ROWS+1-dotline*2, i+SNAP_OFFSET);
-			wprintw(pad,"+");
-		    }
-		    dotline = 0;
+	for(h = (pid * 2654435761U) & (containers_size - 1); containers[h].pid != 0; h = (h + 1) & (containers_size - 1)) {
+		if(containers[h].pid == pid && containers[h].start_time == start_time) {
+			containers[h].seen = loop;
+			return containers[h].name;
 		}
 	}
+	containers[h].pid = pid;
+	containers[h].start_time = start_time;
+	containers[h].seen = loop;
+	container_read(pid, containers[h].name);
+	containers_used++;
+	return containers[h].name;
 }
+/* end container stuff here */
 
-/* This saves the CPU overall usage for later ploting on the screen */
-void plot_save(double user, double kernel, double iowait, double idle)
+void   linux_bbbp(char *name, char *cmd, char *err)
 {
-	cpu_snap[next_cpu_snap].user = user;
-	cpu_snap[next_cpu_snap].kernel = kernel;
-	cpu_snap[next_cpu_snap].iowait = iowait;
-	cpu_snap[next_cpu_snap].idle = idle;
-	next_cpu_snap++;
-	if(next_cpu_snap >= current_snaps) {
-		next_cpu_snap=0;
-		cpu_snap_all=1;
-	}
-}
-
-/* This puts the CPU usage on the screen and draws the CPU graphs or outputs to the file */
+        int   i;
+        int   len;
+#define STRLEN 4096
+        char   str[STRLEN];
+        FILE * pop;
+        static int   lineno = 0;
 
-void save_smp(WINDOW *pad, int cpu_no, int row, long user, long kernel, long iowait, long idle, long nice, long irq, long softirq, long steal)
-{
-static int firsttime = 1;
-	if (cursed) {
-		mvwprintw(pad,row,0, "%02d usr=%4ld sys=%4ld wait=%4ld idle=%4ld steal=%2ld nice=%4ld irq=%2ld sirq=%2ld\n", 
-		cpu_no, user, kernel, iowait, idle, steal, nice, irq, softirq, steal);
-		return;
-	}
-	if(firsttime) {
-		fprintf(fp,"CPUTICKS_ALL,AAA,user,sys,wait,idle,nice,irq,softirq,steal\n");
-		fprintf(fp,"CPUTICKS%02d,AAA,user,sys,wait,idle,nice,irq,softirq,steal\n", cpu_no);
-		firsttime=0;	
-	}
-	if(cpu_no==0) {
-	fprintf(fp,"CPUTICKS_ALL,%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", 
-	        LOOP, user, kernel, iowait, idle, nice, irq, softirq, steal);
-	} else {
-	fprintf(fp,"CPUTICKS%02d,%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", 
-	cpu_no, LOOP, user, kernel, iowait, idle, nice, irq, softirq, steal);
-	}
+        pop = popen(cmd, "r");
+        if (pop == NULL) {
+                fprintf(fp, "BBBP,%03d,%s failed to run %s\n", lineno++, cmd, err);
+        } else {
+                fprintf(fp, "BBBP,%03d,%s\n", lineno++, name);
+                for (i = 0; i < 2048 && (fgets(str, STRLEN, pop) != NULL); i++) { /* 2048=sanity check only */
+                        len = strlen(str);
+			if(len>STRLEN) len=STRLEN;
+                        if (str[len-1] == '\n') /*strip off the newline */
+                                str[len-1] = 0;
+                        /* fix lsconf style output so it does not confuse spread sheets */
+                        if(str[0] == '+') str[0]='p';
+                        if(str[0] == '*') str[0]='m';
+                        if(str[0] == '-') str[0]='n';
+                        if(str[0] == '/') str[0]='d';
+                        if(str[0] == '=') str[0]='e';
+                        fprintf(fp, "BBBP,%03d,%s,\"%s\"\n", lineno++, name, str);
+                }
+                pclose(pop);
+        }
 }
 
-void plot_smp(WINDOW *pad, int cpu_no, int row, double user, double kernel, double iowait, double idle)
-{
-	int	i;
-	int	peak_col;
-
-	if(show_rrd) return;
-
-	if(cpu_peak[cpu_no] < ((double)((int)user/2 + (int)kernel/2 + (int)iowait/2)*2.0) )
-		cpu_peak[cpu_no] = (double)((int)user/2 + (int)kernel/2 + (int)iowait/2)*2.0;
-
-	if (cursed) {
-		if(cpu_no == 0)
-			mvwprintw(pad,row, 0, "Avg");
-		else
-			mvwprintw(pad,row, 0, "%2d", cpu_no);
-		mvwprintw(pad,row,  3, "%5.1lf", user);
-		mvwprintw(pad,row,  9, "%5.1lf", kernel);
-		mvwprintw(pad,row, 15, "%5.1lf", iowait);
-		mvwprintw(pad,row, 22, "%5.1lf", idle);
-		mvwprintw(pad,row, 27, "|                                                  ");
-		wmove(pad,row, 28);
-		for (i = 0; i < (int)(user   / 2); i++){
-			COLOUR wattrset(pad,COLOR_PAIR(9));
-			wprintw(pad,"U");
-			COLOUR wattrset(pad,COLOR_PAIR(0));
-		}
-		for (i = 0; i < (int)(kernel / 2); i++){
-			COLOUR wattrset(pad,COLOR_PAIR(8));
-			wprintw(pad,"s");
-			COLOUR wattrset(pad,COLOR_PAIR(0));
-		}
-		for (i = 0; i < (int)(iowait / 2); i++) {
-			COLOUR wattrset(pad,COLOR_PAIR(10));
-			wprintw(pad,"W");
-			COLOUR wattrset(pad,COLOR_PAIR(0));
-		}
-		for (i = 0; i < (int)(idle   / 2); i++)
-			wprintw(pad," ");
-		mvwprintw(pad,row, 77, "|");
-		
-		peak_col = 28 +(int)(cpu_peak[cpu_no]/2);
-		if(peak_col > 77)
-			peak_col=77;
-		mvwprintw(pad,row, peak_col, ">");
-	} else {
-	/* Sanity check the numnbers */
-		if( user < 0.0 || kernel < 0.0 || iowait < 0.0 || idle < 0.0 || idle >100.0) {
-			user = kernel = iowait = idle = 0;
-		}
-		
-		if(cpu_no == 0)
-			fprintf(fp,"CPU_ALL,%s,%.1lf,%.1lf,%.1lf,%.1lf,,%d\n", LOOP,
-			    user, kernel, iowait, idle,cpus);
-		else {
-			fprintf(fp,"CPU%02d,%s,%.1lf,%.1lf,%.1lf,%.1lf\n", cpu_no, LOOP,
-			    user, kernel, iowait, idle);
-		}
-	}
-}
-/* Added variable to remember started children
- * 0 - start
- * 1 - snap
- * 2 - end
-*/
-#define CHLD_START 0
-#define CHLD_SNAP 1
-#define CHLD_END 2
-int nmon_children[3] = {-1,-1,-1};
+#define WARNING "needs root permission or file not present"
 
+/* Global name of programme for printing it */
+char	*progname;
 
-/* Signal handler 
- * SIGUSR1 or 2 is used to stop nmon cleanly
- * SIGWINCH is used when the window size is changed
+/* Main data structure for collected stats.
+ * Two versions are previous and current data.
+ * Often its the difference that is printed.
+ * The pointers are swaped i.e. current becomes the previous
+ * and the previous over written rather than moving data around.
  */
-void	interrupt(int signum)
-{
-int child_pid;
-int waitstatus;
-	if (signum == SIGCHLD ) {
-		while((child_pid = waitpid(0, &waitstatus, 0)) == -1 ) {
-			if( errno == EINTR) /* retry */
-				continue;
-			return; /* ECHLD, EFAULT */
-		}
-                if(child_pid == nmon_children[CHLD_SNAP]) 
-                	nmon_children[CHLD_SNAP] = -1;
-		signal(SIGCHLD, interrupt);
-		return;
-	}
-	if (signum == SIGUSR1 || signum == SIGUSR2) {
-		maxloops = loop;
-		return;
-	}
-	if (signum == SIGWINCH) {
-		CURSE endwin(); /* stop + start curses so it works out the # of row and cols */
-		CURSE initscr();
-		CURSE nodelay(stdscr, TRUE);
-		CURSE noecho();
-		CURSE keypad(stdscr,TRUE);
-		CURSE cbreak();
-		signal(SIGWINCH, interrupt);
-		COLOUR colour = has_colors();
-        	COLOUR start_color();
-                COLOUR init_pair((short)0,(short)7,(short)0); /* White */
-                COLOUR init_pair((short)1,(short)1,(short)0); /* Red */
-                COLOUR init_pair((short)2,(short)2,(short)0); /* Green */
-                COLOUR init_pair((short)3,(short)3,(short)0); /* Yellow */
-                COLOUR init_pair((short)4,(short)4,(short)0); /* Blue */
-                COLOUR init_pair((short)5,(short)5,(short)0); /* Magenta */
-                COLOUR init_pair((short)6,(short)6,(short)0); /* Cyan */
-                COLOUR init_pair((short)7,(short)7,(short)0); /* White */
-		COLOUR init_pair((short)8,(short)1,(short)1); /* Red background, red text */
-		COLOUR init_pair((short)9,(short)2,(short)2); /* Green background, green text */
-		COLOUR init_pair((short)10,(short)4,(short)4); /* Blue background, blue text */
-		COLOUR init_pair((short)11,(short)3,(short)3); /* Yellow background, yellow text */
-		COLOUR init_pair((short)12,(short)6,(short)6); /* Cyan background, cyan text */
-		COLOUR init_pair((short)13,(short)5,(short)5); /* Magenta background, Magenta text */
-		CURSE clear();
-		return;
-	}
-	CURSE endwin();
-	exit(0);
-}
-
-
-/* only place the q=previous and p=currect pointers are modified */
-void switcher(void)
-{
-	static int	which = 1;
-
-	if (which) {
-		p = &database[0];
-		q = &database[1];
-		which = 0;
-	} else {
-		p = &database[1];
-		q = &database[0];
-		which = 1;
-	}
-	if(flash_on)
-		flash_on = 0;
-	else
-		flash_on = 1;
-}
+struct cpu_stat {
+	long long user;
+	long long sys;
+	long long wait; 
+	long long idle;
+	long long irq;
+	long long softirq;
+	long long steal;
+	long long nice;
+	long long intr;
+	long long ctxt;
+	long long btime;
+	long long procs;
+	long long running;
+	long long blocked;
+	float uptime;
+	float idletime;
+	float mins1;
+	float mins5;
+	float mins15;
+};
 
+#define ulong unsigned long
+struct dsk_stat {	
+	char	dk_name[32];
+	int	dk_major;
+	int	dk_minor;
+	long	dk_noinfo;
+	ulong	dk_reads;
+	ulong	dk_rmerge;
+	ulong	dk_rmsec;
+	ulong	dk_rkb;
+	ulong	dk_writes;
+	ulong	dk_wmerge;
+	ulong	dk_wmsec;
+	ulong	dk_wkb;
+	ulong	dk_xfers;
+	ulong	dk_bsize;
+	ulong	dk_time;
+	ulong	dk_inflight;
+	ulong	dk_11;
+	ulong	dk_partition;
+	ulong	dk_blocks; /* in /proc/partitions only */
+	ulong	dk_use;
+	ulong	dk_aveq;
+};
 
-/* Lookup the right string */
-char	*status(int n)
-{
-	switch (n) {
-	case 0:
-		return "Run  ";
-	default:
-		return "Sleep";
-	}
-}
+struct mem_stat {
+	long memtotal;
+	long memfree;
+	long memshared;
+	long buffers;
+	long cached;
+	long swapcached;
+	long active;
+	long inactive;
+	long hightotal;
+	long highfree;
+	long lowtotal;
+	long lowfree;
+	long swaptotal;
+	long swapfree;
+#ifdef LARGEMEM
+	long dirty;
+	long writeback;
+	long mapped;
+	long slab;
+	long committed_as;
+	long pagetables;
+	long hugetotal;
+	long hugefree;
+	long hugesize;
+#else
+	long bigfree;
+#endif /*LARGEMEM*/
+};
 
-/* Lookup the right process state string */
-char	*get_state( char n)
-{
-	static char	duff[64];
-	switch (n) {
-	case 'R': return "Running  ";
-	case 'S': return "Sleeping ";
-	case 'D': return "DiskSleep";
-	case 'Z': return "Zombie   ";
-	case 'T': return "Traced   ";
-	case 'W': return "Paging   ";
-	default:
-		sprintf(duff, "%d", n);
-		return duff;
-	}
-}
+struct vm_stat {
+long long nr_dirty;
+long long nr_writeback;
+long long nr_unstable;
+long long nr_page_table_pages;
+long long nr_mapped;
+long long nr_slab;
+long long pgpgin;
+long long pgpgout;
+long long pswpin;
+long long pswpout;
+long long pgalloc_high;
+long long pgalloc_normal;
+long long pgalloc_dma;
+long long pgfree;
+long long pgactivate;
+long long pgdeactivate;
+long long pgfault;
+long long pgmajfault;
+long long pgrefill_high;
+long long pgrefill_normal;
+long long pgrefill_dma;
+long long pgsteal_high;
+long long pgsteal_normal;
+long long pgsteal_dma;
+long long pgscan_kswapd_high;
+long long pgscan_kswapd_normal;
+long long pgscan_kswapd_dma;
+long long pgscan_direct_high;
+long long pgscan_direct_normal;
+long long pgscan_direct_dma;
+long long pginodesteal;
+long long slabs_scanned;
+long long kswapd_steal;
+long long kswapd_inodesteal;
+long long pageoutrun;
+long long allocstall;
+long long pgrotated;
+};
 
-#ifdef GETUSER
-/* Convert User id (UID) to a name with caching for speed 
- * getpwuid() should be NFS/yellow pages safe
- */
-char	*getuser(uid_t uid)
-{
-#define NAMESIZE 16
-	struct user_info {
-		uid_t uid;
-		char	name[NAMESIZE];
-	};
-	static struct user_info *u = NULL;
-	static int	used = 0;
-	int	i;
-	struct passwd *pw;
 
-	i = 0;
-	if (u != NULL) {
-		for (i = 0; i < used; i++) {
-			if (u[i].uid == uid) {
-				return u[i].name;
-			}
-		}
-		u = (struct user_info *)realloc(u, (sizeof(struct user_info ) * (i + 1)));
-	} else
-		u = (struct user_info *)malloc(sizeof(struct user_info ));
-	used++;
 
-	/* failed to find a match so add it */
-	u[i].uid = uid;
-	pw = getpwuid(uid);
+char *nfs_v2_names[18] = {
+	"null", "getattr", "setattr", "root", "lookup", "readlink",
+	"read", "wrcache", "write", "create", "remove", "rename",
+	"link", "symlink", "mkdir", "rmdir", "readdir", "fsstat"};
 
-	if (pw != NULL)
-		strncpy(u[i].name, pw->pw_name, NAMESIZE);
-	else
-		sprintf(u[i].name, "unknown%d",uid);
-	return u[i].name;
-}
-#endif /* GETUSER */
+char *nfs_v3_names[22] ={
+	 "null", "getattr", "setattr", "lookup", "access", "readlink",
+	 "read", "write", "create", "mkdir", "symlink", "mknod", 
+	 "remove", "rmdir", "rename", "link", "readdir", "readdirplus",
+	 "fsstat", "fsinfo", "pathconf", "commit"};
 
-/* User Defined Disk Groups */
+struct nfs_stat {
+	long v2c[18];	/* verison2 client */
+	long v3c[22];	/* verison3 client */
+	long v2s[18];	/* verison2 server */
+	long v3s[22];	/* verison3 server */
+};
 
-char   *save_word(char *in, char *out)
-{
-        int   len;
-        int   i;
-        len = strlen(in);
-	out[0] = 0;
-        for (i = 0; i < len; i++) {
-                if ( isalnum(in[i]) || in[i] == '_' || in[i] == '-' || in[i] == '/' ) {
-                        out[i] = in[i];
-                        out[i+1] = 0;
-                } else
-                        break;
-        }
-        for (; i < len; i++)
-                if (isalnum(in[i]))
-                        return &in[i];
-        return &in[i];
-} 
+#define NETMAX 32
+struct net_stat {
+	unsigned long if_name[17];
+	unsigned long long if_ibytes;
+	unsigned long long if_obytes;
+	unsigned long long if_ipackets;
+	unsigned long long if_opackets;
+	unsigned long if_ierrs;
+	unsigned long if_oerrs;
+	unsigned long if_idrop;   
+	unsigned long if_ififo;   
+	unsigned long if_iframe;   
+	unsigned long if_odrop;   
+	unsigned long if_ofifo;   
+	unsigned long if_ocarrier;   
+	unsigned long if_ocolls;   
+} ;
+#ifdef PARTITIONS
+#define PARTMAX 256
+struct part_stat {
+	int part_major;
+	int part_minor;
+	unsigned long part_blocks;
+	char part_name[16];
+	unsigned long part_rio;
+	unsigned long part_rmerge;
+	unsigned long part_rsect;
+	unsigned long part_ruse;
+	unsigned long part_wio;
+	unsigned long part_wmerge;
+	unsigned long part_wsect;
+	unsigned long part_wuse;
+	unsigned long part_run;
+	unsigned long part_use;
+	unsigned long part_aveq;
+};
+#endif /*PARTITIONS*/
 
-#define DGROUPS 64
-#define DGROUPITEMS 512
+/* /proc/interrupts and /proc/softirqs are held as a sparse IRQ by CPU matrix.
+ * Only the non-zero cells are kept (row by row, like a CSR matrix) as MSI-X
+ * vectors are normally bound to one or two CPUs out of hundreds.
+ */
+#define IRQNAMELEN 16
+#define IRQDESCLEN 32
+struct irq_row {
+	char	name[IRQNAMELEN];	/* "24", "NMI", "NET_RX" */
+	char	desc[IRQDESCLEN];	/* "PCI-MSI 524288-edge eth0-TxRx-0" tail */
+	int	first;			/* index of the first cell of this row */
+	int	cells;			/* number of non-zero cells in this row */
+	int	global;			/* 1 = one count for the system, like ERR: */
+	unsigned long long total;
+};
 
-char   *dgroup_filename;
-char   *dgroup_name[DGROUPS];
-int   *dgroup_data;
-int   dgroup_disks[DGROUPS];
-int   dgroup_total_disks;
-int   dgroup_total_groups;
+struct irq_stat {
+	int	rows;
+	int	maxrows;
+	int	ncells;
+	int	maxcells;
+	struct irq_row *row;
+	int	*cpu;			/* CPU number of each cell */
+	unsigned long long *count;	/* counter of each cell */
+	int	cpu_max;		/* highest CPU number seen + 1 */
+};
 
-void load_dgroup(struct dsk_stat *dk)
-{
-	FILE * gp;
-	char   line[4096];
-	char   name[1024];
-	int   i, j;
-	char   *nextp;
+/* /proc/pressure/{cpu,memory,io} - "some" = at least one task stalled,
+ * "full" = all non-idle tasks stalled.  cpu has no full line on older kernels.
+ */
+#define PSI_CPU 0
+#define PSI_MEM 1
+#define PSI_IO  2
+#define PSI_MAX 3
+
+struct psi_line {
+	double	avg[3];			/* avg10 avg60 avg300 in percent */
+	unsigned long long total;	/* microseconds stalled */
+};
 
-	if (dgroup_loaded == 2)
-		return;
-	dgroup_data = MALLOC(sizeof(int)*DGROUPS * DGROUPITEMS);
-	for (i = 0; i < DGROUPS; i++)
-		for (j = 0; j < DGROUPITEMS; j++)
-			dgroup_data[i*DGROUPS+j] = -1;
+struct psi_stat {
+	int	valid;
+	int	has_full;
+	struct psi_line some;
+	struct psi_line full;
+	long	triggers;		/* times the PSI trigger fired so far */
+};
 
-	gp = fopen(dgroup_filename, "r");
+/* One cgroup v2 sample, node is the slot in the cg_node table of open
+ * directories and gen tells if the slot was reused for another cgroup.
+ */
+struct cg_sample {
+	int	node;
+	int	gen;
+	char	*path;
+	unsigned long long usage_usec;
+	unsigned long long user_usec;
+	unsigned long long system_usec;
+	unsigned long long throttled_usec;
+	unsigned long long mem_current;
+	unsigned long long anon;
+	unsigned long long file;
+	unsigned long long rbytes;
+	unsigned long long wbytes;
+	unsigned long long rios;
+	unsigned long long wios;
+	struct psi_line psi[PSI_MAX];	/* some line of cpu/memory/io.pressure */
+};
 
-	if (gp == NULL) {
-		perror("opening disk group file");
-		fprintf(stderr,"ERROR: failed to open %s\n", dgroup_filename);
-		exit(9);
-	}
+#define NUMAMAX 64
+
+struct numa_stat {
+	int	node;
+	unsigned long long total;	/* KB */
+	unsigned long long free;
+	unsigned long long used;
+	unsigned long long file;
+	unsigned long long anon;
+	unsigned long long numa_hit;	/* pages */
+	unsigned long long numa_miss;
+	unsigned long long numa_foreign;
+	unsigned long long interleave_hit;
+	unsigned long long local_node;
+	unsigned long long other_node;
+};
 
-	for (dgroup_total_groups = 0; 
-		fgets(line, 4096, gp) != NULL && dgroup_total_groups < DGROUPS; 
-		dgroup_total_groups++) {
-		/* save the name */
-		nextp = save_word(line, name);
-		if(strlen(name) == 0) { /* was a blank line */
-			fprintf(stderr,"ERROR elmon:ignoring odd line in diskgroup file \"%s\"\n",line);
-			/* Decrement dgroup_total_groups by 1 to correct index for next loop */
-			--dgroup_total_groups;
-			continue;
-		}
-		/* Added +1 to be able to correctly store the terminating \0 character */
-		dgroup_name[dgroup_total_groups] = MALLOC(strlen(name)+1);
-		strcpy(dgroup_name[dgroup_total_groups], name);
+#define CG_SORT_CPU	1
+#define CG_SORT_MEM	2
+#define CG_SORT_IO	3
+int	cg_sort = CG_SORT_CPU;
 
-		/* save the hdisks */
-		for (i = 0; i < DGROUPITEMS && *nextp != 0; i++) {
-			nextp = save_word(nextp, name);
-			for (j = 0; j < disks; j++) {
-				if ( !strcmp(dk[j].dk_name, name) ) {
-					dgroup_data[dgroup_total_groups*DGROUPS+i] = j;
-					dgroup_disks[dgroup_total_groups]++;
-					dgroup_total_disks++;
-					break;
-				}
-			}
-			if (j == disks)
-				fprintf(stderr,"ERROR elmon:diskgroup file - failed to find disk=%s for group=%s disks know=%d\n",
-					 name, dgroup_name[dgroup_total_groups],disks);
-		}
-	}
-	fclose(gp);
-	dgroup_loaded = 2;
-}
 
+#ifdef POWER
 
-void list_dgroup(struct dsk_stat *dk)
-{
-	int   i, j, k, n;
-	int   first = 1;
+int lparcfg_reread=1;
 
-	for (n = 0, i = 0; i < dgroup_total_groups; i++) {
-		if (first) {
-			fprintf(fp, "BBBG,%03d,User Defined Disk Groups Name,Disks\n", n++);
-			first = 0;
-		}
-		fprintf(fp, "BBBG,%03d,%s", n++, dgroup_name[i]);
-		for (k = 0, j = 0; j < dgroup_disks[i]; j++) {
-			if (dgroup_data[i*DGROUPS+j] != -1) {
-				fprintf(fp, ",%s", dk[dgroup_data[i*DGROUPS+j]].dk_name);
-				k++;
-			}
-			/* add extra line if we have lots to stop spreadsheet line width problems */
-			if (k == 128) {
-				fprintf(fp, "\nBBBG,%03d,%s continued", n++, dgroup_name[i]);
-			}
-		}
-		fprintf(fp, "\n");
-	}
-	fprintf(fp, "DGBUSY,Disk Group Busy %s", hostname);
-	for (i = 0; i < DGROUPS; i++) {
-		if (dgroup_name[i] != 0)
-			fprintf(fp, ",%s", dgroup_name[i]);
-	}
-	fprintf(fp, "\n");
-	fprintf(fp, "DGREAD,Disk Group Read KB/s %s", hostname);
-	for (i = 0; i < DGROUPS; i++) {
-		if (dgroup_name[i] != 0)
-			fprintf(fp, ",%s", dgroup_name[i]);
-	}
-	fprintf(fp, "\n");
-	fprintf(fp, "DGWRITE,Disk Group Write KB/s %s", hostname);
-	for (i = 0; i < DGROUPS; i++) {
-		if (dgroup_name[i] != 0)
-			fprintf(fp, ",%s", dgroup_name[i]);
-	}
-	fprintf(fp, "\n");
-	fprintf(fp, "DGSIZE,Disk Group Block Size KB %s", hostname);
-	for (i = 0; i < DGROUPS; i++) {
-		if (dgroup_name[i] != 0)
-			fprintf(fp, ",%s", dgroup_name[i]);
-	}
-	fprintf(fp, "\n");
-	fprintf(fp, "DGXFER,Disk Group Transfers/s %s", hostname);
-	for (i = 0; i < DGROUPS; i++) {
-		if (dgroup_name[i] != 0)
-			fprintf(fp, ",%s", dgroup_name[i]);
-	}
-	fprintf(fp, "\n");
-}
+struct lpar_stat {
+char version_string[16];		/*lparcfg 1.3 */
+int version;
+char serial_number[16];			/*HAL,0210033EA*/
+char system_type[16];			/*HAL,9124-720*/
+int  partition_id;			/*11*/
+/* 
+R4=0x14
+R5=0x0
+R6=0x800b0000
+R7=0x1000000040004
+*/
+int BoundThrds;				/*=1*/
+int CapInc;				/*=1*/
+long long DisWheRotPer;			/*=2070000*/
+int MinEntCap;				/*=10*/
+int MinEntCapPerVP;			/*=10*/
+int MinMem;				/*=2048*/
+int DesMem;				/*=4096*/
+int MinProcs;				/*=1*/
+int partition_max_entitled_capacity;	/*=400*/
+int system_potential_processors;	/*=4*/
+		/**/
+int partition_entitled_capacity;	/*=20*/
+int system_active_processors;		/*=4*/
+int pool_capacity;			/*=4*/
+int unallocated_capacity_weight;	/*=0*/
+int capacity_weight;			/*=0*/
+int capped;				/*=1*/
+int unallocated_capacity;		/*=0*/
+long long pool_idle_time;		/*=0*/
+long long pool_idle_saved;
+long long pool_idle_diff;
+int pool_num_procs;			/*=0*/
+long long purr;				/*=0*/
+long long purr_saved;
+long long purr_diff;
+long long timebase;
+int partition_active_processors;	/*=1*/
+int partition_potential_processors;	/*=40*/
+int shared_processor_mode;		/*=1*/
+} lparcfg;
 
+int lpar_count=0;
 
+#define LPAR_LINE_MAX   50
+#define LPAR_LINE_WIDTH 80
+char lpar_buffer[LPAR_LINE_MAX][LPAR_LINE_WIDTH];
 
-void hint(void)
-{
-	printf("\tDeveloper: Brian Smith\n");
-	printf("\tBased on nmon by Nigel Griffiths\n");
-	printf("\tLicense:  GPL version 3\n\n");
-	printf("\tThis program is distributed in the hope that it will be useful,\n");
-	printf("\tbut WITHOUT ANY WARRANTY; without even the implied warranty of\n");
-	printf("\tMERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n");
-	printf("\nHint: %s [-h] [-s <seconds>] [-c <count>] [-f -d <disks> -t -r <name>] [-x]\n\n", progname);
-	printf("\t-h            FULL help information\n");
-	printf("\tInteractive-Mode:\n");
-	printf("\tread startup banner and type: \"h\" once it is running\n");
-	printf("\tFor Data-Collect-Mode (-f)\n");
-	printf("\t-f            spreadsheet output format [note: default -s300 -c288]\n");
-	printf("\toptional\n");
-	printf("\t-s <seconds>  between refreshing the screen [default 2]\n");
-	printf("\t-c <number>   of refreshes [default millions]\n");
-	printf("\t-d <disks>    to increase the number of disks [default 256]\n");
-	printf("\t-t            spreadsheet includes top processes\n");
-	printf("\t-x            capacity planning (15 min for 1 day = -fdt -s 900 -c 96)\n");
-	printf("\n");
-}
+int lpar_sanity=55;
 
-void help(void)
+char *locate(char *s)
 {
-	hint();
-	printf("Version - %s\n\n",SccsId);
-	printf("For Interactive-Mode\n");
-	printf("\t-s <seconds>  between refreshing the screen [default 2]\n");
-	printf("\t-c <number>   of refreshes [default millions]\n");
-	printf("\t-g <filename> User Defined Disk Groups [hit g to show them]\n");
-	printf("\t              - file = on each line: group_name <disks list> sapce separated\n");
-	printf("\t              - like: database sdb sdc sdd sde\n");
-	printf("\t              - upto 32 disk groups, disks can appear more than once\n");
-	printf("\t-b            black and white [default is colour]\n");
-	printf("\texample: %s -s 1 -c 100\n",progname);
-	printf("\n");
-	printf("For Data-Collect-Mode = spreadsheet format (comma separated values)\n");
-	printf("\tNote: use only one of f,F,z,x or X and make it the first argument\n");
-	printf("\t-f            spreadsheet output format [note: default -s300 -c288]\n");
-	printf("\t\t\t output file is <hostname>_YYYYMMDD_HHMM.nmon\n");
-	printf("\t-F <filename> same as -f but user supplied filename\n");
-	printf("\t-r <runname>  goes into spreadsheet file [default hostname]\n");
-	printf("\t-t            include top processes in the output\n");
-	printf("\t-T            as -t plus saves command line arguments in UARG section\n");
-	printf("\t-s <seconds>  between snap shots\n");
-	printf("\t-c <number>   of refreshes\n");
-	printf("\t-d <disks>    to increase the number of disks [default 256]\n");
-	printf("\t-l <dpl>      disks/line default 150 to avoid spreadsheet issues. EMC=64.\n");
-	printf("\t-g <filename> User Defined Disk Groups (see above)\n");
-
-	printf("\t-N            include NFS Network File System\n");
-	printf("\t-I <percent>  Include precoess and disks busy threshold (default 0.1)\n");
-	printf("\t              don't save or show proc/disk using less than this percent\n");
-	printf("\t-m <directory> elmon changes to this directory before saving to file\n");
-	printf("\texample: collect for 1 hour at 30 second intervals with top procs\n");
-	printf("\t\t %s -f -t -r Test1 -s30 -c120\n",progname);
-	printf("\n");
-printf("\tTo load into a spreadsheet like Lotus 1-2-3:\n");
-	printf("\tsort -A *nmon >stats.csv\n");
-	printf("\ttransfer the stats.csv file to your PC\n");
-	printf("\tStart 1-2-3 and then Open <char-separated-value ASCII file>\n");
-	printf("\n");
-	printf("Capacity planning mode - use cron to run each day\n");
-	printf("\t-x            sensible spreadsheet output for CP =  one day\n");
-	printf("\t              every 15 mins for 1 day ( i.e. -ft -s 900 -c 96)\n");
-	printf("\t-X            sensible spreadsheet output for CP = busy hour\n");
-	printf("\t              every 30 secs for 1 hour ( i.e. -ft -s 30 -c 120)\n");
-	printf("\n");
-	printf("Set-up and installation\n");
-	printf("\t- this adds the disk %% busy numbers (otherwise they are zero)\n");
-	printf("\tIf you have hundreds of disk this can take 1%% to 2%% CPU\n");
-	printf("\n");
-
-	printf("Interactive Mode Commands\n");
-	printf("\tkey --- Toggles to control what is displayed ---\n");
-	printf("\th   = Online help information\n");
-	printf("\tr   = Machine type, machine name, cache details and OS version + LPAR\n");
-	printf("\tc   = CPU by processor stats with bar graphs\n");
-	printf("\tl   = long term CPU (over 75 snapshots) with bar graphs\n");
-	printf("\tm   = Memory stats\n");
-	printf("\tM   = Memory graphs\n");
-	printf("\tV   = Virtual Memory and Swap stats\n");
-	printf("\tk   = Kernel Internal stats\n"); 
-	printf("\tn   = Network stats and errors\n");
-	printf("\tN   = NFS Network File System\n");
-	printf("\td   = Disk I/O Graphs\n");
-	printf("\tD   = Disk I/O Stats\n");
-	printf("\to   = Disk I/O Map (one character per disk showing how busy it is)\n");
-#ifdef PARTITIONS
-	printf("\tP   = Partitions Disk I/O Stats\n");
-#endif 
-#ifdef POWER
-	printf("\tp   = Logical Partitions Stats\n");
-#endif 
-	printf("\tb   = black and white mode (or use -b option)\n");
-	printf("\t.   = minimum mode i.e. only busy disks and processes\n");
-	printf("\n");
-	printf("\tkey --- Other Controls ---\n");
-	printf("\t+   = double the screen refresh time\n");
-	printf("\t-   = halves the screen refresh time\n");
-	printf("\tq   = quit (also x, e or control-C)\n");
-	printf("\t0   = reset peak counts to zero (peak = \">\")\n");
-	printf("\tC   = Single-Column View\n");
-	printf("\tspace = refresh screen now\n");
-	printf("\n");
-	printf("Startup Control\n");
-	printf("\tIf you find you always type the same toggles every time you start\n");
-	printf("\tthen place them in the ELMON shell variable. For example:\n");
-	printf("\t export ELMON=cmdrvtan\n");
-
-	printf("\n");
-	printf("Others:\n");
-	printf("\ta) To you want to stop elmon - kill -USR2 <elmon-pid>\n");
-	printf("\tb) Use -p and elmon outputs the background process pid\n");
-	printf("\tc) To limit the processes elmon lists (online and to a file)\n");
-	printf("\t   Either set NMONCMD0 to NMONCMD63 to the program names\n");
-	printf("\t   or use -C cmd:cmd:cmd etc. example: -C ksh:vi:syncd\n");
-	printf("\td) If you want to pipe elmon output to other commands use a FIFO:\n");
-	printf("\t   mkfifo /tmp/mypipe\n");
-	printf("\t   elmon -F /tmp/mypipe &\n");
-	printf("\t   grep /tmp/mypipe\n");
-	printf("\te) If elmon fails please report it with:\n");
-	printf("\t   1) elmon version like: %s\n",VERSION);
-	printf("\t   2) the output of cat /proc/cpuinfo\n");
-	printf("\t   3) some clue of what you were doing\n");
-	printf("\t   4) I may ask you to run the debug version\n");
-	printf("\n");
-	exit(0);
+int i;
+int len;
+	len=strlen(s);
+	for(i=0;i<lpar_count;i++)
+		if( !strncmp(s,lpar_buffer[i],len))
+			return lpar_buffer[i];
+	return "";
 }
 
-#define JFSMAX 128
-#define LOAD 1
-#define UNLOAD 0
-#define JFSNAMELEN 64
-#define JFSTYPELEN 8
-
-struct jfs {
-	char name[JFSNAMELEN];
-	char device[JFSNAMELEN];
-	char type[JFSNAMELEN];
-	int  fd;
-	int  mounted;
-	} jfs[JFSMAX];
+#define NUMBER_NOT_VALID -999
 
-int jfses =0;
-void jfs_load(int load)
+long long read_longlong(char *s)
 {
+long long x;
+int ret;
+int len;
 int i;
-struct stat stat_buffer;
-FILE * mfp; /* FILE pointer for mtab file*/
-struct mntent *mp; /* mnt point stats */
-static int jfs_loaded = 0;
-
-	if(load==LOAD) { 
-		if(jfs_loaded == 0) { 
-			mfp = setmntent("/etc/mtab","r");
-			for(i=0; i<JFSMAX && (mp = getmntent(mfp) ) != NULL; i++) {
-				strncpy(jfs[i].device, mp->mnt_fsname,JFSNAMELEN);
-				strncpy(jfs[i].name,mp->mnt_dir,JFSNAMELEN);
-				strncpy(jfs[i].type, mp->mnt_type,JFSTYPELEN);
-				mp->mnt_fsname[JFSNAMELEN-1]=0;
-				mp->mnt_dir[JFSNAMELEN-1]=0;
-				mp->mnt_type[JFSTYPELEN-1]=0;
+char *str;
+	str = locate(s);
+	len=strlen(str);
+	if(len == 0) {
+		return NUMBER_NOT_VALID;
+	}
+	for(i=0;i<len;i++) {
+		if(str[i] == '=') {
+			ret = sscanf(&str[i+1], "%lld", &x);
+			if(ret != 1) {
+				fprintf(stderr,"sscanf for %s failed returned = %d line=%s\n", s, ret, str);
+				return -1;
 			}
-			endfsent();
-			jfs_loaded = 1;
-			jfses=i;
+			return x;
 		}
+	}
+	fprintf(stderr,"read_long_long failed returned line=%s\n", str);
+	return -2;
+}
 
-		/* 1st or later time - just reopen the mount points */
-		for(i=0;i<JFSMAX && jfs[i].name[0] !=0;i++) {
-			if(stat(jfs[i].name, &stat_buffer) != -1 ) {
 
-                                jfs[i].fd = open(jfs[i].name, O_RDONLY);
-                                if(jfs[i].fd != -1 ) 
-                                        jfs[i].mounted = 1;
-                                else
-                                        jfs[i].mounted = 0;
-			}
-			else jfs[i].mounted = 0;
-		}
-	} else { /* this is an unload request */
-		if(jfs_loaded)
-			for(i=0;i<JFSMAX && jfs[i].name[0] != 0;i++) {
-			    if(jfs[i].mounted)
-				close(jfs[i].fd);
-			    jfs[i].fd=0;
-			}
-		else 
-			/* do nothing */ ;
+int proc_lparcfg()
+{
+static FILE *fp = (FILE *)-1;
+char *str;
+	if( fp == (FILE *)-1) {
+           if( (fp = fopen("/proc/ppc64/lparcfg","r")) == NULL) {
+		error("failed to open - /proc/ppc64/lparcfg");
+		fp = (FILE *)-1;
+		return 0;
+	   }
+	}
+
+	for(lpar_count=0;lpar_count<LPAR_LINE_MAX-1;lpar_count++) {
+		if(fgets(lpar_buffer[lpar_count],LPAR_LINE_WIDTH-1,fp) == NULL)
+			break; 
 	}
+	if(lparcfg_reread) {
+		fclose(fp);
+		fp = (FILE *)-1;
+	} else rewind(fp);
+
+	str=locate("lparcfg");  	sscanf(str, "lparcfg %s", lparcfg.version_string);
+	str=locate("serial_number");	sscanf(str, "serial_number=%s", lparcfg.serial_number);
+	str=locate("system_type");	sscanf(str, "system_type=%s", lparcfg.system_type);
+
+#define GETDATA(variable) lparcfg.variable = read_longlong( __STRING(variable) );
+
+	GETDATA(partition_id);
+	GETDATA(BoundThrds);
+	GETDATA(CapInc);
+	GETDATA(DisWheRotPer);
+	GETDATA(MinEntCap);
+	GETDATA(MinEntCapPerVP);
+	GETDATA(MinMem);
+	GETDATA(DesMem);
+	GETDATA(MinProcs);
+	GETDATA(partition_max_entitled_capacity);
+	GETDATA(system_potential_processors);
+	GETDATA(partition_entitled_capacity);
+	GETDATA(system_active_processors);
+	GETDATA(pool_capacity);
+	GETDATA(unallocated_capacity_weight);
+	GETDATA(capacity_weight);
+	GETDATA(capped);
+	GETDATA(unallocated_capacity);
+	lparcfg.pool_idle_saved = lparcfg.pool_idle_time;
+	GETDATA(pool_idle_time);
+	lparcfg.pool_idle_diff = lparcfg.pool_idle_time - lparcfg.pool_idle_saved;
+	GETDATA(pool_num_procs);
+	lparcfg.purr_saved = lparcfg.purr;
+	GETDATA(purr);
+	lparcfg.purr_diff = lparcfg.purr - lparcfg.purr_saved;
+	GETDATA(partition_active_processors);
+	GETDATA(partition_potential_processors);
+	GETDATA(shared_processor_mode);
+	return 1;
 }
+#endif /*POWER*/
 
-/* We order this array rather than the actual process tables
- * the index is the position in the process table and
- * the time is the CPU used in the last period in seconds
+
+#define DISKMIN 256
+#define DISKMAX diskmax
+int diskmax = DISKMIN;
+
+#define CPUMAX 128
+
+/* statfs() of each entry in the jfs[] table of mounted filesystems */
+struct fs_stat {
+	int	mounted;
+	int	ret;			/* -1 = statfs failed */
+	unsigned long long blocks;
+	unsigned long long bfree;
+};
+
+/* The sources collect() reads, each gets the time it was read so a
+ * section's rates are over its own interval rather than the snapshot's:
+ * a long process scan no longer stretches or shrinks the disk rates
  */
-struct topper {
-	int	index;
-	int	other;
-	double	size;
-	double	io;
-	int	time;
-} *topper;
-int	topper_size = 200;
+#define SRC_SNAP	-1	/* the snapshot as a whole */
+#define SRC_STAT	0	/* /proc/stat */
+#define SRC_MEM		1
+#define SRC_VMSTAT	2
+#define SRC_DISK	3
+#define SRC_NET		4
+#define SRC_NFS		5
+#define SRC_IRQ		6
+#define SRC_PSI		7
+#define SRC_CGROUP	8
+#define SRC_NUMA	9
+#define SRC_JFS		10
+#define SRC_LPAR	11
+#define SRC_PROCS	12	/* the scan, each process has its own time too */
+#define SRC_MAX		13
+char	*src_name[SRC_MAX] = { "stat", "meminfo", "vmstat", "disks", "net", "nfs",
+	"interrupts", "psi", "cgroups", "numa", "jfs", "lpar", "procs" };
+
+/* The collectors, see collectors[] */
+#define COL_STAT	0	/* CPUs, context switches, interrupt count */
+#define COL_MEM		1
+#define COL_VMSTAT	2
+#define COL_KERNEL	3	/* uptime and load average */
+#define COL_DISK	4
+#define COL_NET		5
+#define COL_NFS		6
+#define COL_IRQ		7
+#define COL_PSI		8
+#define COL_CGROUP	9
+#define COL_NUMA	10
+#define COL_JFS		11
+#define COL_LPAR	12
+#define COL_PROCS	13
+#define COL_MAX		14
+#define COL_BIT(c)	(1U << (c))
 
-/* Routine used by qsort to order the processes by CPU usage */
-int	cpu_compare(const void *a, const void *b)
+struct data {
+	struct dsk_stat *dk;
+	struct cpu_stat cpu_total;
+	struct cpu_stat cpuN[CPUMAX];
+	struct mem_stat mem;
+	struct vm_stat vm;
+	struct nfs_stat nfs;
+	struct net_stat ifnets[NETMAX];
+#ifdef PARTITIONS
+	struct part_stat parts[PARTMAX];
+#endif /*PARTITIONS*/
+	struct irq_stat irq;
+	struct irq_stat softirq;
+	struct psi_stat psi[PSI_MAX];
+	struct cg_sample *cg;
+	int	cgroups;
+	int	cg_size;
+	struct numa_stat numa[NUMAMAX];
+	int	numa_nodes;
+	struct fs_stat *fs;
+	int	fses;
+#ifdef POWER
+	struct lpar_stat lpar;
+	int	lpar_ret;
+#endif /*POWER*/
+	int	vm_ret;
+	int	disks;
+	int	networks;
+	int	loop;
+	char	*cg_paths;
+	long	size;		/* bytes held by this snapshot */
+	struct data *older;	/* history list, UI thread only */
+	struct data *newer;
+	int	restart;	/* playback jumped, the ones before do not lead up to it */
+
+	struct timeval tv;
+	double time;
+	double late;		/* seconds after its deadline the collector took it */
+	double mono;		/* CLOCK_MONOTONIC as collect() started */
+	double stamp[SRC_MAX];	/* and in the middle of reading each source */
+	unsigned int collected;	/* COL_BIT()s of the collectors that ran */
+	struct procsinfo *procs;
+
+	int    nprocs;
+};
+
+/* The collector thread points p at its work area, the UI thread points
+ * p and q at the snapshot on the screen and the one before it.
+ */
+__thread struct data *p, *q;
+
+/* Seconds between the reads of source src in b and in a, or between the
+ * snapshots for SRC_SNAP and for snapshots without the times, the ones
+ * played back
+ */
+double snap_elapsed(struct data *a, struct data *b, int src)
 {
-	return (int)(((struct topper *)b)->time - ((struct topper *)a)->time);
+	if(src != SRC_SNAP && a->stamp[src] > b->stamp[src] && b->stamp[src] > 0.0)
+		return a->stamp[src] - b->stamp[src];
+	if(a->mono > b->mono && b->mono > 0.0)
+		return a->mono - b->mono;
+	return a->time - b->time;
 }
 
-int	size_compare(const void *a, const void *b)
+/* The collectors a section needs, and through collectors[] the ones they need */
+unsigned int section_needs(int item)
 {
-	return (int)((((struct topper *)b)->size - ((struct topper *)a)->size));
+	switch(item) {
+	case SHOW_CPU:
+	case SHOW_SMP:
+	case SHOW_LONGTERM:	return COL_BIT(COL_STAT);
+	case SHOW_VERBOSE:	return COL_BIT(COL_STAT) | COL_BIT(COL_DISK);
+	case SHOW_KERNEL:	return COL_BIT(COL_STAT) | COL_BIT(COL_KERNEL);
+	case SHOW_DISK:
+	case SHOW_DISKMAP:
+	case SHOW_DGROUP:
+	case SHOW_PARTITIONS:	return COL_BIT(COL_DISK);
+	case SHOW_MEMORY:
+	case SHOW_MEMORY_GRAPH:
+	case SHOW_LARGE:	return COL_BIT(COL_MEM);
+	case SHOW_VM:		return COL_BIT(COL_VMSTAT);
+	case SHOW_NET:
+	case SHOW_NETERROR:	return COL_BIT(COL_NET);
+	case SHOW_NFS:		return COL_BIT(COL_NFS);
+	case SHOW_IRQ:		return COL_BIT(COL_IRQ) | COL_BIT(COL_STAT);
+	case SHOW_PSI:		return COL_BIT(COL_PSI);
+	case SHOW_CGROUP:	return COL_BIT(COL_CGROUP);
+	case SHOW_NUMA:		return COL_BIT(COL_NUMA);
+	case SHOW_JFS:		return COL_BIT(COL_JFS);
+	case SHOW_LPAR:		return COL_BIT(COL_LPAR);
+	case SHOW_TOP:		return COL_BIT(COL_PROCS);
+	}
+	return 0;
 }
 
-int	disk_compare(void *a, void *b)
+/* Whether snapshot s has what the collectors in needs read.  Played back
+ * ones have whatever was recorded.
+ */
+int snap_has(struct data *s, unsigned int needs)
 {
-	return (int)((((struct topper *)b)->io - ((struct topper *)a)->io));
+	return s->mono == 0.0 || (s->collected & needs) == needs;
 }
 
+/* The source whose rates a section shows */
+int show_source(int item)
+{
+	switch(item) {
+	case SHOW_DISK:
+	case SHOW_DISKMAP:
+	case SHOW_DGROUP:
+	case SHOW_VERBOSE:	return SRC_DISK;
+	case SHOW_NET:
+	case SHOW_NETERROR:	return SRC_NET;
+	case SHOW_NFS:		return SRC_NFS;
+	case SHOW_IRQ:		return SRC_IRQ;
+	case SHOW_PSI:		return SRC_PSI;
+	case SHOW_CGROUP:	return SRC_CGROUP;
+	case SHOW_NUMA:		return SRC_NUMA;
+	case SHOW_JFS:		return SRC_JFS;
+	case SHOW_LPAR:		return SRC_LPAR;
+	case SHOW_TOP:		return SRC_PROCS;
+	case SHOW_MEMORY:
+	case SHOW_MEMORY_GRAPH:
+	case SHOW_LARGE:	return SRC_MEM;
+	case SHOW_VM:		return SRC_VMSTAT;
+	}
+	return SRC_STAT;
+}
 
-/* checkinput is the subroutine to handle user input */
-int checkinput(void)
+void snapshot_free(struct data *s)
 {
-	static int use_env = 1;
-	char	buf[1024];
-	int	chars;
-	int	key;
-	int	i = 0;
-	char *p;
-	int 	keys = 0;  //Keeps track if a key was pressed.  1 = yes, 2 = arrow key was pressed
+	FREE(s->dk);
+	FREE(s->procs);
+	FREE(s->fs);
+	FREE(s->irq.row);
+	FREE(s->irq.cpu);
+	FREE(s->irq.count);
+	FREE(s->softirq.row);
+	FREE(s->softirq.cpu);
+	FREE(s->softirq.count);
+	FREE(s->cg);
+	FREE(s->cg_paths);
+	FREE(s);
+}
 
-	if (!cursed) /* not user input so stop with control-C */
-		return 0;
+/* The UI thread keeps the last snapshots so a spike can be looked at
+ * after it has scrolled past.  The oldest go when there are more than
+ * hist_max of them or they take more than hist_budget bytes.
+ */
+struct data *hist_oldest = NULL;
+struct data *hist_newest = NULL;
+struct data *hist_view = NULL;	/* snapshot on the screen, NULL = live */
+long	hist_count = 0;
+long	hist_bytes = 0;
+long	hist_max = 3600;	/* -H <count> */
+long	hist_budget = 64*1024*1024;	/* -H <size>M */
+
+void history_add(struct data *s)
+{
+struct data *old;
 
-	if (use_env){
-		use_env = 0;
-		p=getenv("ELMON");
-		if(p!=0){
-			strcpy(buf,p);
-			chars = strlen(buf);
-                        for (i = chars; i >= 0; i--){
-				ungetch(buf[i]);
-			}
-                }
+	s->older = hist_newest;
+	s->newer = NULL;
+	if(hist_newest != NULL)
+		hist_newest->newer = s;
+	else
+		hist_oldest = s;
+	hist_newest = s;
+	hist_count++;
+	hist_bytes += s->size;
+
+	/* always keep a pair, the rates need a previous snapshot */
+	while(hist_count > 2 && (hist_count > hist_max || hist_bytes > hist_budget)) {
+		old = hist_oldest;
+		if(hist_view == old->newer)	/* do not pull the q out from under it */
+			hist_view = hist_view->newer;
+		hist_oldest = old->newer;
+		hist_oldest->older = NULL;
+		hist_count--;
+		hist_bytes -= old->size;
+		snapshot_free(old);
 	}
-	
-	key = getch();
-		while (key != ERR){
-				keys = 1;
-				welcome=0;
-				switch (key) {
-				case 'x':
-				case 'q':
-					nocbreak();
-					endwin();
-					exit(0);
+}
 
-				case '6':
-				case '7':
-				case '8':
-				case '9':
-					dotline = buf[i] - '0';
-					break;
-				case '+':
-					seconds = seconds * 2;
-					if (seconds > 10 && (seconds % 10 != 0)){
-						seconds = (int)(seconds / 10) * 10;
-					}
-					break;
-				case '-':
-					seconds = seconds / 2;
-					if (seconds < 1)
-						seconds = 1;
-					if (seconds > 10 && (seconds % 10 != 0)){
-						seconds = (int)(seconds / 10) * 10;
-					}
-					break;
-				case '.':
-					if (show_all)
-						show_all = 0;
-					else {
-						show_all = 1;
-						show_disk_mode = SHOW_DISK_STATS;
-						add_option(SHOW_DISK);
-						add_option(SHOW_TOP);
-						show_topmode =3;
-					}
-					clear();
-					break;
-				case '?':
-				case 'h':
-				case 'H':
-                                        if (enabled_option(SHOW_HELP))
-                                                remove_option(SHOW_HELP);
-                                        else {
-                                                add_option(SHOW_HELP);
-                                                remove_option(SHOW_VERBOSE);
-                                        }
-					clear();
-					break;
-				case 'b':
-				case 'B':
-					FLIP(colour);
-					clear();
-					break;
-				case 'Z':
-					FLIP(show_raw);
-					add_option(SHOW_SMP);
-					clear();
-					break;
-				case 'l':
-					flip (SHOW_LONGTERM);
-					clear();
-					break;
-				case 'p':
-					flip(SHOW_LPAR);
-					clear();
-					break;
-				case 'V':
-					flip(SHOW_VM);
-					clear();
-					break;
-				case 'j':
-				case 'J':
-                                        flip(SHOW_JFS);
-                                        if (enabled_option(SHOW_JFS)){
-                                                jfs_load(1);
-                                        }else{
-                                                jfs_load(0);
-                                        }
-					clear();
-					break;
-#ifdef PARTITIONS
-				case 'P':
-					flip(SHOW_PARTITIONS);
-					clear();
-					break;
-#endif /*PARTITIONS*/
-				case 'k':
-				case 'K':
-					flip(SHOW_KERNEL);
-					clear();
-					break;
-				case 'm':
-					flip(SHOW_MEMORY);
-					clear();
-					break;
-				case 'M':
+/* Drop the lot, playback jumped to somewhere else in the recording */
+void history_clear()
+{
+struct data *old;
+
+	while( (old = hist_oldest) != NULL) {
+		hist_oldest = old->newer;
+		snapshot_free(old);
+	}
+	hist_newest = hist_view = NULL;
+	hist_count = 0;
+	hist_bytes = 0;
+}
+
+/* Move the view one snapshot back (-1) or forward (1), this pauses the screen */
+void history_step(int dir)
+{
+	if(hist_view == NULL)
+		hist_view = hist_newest;
+	if(dir < 0 && hist_view->older != NULL && hist_view->older->older != NULL)
+		hist_view = hist_view->older;
+	if(dir > 0 && hist_view->newer != NULL)
+		hist_view = hist_view->newer;
+}
+
+/* How busy the thing a section shows was between snapshots a and b, NAN
+ * if they do not have what it is worked out from
+ */
+double history_metric(int item, struct data *a, struct data *b)
+{
+double elapsed = snap_elapsed(a, b, item == SHOW_IRQ ? SRC_STAT : show_source(item));
+unsigned int needs = section_needs(item) ? section_needs(item) : COL_BIT(COL_STAT);
+double value = 0.0;
+double total;
+int i;
+int r;
+
+	if(elapsed <= 0.0 || !snap_has(a, needs) || !snap_has(b, needs))
+		return NAN;
+	switch(item) {
+	case SHOW_DISK:
+	case SHOW_DISKMAP:
+	case SHOW_DGROUP:
+		for(i = 0; i < a->disks && i < b->disks; i++)
+			if(a->dk[i].dk_time - b->dk[i].dk_time > value)
+				value = a->dk[i].dk_time - b->dk[i].dk_time;
+		return value / elapsed;
+	case SHOW_NET:
+	case SHOW_NETERROR:
+		for(i = 0; i < a->networks && i < b->networks; i++)
+			value += (a->ifnets[i].if_ibytes - b->ifnets[i].if_ibytes)
+				+ (a->ifnets[i].if_obytes - b->ifnets[i].if_obytes);
+		return value / elapsed;
+	case SHOW_MEMORY:
+	case SHOW_MEMORY_GRAPH:
+	case SHOW_LARGE:
+	case SHOW_VM:
+		return (double)(a->mem.memtotal - a->mem.memfree);
+	case SHOW_KERNEL:
+		return (a->cpu_total.ctxt - b->cpu_total.ctxt) / elapsed;
+	case SHOW_IRQ:
+		return (a->cpu_total.intr - b->cpu_total.intr) / elapsed;
+	case SHOW_PSI:
+		for(r = 0; r < PSI_MAX; r++)
+			if(a->psi[r].valid && b->psi[r].valid
+			&& a->psi[r].some.total - b->psi[r].some.total > value)
+				value = a->psi[r].some.total - b->psi[r].some.total;
+		return value / elapsed;
+	default:	/* CPU busy */
+		total = (a->cpu_total.user - b->cpu_total.user)
+			+ (a->cpu_total.nice - b->cpu_total.nice)
+			+ (a->cpu_total.sys - b->cpu_total.sys)
+			+ (a->cpu_total.irq - b->cpu_total.irq)
+			+ (a->cpu_total.softirq - b->cpu_total.softirq)
+			+ (a->cpu_total.steal - b->cpu_total.steal);
+		value = total + (a->cpu_total.wait - b->cpu_total.wait)
+			+ (a->cpu_total.idle - b->cpu_total.idle);
+		return value > 0.0 ? total / value : 0.0;
+	}
+}
+
+/* Pause on the busiest snapshot for the section switched on last */
+void history_peak()
+{
+struct data *s;
+double max = -1.0;
+double value;
+int item = SHOW_CPU;
+int i;
+
+	for(i = optionCount - 1; i >= 0; i--)
+		if(enabled_options[i] != SHOW_HELP && enabled_options[i] != SHOW_VERBOSE) {
+			item = enabled_options[i];
+			break;
+		}
+	for(s = hist_oldest->newer; s != NULL; s = s->newer) {
+		value = history_metric(item, s, s->older);
+		if(value > max) {
+			max = value;
+			hist_view = s;
+		}
+	}
+}
+
+/* Number of snapshots the screen is behind the newest one */
+long history_behind()
+{
+struct data *s;
+long n = 0;
+
+	for(s = hist_view; s != NULL && s != hist_newest; s = s->newer)
+		n++;
+	return n;
+}
+
+
+
+long long read_vmline(FILE *fp, char  *s)
+{
+char buffer[4096];
+int len;
+ int ret;
+long long var;
+
+	if(fgets(buffer,4096-1,fp) == NULL)
+		return -1;
+	len = strlen(s) +1;
+	var = -1;
+	ret = sscanf(&buffer[len],"%lld", &var);
+	if(ret == 1)
+		return var;
+	else
+		return -1;
+}
+
+#define GETVM(variable) p->vm.variable = read_vmline(fp, __STRING(variable) );
+
+int read_vmstat()
+{
+FILE *fp;
+
+	if( (fp = proc_stream(P_VMSTAT)) == NULL)
+		return -1;
+	GETVM(nr_dirty);
+	GETVM(nr_writeback);
+	GETVM(nr_unstable);
+	GETVM(nr_page_table_pages);
+	GETVM(nr_mapped);
+	GETVM(nr_slab);
+	GETVM(pgpgin);
+	GETVM(pgpgout);
+	GETVM(pswpin);
+	GETVM(pswpout);
+	GETVM(pgalloc_high);
+	GETVM(pgalloc_normal);
+	GETVM(pgalloc_dma);
+	GETVM(pgfree);
+	GETVM(pgactivate);
+	GETVM(pgdeactivate);
+	GETVM(pgfault);
+	GETVM(pgmajfault);
+	GETVM(pgrefill_high);
+	GETVM(pgrefill_normal);
+	GETVM(pgrefill_dma);
+	GETVM(pgsteal_high);
+	GETVM(pgsteal_normal);
+	GETVM(pgsteal_dma);
+	GETVM(pgscan_kswapd_high);
+	GETVM(pgscan_kswapd_normal);
+	GETVM(pgscan_kswapd_dma);
+	GETVM(pgscan_direct_high);
+	GETVM(pgscan_direct_normal);
+	GETVM(pgscan_direct_dma);
+	GETVM(pginodesteal);
+	GETVM(slabs_scanned);
+	GETVM(kswapd_steal);
+	GETVM(kswapd_inodesteal);
+	GETVM(pageoutrun);
+	GETVM(allocstall);
+	GETVM(pgrotated);
+	fclose(fp);
+	return 1;
+}
+
+
+/* These macro simplify the access to the Main data structure */
+#define DKDELTA(member) ( (q->dk[i].member > p->dk[i].member) ? 0 : (p->dk[i].member - q->dk[i].member))
+#define SIDELTA(member) ( (q->si.member > p->si.member)       ? 0 : (p->si.member - q->si.member))
+
+#define IFNAME 64
+
+#define TIMEDELTA(member,index1,index2) ((p->procs[index1].member) - (q->procs[index2].member))
+#define COUNTDELTA(member) ( (q->procs[topper[j].other].member > p->procs[i].member) ? 0 : (p->procs[i].member  - q->procs[topper[j].other].member) )
+
+#define TIMED(member) ((double)(p->procs[i].member.tv_sec)) 
+
+double mem_peak = 0;
+double swap_peak = 0;
+double *cpu_peak; /* ptr to array  - 1 for each cpu - 0 = average for machine */
+double *disk_busy_peak;
+double *disk_rate_peak;
+double net_read_peak[NETMAX];
+double net_write_peak[NETMAX];
+int aiorunning;
+int aiorunning_max = 0;
+int aiocount;
+int aiocount_max = 0;
+float aiotime;
+float aiotime_max =0.0;
+
+char *dskgrp(int i)
+{
+static char error_string[] = { "Too-Many-Disks" };
+static char *string[16] = {"",   "1",  "2",  "3", 
+			   "4",  "5",  "6",  "7", 
+			   "8",  "9",  "10", "11", 
+			   "12", "13", "14", "15"};
+
+	i = (int)((float)i/(float)disks_per_line);
+	if(0 <= i && i <= 15 ) 
+		return string[i];
+	return error_string;
+}
+
+/* The -f disk sections, one line every disks_per_line disks */
+char *disk_section[5] = { "DISKBUSY", "DISKREAD", "DISKWRITE", "DISKXFER", "DISKBSIZE" };
+char *disk_rrd[5]     = { "diskbusy", "diskread", "diskwrite", "diskxfer", "diskbsize" };
+
+/* Start the record of disk section m for the line disk i is first on */
+void disk_begin(int m, int i)
+{
+char section[32];
+char rrd[32];
+
+	strcpy(section, disk_section[m]);
+	strcat(section, dskgrp(i));
+	strcpy(rrd, disk_rrd[m]);
+	strcat(rrd, dskgrp(i));
+	strcat(rrd, ".rrd");
+	enc_begin(section, rrd);
+}
+
+/* command checking against a list */
+
+#define CMDMAX 64
+
+char *cmdlist[CMDMAX];
+int cmdfound = 0;
+
+int cmdcheck(char *cmd)
+{
+	int i;
+#ifdef CMDDEBUG
+	fprintf(stderr,"cmdfound=%d\n",cmdfound);
+	for(i=0;i<cmdfound;i++)
+		fprintf(stderr,"cmdlist[%d]=\"%s\"\n",i,cmdlist[i]);
+#endif /* CMDDEBUG */
+	for(i=0;i<cmdfound;i++) {
+		if(strlen(cmdlist[i]) == 0)
+			continue;
+		if( !strncmp(cmdlist[i],cmd,strlen(cmdlist[i])) )
+			return 1;
+	}
+	return 0;
+}
+
+/* Convert secs + micro secs to a double */
+double	doubletime(void)
+{
+
+	gettimeofday(&p->tv, 0);
+	return((double)p->tv.tv_sec + p->tv.tv_usec * 1.0e-6);
+}
+
+/* Seconds on CLOCK_MONOTONIC, which setting the clock does not move */
+double	monotime(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((double)ts.tv_sec + ts.tv_nsec * 1.0e-9);
+}
+
+int stat8 = 0; /* used to determine the number of variables on a line */
+
+void proc_cpu()
+{
+int i;
+static int intr_line = 0;
+static int ctxt_line = 0;
+static int btime_line= 0;
+static int proc_line = 0;
+static int run_line  = 0;
+static int block_line= 0;
+static int proc_cpu_first_time = 1;
+long long user;
+long long nice;
+long long sys;
+long long idle;
+long long iowait;
+long long hardirq;
+long long softirq;
+long long steal;
+
+	if(proc_cpu_first_time) {
+		stat8 = sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld %lld %lld %lld %lld", 
+			&user,
+			&nice,
+			&sys,
+			&idle,
+			&iowait,
+			&hardirq,
+			&softirq,
+			&steal);
+		proc_cpu_first_time = 0;
+	}
+	user = nice = sys = idle = iowait = hardirq = softirq = steal = 0;
+	if(stat8 == 8) {
+		sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld %lld %lld %lld %lld", 
+			&user,
+			&nice,
+			&sys,
+			&idle,
+			&iowait,
+			&hardirq,
+			&softirq,
+			&steal);
+	} else { /* stat 4 variables here as older Linux proc */
+		sscanf(&proc[P_STAT].line[0][5], "%lld %lld %lld %lld", 
+			&user,
+			&nice,
+			&sys,
+			&idle);
+	}
+	p->cpu_total.user = user + nice;
+	p->cpu_total.wait = iowait; /* in the case of 4 variables = 0 */
+	p->cpu_total.sys  = sys;
+	/* p->cpu_total.sys  = sys + hardirq + softirq + steal;*/
+	p->cpu_total.idle = idle;
+	
+	p->cpu_total.irq     = hardirq;
+	p->cpu_total.softirq = softirq;
+	p->cpu_total.steal   = steal;
+	p->cpu_total.nice    = nice;
+#ifdef DEBUG
+	if(debug)fprintf(stderr,"XX user=%lld wait=%lld sys=%lld idle=%lld\n",
+			p->cpu_total.user,
+			p->cpu_total.wait,
+			p->cpu_total.sys,
+			p->cpu_total.idle);
+#endif /*DEBUG*/
+
+	for(i=0;i<cpus;i++ ) {
+	    user = nice = sys = idle = iowait = hardirq = softirq = steal = 0;
+	    if(stat8 == 8) {
+		sscanf(&proc[P_STAT].line[i+1][5], 
+			"%lld %lld %lld %lld %lld %lld %lld %lld", 
+		&user,
+		&nice,
+		&sys,
+		&idle,
+		&iowait,
+		&hardirq,
+		&softirq,
+		&steal);
+	    } else {
+		sscanf(&proc[P_STAT].line[i+1][5], "%lld %lld %lld %lld", 
+		&user,
+		&nice,
+		&sys,
+		&idle);
+	    }
+		p->cpuN[i].user = user + nice;
+		p->cpuN[i].wait = iowait;
+		p->cpuN[i].sys  = sys;
+		/*p->cpuN[i].sys  = sys + hardirq + softirq + steal;*/
+		p->cpuN[i].idle = idle;
+
+		p->cpuN[i].irq     = hardirq;
+		p->cpuN[i].softirq = softirq;
+		p->cpuN[i].steal   = steal;
+		p->cpuN[i].nice    = nice;
+	}
+
+	if(intr_line == 0) {
+		if(proc[P_STAT].line[i+1][0] == 'p' &&
+		   proc[P_STAT].line[i+1][1] == 'a' &&
+		   proc[P_STAT].line[i+1][2] == 'g' &&
+		   proc[P_STAT].line[i+1][3] == 'e' ) {
+			/* 2.4 kernel */
+			intr_line = i+3;
+			ctxt_line = i+5;
+			btime_line= i+6;
+			proc_line = i+7;
+			run_line  = i+8;
+			block_line= i+9;
+		}else {
+			/* 2.6 kernel */
+			intr_line = i+1;
+			ctxt_line = i+2;
+			btime_line= i+3;
+			proc_line = i+4;
+			run_line  = i+5;
+			block_line= i+6;
+		}
+	}
+	p->cpu_total.intr = -1;
+	p->cpu_total.ctxt = -1;
+	p->cpu_total.btime = -1;
+	p->cpu_total.procs = -1;
+	p->cpu_total.running = -1;
+	p->cpu_total.blocked = -1;
+	if(proc[P_STAT].lines >= intr_line)
+	sscanf(&proc[P_STAT].line[intr_line][0], "intr %lld", &p->cpu_total.intr);
+	if(proc[P_STAT].lines >= ctxt_line)
+	sscanf(&proc[P_STAT].line[ctxt_line][0], "ctxt %lld", &p->cpu_total.ctxt);
+	if(proc[P_STAT].lines >= btime_line)
+	sscanf(&proc[P_STAT].line[btime_line][0], "btime %lld", &p->cpu_total.btime);
+	if(proc[P_STAT].lines >= proc_line)
+	sscanf(&proc[P_STAT].line[proc_line][0], "processes %lld", &p->cpu_total.procs);
+	if(proc[P_STAT].lines >= run_line)
+	sscanf(&proc[P_STAT].line[run_line][0], "procs_running %lld", &p->cpu_total.running);
+	if(proc[P_STAT].lines >= block_line)
+	sscanf(&proc[P_STAT].line[block_line][0], "procs_blocked %lld", &p->cpu_total.blocked);
+}
+
+void proc_nfs()
+{
+int i;
+int j;
+    if(proc[P_NFS].len > 0) {
+	/* line readers "proc2 18 num num etc" */
+	for(j=0,i=8;i<strlen(proc[P_NFS].line[2]);i++) {
+		if(proc[P_NFS].line[2][i] == ' ') {
+			p->nfs.v2c[j] =atol(&proc[P_NFS].line[2][i+1]);
+			j++;
+		}
+	}
+	/* line readers "proc3 22 num num etc" */
+	for(j=0,i=8;i<strlen(proc[P_NFS].line[3]);i++) {
+		if(proc[P_NFS].line[3][i] == ' ') {
+			p->nfs.v3c[j] =atol(&proc[P_NFS].line[3][i+1]);
+			j++;
+		}
+	}
+    }
+	/* line readers "proc2 18 num num etc" */
+    if(proc[P_NFSD].len > 0) {
+	for(j=0,i=8;i<strlen(proc[P_NFSD].line[7]);i++) {
+		if(proc[P_NFSD].line[2][i] == ' ') {
+			p->nfs.v2s[j] =atol(&proc[P_NFSD].line[2][i+1]);
+			j++;
+		}
+	}
+	/* line readers "proc3 22 num num etc" */
+	for(j=0,i=8;i<strlen(proc[P_NFSD].line[8]);i++) {
+		if(proc[P_NFS].line[3][i] == ' ') {
+			p->nfs.v3s[j] =atol(&proc[P_NFSD].line[3][i+1]);
+			j++;
+		}
+	}
+    }
+}
+
+void proc_kernel()
+{
+int i;
+	p->cpu_total.uptime=0.0;
+	p->cpu_total.idletime=0.0;
+	p->cpu_total.uptime=atof(proc[P_UPTIME].line[0]);
+	for(i=0;i<strlen(proc[P_UPTIME].line[0]);i++) {
+		if(proc[P_UPTIME].line[0][i] == ' ') {
+			p->cpu_total.idletime=atof(&proc[P_UPTIME].line[0][i+1]);
+			break;
+		}
+	}
+
+        sscanf(&proc[P_LOADAVG].line[0][0], "%f %f %f", 
+		&p->cpu_total.mins1,
+		&p->cpu_total.mins5,
+		&p->cpu_total.mins15);
+
+}
+
+char *proc_find_sb(char * p)
+{
+	for(; *p != 0;p++)
+		if(*p == ' ' && *(p+1) == '(')
+			return p;
+	return 0;
+}
+
+#define DISK_MODE_IO 1
+#define DISK_MODE_DISKSTATS 2
+#define DISK_MODE_PARTITIONS 3
+
+int disk_mode = 0;
+
+void proc_disk_io()
+{
+int diskline;
+int i;
+int ret;
+char *str;
+
+	disks = 0;
+	for(diskline=0;diskline<proc[P_STAT].lines;diskline++) {
+		if(strncmp("disk_io", proc[P_STAT].line[diskline],7) == 0) 
+			break;
+	}
+	for(i=8;i<strlen(proc[P_STAT].line[diskline]);i++) {
+		if( proc[P_STAT].line[diskline][i] == ':')
+			disks++;
+	}
+
+	str=&proc[P_STAT].line[diskline][0];
+	for(i=0;i<disks;i++) {
+		str=proc_find_sb(str);
+		if(str == 0)
+			break;
+		ret = sscanf(str, " (%d,%d):(%ld,%ld,%ld,%ld,%ld", 
+			&p->dk[i].dk_major,
+			&p->dk[i].dk_minor,
+			&p->dk[i].dk_noinfo,
+			&p->dk[i].dk_reads,
+			&p->dk[i].dk_rkb,
+			&p->dk[i].dk_writes,
+			&p->dk[i].dk_wkb);
+		if(ret != 7)
+			exit(7);
+		p->dk[i].dk_xfers = p->dk[i].dk_noinfo;
+		/* blocks  are 512 bytes*/
+		p->dk[i].dk_rkb = p->dk[i].dk_rkb/2;
+		p->dk[i].dk_wkb = p->dk[i].dk_wkb/2;
+
+		p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
+		/* no busy time, disk_delta() makes it up */
+
+		sprintf(p->dk[i].dk_name,"dev-%d-%d",p->dk[i].dk_major,p->dk[i].dk_minor);
+/*	fprintf(stderr,"disk=%d name=\"%s\" major=%d minor=%d\n", i,p->dk[i].dk_name, p->dk[i].dk_major,p->dk[i].dk_minor); */
+		str++;
+	}
+}
+
+void proc_diskstats()
+{
+FILE *fp;
+char buf[1024];
+int i;
+int ret;
+
+	if( (fp = proc_stream(P_DISKSTATS)) == NULL) {
+		disks=0;
+		return;
+	}
+/*
+   2    0 fd0 1 0 2 13491 0 0 0 0 0 13491 13491
+   3    0 hda 41159 53633 1102978 620181 39342 67538 857108 4042631 0 289150 4668250
+   3    1 hda1 58209 58218 0 0
+   3    2 hda2 148 4794 10 20
+   3    3 hda3 65 520 0 0
+   3    4 hda4 35943 1036092 107136 857088
+  22    0 hdc 167 5394 22308 32250 0 0 0 0 0 22671 32250 <-- USB !!
+   8    0 sda 990 2325 4764 6860 9 3 12 417 0 6003 7277
+   8    1 sda1 3264 4356 12 12
+*/
+	for(i=0;i<DISKMAX;) {
+		if(fgets(buf,1024,fp) == NULL)
+			break;
+		/* zero the data ready for reading */
+		p->dk[i].dk_major = 
+		p->dk[i].dk_minor =
+		p->dk[i].dk_name[0] =
+		p->dk[i].dk_reads =
+		p->dk[i].dk_rmerge =
+		p->dk[i].dk_rkb =
+		p->dk[i].dk_rmsec =
+		p->dk[i].dk_writes =
+		p->dk[i].dk_wmerge =
+		p->dk[i].dk_wkb =
+		p->dk[i].dk_wmsec =
+		p->dk[i].dk_inflight =
+		p->dk[i].dk_time =
+		p->dk[i].dk_11 =0;
+
+		ret = sscanf(&buf[0], "%d %d %s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+			&p->dk[i].dk_major,
+			&p->dk[i].dk_minor,
+			&p->dk[i].dk_name[0],
+			&p->dk[i].dk_reads,
+			&p->dk[i].dk_rmerge,
+			&p->dk[i].dk_rkb,
+			&p->dk[i].dk_rmsec,
+			&p->dk[i].dk_writes,
+			&p->dk[i].dk_wmerge,
+			&p->dk[i].dk_wkb,
+			&p->dk[i].dk_wmsec,
+			&p->dk[i].dk_inflight,
+			&p->dk[i].dk_time,
+			&p->dk[i].dk_11 );
+		if(ret == 7) { /* suffle the data around due to missing columns for partitions */
+			p->dk[i].dk_partition = 1;
+			p->dk[i].dk_wkb = p->dk[i].dk_rmsec;
+			p->dk[i].dk_writes = p->dk[i].dk_rkb;
+			p->dk[i].dk_rkb = p->dk[i].dk_rmerge;
+			p->dk[i].dk_rmsec=0;
+			p->dk[i].dk_rmerge=0;
+	
+		}
+		else if(ret == 14) p->dk[i].dk_partition = 0;
+		else fprintf(stderr,"disk sscanf wanted 14 but returned=%d line=%s\n", 
+	 			ret,buf);
+
+		p->dk[i].dk_rkb /= 2; /* sectors = 512 bytes */
+		p->dk[i].dk_wkb /= 2;
+		/*p->dk[i].dk_xfers = p->dk[i].dk_rkb + p->dk[i].dk_wkb;*/
+		p->dk[i].dk_xfers = p->dk[i].dk_reads + p->dk[i].dk_writes;
+		if(p->dk[i].dk_xfers == 0)
+			p->dk[i].dk_bsize = 0;
+		else
+			p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
+
+		p->dk[i].dk_time /= 10.0; /* in milli-seconds to make it upto 100%, 1000/100 = 10 */
+	
+		if(p->dk[i].dk_reads != 0 || p->dk[i].dk_writes != 0) 
+			i++;	
+	}
+	fclose(fp);
+	disks = i;
+}
+
+void strip_spaces(char *s)
+{
+char *p;
+int spaced=1;
+
+	p=s;
+	for(p=s;*p!=0;p++) {
+		if(*p == ':')
+			*p=' ';
+		if(*p != ' ') {
+			*s=*p;
+			s++;
+			spaced=0;
+		} else if(spaced) {
+			/* do no thing as this is second space */
+			} else {
+				*s=*p;
+				s++;
+				spaced=1;
+			}
+
+	}
+	*s = 0;
+}
+
+void proc_partitions()
+{
+static FILE *fp = (FILE *)-1;
+char buf[1024];
+int i = 0;
+int ret;
+
+	if( fp == (FILE *)-1) {
+           if( (fp = fopen("/proc/partitions","r")) == NULL) {
+		error("failed to open - /proc/partitions");
+		partitions=0;
+		return;
+	   }
+	}
+	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
+	if(fgets(buf,1024,fp) == NULL) goto end;
+/*
+major minor  #blocks  name     rio rmerge rsect ruse wio wmerge wsect wuse running use aveq
+
+  33     0    1052352 hde 2855 15 2890 4760 0 0 0 0 -4 7902400 11345292
+  33     1    1050304 hde1 2850 0 2850 3930 0 0 0 0 0 3930 3930
+   3     0   39070080 hda 9287 19942 226517 90620 8434 25707 235554 425790 -12 7954830 33997658
+   3     1   31744408 hda1 651 90 5297 2030 0 0 0 0 0 2030 2030
+   3     2    6138720 hda2 7808 19561 218922 79430 7299 20529 222872 241980 0 59950 321410
+   3     3     771120 hda3 13 41 168 80 0 0 0 0 0 80 80
+   3     4          1 hda4 0 0 0 0 0 0 0 0 0 0 0
+   3     5     408208 hda5 812 241 2106 9040 1135 5178 12682 183810 0 11230 192850
+*/
+	for(i=0;i<DISKMAX;i++) {
+		if(fgets(buf,1024,fp) == NULL)
+			break;
+		strip_spaces(buf);
+		ret = sscanf(&buf[0], "%d %d %lu %s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+			&p->dk[i].dk_major,
+			&p->dk[i].dk_minor,
+			&p->dk[i].dk_blocks,
+		(char *)&p->dk[i].dk_name,
+			&p->dk[i].dk_reads,
+			&p->dk[i].dk_rmerge,
+			&p->dk[i].dk_rkb,
+			&p->dk[i].dk_rmsec,
+			&p->dk[i].dk_writes,
+			&p->dk[i].dk_wmerge,
+			&p->dk[i].dk_wkb,
+			&p->dk[i].dk_wmsec,
+			&p->dk[i].dk_inflight,
+			&p->dk[i].dk_use,
+			&p->dk[i].dk_aveq
+			);
+		p->dk[i].dk_rkb /= 2; /* sectors = 512 bytes */
+		p->dk[i].dk_wkb /= 2;
+		p->dk[i].dk_xfers = p->dk[i].dk_rkb + p->dk[i].dk_wkb;
+		if(p->dk[i].dk_xfers == 0)
+			p->dk[i].dk_bsize = 0;
+		else
+			p->dk[i].dk_bsize = (p->dk[i].dk_rkb+p->dk[i].dk_wkb)/p->dk[i].dk_xfers*1024;
+
+		p->dk[i].dk_time /= 10.0; /* in milli-seconds to make it upto 100%, 1000/100 = 10 */
+	
+		if(ret != 15) {
+#ifdef DEBUG
+			if(debug)fprintf(stderr,"sscanf wanted 15 returned = %d line=%s\n", ret,buf);
+#endif /*DEBUG*/
+			partitions_short = 1;
+		} else partitions_short = 0;
+	}
+	end:
+	if(reread) {
+		fclose(fp);
+		fp = (FILE *)-1;
+	} else rewind(fp);
+	disks = i;
+}
+
+void proc_disk_init()
+{
+struct stat buf;
+int ret;
+	if(disk_mode == 0) {
+		ret = stat("/proc/diskstats", &buf);
+		if(ret == 0) {
+			disk_mode=DISK_MODE_DISKSTATS;
+		} else {
+	               ret = stat("/proc/partitions", &buf);
+			if(ret == 0) {
+				disk_mode=DISK_MODE_PARTITIONS;
+			} else {
+				disk_mode=DISK_MODE_IO;
+			}
+		}
+	}
+}
+
+void proc_disk()
+{
+	switch(disk_mode){
+	case DISK_MODE_IO: 		proc_disk_io();   break;
+	case DISK_MODE_DISKSTATS: 	proc_diskstats(); break;
+	case DISK_MODE_PARTITIONS: 	proc_partitions(); break;
+	}
+}
+
+/* /proc/stat disk_io has no busy time: take 200 I/Os a second as 100%
+ * busy, though no disk is busier than the interval is long
+ */
+void disk_delta(double elapsed)
+{
+static double *busy = NULL;	/* made up so far */
+static long *ios = NULL;	/* I/Os at the last read */
+static int size = 0;
+double more;
+long n;
+int i;
+
+	if(disk_mode != DISK_MODE_IO)
+		return;
+	if(size < disks) {
+		busy = REALLOC(busy, sizeof(double) * disks);
+		ios = REALLOC(ios, sizeof(long) * disks);
+		for(i = size; i < disks; i++) {
+			busy[i] = 0.0;
+			ios[i] = -1;
+		}
+		size = disks;
+	}
+	for(i = 0; i < disks; i++) {
+		n = p->dk[i].dk_reads + p->dk[i].dk_writes;
+		if(ios[i] >= 0 && n >= ios[i]) {
+			more = (n - ios[i]) / 2.0;
+			busy[i] += (more > 100.0 * elapsed) ? 100.0 * elapsed : more;
+		}
+		ios[i] = n;
+		p->dk[i].dk_time = busy[i];
+	}
+}
+#undef isdigit
+#define isdigit(ch) ( ( '0' <= (ch)  &&  (ch) >= '9')? 0: 1 )
+
+long proc_mem_search( char *s)
+{
+int i;
+int j;
+int len;
+	len=strlen(s);
+	for(i=0;i<proc[P_MEMINFO].lines;i++ ) {
+		if( !strncmp(s, proc[P_MEMINFO].line[i],len) ) {
+			for(j=len;
+				!isdigit(proc[P_MEMINFO].line[i][j]) &&
+				proc[P_MEMINFO].line[i][j] != 0;
+				j++)
+				/* do nothing */ ;
+			return atol( &proc[P_MEMINFO].line[i][j]);
+		}
+	}
+	return -1;
+}
+
+void proc_mem()
+{
+	p->mem.memtotal   = proc_mem_search("MemTotal");
+	p->mem.memfree    = proc_mem_search("MemFree");
+	p->mem.memshared  = proc_mem_search("MemShared");
+	p->mem.buffers    = proc_mem_search("Buffers");
+	p->mem.cached     = proc_mem_search("Cached");
+	p->mem.swapcached = proc_mem_search("SwapCached");
+	p->mem.active     = proc_mem_search("Active");
+	p->mem.inactive   = proc_mem_search("Inactive");
+	p->mem.hightotal  = proc_mem_search("HighTotal");
+	p->mem.highfree   = proc_mem_search("HighFree");
+	p->mem.lowtotal   = proc_mem_search("LowTotal");
+	p->mem.lowfree    = proc_mem_search("LowFree");
+	p->mem.swaptotal  = proc_mem_search("SwapTotal");
+	p->mem.swapfree   = proc_mem_search("SwapFree");
+#ifdef LARGEMEM
+	p->mem.dirty         = proc_mem_search("Dirty");
+	p->mem.writeback     = proc_mem_search("Writeback");
+	p->mem.mapped        = proc_mem_search("Mapped");
+	p->mem.slab          = proc_mem_search("Slab");
+	p->mem.committed_as  = proc_mem_search("Committed_AS");
+	p->mem.pagetables    = proc_mem_search("PageTables");
+	p->mem.hugetotal     = proc_mem_search("HugePages_Total");
+	p->mem.hugefree      = proc_mem_search("HugePages_Free");
+	p->mem.hugesize      = proc_mem_search("Hugepagesize");
+#else
+	p->mem.bigfree       = proc_mem_search("BigFree");
+#endif /*LARGEMEM*/
+}
+
+int current_snaps;
+#define MAX_SNAPS 400
+#define MAX_SNAP_ROWS 20
+#define SNAP_OFFSET 6
+
+
+/* Compressed long term store.  Each series is a list of fixed size
+ * blocks.  Inside a block the timestamps are delta-of-delta coded as in
+ * Facebook's Gorilla and the values as one bit for no change or a
+ * zigzag varint of the change, so a steady clock and an idle counter
+ * cost one bit each per sample.  Every block keeps the min, max and sum
+ * of its points (the change for counters, the value for gauges) so a
+ * time range can be summarised without decoding it.
+ */
+#define TS_BLOCK	1024		/* bytes of coded samples per block */
+#define TS_WORST	160		/* bits one sample can take */
+#define TS_BUDGET	(32*1024*1024)	/* for all series together */
+
+struct ts_block {
+	long	index;		/* number of the first sample in the series */
+	int	count;
+	long	bits;
+	long long t0;		/* first sample, stored as is */
+	long long v0;
+	long long t;		/* last sample, for the encoder */
+	long long v;
+	long long dt;
+	long long min;		/* of the points in this block */
+	long long max;
+	double	sum;
+	int	points;
+	unsigned char data[TS_BLOCK];
+};
+
+struct ts_series {
+	char	name[64];
+	int	counter;	/* points are the change, not the value */
+	struct ts_block **block;	/* oldest first */
+	int	blocks;
+	int	size;
+	long	samples;
+	long long last;
+};
+
+struct ts_cursor {
+	struct ts_series *s;
+	int	b;
+	int	i;		/* sample within the block */
+	long	bit;
+	long	index;		/* sample number in the series */
+	long long t;		/* milliseconds */
+	long long v;
+	long long dt;
+};
+
+struct ts_series **ts_all = NULL;
+int	ts_nseries = 0;
+struct ts_series *ts_cpu[4];	/* user, sys, wait, idle */
+struct ts_series **ts_disk = NULL;
+struct ts_series *ts_net[NETMAX][2];
+long	ts_graph_start = 0;	/* first sample the long term graph shows */
+
+struct ts_series *ts_new(char *name, int counter)
+{
+struct ts_series *s;
+
+	s = MALLOC(sizeof(struct ts_series));
+	memset(s, 0, sizeof(struct ts_series));
+	strncpy(s->name, name, sizeof(s->name) - 1);
+	s->counter = counter;
+	ts_all = REALLOC(ts_all, sizeof(struct ts_series *) * (ts_nseries + 1));
+	ts_all[ts_nseries++] = s;
+	return s;
+}
+
+void ts_put(struct ts_block *b, unsigned long long x, int n)
+{
+	while(n-- > 0) {
+		if((x >> n) & 1)
+			b->data[b->bits >> 3] |= 0x80 >> (b->bits & 7);
+		b->bits++;
+	}
+}
+
+unsigned long long ts_get(struct ts_cursor *c, int n)
+{
+struct ts_block *b = c->s->block[c->b];
+unsigned long long x = 0;
+
+	while(n-- > 0) {
+		x = (x << 1) | ((b->data[c->bit >> 3] >> (7 - (c->bit & 7))) & 1);
+		c->bit++;
+	}
+	return x;
+}
+
+/* n bit two's complement field back to a signed number */
+long long ts_signed(unsigned long long x, int n)
+{
+	if(n < 64 && (x & (1ULL << (n - 1))))
+		return (long long)x - (1LL << n);
+	return (long long)x;
+}
+
+struct ts_block *ts_block_new(struct ts_series *s)
+{
+struct ts_block *b;
+long max;
+
+	/* share the budget out evenly, but always keep a couple */
+	max = TS_BUDGET / (sizeof(struct ts_block) * ts_nseries);
+	if(max < 2)
+		max = 2;
+	if(s->blocks >= max) {
+		FREE(s->block[0]);
+		memmove(&s->block[0], &s->block[1], sizeof(struct ts_block *) * (s->blocks - 1));
+		s->blocks--;
+	}
+	if(s->blocks == s->size) {
+		s->size = s->size ? s->size * 2 : 16;
+		s->block = REALLOC(s->block, sizeof(struct ts_block *) * s->size);
+	}
+	b = MALLOC(sizeof(struct ts_block));
+	memset(b, 0, sizeof(struct ts_block));
+	b->index = s->samples;
+	b->min = LLONG_MAX;
+	b->max = LLONG_MIN;
+	s->block[s->blocks++] = b;
+	return b;
+}
+
+void ts_add(struct ts_series *s, double time, long long v)
+{
+struct ts_block *b = s->blocks ? s->block[s->blocks - 1] : NULL;
+long long t = (long long)(time * 1000.0);
+long long dod;
+long long point;
+unsigned long long z;
+
+	if(b == NULL || b->bits + TS_WORST > TS_BLOCK * 8) {
+		b = ts_block_new(s);
+		b->t0 = b->t = t;
+		b->v0 = b->v = v;
+	} else {
+		dod = (t - b->t) - b->dt;
+		if(dod == 0)
+			ts_put(b, 0, 1);
+		else if(dod >= -64 && dod < 64) {
+			ts_put(b, 2, 2);
+			ts_put(b, dod, 7);
+		} else if(dod >= -256 && dod < 256) {
+			ts_put(b, 6, 3);
+			ts_put(b, dod, 9);
+		} else if(dod >= -2048 && dod < 2048) {
+			ts_put(b, 14, 4);
+			ts_put(b, dod, 12);
+		} else {
+			ts_put(b, 15, 4);
+			ts_put(b, dod, 64);
+		}
+		b->dt = t - b->t;
+		b->t = t;
+		if(v == b->v)
+			ts_put(b, 0, 1);
+		else {
+			ts_put(b, 1, 1);
+			z = ((unsigned long long)(v - b->v) << 1) ^ (unsigned long long)((v - b->v) >> 63);
+			do {
+				ts_put(b, (z & 0x7f) | (z > 0x7f ? 0x80 : 0), 8);
+				z >>= 7;
+			} while(z);
+		}
+		b->v = v;
+	}
+	b->count++;
+	if(!s->counter || s->samples > 0) {
+		point = s->counter ? v - s->last : v;
+		if(point < b->min)
+			b->min = point;
+		if(point > b->max)
+			b->max = point;
+		b->sum += point;
+		b->points++;
+	}
+	s->last = v;
+	s->samples++;
+}
+
+void ts_start(struct ts_cursor *c)
+{
+struct ts_block *b = c->s->block[c->b];
+
+	c->i = 0;
+	c->bit = 0;
+	c->index = b->index;
+	c->t = b->t0;
+	c->v = b->v0;
+	c->dt = 0;
+}
+
+/* Step the cursor on to the next sample, returns 0 at the end */
+int ts_next(struct ts_cursor *c)
+{
+struct ts_block *b = c->s->block[c->b];
+unsigned long long z;
+int shift;
+int n;
+
+	if(c->i + 1 >= b->count) {
+		if(c->b + 1 >= c->s->blocks)
+			return 0;
+		c->b++;
+		ts_start(c);
+		return 1;
+	}
+	if(ts_get(c, 1) == 0)
+		n = 0;
+	else if(ts_get(c, 1) == 0)
+		n = 7;
+	else if(ts_get(c, 1) == 0)
+		n = 9;
+	else if(ts_get(c, 1) == 0)
+		n = 12;
+	else
+		n = 64;
+	if(n)
+		c->dt += ts_signed(ts_get(c, n), n);
+	c->t += c->dt;
+	if(ts_get(c, 1)) {
+		z = 0;
+		shift = 0;
+		do {
+			n = ts_get(c, 8);
+			z |= (unsigned long long)(n & 0x7f) << shift;
+			shift += 7;
+		} while(n & 0x80);
+		c->v += (long long)(z >> 1) ^ -(long long)(z & 1);
+	}
+	c->i++;
+	c->index++;
+	return 1;
+}
+
+/* Put the cursor on sample number index or the oldest one still kept,
+ * returns 0 if the series is empty.
+ */
+int ts_seek(struct ts_cursor *c, struct ts_series *s, long index)
+{
+	c->s = s;
+	if(s->blocks == 0)
+		return 0;
+	for(c->b = s->blocks - 1; c->b > 0 && s->block[c->b]->index > index; c->b--)
+		;
+	ts_start(c);
+	while(c->index < index && ts_next(c))
+		;
+	return 1;
+}
+
+/* Min, max and mean of the points in the blocks that overlap from..to,
+ * seconds like p->time.  Returns the number of points.
+ */
+long ts_summary(struct ts_series *s, double from, double to, long long *min, long long *max, double *avg)
+{
+struct ts_block *b;
+double sum = 0.0;
+long points = 0;
+int i;
+
+	*min = LLONG_MAX;
+	*max = LLONG_MIN;
+	for(i = 0; i < s->blocks; i++) {
+		b = s->block[i];
+		if(b->t < (long long)(from * 1000.0) || b->t0 > (long long)(to * 1000.0) || b->points == 0)
+			continue;
+		if(b->min < *min)
+			*min = b->min;
+		if(b->max > *max)
+			*max = b->max;
+		sum += b->sum;
+		points += b->points;
+	}
+	*avg = points ? sum / points : 0.0;
+	return points;
+}
+
+long ts_bytes()
+{
+long bytes = 0;
+int i;
+
+	for(i = 0; i < ts_nseries; i++)
+		bytes += ts_all[i]->blocks * sizeof(struct ts_block) + sizeof(struct ts_series);
+	return bytes;
+}
+
+/* Add a snapshot to the long term store */
+void ts_save(struct data *s)
+{
+char name[64];
+int i;
+
+	if(ts_cpu[0] == NULL) {
+		ts_cpu[0] = ts_new("CPU User", 1);
+		ts_cpu[1] = ts_new("CPU Sys", 1);
+		ts_cpu[2] = ts_new("CPU Wait", 1);
+		ts_cpu[3] = ts_new("CPU Idle", 1);
+		ts_disk = MALLOC(sizeof(struct ts_series *) * diskmax);
+		memset(ts_disk, 0, sizeof(struct ts_series *) * diskmax);
+	}
+	ts_add(ts_cpu[0], s->time, s->cpu_total.user);
+	ts_add(ts_cpu[1], s->time, s->cpu_total.sys);
+	ts_add(ts_cpu[2], s->time, s->cpu_total.wait);
+	ts_add(ts_cpu[3], s->time, s->cpu_total.idle);
+	for(i = 0; i < s->disks && i < diskmax; i++) {
+		if(ts_disk[i] == NULL) {
+			snprintf(name, sizeof(name), "Disk Busy %s", s->dk[i].dk_name);
+			ts_disk[i] = ts_new(name, 1);
+		}
+		ts_add(ts_disk[i], s->time, s->dk[i].dk_time);
+	}
+	for(i = 0; i < s->networks && i < NETMAX; i++) {
+		if(ts_net[i][0] == NULL) {
+			snprintf(name, sizeof(name), "Net Read %s", (char *)s->ifnets[i].if_name);
+			ts_net[i][0] = ts_new(name, 1);
+			snprintf(name, sizeof(name), "Net Write %s", (char *)s->ifnets[i].if_name);
+			ts_net[i][1] = ts_new(name, 1);
+		}
+		ts_add(ts_net[i][0], s->time, s->ifnets[i].if_ibytes);
+		ts_add(ts_net[i][1], s->time, s->ifnets[i].if_obytes);
+	}
+}
+
+/* The long term graph is redrawn from the store every time */
+struct {
+	double user;
+	double kernel;
+	double iowait;
+	double idle;
+} cpu_snap[MAX_SNAPS];
+int next_cpu_snap = 0;
+int cpu_snap_used = 0;		/* columns with an interval in them */
+
+int snap_average()
+{
+int i;
+int total = 0;
+
+	if(cpu_snap_used == 0)
+		return 0;
+	for(i=0;i<current_snaps;i++) {
+		total = total + cpu_snap[i].user + cpu_snap[i].kernel;
+	}
+	return (total / cpu_snap_used) ;
+}
+
+void snap_clear()
+{
+	if(ts_cpu[0] != NULL)
+		ts_graph_start = ts_cpu[0]->samples;
+}
+
+/* Fill cpu_snap with the intervals up to the snapshot on the screen.  An
+ * interval goes in the column of its number, so the graph sweeps across
+ * as before.
+ */
+void snap_load()
+{
+struct ts_cursor c[4];
+long long prev[4];
+long long d[4];
+long end;
+long start;
+long n = 0;
+double sum;
+int col = 0;
+int i;
+
+	memset(cpu_snap, 0, sizeof(cpu_snap));
+	next_cpu_snap = 0;
+	cpu_snap_used = 0;
+	if(ts_cpu[0] == NULL || ts_cpu[0]->blocks == 0 || current_snaps <= 0)
+		return;
+	/* find the sample on the screen, the newest unless paused */
+	end = ts_cpu[0]->samples - 1;
+	if(ts_seek(&c[0], ts_cpu[0], end - (long)hist_count)) {
+		while(c[0].t < (long long)(p->time * 1000.0) && ts_next(&c[0]))
+			;
+		if(c[0].t == (long long)(p->time * 1000.0))
+			end = c[0].index;
+	}
+	start = end - current_snaps;
+	if(start < ts_graph_start)
+		start = ts_graph_start;
+	for(i = 0; i < 4; i++)
+		if(!ts_seek(&c[i], ts_cpu[i], start))
+			return;
+	for(i = 0; i < 4; i++)
+		prev[i] = c[i].v;
+	while(c[0].index < end) {
+		for(i = 0; i < 4; i++) {
+			if(!ts_next(&c[i]))
+				return;
+			d[i] = c[i].v - prev[i];
+			prev[i] = c[i].v;
+		}
+		sum = d[0] + d[1] + d[2] + d[3];
+		if(sum <= 0)
+			sum = 1;
+		col = c[0].index % current_snaps;
+		cpu_snap[col].user   = d[0] / sum * 100.0;
+		cpu_snap[col].kernel = d[1] / sum * 100.0;
+		cpu_snap[col].iowait = d[2] / sum * 100.0;
+		cpu_snap[col].idle   = d[3] / sum * 100.0;
+		n++;
+	}
+	next_cpu_snap = (col + 1) % current_snaps;
+	cpu_snap_used = (n < current_snaps) ? n : current_snaps;
+}
+
+void plot_snap(WINDOW *pad)
+{
+int i;
+int j;
+long long min;
+long long max;
+double avg[4];
+long points[4];
+double sum;
+	if (cursed) {
+		snap_load();
+		mvwprintw(pad,0, 0, " CPU +");
+		int counter;
+		for (counter=0; counter < current_snaps - 1; counter++){
+			wprintw(pad, "-");
+		}
+		wprintw(pad, "+");
+		if(ts_cpu[0] != NULL && ts_cpu[0]->blocks > 0 && current_snaps > 60) {
+			for(i = 0; i < 4; i++)
+				points[i] = ts_summary(ts_cpu[i], 0.0, p->time, &min, &max, &avg[i]);
+			sum = avg[0] + avg[1] + avg[2] + avg[3];
+			mvwprintw(pad,0, 8, " %ld snapshots kept in %ldKB, Busy %.1f%% on average ",
+				points[0], ts_bytes() / 1024, sum > 0.0 ? (avg[0] + avg[1]) / sum * 100.0 : 0.0);
+		}
+		mvwprintw(pad,1, 0,"100%%-|");
+		mvwprintw(pad,2, 1, "95%%-|");
+		mvwprintw(pad,3, 1, "90%%-|");
+		mvwprintw(pad,4, 1, "85%%-|");
+		mvwprintw(pad,5, 1, "80%%-|");
+		mvwprintw(pad,6, 1, "75%%-|");
+		mvwprintw(pad,7, 1, "70%%-|");
+		mvwprintw(pad,8, 1, "65%%-|");
+		mvwprintw(pad,9, 1, "60%%-|");
+		mvwprintw(pad,10, 1, "55%%-|");
+		mvwprintw(pad,11, 1, "50%%-|");
+		mvwprintw(pad,12, 1, "45%%-|");
+		mvwprintw(pad,13, 1, "40%%-|");
+		mvwprintw(pad,14, 1, "35%%-|");
+		mvwprintw(pad,15, 1, "30%%-|");
+		mvwprintw(pad,16, 1, "25%%-|");
+		mvwprintw(pad,17, 1, "20%%-|");
+		mvwprintw(pad,18, 1,"15%%-|");
+		mvwprintw(pad,19, 1,"10%%-|");
+		mvwprintw(pad,20, 1," 5%%-|");
+
+ 		if (colour){
+ 			mvwprintw(pad,21, 4, " +--------------------");
+ 			COLOUR wattrset(pad, COLOR_PAIR(2));
+ 			mvwprintw(pad,21, 26, "User%%");
+ 			COLOUR wattrset(pad, COLOR_PAIR(0));
+ 			mvwprintw(pad,21, 30, "---------");
+ 			COLOUR wattrset(pad, COLOR_PAIR(1));
+ 			mvwprintw(pad,21, 39, "System%%");
+ 			COLOUR wattrset(pad, COLOR_PAIR(0));
+ 			mvwprintw(pad,21, 45, "---------");
+ 			COLOUR wattrset(pad, COLOR_PAIR(4));
+ 			mvwprintw(pad,21, 54, "Wait%%");
+ 			COLOUR wattrset(pad, COLOR_PAIR(0));
+			for (counter=0; counter < current_snaps - 54; counter++){
+				wprintw(pad, "-");
+			}
+ 			wprintw(pad, "+");
+		} else {
+			mvwprintw(pad,21, 4, " +");
+			for (counter=0; counter < current_snaps - 1; counter++){
+				wprintw(pad, "-");
+			}
+			wprintw(pad, "+");
+		}
+
+		for (j = 0; j < current_snaps; j++) {
+			for (i = 0; i < MAX_SNAP_ROWS; i++) {
+				wmove(pad,MAX_SNAP_ROWS-i, j+SNAP_OFFSET);
+				if( (cpu_snap[j].user / 100 * MAX_SNAP_ROWS) > i+0.5) {
+					COLOUR wattrset(pad,COLOR_PAIR(9));
+					wprintw(pad,"U");
+					COLOUR wattrset(pad,COLOR_PAIR(0));
+				} else if( (cpu_snap[j].user + cpu_snap[j].kernel )/ 100 * MAX_SNAP_ROWS > i+0.5) {
+					COLOUR wattrset(pad,COLOR_PAIR(8));
+					wprintw(pad,"s");
+					COLOUR wattrset(pad,COLOR_PAIR(0));
+				} else if( (cpu_snap[j].user + cpu_snap[j].kernel +cpu_snap[j].iowait )/ 100 * MAX_SNAP_ROWS > i+0.5) {
+					COLOUR wattrset(pad,COLOR_PAIR(10));
+					wprintw(pad,"w");
+					COLOUR wattrset(pad,COLOR_PAIR(0));
+				} else 
+					wprintw(pad," ");
+			}
+		}
+		for (i = 0; i < MAX_SNAP_ROWS; i++) {
+			wmove(pad,MAX_SNAP_ROWS-i, next_cpu_snap+SNAP_OFFSET);
+			wprintw(pad,"|");
+		}
+		wmove(pad,MAX_SNAP_ROWS+1 - (snap_average() /5), next_cpu_snap+SNAP_OFFSET);
+		wprintw(pad,"+");
+		if(dotline) {
+		    for (i = 0; i < current_snaps; i++) {
+			wmove(pad,MAX_SNAP_ROWS+1-dotline*2, i+SNAP_OFFSET);
+			wprintw(pad,"+");
+		    }
+		    dotline = 0;
+		}
+	}
+}
+
+/* This puts the CPU usage on the screen and draws the CPU graphs or outputs to the file */
+
+void save_smp(WINDOW *pad, int cpu_no, int row, long user, long kernel, long iowait, long idle, long nice, long irq, long softirq, long steal)
+{
+static int firsttime = 1;
+char section[32];
+
+	if (cursed) {
+		mvwprintw(pad,row,0, "%02d usr=%4ld sys=%4ld wait=%4ld idle=%4ld steal=%2ld nice=%4ld irq=%2ld sirq=%2ld\n", 
+		cpu_no, user, kernel, iowait, idle, steal, nice, irq, softirq, steal);
+		return;
+	}
+	if(firsttime) {
+		if(show_headings) {
+			fprintf(fp,"CPUTICKS_ALL,AAA,user,sys,wait,idle,nice,irq,softirq,steal\n");
+			fprintf(fp,"CPUTICKS%02d,AAA,user,sys,wait,idle,nice,irq,softirq,steal\n", cpu_no);
+		}
+		firsttime=0;	
+	}
+	if(cpu_no==0)
+		strcpy(section, "CPUTICKS_ALL");
+	else
+		snprintf(section, sizeof(section), "CPUTICKS%02d", cpu_no);
+	enc_begin(section, NULL);
+	enc_num("user", user, 0);
+	enc_num("sys", kernel, 0);
+	enc_num("wait", iowait, 0);
+	enc_num("idle", idle, 0);
+	enc_num("nice", nice, 0);
+	enc_num("irq", irq, 0);
+	enc_num("softirq", softirq, 0);
+	enc_num("steal", steal, 0);
+	enc_end();
+}
+
+void plot_smp(WINDOW *pad, int cpu_no, int row, double user, double kernel, double iowait, double idle)
+{
+	int	i;
+	int	peak_col;
+	char	section[32];
+	char	rrd[32];
+
+	if(cpu_peak[cpu_no] < ((double)((int)user/2 + (int)kernel/2 + (int)iowait/2)*2.0) )
+		cpu_peak[cpu_no] = (double)((int)user/2 + (int)kernel/2 + (int)iowait/2)*2.0;
+
+	if (cursed) {
+		if(cpu_no == 0)
+			mvwprintw(pad,row, 0, "Avg");
+		else
+			mvwprintw(pad,row, 0, "%2d", cpu_no);
+		mvwprintw(pad,row,  3, "%5.1lf", user);
+		mvwprintw(pad,row,  9, "%5.1lf", kernel);
+		mvwprintw(pad,row, 15, "%5.1lf", iowait);
+		mvwprintw(pad,row, 22, "%5.1lf", idle);
+		mvwprintw(pad,row, 27, "|                                                  ");
+		wmove(pad,row, 28);
+		for (i = 0; i < (int)(user   / 2); i++){
+			COLOUR wattrset(pad,COLOR_PAIR(9));
+			wprintw(pad,"U");
+			COLOUR wattrset(pad,COLOR_PAIR(0));
+		}
+		for (i = 0; i < (int)(kernel / 2); i++){
+			COLOUR wattrset(pad,COLOR_PAIR(8));
+			wprintw(pad,"s");
+			COLOUR wattrset(pad,COLOR_PAIR(0));
+		}
+		for (i = 0; i < (int)(iowait / 2); i++) {
+			COLOUR wattrset(pad,COLOR_PAIR(10));
+			wprintw(pad,"W");
+			COLOUR wattrset(pad,COLOR_PAIR(0));
+		}
+		for (i = 0; i < (int)(idle   / 2); i++)
+			wprintw(pad," ");
+		mvwprintw(pad,row, 77, "|");
+		
+		peak_col = 28 +(int)(cpu_peak[cpu_no]/2);
+		if(peak_col > 77)
+			peak_col=77;
+		mvwprintw(pad,row, peak_col, ">");
+	} else {
+	/* Sanity check the numnbers */
+		if( user < 0.0 || kernel < 0.0 || iowait < 0.0 || idle < 0.0 || idle >100.0) {
+			user = kernel = iowait = idle = 0;
+		}
+		
+		if(cpu_no == 0) {
+			strcpy(section, "CPU_ALL");
+			strcpy(rrd, "cpu.rrd");
+		} else {	/* the rrd files count from 0 */
+			snprintf(section, sizeof(section), "CPU%02d", cpu_no);
+			snprintf(rrd, sizeof(rrd), "cpu%02d.rrd", cpu_no - 1);
+		}
+		enc_begin(section, rrd);
+		enc_num("User%", user, 1);
+		enc_num("Sys%", kernel, 1);
+		enc_num("Wait%", iowait, 1);
+		enc_num("Idle%", idle, 1);
+		if(cpu_no == 0 && !show_rrd) {	/* cpu.rrd only has the four */
+			enc_text("Busy", "");
+			enc_num("CPUs", cpus, 0);
+		}
+		enc_end();
+	}
+}
+/* Added variable to remember started children
+ * 0 - start
+ * 1 - snap
+ * 2 - end
+*/
+#define CHLD_START 0
+#define CHLD_SNAP 1
+#define CHLD_END 2
+int nmon_children[3] = {-1,-1,-1};
+
+
+/* Signal handler 
+ * SIGUSR1 or 2 is used to stop nmon cleanly
+ * SIGWINCH is used when the window size is changed
+ */
+void	interrupt(int signum)
+{
+int child_pid;
+int waitstatus;
+	if (signum == SIGCHLD ) {
+		while((child_pid = waitpid(0, &waitstatus, 0)) == -1 ) {
+			if( errno == EINTR) /* retry */
+				continue;
+			return; /* ECHLD, EFAULT */
+		}
+                if(child_pid == nmon_children[CHLD_SNAP]) 
+                	nmon_children[CHLD_SNAP] = -1;
+		signal(SIGCHLD, interrupt);
+		return;
+	}
+	if (signum == SIGUSR1 || signum == SIGUSR2) {
+		maxloops = loop;
+		return;
+	}
+	if (signum == SIGWINCH) {
+		CURSE endwin(); /* stop + start curses so it works out the # of row and cols */
+		CURSE initscr();
+		CURSE nodelay(stdscr, TRUE);
+		CURSE noecho();
+		CURSE keypad(stdscr,TRUE);
+		CURSE cbreak();
+		signal(SIGWINCH, interrupt);
+		COLOUR colour = has_colors();
+        	COLOUR start_color();
+                COLOUR init_pair((short)0,(short)7,(short)0); /* White */
+                COLOUR init_pair((short)1,(short)1,(short)0); /* Red */
+                COLOUR init_pair((short)2,(short)2,(short)0); /* Green */
+                COLOUR init_pair((short)3,(short)3,(short)0); /* Yellow */
+                COLOUR init_pair((short)4,(short)4,(short)0); /* Blue */
+                COLOUR init_pair((short)5,(short)5,(short)0); /* Magenta */
+                COLOUR init_pair((short)6,(short)6,(short)0); /* Cyan */
+                COLOUR init_pair((short)7,(short)7,(short)0); /* White */
+		COLOUR init_pair((short)8,(short)1,(short)1); /* Red background, red text */
+		COLOUR init_pair((short)9,(short)2,(short)2); /* Green background, green text */
+		COLOUR init_pair((short)10,(short)4,(short)4); /* Blue background, blue text */
+		COLOUR init_pair((short)11,(short)3,(short)3); /* Yellow background, yellow text */
+		COLOUR init_pair((short)12,(short)6,(short)6); /* Cyan background, cyan text */
+		COLOUR init_pair((short)13,(short)5,(short)5); /* Magenta background, Magenta text */
+		CURSE clear();
+		return;
+	}
+	CURSE endwin();
+	exit(0);
+}
+
+
+
+/* Lookup the right string */
+char	*status(int n)
+{
+	switch (n) {
+	case 0:
+		return "Run  ";
+	default:
+		return "Sleep";
+	}
+}
+
+/* Lookup the right process state string */
+char	*get_state( char n)
+{
+	static char	duff[64];
+	switch (n) {
+	case 'R': return "Running  ";
+	case 'S': return "Sleeping ";
+	case 'D': return "DiskSleep";
+	case 'Z': return "Zombie   ";
+	case 'T': return "Traced   ";
+	case 'W': return "Paging   ";
+	default:
+		sprintf(duff, "%d", n);
+		return duff;
+	}
+}
+
+#ifdef GETUSER
+/* Convert User id (UID) to a name with caching for speed 
+ * getpwuid() should be NFS/yellow pages safe
+ */
+char	*getuser(uid_t uid)
+{
+#define NAMESIZE 16
+	struct user_info {
+		uid_t uid;
+		char	name[NAMESIZE];
+	};
+	static struct user_info *u = NULL;
+	static int	used = 0;
+	int	i;
+	struct passwd *pw;
+
+	i = 0;
+	if (u != NULL) {
+		for (i = 0; i < used; i++) {
+			if (u[i].uid == uid) {
+				return u[i].name;
+			}
+		}
+		u = (struct user_info *)realloc(u, (sizeof(struct user_info ) * (i + 1)));
+	} else
+		u = (struct user_info *)malloc(sizeof(struct user_info ));
+	used++;
+
+	/* failed to find a match so add it */
+	u[i].uid = uid;
+	pw = getpwuid(uid);
+
+	if (pw != NULL)
+		strncpy(u[i].name, pw->pw_name, NAMESIZE);
+	else
+		sprintf(u[i].name, "unknown%d",uid);
+	return u[i].name;
+}
+#endif /* GETUSER */
+
+/* User Defined Disk Groups */
+
+char   *save_word(char *in, char *out)
+{
+        int   len;
+        int   i;
+        len = strlen(in);
+	out[0] = 0;
+        for (i = 0; i < len; i++) {
+                if ( isalnum(in[i]) || in[i] == '_' || in[i] == '-' || in[i] == '/' ) {
+                        out[i] = in[i];
+                        out[i+1] = 0;
+                } else
+                        break;
+        }
+        for (; i < len; i++)
+                if (isalnum(in[i]))
+                        return &in[i];
+        return &in[i];
+} 
+
+#define DGROUPS 64
+#define DGROUPITEMS 512
+
+char   *dgroup_filename;
+char   *dgroup_name[DGROUPS];
+int   *dgroup_data;
+int   dgroup_disks[DGROUPS];
+int   dgroup_total_disks;
+int   dgroup_total_groups;
+
+void load_dgroup(struct dsk_stat *dk)
+{
+	FILE * gp;
+	char   line[4096];
+	char   name[1024];
+	int   i, j;
+	char   *nextp;
+
+	if (dgroup_loaded == 2)
+		return;
+	dgroup_data = MALLOC(sizeof(int)*DGROUPS * DGROUPITEMS);
+	for (i = 0; i < DGROUPS; i++)
+		for (j = 0; j < DGROUPITEMS; j++)
+			dgroup_data[i*DGROUPS+j] = -1;
+
+	gp = fopen(dgroup_filename, "r");
+
+	if (gp == NULL) {
+		perror("opening disk group file");
+		fprintf(stderr,"ERROR: failed to open %s\n", dgroup_filename);
+		exit(9);
+	}
+
+	for (dgroup_total_groups = 0; 
+		fgets(line, 4096, gp) != NULL && dgroup_total_groups < DGROUPS; 
+		dgroup_total_groups++) {
+		/* save the name */
+		nextp = save_word(line, name);
+		if(strlen(name) == 0) { /* was a blank line */
+			fprintf(stderr,"ERROR elmon:ignoring odd line in diskgroup file \"%s\"\n",line);
+			/* Decrement dgroup_total_groups by 1 to correct index for next loop */
+			--dgroup_total_groups;
+			continue;
+		}
+		/* Added +1 to be able to correctly store the terminating \0 character */
+		dgroup_name[dgroup_total_groups] = MALLOC(strlen(name)+1);
+		strcpy(dgroup_name[dgroup_total_groups], name);
+
+		/* save the hdisks */
+		for (i = 0; i < DGROUPITEMS && *nextp != 0; i++) {
+			nextp = save_word(nextp, name);
+			for (j = 0; j < disks; j++) {
+				if ( !strcmp(dk[j].dk_name, name) ) {
+					dgroup_data[dgroup_total_groups*DGROUPS+i] = j;
+					dgroup_disks[dgroup_total_groups]++;
+					dgroup_total_disks++;
+					break;
+				}
+			}
+			if (j == disks)
+				fprintf(stderr,"ERROR elmon:diskgroup file - failed to find disk=%s for group=%s disks know=%d\n",
+					 name, dgroup_name[dgroup_total_groups],disks);
+		}
+	}
+	fclose(gp);
+	dgroup_loaded = 2;
+}
+
+
+void list_dgroup(struct dsk_stat *dk)
+{
+	int   i, j, k, n;
+	int   first = 1;
+
+	for (n = 0, i = 0; i < dgroup_total_groups; i++) {
+		if (first) {
+			fprintf(fp, "BBBG,%03d,User Defined Disk Groups Name,Disks\n", n++);
+			first = 0;
+		}
+		fprintf(fp, "BBBG,%03d,%s", n++, dgroup_name[i]);
+		for (k = 0, j = 0; j < dgroup_disks[i]; j++) {
+			if (dgroup_data[i*DGROUPS+j] != -1) {
+				fprintf(fp, ",%s", dk[dgroup_data[i*DGROUPS+j]].dk_name);
+				k++;
+			}
+			/* add extra line if we have lots to stop spreadsheet line width problems */
+			if (k == 128) {
+				fprintf(fp, "\nBBBG,%03d,%s continued", n++, dgroup_name[i]);
+			}
+		}
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "DGBUSY,Disk Group Busy %s", hostname);
+	for (i = 0; i < DGROUPS; i++) {
+		if (dgroup_name[i] != 0)
+			fprintf(fp, ",%s", dgroup_name[i]);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "DGREAD,Disk Group Read KB/s %s", hostname);
+	for (i = 0; i < DGROUPS; i++) {
+		if (dgroup_name[i] != 0)
+			fprintf(fp, ",%s", dgroup_name[i]);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "DGWRITE,Disk Group Write KB/s %s", hostname);
+	for (i = 0; i < DGROUPS; i++) {
+		if (dgroup_name[i] != 0)
+			fprintf(fp, ",%s", dgroup_name[i]);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "DGSIZE,Disk Group Block Size KB %s", hostname);
+	for (i = 0; i < DGROUPS; i++) {
+		if (dgroup_name[i] != 0)
+			fprintf(fp, ",%s", dgroup_name[i]);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "DGXFER,Disk Group Transfers/s %s", hostname);
+	for (i = 0; i < DGROUPS; i++) {
+		if (dgroup_name[i] != 0)
+			fprintf(fp, ",%s", dgroup_name[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+
+
+void hint(void)
+{
+	printf("\tDeveloper: Brian Smith\n");
+	printf("\tBased on nmon by Nigel Griffiths\n");
+	printf("\tLicense:  GPL version 3\n\n");
+	printf("\tThis program is distributed in the hope that it will be useful,\n");
+	printf("\tbut WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf("\tMERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n");
+	printf("\nHint: %s [-h] [-s <seconds>] [-c <count>] [-f -d <disks> -t -r <name>] [-x]\n\n", progname);
+	printf("\t-h            FULL help information\n");
+	printf("\tInteractive-Mode:\n");
+	printf("\tread startup banner and type: \"h\" once it is running\n");
+	printf("\tFor Data-Collect-Mode (-f)\n");
+	printf("\t-f            spreadsheet output format [note: default -s300 -c288]\n");
+	printf("\toptional\n");
+	printf("\t-s <seconds>  between refreshing the screen [default 2]\n");
+	printf("\t-c <number>   of refreshes [default millions]\n");
+	printf("\t-d <disks>    to increase the number of disks [default 256]\n");
+	printf("\t-t            spreadsheet includes top processes\n");
+	printf("\t-x            capacity planning (15 min for 1 day = -fdt -s 900 -c 96)\n");
+	printf("\n");
+}
+
+void help(void)
+{
+	hint();
+	printf("Version - %s\n\n",SccsId);
+	printf("For Interactive-Mode\n");
+	printf("\t-s <seconds>  between refreshing the screen [default 2]\n");
+	printf("\t-c <number>   of refreshes [default millions]\n");
+	printf("\t-g <filename> User Defined Disk Groups [hit g to show them]\n");
+	printf("\t              - file = on each line: group_name <disks list> sapce separated\n");
+	printf("\t              - like: database sdb sdc sdd sde\n");
+	printf("\t              - upto 32 disk groups, disks can appear more than once\n");
+	printf("\t-b            black and white [default is colour]\n");
+	printf("\t-H <count>    snapshots kept for scrolling back with < and > [default 3600]\n");
+	printf("\t-H <size>M    or as many as fit in this many MB [default 64M]\n");
+	printf("\t-P <filename> play a -B recording or .nmon file instead of live data\n");
+	printf("\texample: %s -s 1 -c 100\n",progname);
+	printf("\n");
+	printf("For Data-Collect-Mode = spreadsheet format (comma separated values)\n");
+	printf("\tNote: use only one of f,F,z,x or X and make it the first argument\n");
+	printf("\t-f            spreadsheet output format [note: default -s300 -c288]\n");
+	printf("\t\t\t output file is <hostname>_YYYYMMDD_HHMM.nmon\n");
+	printf("\t-F <filename> same as -f but user supplied filename\n");
+	printf("\t-B <filename> same as -F but a compact binary recording, then use\n");
+	printf("\t              %s --to-nmon <filename> [<output> [<from> [<to>]]] to get\n", progname);
+	printf("\t              the sorted .nmon, from and to are T<snapshot> or hh:mm[:ss]\n");
+	printf("\t-W <count>    fdatasync the output every <count> snapshots, 0 = never [default 60]\n");
+	printf("\t-j            gzip the output, in blocks that decompress on their own\n");
+	printf("\t-L <size>M    go on in <name>_1, <name>_2 ... when the file gets this big\n");
+	printf("\t-L hour|day   or when a new hour or day starts [both -L can be given]\n");
+	printf("\t-M [<address>:]<port>  instead of a file serve the latest snapshot as\n");
+	printf("\t              Prometheus metrics on http://<address>:<port>/metrics,\n");
+	printf("\t              address 127.0.0.1 unless given, with -t the %d busiest processes\n", PROM_TOP);
+	printf("\t-Q graphite|statsd[+tcp|+udp]:<host>:<port>  instead of a file push each\n");
+	printf("\t              snapshot as Graphite plaintext [default TCP] or StatsD gauges\n");
+	printf("\t              [default UDP], kept in elmon_<hostname>.spool while the sink\n");
+	printf("\t              is down [up to 64MB], with -t the %d busiest processes\n", PROM_TOP);
+	printf("\t-Y <name>     instead of a file keep the latest snapshot in the shared\n");
+	printf("\t              memory /dev/shm/<name> for programs using elmon_shm.h,\n");
+	printf("\t              with -t the %d busiest processes\n", PROM_TOP);
+	printf("\t-u <path>     Unix socket taking commands a line at a time: status,\n");
+	printf("\t              enable|disable <section>, interval <seconds>, snapshot,\n");
+	printf("\t              history (of -H snapshots) and values [<section>], the\n");
+	printf("\t              answers are JSON, e.g. echo status | nc -U <path>\n");
+	printf("\t-R            instead of a file keep round robin archives, <section>.rra\n");
+	printf("\t              of fixed size updated in place with the average and maximum\n");
+	printf("\t              per step, read them with %s --rra-dump <file> [<step>]\n", progname);
+	printf("\t-A <tiers>    the -R steps and how long each is kept, as step:keep with\n");
+	printf("\t              s, m, h, d, w or y [default 1m:1d,5m:1w,1h:1y]\n");
+	printf("\t-O <format>   csv (the nmon format), rrd (rrdtool update lines), json (JSON Lines) or\n");
+	printf("\t              influx (line protocol) [default csv]\n");
+	printf("\t              %s --bench-format [<disks>] times writing the disk lines\n", progname);
+	printf("\t-k            take the snapshots on the clock, at multiples of -s, so\n");
+	printf("\t              they line up across hosts\n");
+	printf("\t-a <seconds>  sample this often and write each -s interval the average,\n");
+	printf("\t              plus <SECTION>MIN, MAX and P95 records of the samples\n");
+	printf("\t-r <runname>  goes into spreadsheet file [default hostname]\n");
+	printf("\t-t            include top processes in the output\n");
+	printf("\t-T            as -t plus saves command line arguments in UARG section\n");
+	printf("\t-K            as -t plus CPU and memory added up per container in TOPCONT\n");
+	printf("\t-s <seconds>  between snap shots\n");
+	printf("\t-c <number>   of refreshes\n");
+	printf("\t-d <disks>    to increase the number of disks [default 256]\n");
+	printf("\t-l <dpl>      disks/line default 150 to avoid spreadsheet issues. EMC=64.\n");
+	printf("\t-g <filename> User Defined Disk Groups (see above)\n");
+
+	printf("\t-N            include NFS Network File System\n");
+	printf("\t-i            include Interrupts (top IRQs and softirqs)\n");
+	printf("\t-S            include Pressure Stall Information (PSI)\n");
+	printf("\t-w <us>       PSI trigger: take an extra snapshot as soon as tasks stall\n");
+	printf("\t              for more than <us> microseconds in a second (implies -S)\n");
+	printf("\t-U            include NUMA node memory and allocation stats\n");
+	printf("\t-G <path>     include cgroup v2 stats for the cgroups under <path>\n");
+	printf("\t              - relative to /sys/fs/cgroup, use / for all of them\n");
+	printf("\t-I <percent>  Include precoess and disks busy threshold (default 0.1)\n");
+	printf("\t              don't save or show proc/disk using less than this percent\n");
+	printf("\t-m <directory> elmon changes to this directory before saving to file\n");
+	printf("\texample: collect for 1 hour at 30 second intervals with top procs\n");
+	printf("\t\t %s -f -t -r Test1 -s30 -c120\n",progname);
+	printf("\n");
+printf("\tTo load into a spreadsheet like Lotus 1-2-3:\n");
+	printf("\tsort -A *nmon >stats.csv\n");
+	printf("\ttransfer the stats.csv file to your PC\n");
+	printf("\tStart 1-2-3 and then Open <char-separated-value ASCII file>\n");
+	printf("\n");
+	printf("Capacity planning mode - use cron to run each day\n");
+	printf("\t-x            sensible spreadsheet output for CP =  one day\n");
+	printf("\t              every 15 mins for 1 day ( i.e. -ft -s 900 -c 96)\n");
+	printf("\t-X            sensible spreadsheet output for CP = busy hour\n");
+	printf("\t              every 30 secs for 1 hour ( i.e. -ft -s 30 -c 120)\n");
+	printf("\n");
+	printf("Set-up and installation\n");
+	printf("\t- this adds the disk %% busy numbers (otherwise they are zero)\n");
+	printf("\tIf you have hundreds of disk this can take 1%% to 2%% CPU\n");
+	printf("\n");
+
+	printf("Interactive Mode Commands\n");
+	printf("\tkey --- Toggles to control what is displayed ---\n");
+	printf("\th   = Online help information\n");
+	printf("\tr   = Machine type, machine name, cache details and OS version + LPAR\n");
+	printf("\tc   = CPU by processor stats with bar graphs\n");
+	printf("\tl   = long term CPU (over 75 snapshots) with bar graphs\n");
+	printf("\tm   = Memory stats\n");
+	printf("\tM   = Memory graphs\n");
+	printf("\tV   = Virtual Memory and Swap stats\n");
+	printf("\tk   = Kernel Internal stats\n"); 
+	printf("\tn   = Network stats and errors\n");
+	printf("\tN   = NFS Network File System\n");
+	printf("\ti   = Interrupts - top IRQs with CPU spread, imbalance and storms\n");
+	printf("\tS   = Pressure Stall Information - CPU, memory and IO stalls\n");
+	printf("\tG   = Cgroups - top cgroups by CPU, then by memory, then by IO\n");
+	printf("\tU   = NUMA nodes - memory per node, local/remote allocations, imbalance\n");
+	printf("\td   = Disk I/O Graphs\n");
+	printf("\tD   = Disk I/O Stats\n");
+	printf("\to   = Disk I/O Map (one character per disk showing how busy it is)\n");
+#ifdef PARTITIONS
+	printf("\tP   = Partitions Disk I/O Stats\n");
+#endif 
+#ifdef POWER
+	printf("\tp   = Logical Partitions Stats\n");
+#endif 
+	printf("\tt   = Top Processes, then 1=Basic 2=per Container 3=Perf 4=Size 5=I/O\n");
+	printf("\tb   = black and white mode (or use -b option)\n");
+	printf("\t.   = minimum mode i.e. only busy disks and processes\n");
+	printf("\n");
+	printf("\tkey --- Other Controls ---\n");
+	printf("\t+   = double the screen refresh time\n");
+	printf("\t-   = halves the screen refresh time\n");
+	printf("\tq   = quit (also x, e or control-C)\n");
+	printf("\t0   = reset peak counts to zero (peak = \">\")\n");
+	printf("\tC   = Single-Column View\n");
+	printf("\tspace = refresh screen now\n");
+	printf("\tz   = pause the screen, or back to live\n");
+	printf("\t< > = step back and forward through the history (pauses)\n");
+	printf("\t^   = jump to the busiest snapshot for the section switched on last\n");
+	printf("\tf   = playback speed 1x, 10x or as fast as it goes (-P only)\n");
+	printf("\t/   = playback jump to T<snapshot> or [dd-MON-yyyy] hh:mm[:ss] (-P only)\n");
+	printf("\n");
+	printf("Startup Control\n");
+	printf("\tIf you find you always type the same toggles every time you start\n");
+	printf("\tthen place them in the ELMON shell variable. For example:\n");
+	printf("\t export ELMON=cmdrvtan\n");
+
+	printf("\n");
+	printf("Others:\n");
+	printf("\ta) To you want to stop elmon - kill -USR2 <elmon-pid>\n");
+	printf("\tb) Use -p and elmon outputs the background process pid\n");
+	printf("\tc) To limit the processes elmon lists (online and to a file)\n");
+	printf("\t   Either set NMONCMD0 to NMONCMD63 to the program names\n");
+	printf("\t   or use -C cmd:cmd:cmd etc. example: -C ksh:vi:syncd\n");
+	printf("\td) If you want to pipe elmon output to other commands use a FIFO:\n");
+	printf("\t   mkfifo /tmp/mypipe\n");
+	printf("\t   elmon -F /tmp/mypipe &\n");
+	printf("\t   grep /tmp/mypipe\n");
+	printf("\te) If elmon fails please report it with:\n");
+	printf("\t   1) elmon version like: %s\n",VERSION);
+	printf("\t   2) the output of cat /proc/cpuinfo\n");
+	printf("\t   3) some clue of what you were doing\n");
+	printf("\t   4) I may ask you to run the debug version\n");
+	printf("\tf) Set NMONURING=1 to read /proc through io_uring, one system call\n");
+	printf("\t   an interval, %s --bench-io compares it with a read() a file\n", progname);
+	printf("\n");
+	exit(0);
+}
+
+#define JFSMAX 128
+#define LOAD 1
+#define UNLOAD 0
+#define JFSNAMELEN 64
+#define JFSTYPELEN 8
+
+struct jfs {
+	char name[JFSNAMELEN];
+	char device[JFSNAMELEN];
+	char type[JFSNAMELEN];
+	int  fd;
+	int  mounted;
+	} jfs[JFSMAX];
+
+int jfses =0;
+void jfs_load(int load)
+{
+int i;
+struct stat stat_buffer;
+FILE * mfp; /* FILE pointer for mtab file*/
+struct mntent *mp; /* mnt point stats */
+static int jfs_loaded = 0;
+
+	if(load==LOAD) { 
+		if(jfs_loaded == 0) { 
+			mfp = setmntent("/etc/mtab","r");
+			for(i=0; i<JFSMAX && (mp = getmntent(mfp) ) != NULL; i++) {
+				strncpy(jfs[i].device, mp->mnt_fsname,JFSNAMELEN);
+				strncpy(jfs[i].name,mp->mnt_dir,JFSNAMELEN);
+				strncpy(jfs[i].type, mp->mnt_type,JFSTYPELEN);
+				mp->mnt_fsname[JFSNAMELEN-1]=0;
+				mp->mnt_dir[JFSNAMELEN-1]=0;
+				mp->mnt_type[JFSTYPELEN-1]=0;
+			}
+			endfsent();
+			jfs_loaded = 1;
+			jfses=i;
+		}
+
+		/* 1st or later time - just reopen the mount points */
+		for(i=0;i<JFSMAX && jfs[i].name[0] !=0;i++) {
+			if(stat(jfs[i].name, &stat_buffer) != -1 ) {
+
+                                jfs[i].fd = open(jfs[i].name, O_RDONLY);
+                                if(jfs[i].fd != -1 ) 
+                                        jfs[i].mounted = 1;
+                                else
+                                        jfs[i].mounted = 0;
+			}
+			else jfs[i].mounted = 0;
+		}
+	} else { /* this is an unload request */
+		if(jfs_loaded)
+			for(i=0;i<JFSMAX && jfs[i].name[0] != 0;i++) {
+			    if(jfs[i].mounted)
+				close(jfs[i].fd);
+			    jfs[i].fd=0;
+			}
+		else 
+			/* do nothing */ ;
+	}
+}
+
+/* We order this array rather than the actual process tables
+ * the index is the position in the process table and
+ * the time is the CPU used in the last period in seconds
+ */
+struct topper {
+	int	index;
+	int	other;
+	double	size;
+	double	io;
+	int	time;
+	double	elapsed;	/* between the two reads of the process */
+} *topper;
+int	topper_size = 200;
+
+/* Routine used by qsort to order the processes by CPU usage */
+int	cpu_compare(const void *a, const void *b)
+{
+double ra = ((struct topper *)a)->time / ((struct topper *)a)->elapsed;
+double rb = ((struct topper *)b)->time / ((struct topper *)b)->elapsed;
+
+	return (rb > ra) - (rb < ra);
+}
+
+int	size_compare(const void *a, const void *b)
+{
+	return (int)((((struct topper *)b)->size - ((struct topper *)a)->size));
+}
+
+int	disk_compare(void *a, void *b)
+{
+	return (int)((((struct topper *)b)->io - ((struct topper *)a)->io));
+}
+
+/* Top mode 2 rolls the processes up by container */
+struct container_top {
+	char	*name;
+	int	procs;
+	double	cpu;
+	double	usr;
+	double	sys;
+	unsigned long size;
+	unsigned long res;
+	double	minflt;
+	double	majflt;
+} *ctop = NULL;
+int	ctop_size = 0;
+
+int	container_name_compare(const void *a, const void *b)
+{
+	return strcmp(((struct container_top *)a)->name, ((struct container_top *)b)->name);
+}
+
+int	container_cpu_compare(const void *a, const void *b)
+{
+	if(((struct container_top *)b)->cpu > ((struct container_top *)a)->cpu) return 1;
+	if(((struct container_top *)b)->cpu < ((struct container_top *)a)->cpu) return -1;
+	return 0;
+}
+
+/* Show or save the processes of topper[] added up per container.
+ * Returns the number of containers shown.
+ */
+int top_containers(WINDOW *pad, int max_sorted)
+{
+struct container_top *c;
+int i;
+int j;
+int k;
+int n;
+
+	if(ctop_size < max_sorted) {
+		ctop_size = max_sorted + 128;
+		ctop = REALLOC(ctop, sizeof(struct container_top) * ctop_size);
+	}
+	container_reserve(max_sorted);
+	for(j = 0; j < max_sorted; j++) {
+		i = topper[j].index;
+		c = &ctop[j];
+		c->name   = container_lookup(p->procs[i].pi_pid, p->procs[i].pi_start_time);
+		c->procs  = 1;
+		c->cpu    = topper[j].time / topper[j].elapsed;
+		c->usr    = TIMEDELTA(pi_utime,i,topper[j].other) / topper[j].elapsed;
+		c->sys    = TIMEDELTA(pi_stime,i,topper[j].other) / topper[j].elapsed;
+		c->size   = p->procs[i].statm_size*4;
+		c->res    = p->procs[i].statm_resident*4;
+		c->minflt = COUNTDELTA(pi_minflt) / topper[j].elapsed;
+		c->majflt = COUNTDELTA(pi_majflt) / topper[j].elapsed;
+	}
+	qsort((void *)ctop, max_sorted, sizeof(struct container_top), &container_name_compare);
+	for(n = 0, k = 0; k < max_sorted; k++) {
+		if(n > 0 && strcmp(ctop[n - 1].name, ctop[k].name) == 0) {
+			c = &ctop[n - 1];
+			c->procs++;
+			c->cpu    += ctop[k].cpu;
+			c->usr    += ctop[k].usr;
+			c->sys    += ctop[k].sys;
+			c->size   += ctop[k].size;
+			c->res    += ctop[k].res;
+			c->minflt += ctop[k].minflt;
+			c->majflt += ctop[k].majflt;
+		} else
+			ctop[n++] = ctop[k];
+	}
+	qsort((void *)ctop, n, sizeof(struct container_top), &container_cpu_compare);
+
+	if(cursed)
+		mvwprintw(pad, 1, 1, "Container                Procs    %%CPU    %%Usr    %%Sys    Size-KB  ResSet-KB  MinFlt/s MajFlt/s");
+	for(k = 0; k < n; k++) {
+		c = &ctop[k];
+		if((!show_all || !cursed) && c->cpu < ignore_procdisk_threshold)
+			break;
+		if(cursed)
+			mvwprintw(pad, k + 2, 1, "%-24s %5d %7.1f %7.1f %7.1f %10lu %10lu %9.0f %8.0f",
+				c->name, c->procs, c->cpu, c->usr, c->sys, c->size, c->res, c->minflt, c->majflt);
+		else {
+			enc_begin("TOPCONT", NULL);
+			enc_key("Container", c->name);
+			enc_num("Procs", c->procs, 0);
+			enc_num("%CPU", c->cpu, 1);
+			enc_num("%Usr", c->usr, 1);
+			enc_num("%Sys", c->sys, 1);
+			enc_num("Size", c->size, 0);
+			enc_num("ResSet", c->res, 0);
+			enc_num("MinorFault", c->minflt, 0);
+			enc_num("MajorFault", c->majflt, 0);
+			enc_end();
+		}
+	}
+	return k;
+}
+
+
+/* T<snapshot> or [dd-MON-yyyy] hh:mm[:ss] as a play_seek, with the date of
+ * day if there is none.  0 if it is neither.
+ */
+long long play_when(char *buf, time_t day)
+{
+struct tm tm;
+time_t t;
+char mon[4];
+long tag;
+int i;
+
+	localtime_r(&day, &tm);
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	if((buf[0] == 'T' || buf[0] == 't') && (tag = atol(&buf[1])) >= 0)
+		return (long long)tag + 1;
+	if(sscanf(buf, "%d-%3s-%d %d:%d:%d", &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) >= 5) {
+		for(i = 0; i < 12; i++)
+			if(!strcasecmp(mon, month[i]))
+				tm.tm_mon = i;
+		tm.tm_year -= 1900;
+	} else if(sscanf(buf, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 2)
+		return 0;
+	if((t = mktime(&tm)) <= 0)
+		return 0;
+	return -(long long)t * 1000;
+}
+
+/* -P: ask where to go */
+void play_goto()
+{
+char buf[64];
+long long to;
+
+	mvprintw(0, 1, "%-78s", "Go to T<snapshot> or [dd-MON-yyyy] hh:mm[:ss]: ");
+	move(0, 49);
+	echo();
+	nodelay(stdscr, FALSE);
+	buf[0] = 0;
+	getnstr(buf, sizeof(buf) - 1);
+	nodelay(stdscr, TRUE);
+	noecho();
+	if((to = play_when(buf, p->tv.tv_sec)) != 0)
+		__atomic_store_n(&play_seek, to, __ATOMIC_RELEASE);
+}
+
+/* checkinput is the subroutine to handle user input */
+int checkinput(void)
+{
+	static int use_env = 1;
+	char	buf[1024];
+	int	chars;
+	int	key;
+	int	i = 0;
+	char *p;
+	int 	keys = 0;  //Keeps track if a key was pressed.  1 = yes, 2 = arrow key was pressed
+
+	if (!cursed) /* not user input so stop with control-C */
+		return 0;
+
+	if (use_env){
+		use_env = 0;
+		p=getenv("ELMON");
+		if(p!=0){
+			strcpy(buf,p);
+			chars = strlen(buf);
+                        for (i = chars; i >= 0; i--){
+				ungetch(buf[i]);
+			}
+                }
+	}
+	
+	key = getch();
+		while (key != ERR){
+				keys = 1;
+				welcome=0;
+				switch (key) {
+				case 'x':
+				case 'q':
+					nocbreak();
+					endwin();
+					exit(0);
+
+				case '6':
+				case '7':
+				case '8':
+				case '9':
+					dotline = buf[i] - '0';
+					break;
+				case '+':
+					seconds = seconds * 2;
+					if (seconds > 10 && (seconds % 10 != 0)){
+						seconds = (int)(seconds / 10) * 10;
+					}
+					break;
+				case '-':
+					seconds = seconds / 2;
+					if (seconds < 1)
+						seconds = 1;
+					if (seconds > 10 && (seconds % 10 != 0)){
+						seconds = (int)(seconds / 10) * 10;
+					}
+					break;
+				case '.':
+					if (show_all)
+						show_all = 0;
+					else {
+						show_all = 1;
+						show_disk_mode = SHOW_DISK_STATS;
+						add_option(SHOW_DISK);
+						add_option(SHOW_TOP);
+						show_topmode =3;
+					}
+					clear();
+					break;
+				case '?':
+				case 'h':
+				case 'H':
+                                        if (enabled_option(SHOW_HELP))
+                                                remove_option(SHOW_HELP);
+                                        else {
+                                                add_option(SHOW_HELP);
+                                                remove_option(SHOW_VERBOSE);
+                                        }
+					clear();
+					break;
+				case 'b':
+				case 'B':
+					FLIP(colour);
+					clear();
+					break;
+				case 'Z':
+					FLIP(show_raw);
+					add_option(SHOW_SMP);
+					clear();
+					break;
+				case 'l':
+					flip (SHOW_LONGTERM);
+					clear();
+					break;
+				case 'p':
+					flip(SHOW_LPAR);
+					clear();
+					break;
+				case 'V':
+					flip(SHOW_VM);
+					clear();
+					break;
+				case 'j':
+				case 'J':
+                                        flip(SHOW_JFS);
+					clear();
+					break;
+#ifdef PARTITIONS
+				case 'P':
+					flip(SHOW_PARTITIONS);
+					clear();
+					break;
+#endif /*PARTITIONS*/
+				case 'k':
+				case 'K':
+					flip(SHOW_KERNEL);
+					clear();
+					break;
+				case 'm':
+					flip(SHOW_MEMORY);
+					clear();
+					break;
+				case 'M':
 					flip(SHOW_MEMORY_GRAPH);
 					clear();
 					break;
@@ -2844,6 +5927,29 @@ int checkinput(void)
 					flip(SHOW_NFS);
 					clear();
 					break;
+				case 'i':
+				case 'I':
+					flip(SHOW_IRQ);
+					clear();
+					break;
+				case 'S':
+					flip(SHOW_PSI);
+					clear();
+					break;
+				case 'U':
+					flip(SHOW_NUMA);
+					clear();
+					break;
+				case 'G':	/* off -> CPU -> Memory -> IO -> off */
+					if (!enabled_option(SHOW_CGROUP)) {
+						cg_sort = CG_SORT_CPU;
+						add_option(SHOW_CGROUP);
+					} else if (cg_sort == CG_SORT_IO)
+						remove_option(SHOW_CGROUP);
+					else
+						cg_sort++;
+					clear();
+					break;
 				case 'c':
 					flip(SHOW_SMP);
 					clear();
@@ -2885,13 +5991,11 @@ int checkinput(void)
 					add_option(SHOW_TOP);
 					clear();
 					break;
-/*
 				case '2':
 					show_topmode = 2;
-					show_top = 1;
+					add_option(SHOW_TOP);
 					clear();
 					break;
-*/
 				case '3':
 					show_topmode = 3;
 					add_option(SHOW_TOP);
@@ -2929,6 +6033,26 @@ int checkinput(void)
 				case ' ':
 					clear();
 					break;
+				case 'z':	/* pause or go back to live */
+					hist_view = hist_view ? NULL : hist_newest;
+					break;
+				case '<':
+					history_step(-1);
+					break;
+				case '>':
+					history_step(1);
+					break;
+				case '^':
+					history_peak();
+					break;
+				case 'f':	/* playback speed 1x -> 10x -> max */
+					if (rec_in_name != NULL)
+						__atomic_store_n(&play_speed, play_speed == 1 ? 10 : play_speed == 10 ? 0 : 1, __ATOMIC_RELAXED);
+					break;
+				case '/':	/* playback jump to a snapshot or time */
+					if (rec_in_name != NULL)
+						play_goto();
+					break;
 				case 'g':
 					flip(SHOW_DGROUP);
                                         clear();
@@ -3052,405 +6176,6483 @@ int checkinput(void)
 						}
 					}
 					break;
-				#endif
-				default: return 0;
+				#endif
+				default: return 0;
+				}
+			key = getch();
+		}
+
+	if (keys == 1) {        //Key was pressed
+		keys = 0;
+		return 1;
+	}else if (keys == 2) {  //Arraw key was pressed
+		keys = 0;
+		return 2;
+	}else {                 //No keys were pressed
+		return 0;
+	}
+}
+
+void go_background(int def_loops, int def_secs)
+{
+	cursed = 0;
+	if (maxloops == -1)
+		maxloops = def_loops;
+	if (seconds  == -1)
+		seconds = def_secs;
+        add_option(SHOW_CPU);
+        add_option(SHOW_SMP);
+        add_option(SHOW_MEMORY);
+        add_option(SHOW_LARGE);
+        remove_option(SHOW_TOP);
+        add_option(SHOW_PARTITIONS);
+        add_option(SHOW_LPAR);
+        add_option(SHOW_VM);
+        add_option(SHOW_KERNEL);
+        add_option(SHOW_NET);
+        add_option(SHOW_JFS);
+        add_option(SHOW_DISK);
+        show_disk_mode    = SHOW_DISK_STATS;
+
+        show_all     = 1;
+        show_topmode = 3;
+}
+
+void proc_net()
+{
+FILE *fp;
+char buf[1024];
+int i=0;
+int ret;
+unsigned long junk;
+
+	if( (fp = proc_stream(P_NETDEV)) == NULL) {
+		networks=0;
+		return;
+	}
+	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
+	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
+/*
+Inter-|   Receive                                                |  Transmit
+ face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed
+    lo:    1956      30    0    0    0     0          0         0     1956      30    0    0    0     0       0          0
+  eth0:       0       0    0    0    0     0          0         0   458718       0  781    0    0     0     781          0
+  sit0:       0       0    0    0    0     0          0         0        0       0    0    0    0     0       0          0
+  eth1:       0       0    0    0    0     0          0         0        0       0    0    0    0     0       0          0
+*/
+	for(i=0;i<NETMAX;i++) {
+		if(fgets(buf,1024,fp) == NULL)
+			break;
+		strip_spaces(buf);
+				     /* 1   2   3    4   5   6   7   8   9   10   11   12  13  14  15  16 */
+		ret = sscanf(&buf[0], "%s %llu %llu %lu %lu %lu %lu %lu %lu %llu %llu %lu %lu %lu %lu %lu",
+		(char *)&p->ifnets[i].if_name,
+			&p->ifnets[i].if_ibytes,
+			&p->ifnets[i].if_ipackets,
+			&p->ifnets[i].if_ierrs,
+			&p->ifnets[i].if_idrop,
+			&p->ifnets[i].if_ififo,
+			&p->ifnets[i].if_iframe,
+			&junk,
+			&junk,
+			&p->ifnets[i].if_obytes,
+			&p->ifnets[i].if_opackets,
+			&p->ifnets[i].if_oerrs,
+			&p->ifnets[i].if_odrop,
+			&p->ifnets[i].if_ofifo,
+			&p->ifnets[i].if_ocolls,
+			&p->ifnets[i].if_ocarrier
+			);
+		if(ret != 16) 
+			fprintf(stderr,"sscanf wanted 16 returned = %d line=%s\n", ret, (char *)buf);
+	}
+	end:
+	fclose(fp);
+	networks = i;
+}
+
+/* Some /proc files are far bigger than PROC_MAXBUF: /proc/interrupts is
+ * over 10 MB with thousands of MSI-X vectors and hundreds of CPUs.
+ * These are kept open, re-read with pread() and the buffer grows to fit.
+ */
+struct bigfile {
+	char	*filename;
+	int	fd;
+	char	*buf;
+	long	size;	/* allocated bytes */
+	long	len;	/* bytes read last time */
+};
+
+long bigfile_read(struct bigfile *bf)
+{
+char buf[1024];
+long ret;
+
+	if(bf->fd <= 0) {
+		if( (bf->fd = open(bf->filename, O_RDONLY)) == -1) {
+			sprintf(buf, "failed to open file %s", bf->filename);
+			error(buf);
+			bf->fd = 0;
+			return -1;
+		}
+	}
+	if(bf->buf == NULL) {
+		bf->size = PROC_MAXBUF * 4;
+		bf->buf = MALLOC(bf->size);
+	}
+	for(bf->len = 0; ; ) {
+		if(bf->len == bf->size - 1) {
+			bf->size = bf->size * 2;
+			bf->buf = REALLOC(bf->buf, bf->size);
+		}
+		ret = pread(bf->fd, &bf->buf[bf->len], bf->size - 1 - bf->len, bf->len);
+		if(ret <= 0)
+			break;
+		bf->len += ret;
+	}
+	bf->buf[bf->len] = 0;
+	if(reread) {
+		close(bf->fd);
+		bf->fd = 0;
+	}
+	return bf->len;
+}
+
+struct bigfile irq_file     = { "/proc/interrupts", 0, NULL, 0, 0 };
+struct bigfile softirq_file = { "/proc/softirqs",   0, NULL, 0, 0 };
+
+int *irq_column = NULL;	/* CPU number of each column, offline CPUs are missing */
+int irq_columns_max = 0;
+int irq_cpu_max = 0;	/* highest CPU number seen + 1 */
+
+/* Parse one of the two files into the sparse matrix.  This is done by hand
+ * rather than with sscanf as there can be a million cells per read.
+ */
+void proc_irq_parse(struct bigfile *bf, struct irq_stat *is)
+{
+char *s;
+char *eol;
+char *end;
+char *d;
+int columns;
+int c;
+unsigned long long val;
+struct irq_row *row;
+
+	is->rows = 0;
+	is->ncells = 0;
+	if(bigfile_read(bf) <= 0)
+		return;
+	s = bf->buf;
+	end = &bf->buf[bf->len];
+	if((eol = memchr(s, '\n', end - s)) == NULL)
+		return;
+	/* header line is "      CPU0       CPU1       CPU4 ..." */
+	for(columns = 0; s < eol; s++) {
+		if(s[0] != 'C' || s[1] != 'P' || s[2] != 'U')
+			continue;
+		if(columns == irq_columns_max) {
+			irq_columns_max = irq_columns_max * 2 + 64;
+			irq_column = REALLOC(irq_column, sizeof(int) * irq_columns_max);
+		}
+		for(s += 3, c = 0; *s >= '0' && *s <= '9'; s++)
+			c = c * 10 + *s - '0';
+		irq_column[columns++] = c;
+		if(c >= irq_cpu_max)
+			irq_cpu_max = c + 1;
+	}
+
+	/* rows are " 24:   12   0   7  IO-APIC   5-edge   ACPI:Ged" */
+	for(s = eol + 1; s < end; s = eol + 1) {
+		if((eol = memchr(s, '\n', end - s)) == NULL)
+			eol = end;
+		while(*s == ' ')
+			s++;
+		if(s >= eol)
+			continue;
+		if(is->rows == is->maxrows) {
+			is->maxrows = is->maxrows * 2 + 256;
+			is->row = REALLOC(is->row, sizeof(struct irq_row) * is->maxrows);
+		}
+		row = &is->row[is->rows];
+		for(c = 0; s < eol && *s != ':' && c < IRQNAMELEN - 1; s++)
+			row->name[c++] = *s;
+		row->name[c] = 0;
+		while(s < eol && *s != ':')
+			s++;
+		s++;
+		row->first = is->ncells;
+		row->cells = 0;
+		row->total = 0;
+		for(c = 0; c < columns; c++) {
+			while(*s == ' ')
+				s++;
+			if(s >= eol || *s < '0' || *s > '9')
+				break;
+			for(val = 0; *s >= '0' && *s <= '9'; s++)
+				val = val * 10 + *s - '0';
+			row->total += val;
+			if(val == 0)
+				continue;
+			if(is->ncells == is->maxcells) {
+				is->maxcells = is->maxcells * 2 + 4096;
+				is->cpu   = REALLOC(is->cpu,   sizeof(int) * is->maxcells);
+				is->count = REALLOC(is->count, sizeof(unsigned long long) * is->maxcells);
+			}
+			is->cpu[is->ncells] = irq_column[c];
+			is->count[is->ncells] = val;
+			is->ncells++;
+			row->cells++;
+		}
+		/* ERR: and MIS: have one count for the whole system */
+		row->global = (c == 1 && columns > 1);
+		if(row->global && row->cells)
+			is->cpu[row->first] = -1;
+
+		/* keep the tail of the description as that has the device name */
+		while(*s == ' ')
+			s++;
+		if(eol - s > IRQDESCLEN - 1) {
+			s = eol - (IRQDESCLEN - 1);
+			for(d = s; d < eol && *d != ' '; d++)
+				;
+			if(d < eol)
+				s = d;
+		}
+		for(d = row->desc; s < eol; s++) {
+			if(*s == ' ' && (d == row->desc || d[-1] == ' '))
+				continue;
+			*d++ = (*s == ',') ? ';' : *s;	/* keep the spreadsheet columns */
+		}
+		*d = 0;
+		is->rows++;
+	}
+	is->cpu_max = irq_cpu_max;
+}
+
+void proc_irq()
+{
+	proc_irq_parse(&irq_file, &p->irq);
+	proc_irq_parse(&softirq_file, &p->softirq);
+}
+
+/* Find the row of the previous sample matching row r of this one.
+ * The IRQ list only changes when devices come and go so first try
+ * the same position, allowing for the rows being shifted.
+ */
+int irq_prev_row(struct irq_stat *now, struct irq_stat *prev, int r, int *shift)
+{
+int i;
+
+	i = r + *shift;
+	if(i >= 0 && i < prev->rows && !strcmp(now->row[r].name, prev->row[i].name))
+		return i;
+	for(i = 0; i < prev->rows; i++) {
+		if(!strcmp(now->row[r].name, prev->row[i].name)) {
+			*shift = i - r;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Merge the cells of a row with the previous sample to give the CPU
+ * distribution of the interval.  The per-CPU rates are added to cpu_rate
+ * (if not NULL), the busiest CPU and its share is returned via top_cpu and
+ * top_share and the number of CPUs that took the interrupt via ncpus.
+ * Returns the imbalance score: 0 is evenly spread over all the CPUs
+ * and 100 means only one CPU took them all.
+ */
+double irq_spread(struct irq_stat *now, struct irq_stat *prev, int r, int pr, double elapsed,
+		double *cpu_rate, int *ncpus, int *top_cpu, double *top_share)
+{
+struct irq_row *row = &now->row[r];
+struct irq_row *prow = NULL;
+int i;
+int j;
+int jend;
+unsigned long long delta;
+unsigned long long total = 0;
+unsigned long long top = 0;
+
+	*ncpus = 0;
+	*top_cpu = -1;
+	*top_share = 0.0;
+	if(pr < 0)
+		return 0.0;
+	prow = &prev->row[pr];
+	j = prow->first;
+	jend = prow->first + prow->cells;
+	for(i = row->first; i < row->first + row->cells; i++) {
+		/* cells are in CPU order so walk the previous row alongside */
+		while(j < jend && prev->cpu[j] < now->cpu[i])
+			j++;
+		if(j < jend && prev->cpu[j] == now->cpu[i])
+			delta = now->count[i] > prev->count[j] ? now->count[i] - prev->count[j] : 0;
+		else
+			delta = now->count[i];
+		if(delta == 0)
+			continue;
+		(*ncpus)++;
+		total += delta;
+		if(delta > top) {
+			top = delta;
+			*top_cpu = now->cpu[i];
+		}
+		if(cpu_rate != NULL && now->cpu[i] >= 0)
+			cpu_rate[now->cpu[i]] += (double)delta / elapsed;
+	}
+	if(total == 0)
+		return 0.0;
+	*top_share = (double)top / (double)total * 100.0;
+	if(row->global || cpus < 2)
+		return 0.0;
+	return (*top_share - 100.0 / cpus) / (100.0 - 100.0 / cpus) * 100.0;
+}
+
+#define IRQ_TOPN 10		/* IRQs shown/saved each time */
+#define IRQ_STORM_FACTOR 8.0	/* storm = rate jumped to 8 times its average */
+#define IRQ_STORM_MIN 10000.0	/*         and at least this many per second */
+
+struct irq_top {
+	int	row;
+	int	prev;
+	double	rate;
+	double	average;	/* long term rate before this interval */
+	int	ncpus;
+	int	top_cpu;
+	double	top_share;
+	double	imbalance;
+} *irq_top = NULL;
+int	irq_top_size = 0;
+
+/* long term average rate of each row, for p->irq and q->irq row numbers */
+double	*irq_average = NULL;
+double	*irq_average_prev = NULL;
+int	irq_average_rows = 0;	/* valid entries in irq_average_prev */
+double	*irq_cpu_rate = NULL;
+int	irq_cpu_size = 0;
+int	irq_first_time = 1;
+
+int	irq_compare(const void *a, const void *b)
+{
+	if(((struct irq_top *)b)->rate > ((struct irq_top *)a)->rate) return 1;
+	if(((struct irq_top *)b)->rate < ((struct irq_top *)a)->rate) return -1;
+	return 0;
+}
+
+/* Work out the rates and distribution of each IRQ then show or save
+ * the top IRQs and the softirqs.  Returns the rows used on the pad.
+ */
+int show_irq(WINDOW *pad, double elapsed)
+{
+static int irq_shift = 0;
+static int soft_shift = 0;
+int i;
+int j;
+int r;
+int pr;
+int n;
+int storm;
+int busiest[4];
+double hard_total = 0.0;
+double soft_total = 0.0;
+double *swap;
+struct irq_top *t;
+struct irq_top soft;
+
+	if(irq_top_size < p->irq.rows) {
+		irq_top_size = p->irq.rows + 64;
+		irq_top = REALLOC(irq_top, sizeof(struct irq_top) * irq_top_size);
+		irq_average = REALLOC(irq_average, sizeof(double) * irq_top_size);
+		irq_average_prev = REALLOC(irq_average_prev, sizeof(double) * irq_top_size);
+	}
+	if(irq_cpu_size < p->irq.cpu_max) {
+		irq_cpu_size = p->irq.cpu_max;
+		irq_cpu_rate = REALLOC(irq_cpu_rate, sizeof(double) * irq_cpu_size);
+	}
+	for(i = 0; i < irq_cpu_size; i++)
+		irq_cpu_rate[i] = 0.0;
+
+	for(r = 0; r < p->irq.rows; r++) {
+		t = &irq_top[r];
+		t->row = r;
+		t->prev = pr = irq_prev_row(&p->irq, &q->irq, r, &irq_shift);
+		if(pr < 0 || p->irq.row[r].total < q->irq.row[pr].total)
+			t->rate = 0.0;
+		else
+			t->rate = (double)(p->irq.row[r].total - q->irq.row[pr].total) / elapsed;
+		if(!p->irq.row[r].global)
+			hard_total += t->rate;
+		t->average = (pr < 0 || pr >= irq_average_rows) ? t->rate : irq_average_prev[pr];
+		irq_average[r] = t->average * 0.9 + t->rate * 0.1;
+		t->imbalance = irq_spread(&p->irq, &q->irq, r, pr, elapsed, irq_cpu_rate,
+					&t->ncpus, &t->top_cpu, &t->top_share);
+	}
+	swap = irq_average_prev;
+	irq_average_prev = irq_average;
+	irq_average = swap;
+	irq_average_rows = q->irq.rows == 0 ? 0 : p->irq.rows;
+	qsort((void *)irq_top, p->irq.rows, sizeof(struct irq_top), &irq_compare);
+	for(r = 0; r < p->softirq.rows; r++) {
+		pr = irq_prev_row(&p->softirq, &q->softirq, r, &soft_shift);
+		if(pr >= 0 && p->softirq.row[r].total >= q->softirq.row[pr].total)
+			soft_total += (double)(p->softirq.row[r].total - q->softirq.row[pr].total) / elapsed;
+	}
+
+	/* the four CPUs taking the most hard interrupts */
+	for(j = 0; j < 4; j++) {
+		busiest[j] = -1;
+		for(i = 0; i < irq_cpu_size; i++) {
+			if(irq_cpu_rate[i] <= 0.0 || (busiest[j] >= 0 && irq_cpu_rate[i] <= irq_cpu_rate[busiest[j]]))
+				continue;
+			for(n = 0; n < j && busiest[n] != i; n++)
+				;
+			if(n == j)
+				busiest[j] = i;
+		}
+	}
+
+	if(cursed) {
+		BANNER(pad, "Interrupts");
+		if(q->irq.rows == 0) {
+			mvwprintw(pad, 1, 1, "Please wait - collecting data");
+			return 2;
+		}
+		mvwprintw(pad, 1, 1, "Hardirq=%10.1f/s  Softirq=%10.1f/s  IRQs=%d  CPUs=%d",
+			hard_total, soft_total, p->irq.rows, p->irq.cpu_max);
+		mvwprintw(pad, 2, 1, "Busiest CPUs:");
+		wclrtoeol(pad);
+		for(j = 0; j < 4 && busiest[j] >= 0; j++)
+			mvwprintw(pad, 2, 15 + j * 16, "cpu%-3d %4.0f%%",
+				busiest[j], hard_total == 0.0 ? 0.0 : irq_cpu_rate[busiest[j]] / hard_total * 100.0);
+		mvwprintw(pad, 3, 1, "IRQ          Rate/s CPUs Imbal TopCPU Share Description");
+		for(j = 0, n = 4; j < IRQ_TOPN && j < p->irq.rows; j++) {
+			t = &irq_top[j];
+			if(!show_all && t->rate < 1.0)
+				break;
+			storm = t->rate > IRQ_STORM_MIN && t->rate > t->average * IRQ_STORM_FACTOR;
+			mvwprintw(pad, n, 1, "%-8.8s %10.1f %4d %5.0f %6d %4.0f%% %-31s",
+				p->irq.row[t->row].name,
+				t->rate,
+				t->ncpus,
+				t->imbalance,
+				t->top_cpu,
+				t->top_share,
+				p->irq.row[t->row].desc);
+			if(storm) {
+				COLOUR wattrset(pad, COLOR_PAIR(1));
+				wprintw(pad, " STORM");
+				COLOUR wattrset(pad, COLOR_PAIR(0));
+			} else
+				wprintw(pad, "      ");
+			n++;
+		}
+		mvwprintw(pad, n++, 1, "Softirq      Rate/s CPUs Imbal TopCPU Share");
+		for(r = 0; r < p->softirq.rows; r++) {
+			pr = irq_prev_row(&p->softirq, &q->softirq, r, &soft_shift);
+			soft.rate = (pr < 0 || p->softirq.row[r].total < q->softirq.row[pr].total) ? 0.0 :
+				(double)(p->softirq.row[r].total - q->softirq.row[pr].total) / elapsed;
+			if(!show_all && soft.rate < 1.0)
+				continue;
+			soft.imbalance = irq_spread(&p->softirq, &q->softirq, r, pr, elapsed, NULL,
+						&soft.ncpus, &soft.top_cpu, &soft.top_share);
+			mvwprintw(pad, n++, 1, "%-8.8s %10.1f %4d %5.0f %6d %4.0f%%",
+				p->softirq.row[r].name,
+				soft.rate,
+				soft.ncpus,
+				soft.imbalance,
+				soft.top_cpu,
+				soft.top_share);
+		}
+		return n;
+	}
+
+	if(irq_first_time) {
+		if(show_headings) {
+			fprintf(fp, "SOFTIRQ,Softirqs per second %s", run_name);
+			for(r = 0; r < p->softirq.rows; r++)
+				fprintf(fp, ",%s", p->softirq.row[r].name);
+			fprintf(fp, "\n");
+			fprintf(fp, "IRQTOP,+IRQ,Time,Rate/s,CPUs,Imbalance,TopCPU,TopCPU%%,Storm,Description\n");
+		}
+		irq_first_time = 0;
+	}
+	if(q->irq.rows == 0)
+		return 0;
+	enc_begin("SOFTIRQ", "softirq.rrd");
+	for(r = 0; r < p->softirq.rows; r++) {
+		pr = irq_prev_row(&p->softirq, &q->softirq, r, &soft_shift);
+		enc_num(p->softirq.row[r].name, (pr < 0 || p->softirq.row[r].total < q->softirq.row[pr].total) ? 0.0 :
+			(double)(p->softirq.row[r].total - q->softirq.row[pr].total) / elapsed, 1);
+	}
+	enc_end();
+	for(j = 0; j < IRQ_TOPN && j < p->irq.rows; j++) {
+		t = &irq_top[j];
+		if(t->rate < ignore_procdisk_threshold)
+			break;
+		storm = t->rate > IRQ_STORM_MIN && t->rate > t->average * IRQ_STORM_FACTOR;
+		enc_begin("IRQTOP", NULL);
+		enc_key("IRQ", p->irq.row[t->row].name);
+		enc_num("Rate/s", t->rate, 1);
+		enc_num("CPUs", t->ncpus, 0);
+		enc_num("Imbalance", t->imbalance, 1);
+		enc_num("TopCPU", t->top_cpu, 0);
+		enc_num("TopCPU%", t->top_share, 1);
+		enc_num("Storm", storm, 0);
+		enc_text("Description", p->irq.row[t->row].desc);
+		enc_end();
+	}
+	return 0;
+}
+
+
+struct bigfile psi_file[PSI_MAX] = {
+	{ "/proc/pressure/cpu",    0, NULL, 0, 0 },
+	{ "/proc/pressure/memory", 0, NULL, 0, 0 },
+	{ "/proc/pressure/io",     0, NULL, 0, 0 } };
+char	*psi_name[PSI_MAX] = { "CPU", "MEM", "IO" };
+char	*psi_col[4] = { "avg10", "avg60", "avg300", "us" };
+int	psi_available = -1;	/* unknown until first read */
+int	psi_first_time = 1;
+
+void proc_psi_line(char *s, struct psi_line *pl)
+{
+	pl->avg[0] = pl->avg[1] = pl->avg[2] = 0.0;
+	pl->total = 0;
+	sscanf(s, "%*s avg10=%lf avg60=%lf avg300=%lf total=%llu",
+		&pl->avg[0], &pl->avg[1], &pl->avg[2], &pl->total);
+}
+
+void proc_psi()
+{
+struct stat st;
+char *s;
+int r;
+
+	if(psi_available == -1)
+		psi_available = (stat("/proc/pressure", &st) == 0);
+	for(r = 0; r < PSI_MAX; r++) {
+		p->psi[r].valid = 0;
+		p->psi[r].has_full = 0;
+		if(!psi_available || bigfile_read(&psi_file[r]) <= 0)
+			continue;
+		p->psi[r].valid = 1;
+		for(s = psi_file[r].buf; s != NULL && *s; ) {
+			if(strncmp(s, "some ", 5) == 0)
+				proc_psi_line(s, &p->psi[r].some);
+			else if(strncmp(s, "full ", 5) == 0) {
+				proc_psi_line(s, &p->psi[r].full);
+				p->psi[r].has_full = 1;
+			}
+			if( (s = strchr(s, '\n')) != NULL)
+				s++;
+		}
+	}
+}
+
+/* PSI triggers: the kernel makes the file descriptor pollable (POLLPRI)
+ * once the tasks stall for more than psi_trigger_us within a window.
+ * This lets elmon wake up and take a snapshot straight away instead of
+ * averaging a short stall burst away over the whole refresh interval.
+ */
+#define PSI_WINDOW_US 1000000
+
+int	psi_trigger_us = 0;	/* -w option, 0 = triggers off */
+struct pollfd psi_poll[PSI_MAX];
+int	psi_polls = 0;
+int	psi_trigger_res[PSI_MAX];	/* resource of each pollfd */
+long	psi_trigger_count[PSI_MAX];	/* times each resource fired */
+
+void psi_trigger_init()
+{
+char buf[64];
+int r;
+int fd;
+int window;
+int threshold;
+
+	for(r = 0; r < PSI_MAX; r++) {
+		/* unprivileged users need a window that is a multiple of 2 seconds */
+		for(window = PSI_WINDOW_US; window <= 2 * PSI_WINDOW_US; window += PSI_WINDOW_US) {
+			if( (fd = open(psi_file[r].filename, O_RDWR | O_NONBLOCK)) == -1)
+				break;
+			threshold = psi_trigger_us > window ? window : psi_trigger_us;
+			sprintf(buf, "some %d %d", threshold, window);
+			if(write(fd, buf, strlen(buf) + 1) > 0) {
+				psi_poll[psi_polls].fd = fd;
+				psi_poll[psi_polls].events = POLLPRI;
+				psi_trigger_res[psi_polls] = r;
+				psi_polls++;
+				break;
+			}
+			close(fd);
+		}
+	}
+	if(psi_polls == 0) {
+		sprintf(buf, "PSI triggers not available");
+		error(buf);
+	}
+}
+
+/* Count the triggers that fired in pfd, psi_poll as polled along with
+ * other descriptors, returns 1 if any did
+ */
+int psi_fired(struct pollfd *pfd)
+{
+int i;
+int fired = 0;
+
+	for(i = 0; i < psi_polls; i++) {
+		if(pfd[i].revents & POLLPRI) {
+			psi_trigger_count[psi_trigger_res[i]]++;
+			fired = 1;
+		}
+		if(pfd[i].revents & (POLLERR | POLLNVAL)) {	/* trigger went away, stop polling it */
+			close(psi_poll[i].fd);
+			psi_poll[i].fd = -1;
+		}
+	}
+	return fired;
+}
+
+#define PSI_DELTA(line) ((!q->psi[r].valid || p->psi[r].line.total < q->psi[r].line.total) ? 0 : \
+			(p->psi[r].line.total - q->psi[r].line.total))
+
+/* Show or save the PSI averages and the stall time this interval */
+int show_psi(WINDOW *pad, double elapsed)
+{
+int r;
+int n;
+int i;
+long fired;
+char col[64];
+
+	if(cursed) {
+		BANNER(pad, "Pressure Stall Information");
+		if(!psi_available) {
+			mvwprintw(pad, 1, 1, "Not available - needs Linux 4.20+ with CONFIG_PSI");
+			return 3;
+		}
+		mvwprintw(pad, 1, 1, "         ---------- some ----------   ---------- full ----------");
+		mvwprintw(pad, 2, 1, "Resource avg10 avg60 avg300 Stall-us   avg10 avg60 avg300 Stall-us  Triggers");
+		for(n = 3, r = 0; r < PSI_MAX; r++, n++) {
+			if(!p->psi[r].valid) {
+				mvwprintw(pad, n, 1, "%-8s -", psi_name[r]);
+				continue;
+			}
+			mvwprintw(pad, n, 1, "%-8s %5.2f %5.2f %6.2f %8llu",
+				psi_name[r],
+				p->psi[r].some.avg[0],
+				p->psi[r].some.avg[1],
+				p->psi[r].some.avg[2],
+				PSI_DELTA(some));
+			if(p->psi[r].has_full)
+				wprintw(pad, "   %5.2f %5.2f %6.2f %8llu",
+					p->psi[r].full.avg[0],
+					p->psi[r].full.avg[1],
+					p->psi[r].full.avg[2],
+					PSI_DELTA(full));
+			else
+				wprintw(pad, "       -     -      -        -");
+			if(psi_trigger_us)
+				wprintw(pad, "  %8ld", p->psi[r].triggers);
+			else
+				wprintw(pad, "       off");
+		}
+		if(psi_trigger_us)
+			mvwprintw(pad, n++, 1, "Trigger: some stall over %d us per second wakes elmon", psi_trigger_us);
+		return n + 1;
+	}
+
+	if(!psi_available)
+		return 0;
+	if(psi_first_time) {
+		if(show_headings) {
+			fprintf(fp, "PSI,Pressure Stall Information %s", run_name);
+			for(r = 0; r < PSI_MAX; r++)
+				fprintf(fp, ",%s some avg10,%s some avg60,%s some avg300,%s some us,%s full avg10,%s full avg60,%s full avg300,%s full us",
+					psi_name[r], psi_name[r], psi_name[r], psi_name[r],
+					psi_name[r], psi_name[r], psi_name[r], psi_name[r]);
+			fprintf(fp, ",Triggers\n");
+		}
+		psi_first_time = 0;
+	}
+	enc_begin("PSI", "psi.rrd");
+	for(fired = 0, r = 0; r < PSI_MAX; r++) {
+		for(i = 0; i < 8; i++) {
+			snprintf(col, sizeof(col), "%s %s %s", psi_name[r], i < 4 ? "some" : "full", psi_col[i % 4]);
+			if(i % 4 == 3)
+				enc_num(col, i < 4 ? PSI_DELTA(some) : PSI_DELTA(full), 0);
+			else
+				enc_num(col, i < 4 ? p->psi[r].some.avg[i % 4] : p->psi[r].full.avg[i % 4], 2);
+		}
+		fired += p->psi[r].triggers - q->psi[r].triggers;
+	}
+	enc_num("Triggers", fired, 0);
+	enc_end();
+	return 0;
+}
+
+/* cgroup v2 statistics.  Walking the tree and opening half a dozen files
+ * per cgroup every interval is too slow on a host with thousands of
+ * cgroups, so the directory and file descriptors are kept open between
+ * snapshots and the tree is only walked again when cgroup.stat shows the
+ * number of descendants changed, or every CG_RESCAN snapshots to catch a
+ * cgroup replaced by another one.
+ */
+#define CG_CPU_STAT	0
+#define CG_MEM_CURRENT	1
+#define CG_MEM_STAT	2
+#define CG_IO_STAT	3
+#define CG_CPU_PRESSURE	4
+#define CG_MEM_PRESSURE	5
+#define CG_IO_PRESSURE	6
+#define CG_FILES	7
+
+#define CG_RESCAN	30
+#define CG_TOPN		20
+#define CG_FD_SPARE	64	/* descriptors left for the rest of elmon */
+#define CG_FD_LIMIT	65536
+
+#define CG_FD_CLOSED	-1
+#define CG_FD_MISSING	-2	/* controller not enabled for this cgroup */
+
+char	*cg_filename[CG_FILES] = { "cpu.stat", "memory.current", "memory.stat", "io.stat",
+				"cpu.pressure", "memory.pressure", "io.pressure" };
+char	*cg_sortname[4] = { "", "CPU", "Memory", "IO" };
+
+struct cg_node {
+	char	*path;		/* relative to cg_root, "." for the top */
+	int	live;
+	int	gen;
+	int	seen;		/* walk number it was last found in */
+	int	dirfd;		/* CG_FD_CLOSED when out of descriptors */
+	int	fd[CG_FILES];
+} *cg_node = NULL;
+int	cg_nodes = 0;		/* slots used, live or not */
+int	cg_node_size = 0;
+int	cg_free_slots = 0;
+int	*cg_hash = NULL;	/* path to slot, -1 = empty */
+int	cg_hash_size = 0;
+
+char	*cg_root = NULL;	/* -G option */
+int	cg_explicit = 0;	/* show the top cgroup too when the user picked it */
+int	cg_rootfd = -1;		/* -2 = no cgroup v2 hierarchy */
+int	cg_statfd = -1;
+long	cg_descendants = -1;
+int	cg_walks = 0;
+int	cg_samples = 0;
+int	cg_rescan = 1;
+long	cg_fd_budget = 0;
+int	cg_first_time = 1;
+
+unsigned int cg_hash_path(char *path)
+{
+unsigned int h = 5381;
+
+	while(*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h;
+}
+
+int cg_lookup(char *path)
+{
+unsigned int h;
+
+	if(cg_hash_size == 0)
+		return -1;
+	for(h = cg_hash_path(path) & (cg_hash_size - 1); cg_hash[h] != -1; h = (h + 1) & (cg_hash_size - 1))
+		if(strcmp(cg_node[cg_hash[h]].path, path) == 0)
+			return cg_hash[h];
+	return -1;
+}
+
+void cg_rehash()
+{
+unsigned int h;
+int i;
+
+	if(cg_hash_size < cg_nodes * 2) {
+		if(cg_hash_size == 0)
+			cg_hash_size = 1024;
+		while(cg_hash_size < cg_nodes * 2)
+			cg_hash_size *= 2;
+		cg_hash = REALLOC(cg_hash, sizeof(int) * cg_hash_size);
+	}
+	for(i = 0; i < cg_hash_size; i++)
+		cg_hash[i] = -1;
+	for(i = 0; i < cg_nodes; i++) {
+		if(!cg_node[i].live)
+			continue;
+		for(h = cg_hash_path(cg_node[i].path) & (cg_hash_size - 1); cg_hash[h] != -1; h = (h + 1) & (cg_hash_size - 1))
+			;
+		cg_hash[h] = i;
+	}
+}
+
+/* open a file of a cgroup, relative to its own directory if that is
+ * still open or else relative to the top of the tree
+ */
+int cg_openat(struct cg_node *n, char *name, int flags)
+{
+char path[PATH_MAX];
+
+	if(n->dirfd >= 0)
+		return openat(n->dirfd, name, flags);
+	snprintf(path, sizeof(path), "%s/%s", n->path, name);
+	return openat(cg_rootfd, path, flags);
+}
+
+int cg_new(char *path)
+{
+struct cg_node *n;
+int i;
+int f;
+
+	i = cg_nodes;
+	if(cg_free_slots > 0)
+		for(i = 0; i < cg_nodes && cg_node[i].live; i++)
+			;
+	if(i == cg_nodes) {
+		if(cg_nodes == cg_node_size) {
+			cg_node_size = cg_node_size * 2 + 256;
+			cg_node = REALLOC(cg_node, sizeof(struct cg_node) * cg_node_size);
+			memset(&cg_node[cg_nodes], 0, sizeof(struct cg_node) * (cg_node_size - cg_nodes));
+		}
+		cg_nodes++;
+	} else
+		cg_free_slots--;
+	n = &cg_node[i];
+	n->path = MALLOC(strlen(path) + 1);
+	strcpy(n->path, path);
+	n->live = 1;
+	n->gen++;
+	n->dirfd = CG_FD_CLOSED;
+	for(f = 0; f < CG_FILES; f++)
+		n->fd[f] = CG_FD_CLOSED;
+	if(cg_fd_budget > 0 && (n->dirfd = openat(cg_rootfd, path, O_RDONLY | O_DIRECTORY)) >= 0)
+		cg_fd_budget--;
+	else
+		n->dirfd = CG_FD_CLOSED;
+	return i;
+}
+
+void cg_free(int i)
+{
+struct cg_node *n = &cg_node[i];
+int f;
+
+	for(f = 0; f < CG_FILES; f++) {
+		if(n->fd[f] >= 0) {
+			close(n->fd[f]);
+			cg_fd_budget++;
+		}
+	}
+	if(n->dirfd >= 0) {
+		close(n->dirfd);
+		cg_fd_budget++;
+	}
+	free(n->path);
+	n->path = NULL;
+	n->live = 0;
+	cg_free_slots++;
+}
+
+void cg_walk(char *path)
+{
+char child[PATH_MAX];
+struct dirent *de;
+DIR *dir;
+int i;
+int f;
+int fd;
+
+	if( (i = cg_lookup(path)) == -1)
+		i = cg_new(path);
+	cg_node[i].seen = cg_walks;
+	for(f = 0; f < CG_FILES; f++)
+		if(cg_node[i].fd[f] == CG_FD_MISSING)	/* controllers can be enabled later */
+			cg_node[i].fd[f] = CG_FD_CLOSED;
+
+	/* fdopendir() takes over the descriptor and a dup() would share its
+	 * offset, leaving the cached one at EOF for the next walk */
+	if(cg_node[i].dirfd >= 0)
+		fd = openat(cg_node[i].dirfd, ".", O_RDONLY | O_DIRECTORY);
+	else
+		fd = openat(cg_rootfd, path, O_RDONLY | O_DIRECTORY);
+	if(fd == -1)
+		return;
+	if( (dir = fdopendir(fd)) == NULL) {
+		close(fd);
+		return;
+	}
+	while( (de = readdir(dir)) != NULL) {
+		if(de->d_type != DT_DIR || de->d_name[0] == '.')
+			continue;
+		if(strcmp(path, ".") == 0)
+			snprintf(child, sizeof(child), "%s", de->d_name);
+		else
+			snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+		cg_walk(child);		/* may move cg_node[] */
+	}
+	closedir(dir);
+}
+
+int cg_init()
+{
+struct rlimit rl;
+char *top = "/sys/fs/cgroup";
+char buf[1024];
+
+	/* hybrid systems mount cgroup v2 under unified with v1 next to it */
+	if(access("/sys/fs/cgroup/cgroup.controllers", F_OK) != 0)
+		top = "/sys/fs/cgroup/unified";
+	if(cg_root == NULL || strcmp(cg_root, "/") == 0 || strcmp(cg_root, ".") == 0) {
+		cg_root = top;
+		cg_explicit = 0;
+	} else if(strncmp(cg_root, "/sys/", 5) != 0) {
+		snprintf(buf, sizeof(buf), "%s/%s", top, cg_root[0] == '/' ? &cg_root[1] : cg_root);
+		cg_root = MALLOC(strlen(buf) + 1);
+		strcpy(cg_root, buf);
+	}
+	if( (cg_rootfd = open(cg_root, O_RDONLY | O_DIRECTORY)) == -1) {
+		snprintf(buf, sizeof(buf), "cgroup v2 not found at %s", cg_root);
+		error(buf);
+		cg_rootfd = -2;
+		return 0;
+	}
+	cg_statfd = openat(cg_rootfd, "cgroup.stat", O_RDONLY);
+
+	/* caching every descriptor for thousands of cgroups needs a high limit */
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		if(rl.rlim_cur < CG_FD_LIMIT && rl.rlim_cur < rl.rlim_max) {
+			rl.rlim_cur = (rl.rlim_max < CG_FD_LIMIT) ? rl.rlim_max : CG_FD_LIMIT;
+			setrlimit(RLIMIT_NOFILE, &rl);
+			getrlimit(RLIMIT_NOFILE, &rl);
+		}
+		cg_fd_budget = (long)rl.rlim_cur - CG_FD_SPARE;
+	}
+	return 1;
+}
+
+/* read a cgroup file into buf, returns the length or -1 */
+long cg_read(struct cg_node *n, int file, char *buf, int size)
+{
+long len;
+int fd;
+
+	if( (fd = n->fd[file]) == CG_FD_MISSING)
+		return -1;
+	if(fd == CG_FD_CLOSED) {
+		if( (fd = cg_openat(n, cg_filename[file], O_RDONLY)) == -1) {
+			n->fd[file] = CG_FD_MISSING;
+			return -1;
+		}
+		if(cg_fd_budget > 0) {
+			n->fd[file] = fd;
+			cg_fd_budget--;
+		}
+	}
+	len = pread(fd, buf, size - 1, 0);
+	if(n->fd[file] != fd)
+		close(fd);
+	if(len < 0) {
+		cg_rescan = 1;	/* removed under our feet */
+		return -1;
+	}
+	buf[len] = 0;
+	return len;
+}
+
+/* value of a "key value" line */
+unsigned long long cg_value(char *buf, char *key)
+{
+int len = strlen(key);
+char *s;
+
+	for(s = buf; s != NULL; ) {
+		if(strncmp(s, key, len) == 0 && s[len] == ' ')
+			return strtoull(&s[len + 1], NULL, 10);
+		if( (s = strchr(s, '\n')) != NULL)
+			s++;
+	}
+	return 0;
+}
+
+/* sum of a "key=value" field over all the devices in io.stat */
+unsigned long long cg_io_value(char *buf, char *key)
+{
+unsigned long long total = 0;
+int len = strlen(key);
+char *s;
+
+	for(s = buf; (s = strstr(s, key)) != NULL; s += len)
+		if(s == buf || s[-1] == ' ')
+			total += strtoull(&s[len], NULL, 10);
+	return total;
+}
+
+void cg_sample(int i, struct cg_sample *s)
+{
+struct cg_node *n = &cg_node[i];
+char buf[8192];
+int r;
+
+	memset(s, 0, sizeof(struct cg_sample));
+	s->node = i;
+	s->gen = n->gen;
+	s->path = n->path;
+	if(cg_read(n, CG_CPU_STAT, buf, sizeof(buf)) > 0) {
+		s->usage_usec     = cg_value(buf, "usage_usec");
+		s->user_usec      = cg_value(buf, "user_usec");
+		s->system_usec    = cg_value(buf, "system_usec");
+		s->throttled_usec = cg_value(buf, "throttled_usec");
+	}
+	if(cg_read(n, CG_MEM_CURRENT, buf, sizeof(buf)) > 0)
+		s->mem_current = strtoull(buf, NULL, 10);
+	if(cg_read(n, CG_MEM_STAT, buf, sizeof(buf)) > 0) {
+		s->anon = cg_value(buf, "anon");
+		s->file = cg_value(buf, "file");
+	}
+	if(cg_read(n, CG_IO_STAT, buf, sizeof(buf)) > 0) {
+		s->rbytes = cg_io_value(buf, "rbytes=");
+		s->wbytes = cg_io_value(buf, "wbytes=");
+		s->rios   = cg_io_value(buf, "rios=");
+		s->wios   = cg_io_value(buf, "wios=");
+	}
+	for(r = 0; r < PSI_MAX; r++)
+		if(cg_read(n, CG_CPU_PRESSURE + r, buf, sizeof(buf)) > 0)
+			proc_psi_line(buf, &s->psi[r]);
+}
+
+void proc_cgroup()
+{
+char buf[1024];
+long count = -1;
+long len;
+int i;
+
+	p->cgroups = 0;
+	if(cg_rootfd == -2 || (cg_rootfd == -1 && !cg_init()))
+		return;
+	if(cg_statfd >= 0 && (len = pread(cg_statfd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = 0;
+		count = (long)cg_value(buf, "nr_descendants");
+	}
+	if(cg_rescan || count != cg_descendants || cg_samples % CG_RESCAN == 0) {
+		cg_walks++;
+		cg_walk(".");
+		for(i = 0; i < cg_nodes; i++)
+			if(cg_node[i].live && cg_node[i].seen != cg_walks)
+				cg_free(i);
+		cg_rehash();
+		cg_descendants = count;
+		cg_rescan = 0;
+	}
+	cg_samples++;
+
+	if(p->cg_size < cg_nodes) {
+		p->cg_size = cg_nodes + 64;
+		p->cg = REALLOC(p->cg, sizeof(struct cg_sample) * p->cg_size);
+	}
+	for(i = 0; i < cg_nodes; i++) {
+		if(!cg_node[i].live || (i == 0 && !cg_explicit))
+			continue;
+		cg_sample(i, &p->cg[p->cgroups++]);
+	}
+}
+
+struct cg_top {
+	struct cg_sample *s;
+	double	cpu;
+	double	user;
+	double	sys;
+	double	throttled;	/* milliseconds per second */
+	double	readkb;
+	double	writekb;
+	double	iops;
+	double	stall[PSI_MAX];	/* percent of the time */
+	double	key;
+} *cg_top = NULL;
+int	cg_top_size = 0;
+int	*cg_prev = NULL;	/* node slot to index in q->cg */
+int	cg_prev_size = 0;
+
+int	cg_compare(const void *a, const void *b)
+{
+	if(((struct cg_top *)b)->key > ((struct cg_top *)a)->key) return 1;
+	if(((struct cg_top *)b)->key < ((struct cg_top *)a)->key) return -1;
+	return 0;
+}
+
+#define CG_DELTA(member) ((double)(s->member > o->member ? s->member - o->member : 0))
+
+/* Work out the rates of each cgroup, sort them and show the top ones or
+ * save those using CPU or doing I/O.  Returns the rows used on the pad.
+ */
+int show_cgroup(WINDOW *pad, double elapsed)
+{
+struct cg_sample *s;
+struct cg_sample *o;
+struct cg_top *t;
+char *path;
+int i;
+int j;
+int n;
+int r;
+
+	if(cg_top_size < p->cgroups) {
+		cg_top_size = p->cgroups + 64;
+		cg_top = REALLOC(cg_top, sizeof(struct cg_top) * cg_top_size);
+	}
+	/* the node table belongs to the collector, only look at the snapshot */
+	for(r = 0, i = 0; i < p->cgroups; i++)
+		if(p->cg[i].node >= r)
+			r = p->cg[i].node + 1;
+	if(cg_prev_size < r) {
+		cg_prev_size = r + 64;
+		cg_prev = REALLOC(cg_prev, sizeof(int) * cg_prev_size);
+	}
+	for(i = 0; i < cg_prev_size; i++)
+		cg_prev[i] = -1;
+	for(i = 0; i < q->cgroups; i++)
+		if(q->cg[i].node < cg_prev_size)
+			cg_prev[q->cg[i].node] = i;
+
+	for(i = 0, j = 0; i < p->cgroups; i++) {
+		s = &p->cg[i];
+		if( (r = cg_prev[s->node]) == -1 || q->cg[r].gen != s->gen)
+			continue;	/* new cgroup, no rates until next time */
+		o = &q->cg[r];
+		t = &cg_top[j++];
+		t->s = s;
+		t->cpu       = CG_DELTA(usage_usec) / elapsed / 10000.0;
+		t->user      = CG_DELTA(user_usec) / elapsed / 10000.0;
+		t->sys       = CG_DELTA(system_usec) / elapsed / 10000.0;
+		t->throttled = CG_DELTA(throttled_usec) / elapsed / 1000.0;
+		t->readkb    = CG_DELTA(rbytes) / elapsed / 1024.0;
+		t->writekb   = CG_DELTA(wbytes) / elapsed / 1024.0;
+		t->iops      = (CG_DELTA(rios) + CG_DELTA(wios)) / elapsed;
+		for(r = 0; r < PSI_MAX; r++)
+			t->stall[r] = CG_DELTA(psi[r].total) / elapsed / 10000.0;
+		switch(cg_sort) {
+		case CG_SORT_MEM: t->key = (double)s->mem_current; break;
+		case CG_SORT_IO:  t->key = t->readkb + t->writekb; break;
+		default:          t->key = t->cpu; break;
+		}
+	}
+	qsort(cg_top, j, sizeof(struct cg_top), cg_compare);
+
+	if(cursed) {
+		BANNER(pad, "Cgroups");
+		mvwprintw(pad, 1, 1, "%d cgroups under %s sorted by %s (G to change)",
+			p->cgroups, cg_root, cg_sortname[cg_sort]);
+		if(cg_rootfd == -2) {
+			mvwprintw(pad, 2, 1, "cgroup v2 hierarchy not found");
+			return 4;
+		}
+		if(q->cgroups == 0) {
+			mvwprintw(pad, 2, 1, "Please wait - collecting data");
+			return 4;
+		}
+		mvwprintw(pad, 2, 1, "  CPU%%  User%%   Sys%% Thrtl-ms   MemMB  AnonMB  FileMB ReadKB/s WriteKB/s    IO/s  Stall%%:CPU  Mem   IO Cgroup");
+		for(n = 3, i = 0; i < j && i < CG_TOPN; i++) {
+			t = &cg_top[i];
+			if(!show_all && t->key == 0.0)
+				break;
+			path = t->s->path;
+			if(strlen(path) > 30)
+				path = &path[strlen(path) - 30];
+			mvwprintw(pad, n++, 1, "%6.1f %6.1f %6.1f %8.1f %7.1f %7.1f %7.1f %8.1f %9.1f %7.1f %11.1f %4.1f %4.1f %s",
+				t->cpu,
+				t->user,
+				t->sys,
+				t->throttled,
+				t->s->mem_current / 1024.0 / 1024.0,
+				t->s->anon / 1024.0 / 1024.0,
+				t->s->file / 1024.0 / 1024.0,
+				t->readkb,
+				t->writekb,
+				t->iops,
+				t->stall[PSI_CPU],
+				t->stall[PSI_MEM],
+				t->stall[PSI_IO],
+				path);
+		}
+		return n + 1;
+	}
+
+	if(cg_first_time) {
+		if(show_headings)
+			fprintf(fp, "CGROUP,+Cgroup,Time,CPU%%,User%%,Sys%%,ThrottledMS/s,MemMB,AnonMB,FileMB,ReadKB/s,WriteKB/s,IO/s,CPUStall%%,MemStall%%,IOStall%%\n");
+		cg_first_time = 0;
+	}
+	for(i = 0; i < j; i++) {
+		t = &cg_top[i];
+		if(t->cpu < ignore_procdisk_threshold && t->readkb + t->writekb == 0.0)
+			continue;
+		enc_begin("CGROUP", NULL);
+		enc_key("Cgroup", t->s->path);
+		enc_num("CPU%", t->cpu, 1);
+		enc_num("User%", t->user, 1);
+		enc_num("Sys%", t->sys, 1);
+		enc_num("ThrottledMS/s", t->throttled, 1);
+		enc_num("MemMB", t->s->mem_current / 1024.0 / 1024.0, 1);
+		enc_num("AnonMB", t->s->anon / 1024.0 / 1024.0, 1);
+		enc_num("FileMB", t->s->file / 1024.0 / 1024.0, 1);
+		enc_num("ReadKB/s", t->readkb, 1);
+		enc_num("WriteKB/s", t->writekb, 1);
+		enc_num("IO/s", t->iops, 1);
+		enc_num("CPUStall%", t->stall[PSI_CPU], 1);
+		enc_num("MemStall%", t->stall[PSI_MEM], 1);
+		enc_num("IOStall%", t->stall[PSI_IO], 1);
+		enc_end();
+	}
+	return 0;
+}
+
+/* NUMA nodes: per node memory from nodeN/meminfo and the page allocation
+ * counters from nodeN/numastat.  Nodes are found once at the start.
+ */
+struct bigfile *numa_meminfo = NULL;
+struct bigfile *numa_numastat = NULL;
+int	numa_node_ids[NUMAMAX];
+int	numa_count = -1;	/* unknown until the first read */
+int	numa_first_time = 1;
+
+int	numa_id_compare(const void *a, const void *b)
+{
+	return *(int *)a - *(int *)b;
+}
+
+void numa_init()
+{
+char filename[256];
+struct dirent *de;
+DIR *dir;
+int i;
+
+	numa_count = 0;
+	if( (dir = opendir("/sys/devices/system/node")) == NULL)
+		return;
+	while( (de = readdir(dir)) != NULL && numa_count < NUMAMAX)
+		if(strncmp(de->d_name, "node", 4) == 0 && isdigit(de->d_name[4]))
+			numa_node_ids[numa_count++] = atoi(&de->d_name[4]);
+	closedir(dir);
+	qsort(numa_node_ids, numa_count, sizeof(int), numa_id_compare);
+
+	numa_meminfo = MALLOC(sizeof(struct bigfile) * (numa_count + 1));
+	numa_numastat = MALLOC(sizeof(struct bigfile) * (numa_count + 1));
+	memset(numa_meminfo, 0, sizeof(struct bigfile) * (numa_count + 1));
+	memset(numa_numastat, 0, sizeof(struct bigfile) * (numa_count + 1));
+	for(i = 0; i < numa_count; i++) {
+		sprintf(filename, "/sys/devices/system/node/node%d/meminfo", numa_node_ids[i]);
+		numa_meminfo[i].filename = MALLOC(strlen(filename) + 1);
+		strcpy(numa_meminfo[i].filename, filename);
+		sprintf(filename, "/sys/devices/system/node/node%d/numastat", numa_node_ids[i]);
+		numa_numastat[i].filename = MALLOC(strlen(filename) + 1);
+		strcpy(numa_numastat[i].filename, filename);
+	}
+}
+
+/* value of a "Node N Key:   value kB" line */
+unsigned long long numa_value(char *buf, char *key)
+{
+int len = strlen(key);
+char *s;
+
+	for(s = buf; s != NULL; ) {
+		if(strncmp(s, "Node ", 5) == 0 && (s = strchr(s + 5, ' ')) != NULL) {
+			s++;
+			if(strncmp(s, key, len) == 0 && s[len] == ':')
+				return strtoull(&s[len + 1], NULL, 10);
+		}
+		if(s != NULL && (s = strchr(s, '\n')) != NULL)
+			s++;
+	}
+	return 0;
+}
+
+void proc_numa()
+{
+struct numa_stat *n;
+int i;
+
+	if(numa_count == -1)
+		numa_init();
+	for(p->numa_nodes = 0, i = 0; i < numa_count; i++) {
+		n = &p->numa[p->numa_nodes];
+		memset(n, 0, sizeof(struct numa_stat));
+		n->node = numa_node_ids[i];
+		if(bigfile_read(&numa_meminfo[i]) > 0) {
+			n->total = numa_value(numa_meminfo[i].buf, "MemTotal");
+			n->free  = numa_value(numa_meminfo[i].buf, "MemFree");
+			n->used  = numa_value(numa_meminfo[i].buf, "MemUsed");
+			n->file  = numa_value(numa_meminfo[i].buf, "FilePages");
+			n->anon  = numa_value(numa_meminfo[i].buf, "AnonPages");
+		}
+		if(bigfile_read(&numa_numastat[i]) > 0) {
+			n->numa_hit       = cg_value(numa_numastat[i].buf, "numa_hit");
+			n->numa_miss      = cg_value(numa_numastat[i].buf, "numa_miss");
+			n->numa_foreign   = cg_value(numa_numastat[i].buf, "numa_foreign");
+			n->interleave_hit = cg_value(numa_numastat[i].buf, "interleave_hit");
+			n->local_node     = cg_value(numa_numastat[i].buf, "local_node");
+			n->other_node     = cg_value(numa_numastat[i].buf, "other_node");
+		}
+		p->numa_nodes++;
+	}
+}
+
+#define NUMA_DELTA(member) ((double)(i < q->numa_nodes && p->numa[i].member > q->numa[i].member ? \
+				p->numa[i].member - q->numa[i].member : 0) / elapsed)
+#define NUMA_MB(kb) ((double)(kb) / 1024.0)
+char	*numa_col[10] = { "FreeMB", "UsedMB", "FileMB", "AnonMB", "Hit/s", "Miss/s", "Foreign/s",
+	"Interleave/s", "Local/s", "Other/s" };
+#define NUMA_IMBALANCE_WARN 25.0	/* highlight when Used% differs more than this */
+#define NUMA_REMOTE_WARN 10.0	/* or more than this % of allocations are remote */
+
+/* Show or save the per node memory and allocation rates.  The imbalance
+ * is the spread of Used% between the fullest and emptiest node and Remote%
+ * is the share of pages allocated off the node the task ran on.
+ */
+int show_numa(WINDOW *pad, double elapsed)
+{
+double used_min = 100.0;
+double used_max = 0.0;
+double used;
+double local = 0.0;
+double other = 0.0;
+double remote;
+double imbalance;
+double v[10];
+int i;
+int j;
+int n;
+char col[64];
+
+	for(i = 0; i < p->numa_nodes; i++) {
+		used = p->numa[i].total ? p->numa[i].used * 100.0 / p->numa[i].total : 0.0;
+		if(used < used_min)
+			used_min = used;
+		if(used > used_max)
+			used_max = used;
+		local += NUMA_DELTA(local_node);
+		other += NUMA_DELTA(other_node);
+	}
+	imbalance = p->numa_nodes > 1 ? used_max - used_min : 0.0;
+	remote = (local + other) > 0.0 ? other * 100.0 / (local + other) : 0.0;
+
+	if(cursed) {
+		BANNER(pad, "NUMA Nodes");
+		if(p->numa_nodes == 0) {
+			mvwprintw(pad, 1, 1, "No NUMA information in /sys/devices/system/node");
+			return 3;
+		}
+		mvwprintw(pad, 1, 1, "Node Total-MB  Free-MB  Used-MB Used%%  File-MB  Anon-MB     Hit/s  Miss/s Foreign/s Interlv/s   Local/s   Other/s Remote%%");
+		for(n = 2, i = 0; i < p->numa_nodes; i++, n++) {
+			local = NUMA_DELTA(local_node);
+			other = NUMA_DELTA(other_node);
+			mvwprintw(pad, n, 1, "%4d %8.0f %8.0f %8.0f %5.1f %8.0f %8.0f %9.0f %7.0f %9.0f %9.0f %9.0f %9.0f %6.1f",
+				p->numa[i].node,
+				NUMA_MB(p->numa[i].total),
+				NUMA_MB(p->numa[i].free),
+				NUMA_MB(p->numa[i].used),
+				p->numa[i].total ? p->numa[i].used * 100.0 / p->numa[i].total : 0.0,
+				NUMA_MB(p->numa[i].file),
+				NUMA_MB(p->numa[i].anon),
+				NUMA_DELTA(numa_hit),
+				NUMA_DELTA(numa_miss),
+				NUMA_DELTA(numa_foreign),
+				NUMA_DELTA(interleave_hit),
+				local,
+				other,
+				(local + other) > 0.0 ? other * 100.0 / (local + other) : 0.0);
+		}
+		mvwprintw(pad, n, 1, "Imbalance (Used%% max-min)=%5.1f%%   Remote allocations=%5.1f%%  ", imbalance, remote);
+		if(imbalance > NUMA_IMBALANCE_WARN || remote > NUMA_REMOTE_WARN) {
+			COLOUR wattrset(pad, COLOR_PAIR(1));
+			wprintw(pad, "%s", imbalance > NUMA_IMBALANCE_WARN ? "UNBALANCED" : "REMOTE");
+			COLOUR wattrset(pad, COLOR_PAIR(0));
+		} else
+			wprintw(pad, "          ");
+		return n + 2;
+	}
+
+	if(p->numa_nodes == 0)
+		return 0;
+	if(numa_first_time) {
+		if(show_headings) {
+			fprintf(fp, "NUMA,NUMA Nodes %s", run_name);
+			for(i = 0; i < p->numa_nodes; i++)
+				fprintf(fp, ",node%d FreeMB,node%d UsedMB,node%d FileMB,node%d AnonMB,node%d Hit/s,node%d Miss/s,node%d Foreign/s,node%d Interleave/s,node%d Local/s,node%d Other/s",
+					p->numa[i].node, p->numa[i].node, p->numa[i].node, p->numa[i].node, p->numa[i].node,
+					p->numa[i].node, p->numa[i].node, p->numa[i].node, p->numa[i].node, p->numa[i].node);
+			fprintf(fp, ",Imbalance%%,Remote%%\n");
+		}
+		numa_first_time = 0;
+	}
+	if(q->numa_nodes == 0)
+		return 0;
+	enc_begin("NUMA", "numa.rrd");
+	for(i = 0; i < p->numa_nodes; i++) {
+		v[0] = NUMA_MB(p->numa[i].free);
+		v[1] = NUMA_MB(p->numa[i].used);
+		v[2] = NUMA_MB(p->numa[i].file);
+		v[3] = NUMA_MB(p->numa[i].anon);
+		v[4] = NUMA_DELTA(numa_hit);
+		v[5] = NUMA_DELTA(numa_miss);
+		v[6] = NUMA_DELTA(numa_foreign);
+		v[7] = NUMA_DELTA(interleave_hit);
+		v[8] = NUMA_DELTA(local_node);
+		v[9] = NUMA_DELTA(other_node);
+		for(j = 0; j < 10; j++) {
+			snprintf(col, sizeof(col), "node%d %s", p->numa[i].node, numa_col[j]);
+			enc_num(col, v[j], j < 4 ? 1 : 0);
+		}
+	}
+	enc_num("Imbalance%", imbalance, 1);
+	enc_num("Remote%", remote, 1);
+	enc_end();
+	return 0;
+}
+
+int proc_procsinfo(int pid, int index)
+{
+FILE *fp;
+char filename[64];
+char buf[1024*4];
+int size=0;
+int ret=0;
+int count=0;
+
+	sprintf(filename,"/proc/%d/stat",pid);
+	if( (fp = fopen(filename,"r")) == NULL) {
+		sprintf(buf,"failed to open file %s",filename);
+		error(buf);
+		return 0;
+	}
+	size = fread(buf, 1, 1024-1, fp);
+	p->procs[index].pi_stamp = monotime();
+	if(size == -1) {
+#ifdef DEBUG
+		fprintf(stderr,"procsinfo read returned = %d assuming process stopped pid=%d\n", ret,pid);
+#endif /*DEBUG*/
+		return 0;
+	}
+	fclose(fp);
+        ret = sscanf(buf, "%d (%s)",
+                &p->procs[index].pi_pid,
+                &p->procs[index].pi_comm[0]);
+	if(ret != 2) {
+		fprintf(stderr,"procsinfo sscanf returned = %d line=%s\n", ret,buf);
+		return 0;
+	}
+	p->procs[index].pi_comm[strlen(p->procs[index].pi_comm)-1] = 0;
+
+	for(count=0; count<size;count++)	/* now look for ") " as dumb Infiniban driver includes "()" */
+		if(buf[count] == ')' && buf[count+1] == ' ' ) break;
+
+	if(count == size) {
+#ifdef DEBUG
+		fprintf(stderr,"procsinfo failed to find end of command buf=%s\n", buf);
+#endif /*DEBUG*/
+		return 0;
+	}
+	count++; count++;
+
+        ret = sscanf(&buf[count], 
+"%c %d %d %d %d %d %lu %lu %lu %lu %lu %lu %lu %ld %ld %ld %ld %ld %ld %lu %lu %ld %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %d %d",
+                &p->procs[index].pi_state,
+                &p->procs[index].pi_ppid,
+                &p->procs[index].pi_pgrp,
+                &p->procs[index].pi_session,
+                &p->procs[index].pi_tty_nr,
+                &p->procs[index].pi_tty_pgrp,
+                &p->procs[index].pi_flags,
+                &p->procs[index].pi_minflt,
+                &p->procs[index].pi_cmin_flt,
+                &p->procs[index].pi_majflt,
+                &p->procs[index].pi_cmaj_flt,
+                &p->procs[index].pi_utime,
+                &p->procs[index].pi_stime,
+                &p->procs[index].pi_cutime,
+                &p->procs[index].pi_cstime,
+                &p->procs[index].pi_pri,
+                &p->procs[index].pi_nice,
+                &p->procs[index].junk,
+                &p->procs[index].pi_it_real_value,
+                &p->procs[index].pi_start_time,
+                &p->procs[index].pi_vsize,
+                &p->procs[index].pi_rss,
+                &p->procs[index].pi_rlim_cur,
+                &p->procs[index].pi_start_code,
+                &p->procs[index].pi_end_code,
+                &p->procs[index].pi_start_stack,
+                &p->procs[index].pi_esp,
+                &p->procs[index].pi_eip,
+                &p->procs[index].pi_pending_signal,
+                &p->procs[index].pi_blocked_sig,
+                &p->procs[index].pi_sigign,
+                &p->procs[index].pi_sigcatch,
+                &p->procs[index].pi_wchan,
+                &p->procs[index].pi_nswap,
+                &p->procs[index].pi_cnswap,
+                &p->procs[index].pi_exit_signal,
+		&p->procs[index].pi_cpu
+		);
+	if(ret != 37) {
+		fprintf(stderr,"procsinfo2 sscanf wanted 37 returned = %d pid=%d line=%s\n", ret,pid,buf);
+		return 0;
+	}
+
+	sprintf(filename,"/proc/%d/statm",pid);
+	if( (fp = fopen(filename,"r")) == NULL) {
+		sprintf(buf,"failed to open file %s",filename);
+		error(buf);
+		return 0;
+	}
+	size = fread(buf, 1, 1024*4-1, fp);
+	if(size == -1) {
+		sprintf(buf,"failed to read file %s",filename);
+		error(buf);
+		return 0;
+	}
+	fclose(fp);
+
+        ret = sscanf(&buf[0], "%lu %lu %lu %lu %lu %lu %lu",
+                &p->procs[index].statm_size,
+                &p->procs[index].statm_resident,
+                &p->procs[index].statm_share,
+                &p->procs[index].statm_trs,
+                &p->procs[index].statm_drs,
+                &p->procs[index].statm_lrs,
+                &p->procs[index].statm_dt
+		);
+	if(ret != 7) {
+		fprintf(stderr,"sscanf wanted 7 returned = %d line=%s\n", ret,buf);
+		return 0;
+	}
+	return 1;
+}
+#ifdef DEBUGPROC 
+print_procs(int index)
+{
+printf("procs[%d].pid           =%d\n",index,procs[index].pi_pid);
+printf("procs[%d].comm[0]       =%s\n",index,&procs[index].pi_comm[0]);
+printf("procs[%d].state         =%c\n",index,procs[index].pi_state);
+printf("procs[%d].ppid          =%d\n",index,procs[index].pi_ppid);
+printf("procs[%d].pgrp          =%d\n",index,procs[index].pi_pgrp);
+printf("procs[%d].session       =%d\n",index,procs[index].pi_session);
+printf("procs[%d].tty_nr        =%d\n",index,procs[index].pi_tty_nr);
+printf("procs[%d].tty_pgrp      =%d\n",index,procs[index].pi_tty_pgrp);
+printf("procs[%d].flags         =%lu\n",index,procs[index].pi_flags);
+printf("procs[%d].minflt       =%lu\n",index,procs[index].pi_minflt);
+printf("procs[%d].cmin_flt     =%lu\n",index,procs[index].pi_cmin_flt);
+printf("procs[%d].majflt       =%lu\n",index,procs[index].pi_majflt);
+printf("procs[%d].cmaj_flt     =%lu\n",index,procs[index].pi_cmaj_flt);
+printf("procs[%d].utime        =%lu\n",index,procs[index].pi_utime);
+printf("procs[%d].stime        =%lu\n",index,procs[index].pi_stime);
+printf("procs[%d].cutime       =%ld\n",index,procs[index].pi_cutime);
+printf("procs[%d].cstime       =%ld\n",index,procs[index].pi_cstime);
+printf("procs[%d].pri           =%d\n",index,procs[index].pi_pri);
+printf("procs[%d].nice          =%d\n",index,procs[index].pi_nice);
+printf("procs[%d].junk          =%d\n",index,procs[index].junk);
+printf("procs[%d].it_real_value =%lu\n",index,procs[index].pi_it_real_value);
+printf("procs[%d].start_time    =%lu\n",index,procs[index].pi_start_time);
+printf("procs[%d].vsize         =%lu\n",index,procs[index].pi_vsize);
+printf("procs[%d].rss           =%lu\n",index,procs[index].pi_rss);
+printf("procs[%d].rlim_cur      =%lu\n",index,procs[index].pi_rlim_cur);
+printf("procs[%d].start_code    =%lu\n",index,procs[index].pi_start_code);
+printf("procs[%d].end_code      =%lu\n",index,procs[index].pi_end_code);
+printf("procs[%d].start_stack   =%lu\n",index,procs[index].pi_start_stack);
+printf("procs[%d].esp           =%lu\n",index,procs[index].pi_esp);
+printf("procs[%d].eip           =%lu\n",index,procs[index].pi_eip);
+printf("procs[%d].pending_signal=%lu\n",index,procs[index].pi_pending_signal);
+printf("procs[%d].blocked_sig   =%lu\n",index,procs[index].pi_blocked_sig);
+printf("procs[%d].sigign        =%lu\n",index,procs[index].pi_sigign);
+printf("procs[%d].sigcatch      =%lu\n",index,procs[index].pi_sigcatch);
+printf("procs[%d].wchan         =%lu\n",index,procs[index].pi_wchan);
+printf("procs[%d].nswap         =%lu\n",index,procs[index].pi_nswap);
+printf("procs[%d].cnswap        =%lu\n",index,procs[index].pi_cnswap);
+printf("procs[%d].exit_signal   =%d\n",index,procs[index].pi_exit_signal);
+printf("procs[%d].cpu           =%d\n",index,procs[index].pi_cpu);
+printf("OK\n");
+}
+#endif /*DEBUG*/
+/* --- */
+
+int isnumbers(char *s)
+{
+	while(*s != 0) {
+		if( *s < '0' || *s > '9')
+			return 0;
+		s++;
+	}
+	return 1;
+}
+
+int getprocs(int details)
+{
+struct dirent *dent;
+DIR *procdir;
+int count =0;
+
+	if((char *)(procdir = opendir("/proc")) == NULL) {
+		printf("opendir(/proc) failed");
+		return 0;
+	}
+	while( (char *)(dent = readdir(procdir)) != NULL ) {
+		if(dent->d_type == 4) { /* is this a directlory */
+/* mainframes report 0 = unknown every time !!!!  */
+/*
+		    printf("inode=%d type=%d name=%s\n",
+				dent->d_ino,	
+				dent->d_type,	
+				dent->d_name);
+*/
+		    if(isnumbers(dent->d_name)) {
+/*			printf("%s pid\n",dent->d_name); */
+			if(details) {
+				count=count+proc_procsinfo(atoi(dent->d_name),count);
+			} else {
+				count++;
+			}
+		    }
+/*
+		    else
+			printf("NOT numbers\n");
+*/
+		}
+	}
+	closedir(procdir);
+	return count;
+}
+/* --- */
+
+char graph_line[] = "+-------------------------------------------------+";
+/* Start process as specified in cmd in a child process without waiting
+ * for completion
+ * not sure if want to prevent this funcitonality for root user
+ * when: CHLD_START, CHLD_SNAP or CHLD_END
+ * cmd:  pointer to command string - assumed to be cleansed ....
+ * timestamp_type: 0 - T%04d, 1 - detailed time stamp
+ * loop: loop id (0 for CHLD_START)
+ * the_time: time to use for timestamp generation
+ */
+void child_start(int when,
+                char *cmd,
+                int timestamp_type,
+                int loop,
+                time_t the_time)
+{
+        int i;
+        pid_t child_pid;
+        char time_stamp_str[20]="";
+        char *when_info="";
+        struct tm *tim; /* used to work out the hour/min/second */
+
+#ifdef DEBUG2
+fprintf(fp,"child start when=%d cmd=%s time=%d loop=%d\n",when,cmd,timestamp_type,loop);
+#endif 
+        /* Validate parameter and initialize error text */
+        switch( when ) {
+                case CHLD_START:
+                        when_info = "elmon fork exec failure CHLD_START";
+                        break;
+                case CHLD_END:
+                        when_info = "elmon fork exec failure CHLD_END";
+                        break;
+
+                case CHLD_SNAP:
+                        /* check if old child has finished - otherwise we do nothing */
+                        if( nmon_children[CHLD_SNAP] != -1 ) {
+                                if(!cursed)fprintf(fp,"ERROR,T%04d, Starting snap command \"%s\" failed as previous child still running - killing it now\n", loop, cmd);
+                                kill( nmon_children[CHLD_SNAP],9);
+                        }
+
+                        when_info = "elmon fork exec failure CHLD_SNAP";
+                        break;
+        }
+
+
+        /* now fork off a child process. */
+        switch (child_pid = fork()) {
+                case -1:        /* fork failed. */
+                        perror(when_info);
+                        return;
+
+                case 0:         /* inside child process.  */
+                        /* create requested timestamp */
+                        if( timestamp_type == 1 ) {
+                                tim = localtime(&the_time);
+                                sprintf(time_stamp_str,"%02d:%02d:%02d,%02d,%02d,%04d",
+                                       tim->tm_hour, tim->tm_min, tim->tm_sec,
+                                       tim->tm_mday, tim->tm_mon + 1, tim->tm_year + 1900);
+                        }
+                        else {
+                                sprintf(time_stamp_str,"T%04d", loop);
+                        }
+
+                        /* close all open file pointers except the defaults */
+                        for( i=3; i<5; ++i )
+                                close(i);
+
+                        /* Now switch to the defined command */
+                        execlp(cmd, cmd, time_stamp_str,(void *)0);
+
+                        /* If we get here the specified command could not be started */
+                        perror(when_info);
+                        exit(1);                     /* We can't do anything more */
+                        /* never reached */
+
+                default:        /* inside parent process. */
+                        /* In father - remember child pid for future */
+                        nmon_children[when] = child_pid;
+        }
+}
+
+/* Collection runs in its own thread so that a slow terminal or output
+ * file does not delay sampling and put jitter into the data.  Every
+ * interval the collector fills in "work", takes a private copy and hands
+ * that snapshot to the UI thread through a single producer, single
+ * consumer ring.  A snapshot is never changed once it is on the ring and
+ * the UI thread frees it when it drops out of the history.
+ */
+#define RING_SIZE 16
+
+struct data work;
+struct data *ring[RING_SIZE];
+unsigned long ring_head = 0;	/* next slot the collector fills */
+unsigned long ring_tail = 0;	/* next slot the UI takes */
+long	ring_dropped = 0;	/* snapshots thrown away as the UI fell behind */
+int	ring_notify[2] = { -1, -1 };	/* pipe to wake up the UI */
+int	procs_size = 0;		/* entries allocated in work.procs */
+int	jfs_open = 0;
+pthread_t collector_thread;
+
+void *snapshot_dup(void *from, long size)
+{
+void *to;
+
+	if(from == NULL || size <= 0)
+		return NULL;
+	to = MALLOC(size);
+	memcpy(to, from, size);
+	return to;
+}
+
+void irq_dup(struct irq_stat *to, struct irq_stat *from)
+{
+	to->maxrows  = from->rows;
+	to->maxcells = from->ncells;
+	to->row   = snapshot_dup(from->row,   sizeof(struct irq_row) * from->rows);
+	to->cpu   = snapshot_dup(from->cpu,   sizeof(int) * from->ncells);
+	to->count = snapshot_dup(from->count, sizeof(unsigned long long) * from->ncells);
+}
+
+/* Deep copy of the work area for the UI thread */
+struct data *snapshot_copy(struct data *w)
+{
+struct data *s;
+long len;
+int i;
+
+	s = MALLOC(sizeof(struct data));
+	memcpy(s, w, sizeof(struct data));
+	/* all of them as the disk count can change between snapshots */
+	s->dk    = snapshot_dup(w->dk, sizeof(struct dsk_stat) * diskmax);
+	s->procs = snapshot_dup(w->procs, sizeof(struct procsinfo) * w->nprocs);
+	s->fs    = snapshot_dup(w->fs, sizeof(struct fs_stat) * w->fses);
+	irq_dup(&s->irq, &w->irq);
+	irq_dup(&s->softirq, &w->softirq);
+	s->cg_size = w->cgroups;
+	s->cg    = snapshot_dup(w->cg, sizeof(struct cg_sample) * w->cgroups);
+
+	/* cgroup node slots get reused, so the names go with the data */
+	for(len = 0, i = 0; i < s->cgroups; i++)
+		len += strlen(s->cg[i].path) + 1;
+	s->cg_paths = len ? MALLOC(len) : NULL;
+	for(len = 0, i = 0; i < s->cgroups; i++) {
+		strcpy(&s->cg_paths[len], s->cg[i].path);
+		s->cg[i].path = &s->cg_paths[len];
+		len += strlen(s->cg[i].path) + 1;
+	}
+	s->size = sizeof(struct data) + sizeof(struct dsk_stat) * diskmax
+		+ sizeof(struct procsinfo) * s->nprocs + sizeof(struct fs_stat) * s->fses
+		+ sizeof(struct irq_row) * (s->irq.maxrows + s->softirq.maxrows)
+		+ (sizeof(int) + sizeof(unsigned long long)) * (s->irq.maxcells + s->softirq.maxcells)
+		+ sizeof(struct cg_sample) * s->cgroups + len;
+	s->older = s->newer = NULL;
+	return s;
+}
+
+/* An empty snapshot for playback to fill in */
+struct data *snapshot_new()
+{
+struct data *s;
+
+	s = MALLOC(sizeof(struct data));
+	memset(s, 0, sizeof(struct data));
+	s->dk = MALLOC(sizeof(struct dsk_stat) * diskmax + 1);
+	memset(s->dk, 0, sizeof(struct dsk_stat) * diskmax);
+	s->fs = MALLOC(sizeof(struct fs_stat) * JFSMAX);
+	memset(s->fs, 0, sizeof(struct fs_stat) * JFSMAX);
+	return s;
+}
+
+/* Collector side, returns 0 if the ring is full */
+int ring_push(struct data *s)
+{
+unsigned long head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+
+	if(head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+		return 0;
+	ring[head % RING_SIZE] = s;
+	__atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* UI side, returns NULL if the ring is empty */
+struct data *ring_pop()
+{
+unsigned long tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+struct data *s;
+
+	if(tail == __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE))
+		return NULL;
+	s = ring[tail % RING_SIZE];
+	__atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+	return s;
+}
+
+/* Note when source src is read: the middle of the read, as that is when
+ * the kernel's counters are most likely from
+ */
+void src_begin(int src)
+{
+	p->stamp[src] = monotime();
+}
+
+void src_end(int src)
+{
+	p->stamp[src] = (p->stamp[src] + monotime()) / 2.0;
+}
+
+/* The collectors' hooks, all run on the collector thread */
+void col_stat()
+{
+	proc_read(P_STAT);
+	proc_cpu();
+}
+
+void col_mem()
+{
+	proc_read(P_MEMINFO);
+	proc_mem();
+}
+
+void col_vmstat()
+{
+	p->vm_ret = read_vmstat();
+}
+
+void col_kernel()
+{
+	proc_read(P_UPTIME);
+	proc_read(P_LOADAVG);
+	proc_kernel();
+}
+
+void col_disk()
+{
+	proc_disk();
+	p->disks = disks;
+}
+
+void col_net()
+{
+	proc_net();
+	p->networks = networks;
+}
+
+void col_nfs()
+{
+	proc_read(P_NFS);
+	proc_read(P_NFSD);
+	proc_nfs();
+}
+
+void col_irq_off()
+{
+	p->irq.rows = p->irq.ncells = 0;
+	p->softirq.rows = p->softirq.ncells = 0;
+}
+
+void col_irq()
+{
+	col_irq_off();
+	proc_irq();
+}
+
+void col_psi_off()
+{
+int r;
+	for(r = 0; r < PSI_MAX; r++)
+		p->psi[r].valid = 0;
+}
+
+void col_psi()
+{
+	col_psi_off();
+	proc_psi();
+}
+
+void col_cgroup_off()
+{
+	p->cgroups = 0;
+}
+
+void col_cgroup()
+{
+	col_cgroup_off();
+	proc_cgroup();
+}
+
+void col_numa_off()
+{
+	p->numa_nodes = 0;
+}
+
+void col_numa()
+{
+	col_numa_off();
+	proc_numa();
+}
+
+#ifdef JFS
+void col_jfs_off()
+{
+	if(jfs_open) {
+		jfs_load(UNLOAD);
+		jfs_open = 0;
+	}
+	p->fses = 0;
+}
+
+void col_jfs()
+{
+struct statfs statfs_buffer;
+int k;
+
+	if(!jfs_open) {
+		jfs_load(LOAD);
+		jfs_open = 1;
+	}
+	for (k = 0; k < jfses; k++) {
+		p->fs[k].mounted = jfs[k].mounted;
+		p->fs[k].blocks = 0;
+		p->fs[k].bfree = 0;
+		p->fs[k].ret = -1;
+		if(jfs[k].mounted && (p->fs[k].ret = fstatfs(jfs[k].fd, &statfs_buffer)) != -1) {
+			p->fs[k].blocks = statfs_buffer.f_blocks;
+			p->fs[k].bfree  = statfs_buffer.f_bfree;
+		}
+	}
+	p->fses = jfses;
+	/* file output does not keep the filesystems busy in between */
+	if(!cursed) {
+		jfs_load(UNLOAD);
+		jfs_open = 0;
+	}
+}
+#endif /* JFS */
+
+#ifdef POWER
+void col_lpar()
+{
+	p->lpar_ret = proc_lparcfg();
+	memcpy(&p->lpar, &lparcfg, sizeof(struct lpar_stat));
+}
+#endif /*POWER*/
+
+void col_procs_off()
+{
+	p->nprocs = 0;
+}
+
+void col_procs()
+{
+int n;
+
+	n = getprocs(0);
+	if (n > procs_size) {
+		n = n +128; /* allow for growth in the number of processes in the mean time */
+		p->procs = REALLOC(p->procs, sizeof(struct procsinfo ) * (n+1) ); /* add one to avoid overrun */
+		procs_size = n;
+	}
+	p->nprocs = getprocs(1);
+}
+
+/* What reads each source.  init runs when a section first needs the
+ * collector, collect each snapshot after the collectors in needs, delta
+ * then with the seconds since its last read and teardown when no section
+ * needs it any more.  The files are read together by proc_batch() before
+ * any collector runs.  Indexed by COL_ number.
+ */
+struct collector {
+	char	*name;
+	int	src;		/* SRC_ stamp it sets, SRC_SNAP for none */
+	int	files;		/* 1 << P_ for proc_batch() */
+	unsigned int needs;	/* COL_BIT()s to run first */
+	void	(*init)(void);
+	void	(*collect)(void);
+	void	(*delta)(double elapsed);
+	void	(*teardown)(void);
+} collectors[COL_MAX] = {
+	{ "stat",	SRC_STAT,	1 << P_STAT,	0, NULL, col_stat, NULL, NULL },
+	{ "meminfo",	SRC_MEM,	1 << P_MEMINFO,	0, NULL, col_mem, NULL, NULL },
+	{ "vmstat",	SRC_VMSTAT,	1 << P_VMSTAT,	0, NULL, col_vmstat, NULL, NULL },
+	{ "kernel",	SRC_SNAP,	(1 << P_UPTIME) | (1 << P_LOADAVG), 0, NULL, col_kernel, NULL, NULL },
+	/* Linux 2.4 has the disks in /proc/stat */
+	{ "disks",	SRC_DISK,	1 << P_DISKSTATS, COL_BIT(COL_STAT), proc_disk_init, col_disk, disk_delta, NULL },
+	{ "net",	SRC_NET,	1 << P_NETDEV,	0, NULL, col_net, NULL, NULL },
+	{ "nfs",	SRC_NFS,	(1 << P_NFS) | (1 << P_NFSD), 0, NULL, col_nfs, NULL, NULL },
+	{ "interrupts",	SRC_IRQ,	0, 0, NULL, col_irq, NULL, col_irq_off },
+	{ "psi",	SRC_PSI,	0, 0, NULL, col_psi, NULL, col_psi_off },
+	{ "cgroups",	SRC_CGROUP,	0, 0, NULL, col_cgroup, NULL, col_cgroup_off },
+	{ "numa",	SRC_NUMA,	0, 0, NULL, col_numa, NULL, col_numa_off },
+#ifdef JFS
+	{ "jfs",	SRC_JFS,	0, 0, NULL, col_jfs, NULL, col_jfs_off },
+#else
+	{ "jfs",	SRC_JFS,	0, 0, NULL, NULL, NULL, NULL },
+#endif /* JFS */
+#ifdef POWER
+	{ "lpar",	SRC_LPAR,	0, 0, NULL, col_lpar, NULL, NULL },
+#else
+	{ "lpar",	SRC_LPAR,	0, 0, NULL, NULL, NULL, NULL },
+#endif /*POWER*/
+	{ "procs",	SRC_PROCS,	0, 0, NULL, col_procs, NULL, col_procs_off },
+};
+
+unsigned int col_running = 0;	/* collector thread only */
+double	col_last[COL_MAX];	/* when each last read */
+
+/* The collectors the sections in mask (1 << SHOW_ number) need, with the
+ * ones those need.  The screen also keeps the CPU, disk and network
+ * history for the long term graph, see ts_save().
+ */
+unsigned int collectors_needed(unsigned long long mask)
+{
+unsigned int needs = 0;
+unsigned int before;
+int i;
+
+	for(i = 0; i < 64; i++)
+		if(mask & (1ULL << i))
+			needs |= section_needs(i);
+	if(cursed)
+		needs |= COL_BIT(COL_STAT) | COL_BIT(COL_DISK) | COL_BIT(COL_NET);
+	do {
+		before = needs;
+		for(i = 0; i < COL_MAX; i++)
+			if(needs & COL_BIT(i))
+				needs |= collectors[i].needs;
+	} while(needs != before);
+	return needs;
+}
+
+/* Run collector c after the ones it needs, each once */
+void collector_run(int c, unsigned int *done)
+{
+struct collector *col = &collectors[c];
+double now;
+int i;
+
+	if(*done & COL_BIT(c))
+		return;
+	*done |= COL_BIT(c);
+	for(i = 0; i < COL_MAX; i++)
+		if(col->needs & COL_BIT(i))
+			collector_run(i, done);
+	if(col->collect == NULL)
+		return;
+	if(col->src != SRC_SNAP)
+		src_begin(col->src);
+	col->collect();
+	if(col->src != SRC_SNAP) {
+		src_end(col->src);
+		for(i = 0; i < P_NUMBER; i++)	/* read by proc_batch() */
+			if(col->files & (1 << i)) {
+				if(proc[i].len >= 0)
+					p->stamp[col->src] = proc[i].stamp;
+				break;
+			}
+		now = p->stamp[col->src];
+	} else
+		now = monotime();
+	if(col->delta != NULL)
+		col->delta(col_last[c] > 0.0 ? now - col_last[c] : 0.0);
+	col_last[c] = now;
+}
+
+/* Read what the enabled sections need into p, nothing else */
+void collect()
+{
+unsigned int needs;
+unsigned int done = 0;
+int files = 0;
+int c;
+int r;
+
+	p->time = doubletime();
+	p->mono = monotime();
+	needs = collectors_needed(__atomic_load_n(&collect_options, __ATOMIC_RELAXED));
+	for(c = 0; c < COL_MAX; c++) {
+		if((needs & COL_BIT(c)) && !(col_running & COL_BIT(c)) && collectors[c].init != NULL)
+			collectors[c].init();
+		if(!(needs & COL_BIT(c)) && (col_running & COL_BIT(c))) {
+			if(collectors[c].teardown != NULL)
+				collectors[c].teardown();
+			col_last[c] = 0.0;
+		}
+		if(!(needs & COL_BIT(c)) && collectors[c].src != SRC_SNAP)
+			p->stamp[collectors[c].src] = 0.0;
+		if(needs & COL_BIT(c))
+			files |= collectors[c].files;
+	}
+	col_running = needs;
+
+	proc_batch(files);
+	for(c = 0; c < COL_MAX; c++)
+		if(needs & COL_BIT(c))
+			collector_run(c, &done);
+	p->collected = needs;
+	for(r = 0; r < PSI_MAX; r++)
+		p->psi[r].triggers = psi_trigger_count[r];
+}
+
+/* The collector thread: sample on a fixed schedule, not after however
+ * long the screen took to draw.  The deadlines are absolute times on
+ * CLOCK_MONOTONIC, each one interval on from the last, so the time taken
+ * to collect does not add up and setting the clock does not move them.
+ * With -k each is the multiple of the interval on the clock nearest to
+ * that, so hosts sampling every 60 seconds all do so on the minute.  A
+ * PSI trigger or -u snapshot gives an extra snapshot without moving the
+ * schedule, and -u interval changes it from the next wait on.
+ */
+int	collect_now = 0;	/* set by -u snapshot */
+int	collect_wake[2];	/* written to have the collector look at those */
+int	sched_align = 0;	/* -k */
+long	sched_missed = 0;	/* deadlines skipped as the snapshot before took too long */
+
+/* The deadline after deadline */
+double sched_next(double deadline, double interval)
+{
+struct timespec ts;
+double t;
+
+	if(!sched_align)
+		return deadline + interval;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t = ts.tv_sec + ts.tv_nsec * 1.0e-9 - monotime() + deadline + interval;	/* on the clock */
+	return deadline + interval + floor(t / interval + 0.5) * interval - t;
+}
+
+/* Wait until the monotonic time next, returns 0 once it is there, 1 for
+ * an extra snapshot now and 2 to work out the deadline again.  Without a
+ * timerfd (tfd -1) the poll() timeout has to do.
+ */
+int sched_wait(int tfd, double next)
+{
+struct pollfd pfd[2 + PSI_MAX];
+struct itimerspec its;
+uint64_t expired;
+char buf[64];
+double left;
+int timeout = -1;
+int r;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = (time_t)next;
+	its.it_value.tv_nsec = (long)((next - its.it_value.tv_sec) * 1.0e9);
+	if(tfd == -1 || timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		tfd = -1;
+		if((left = next - monotime()) <= 0.0)
+			return 0;
+		timeout = (int)(left * 1000.0) + 1;
+	}
+	pfd[0].fd = tfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = collect_wake[0];
+	pfd[1].events = POLLIN;
+	memcpy(&pfd[2], psi_poll, psi_polls * sizeof(struct pollfd));
+	if((r = poll(pfd, 2 + psi_polls, timeout)) == 0)
+		return 0;
+	if(r < 0)
+		return 2;
+	if(psi_polls > 0 && psi_fired(&pfd[2]))
+		return 1;
+	if(pfd[1].revents & POLLIN) {
+		while(read(collect_wake[0], buf, sizeof(buf)) == sizeof(buf))
+			;
+		return __atomic_exchange_n(&collect_now, 0, __ATOMIC_RELAXED) ? 1 : 2;
+	}
+	if(pfd[0].revents & POLLIN && read(tfd, &expired, sizeof(expired)) == sizeof(expired))
+		return 0;
+	return 2;
+}
+
+/* Have the collector look at collect_now and the interval now */
+void collect_poke()
+{
+	if(write(collect_wake[1], "w", 1) != 1)
+		/* pipe full, it has a wake up waiting anyway */ ;
+}
+
+/* A section switched on that needs a collector not running yet gets an
+ * extra snapshot now, its rates start from that one instead of the next
+ */
+void collectors_wanted(unsigned long long before, unsigned long long now)
+{
+	if(collect_wake[1] > 0 && rec_in_name == NULL
+	&& (collectors_needed(now) & ~collectors_needed(before))) {
+		__atomic_store_n(&collect_now, 1, __ATOMIC_RELAXED);
+		collect_poke();
+	}
+}
+
+void *collector(void *arg)
+{
+struct data *s;
+double deadline;
+double interval;
+double next;
+double behind;
+long skip;
+int tfd;
+int r = 0;
+int n;
+
+	p = &work;
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);	/* -1 before Linux 2.6.25 */
+	deadline = monotime();
+	for(n = 1; ; n++) {
+		p->late = (r == 1) ? 0.0 : monotime() - deadline;
+		collect();
+		p->loop = n;
+		s = snapshot_copy(p);
+		while(!ring_push(s)) {
+			if(cursed) {	/* the screen only wants the newest */
+				snapshot_free(s);
+				ring_dropped++;
+				break;
+			}
+			usleep(10000);	/* but the file has to have all of them */
+		}
+		if(write(ring_notify[1], "s", 1) != 1)
+			/* pipe full, the UI has a wake up waiting anyway */ ;
+		if(n / roll_every >= maxloops)
+			break;
+
+		do {
+			interval = (roll_base ? roll_base : __atomic_load_n(&seconds, __ATOMIC_RELAXED)) / 10.0;
+			next = sched_next(deadline, interval);
+		} while((r = sched_wait(tfd, next)) == 2);
+		if(r == 0) {
+			deadline = next;
+			if((behind = monotime() - deadline) >= interval) {	/* fell behind, skip the missed ones */
+				skip = (long)(behind / interval);
+				__atomic_add_fetch(&sched_missed, skip, __ATOMIC_RELAXED);
+				deadline += skip * interval;
+			}
+		}
+	}
+	if(tfd != -1)
+		close(tfd);
+	return NULL;
+}
+
+void collector_start(void *(*thread)(void *))
+{
+sigset_t all;
+sigset_t old;
+
+	if(pipe(ring_notify) == -1) {
+		perror("elmon: failed to create the collector pipe");
+		exit(43);
+	}
+	fcntl(ring_notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(ring_notify[1], F_SETFL, O_NONBLOCK);
+	if(pipe(collect_wake) == -1) {
+		perror("elmon: failed to create the collector pipe");
+		exit(43);
+	}
+	fcntl(collect_wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(collect_wake[1], F_SETFL, O_NONBLOCK);
+	/* signals have to go to the UI thread as that tidies up curses */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if(pthread_create(&collector_thread, NULL, thread, NULL) != 0) {
+		perror("elmon: failed to start the collector thread");
+		exit(44);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* UI side: move everything new off the ring into the history and point
+ * p and q at the snapshot being viewed.  Curses takes all of them, file
+ * output one at a time.  Returns the number taken.
+ */
+int snapshot_next()
+{
+struct data *s;
+int n = 0;
+
+	while( (s = ring_pop()) != NULL) {
+		if(s->restart) {
+			history_clear();
+			snap_clear();
+		}
+		history_add(s);
+		if(cursed)
+			ts_save(s);
+		n++;
+		if(!cursed)
+			break;
+	}
+	p = hist_view ? hist_view : hist_newest;
+	q = p->older;
+	return n;
+}
+
+/* -u: a Unix socket to control elmon while it runs in the background.
+ * The UI thread serves it while it waits for the next snapshot, so the
+ * commands change the options and read the history with nothing else
+ * touching them.  A command is a line and the answer a line of JSON:
+ *
+ *	status			snapshot, interval and the sections on
+ *	enable <section>	start or stop a section from the next
+ *	disable <section>	snapshot, names as in ctl_sections
+ *	interval <seconds>	snapshots this often from now on
+ *	snapshot		one now, the schedule stays as it was
+ *	history			CPU, disk, network and memory for every
+ *				snapshot in the history, -H of them, null
+ *				where the section was not collected
+ *	values [<section>]	the latest snapshot as -f has it
+ */
+#define CTL_CLIENTS	8
+#define CTL_LINE	256
+
+struct ctl_section {
+	char	*name;
+	int	item;
+} ctl_sections[] = {
+	{ "cpu",	SHOW_SMP },
+	{ "longterm",	SHOW_LONGTERM },
+	{ "sysinfo",	SHOW_CPU },
+	{ "memory",	SHOW_MEMORY },
+	{ "large",	SHOW_LARGE },
+	{ "vm",		SHOW_VM },
+	{ "kernel",	SHOW_KERNEL },
+	{ "disk",	SHOW_DISK },
+	{ "dgroup",	SHOW_DGROUP },
+	{ "jfs",	SHOW_JFS },
+	{ "net",	SHOW_NET },
+	{ "neterror",	SHOW_NETERROR },
+	{ "nfs",	SHOW_NFS },
+	{ "partitions",	SHOW_PARTITIONS },
+	{ "top",	SHOW_TOP },
+	{ "lpar",	SHOW_LPAR },
+	{ "irq",	SHOW_IRQ },
+	{ "psi",	SHOW_PSI },
+	{ "cgroup",	SHOW_CGROUP },
+	{ "numa",	SHOW_NUMA },
+	{ NULL }
+};
+
+struct ctl_client {
+	int	fd;		/* -1 for a free slot */
+	char	req[CTL_LINE];
+	int	got;
+	int	eof;		/* close once the answers are sent */
+	char	*out;		/* answers still to send */
+	size_t	len;
+	size_t	done;
+	size_t	size;
+};
+
+char	*ctl_path = NULL;	/* -u */
+int	ctl_fd = -1;
+struct ctl_client ctl_client[CTL_CLIENTS];
+
+void ctl_close(struct ctl_client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	FREE(c->out);
+	c->out = NULL;
+	c->len = c->done = c->size = 0;
+}
+
+/* fmt from start on is the answer, it moves to the client */
+void ctl_answer(struct ctl_client *c, long start)
+{
+size_t n = fmt.len - start;
+
+	if(c->len + n > c->size) {
+		c->size = (c->len + n) * 2;
+		c->out = REALLOC(c->out, c->size);
+	}
+	memcpy(c->out + c->len, &fmt.data[start], n);
+	c->len += n;
+	fmt.len = start;
+}
+
+void ctl_error(char *msg, char *arg)
+{
+char buf[CTL_LINE + 64];
+
+	snprintf(buf, sizeof(buf), "%s%s", msg, arg);
+	fmt_str("{\"error\":");
+	fmt_json(buf);
+	fmt_str("}\n");
+}
+
+void ctl_status()
+{
+struct ctl_section *cs;
+int n = 0;
+
+	fmt_str("{\"snapshot\":");
+	fmt_num(loop, 0);
+	fmt_str(",\"interval\":");
+	fmt_num(__atomic_load_n(&seconds, __ATOMIC_RELAXED) / 10.0, 1);
+	fmt_str(",\"history\":");
+	fmt_num(hist_count, 0);
+	fmt_str(",\"missed\":");
+	fmt_num(__atomic_load_n(&sched_missed, __ATOMIC_RELAXED), 0);
+	fmt_str(",\"sections\":[");
+	for(cs = ctl_sections; cs->name != NULL; cs++)
+		if(enabled_option(cs->item)) {
+			fmt_str(n++ ? "," : "");
+			fmt_json(cs->name);
+		}
+	fmt_str("]}\n");
+}
+
+/* ,"name":value of a history entry, null if it was not collected */
+void ctl_metric(char *name, double v, int prec)
+{
+	fmt_str(",");
+	fmt_json(name);
+	fmt_str(":");
+	if(isfinite(v))
+		fmt_num(v, prec);
+	else
+		fmt_str("null");
+}
+
+void ctl_history()
+{
+struct data *s;
+int n = 0;
+
+	fmt_str("{\"history\":[");
+	for(s = hist_oldest; s != NULL; s = s->newer) {
+		if(s->older == NULL)	/* the rates need the one before */
+			continue;
+		fmt_str(n++ ? ",{\"snapshot\":" : "{\"snapshot\":");
+		fmt_num(s->loop, 0);
+		fmt_str(",\"time\":");
+		fmt_num(s->time, 3);
+		ctl_metric("cpu_busy_pct", history_metric(SHOW_CPU, s, s->older) * 100.0, 1);
+		ctl_metric("disk_busy_pct", history_metric(SHOW_DISK, s, s->older), 1);
+		ctl_metric("net_bytes_per_sec", history_metric(SHOW_NET, s, s->older), 0);
+		ctl_metric("mem_used_kb", history_metric(SHOW_MEMORY, s, s->older), 0);
+		ctl_metric("pswitch_per_sec", history_metric(SHOW_KERNEL, s, s->older), 0);
+		ctl_metric("intr_per_sec", history_metric(SHOW_IRQ, s, s->older), 0);
+		fmt_str("}");
+	}
+	fmt_str("]}\n");
+}
+
+/* The table -Y and -u keep, as section: {column: value} or for sections
+ * with a key section: {key: {column: value}}
+ */
+void ctl_values(char *want)
+{
+struct elmon_shm_buffer *b = &shm_segment->buffer[shm_segment->latest];
+struct elmon_shm_entry *e;
+char *section = NULL;
+char *key = NULL;
+int cols = 0;
+uint32_t i;
+
+	if(b->seq == 0) {
+		ctl_error("no snapshot yet", "");
+		return;
+	}
+	fmt_str("{\"snapshot\":");
+	fmt_num(b->snapshot, 0);
+	fmt_str(",\"time\":");
+	fmt_num(b->time, 0);
+	fmt_str(",\"values\":{");
+	for(i = 0; i < b->count; i++) {
+		e = &b->entry[i];
+		if(want != NULL && strcasecmp(e->section, want) != 0)
+			continue;
+		if(section == NULL || strcmp(e->section, section) != 0) {
+			if(section != NULL)
+				fmt_str(key != NULL ? "}}," : "},");
+			fmt_json(e->section);
+			fmt_str(":{");
+			section = e->section;
+			key = NULL;
+			cols = 0;
+		}
+		if(e->key[0] != 0 && (key == NULL || strcmp(e->key, key) != 0)) {
+			if(key != NULL)
+				fmt_str("},");
+			else if(cols > 0)
+				fmt_str(",");
+			fmt_json(e->key);
+			fmt_str(":{");
+			key = e->key;
+			cols = 0;
+		}
+		fmt_str(cols++ ? "," : "");
+		fmt_json(e->column);
+		fmt_str(":");
+		if(e->text[0] != 0)
+			fmt_json(e->text);
+		else if(isfinite(e->value))
+			fmt_num(e->value, 3);
+		else
+			fmt_str("null");
+	}
+	if(section != NULL)
+		fmt_str(key != NULL ? "}}" : "}");
+	fmt_str("}}\n");
+}
+
+void ctl_command(struct ctl_client *c, char *line)
+{
+struct ctl_section *cs;
+long start = fmt.len;
+char *cmd;
+char *arg;
+double v;
+
+	cmd = strtok(line, " \t\r");
+	arg = strtok(NULL, " \t\r");
+	if(cmd == NULL)
+		return;
+	if(strcmp(cmd, "status") == 0)
+		ctl_status();
+	else if(strcmp(cmd, "enable") == 0 || strcmp(cmd, "disable") == 0) {
+		for(cs = ctl_sections; arg != NULL && cs->name != NULL; cs++)
+			if(strcmp(cs->name, arg) == 0)
+				break;
+		if(arg == NULL || cs->name == NULL)
+			ctl_error("no such section: ", arg ? arg : "");
+		else {
+			if(cmd[0] == 'e')
+				add_option(cs->item);
+			else
+				remove_option(cs->item);
+			ctl_status();
+		}
+	} else if(strcmp(cmd, "interval") == 0) {
+		v = arg ? atof(arg) : 0.0;
+		if(v < 0.1 || v > 86400.0)
+			ctl_error("interval needs seconds from 0.1 to 86400, not ", arg ? arg : "");
+		else {
+			__atomic_store_n(&seconds, (int)(v * 10.0 + 0.5), __ATOMIC_RELAXED);
+			collect_poke();
+			if(shm_segment != NULL)
+				shm_segment->interval_ms = seconds * 100;
+			ctl_status();
+		}
+	} else if(strcmp(cmd, "snapshot") == 0) {
+		__atomic_store_n(&collect_now, 1, __ATOMIC_RELAXED);
+		collect_poke();
+		fmt_str("{\"ok\":true}\n");
+	} else if(strcmp(cmd, "history") == 0)
+		ctl_history();
+	else if(strcmp(cmd, "values") == 0)
+		ctl_values(arg);
+	else
+		ctl_error("unknown command: ", cmd);
+	ctl_answer(c, start);
+}
+
+/* Send what the client can take now */
+void ctl_send(struct ctl_client *c)
+{
+ssize_t n;
+
+	while(c->done < c->len) {
+		if((n = send(c->fd, c->out + c->done, c->len - c->done, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				ctl_close(c);
+			return;
+		}
+		c->done += n;
+	}
+	c->len = c->done = 0;
+	if(c->eof)
+		ctl_close(c);
+}
+
+void ctl_read(struct ctl_client *c)
+{
+char *nl;
+ssize_t n;
+
+	if((n = read(c->fd, c->req + c->got, sizeof(c->req) - 1 - c->got)) < 0) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			ctl_close(c);
+		return;
+	}
+	if(n == 0)
+		c->eof = 1;
+	c->got += n;
+	c->req[c->got] = 0;
+	while((nl = strchr(c->req, '\n')) != NULL || (c->eof && c->got > 0)
+	|| c->got == sizeof(c->req) - 1) {
+		if(nl == NULL)	/* the last line without a newline, or too long */
+			nl = &c->req[c->got];
+		*nl = 0;
+		ctl_command(c, c->req);
+		n = c->req + c->got - nl;
+		c->got = n > 0 ? n - 1 : 0;
+		memmove(c->req, nl + 1, c->got);
+		c->req[c->got] = 0;
+	}
+	ctl_send(c);
+}
+
+/* The socket and clients into pfd, returns how many */
+int ctl_fds(struct pollfd *pfd)
+{
+int i;
+
+	if(ctl_fd < 0)
+		return 0;
+	pfd[0].fd = ctl_fd;
+	pfd[0].events = POLLIN;
+	for(i = 0; i < CTL_CLIENTS; i++) {
+		pfd[i + 1].fd = ctl_client[i].fd;
+		pfd[i + 1].events = (ctl_client[i].eof ? 0 : POLLIN)
+			| (ctl_client[i].done < ctl_client[i].len ? POLLOUT : 0);
+	}
+	return CTL_CLIENTS + 1;
+}
+
+/* Deal with what poll() found on the ctl_fds() */
+void ctl_serve(struct pollfd *pfd)
+{
+struct ctl_client *c;
+int fd;
+int i;
+
+	for(i = 0; i < CTL_CLIENTS; i++) {
+		c = &ctl_client[i];
+		if(c->fd < 0 || pfd[i + 1].fd != c->fd || pfd[i + 1].revents == 0)
+			continue;
+		if(pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+			ctl_read(c);
+		if(c->fd >= 0 && (pfd[i + 1].revents & POLLOUT))
+			ctl_send(c);
+	}
+	if(pfd[0].revents & POLLIN)
+		while((fd = accept(ctl_fd, NULL, NULL)) >= 0) {
+			for(i = 0; i < CTL_CLIENTS && ctl_client[i].fd >= 0; i++)
+				;
+			if(i == CTL_CLIENTS) {	/* busy */
+				close(fd);
+				continue;
+			}
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			memset(&ctl_client[i], 0, sizeof(struct ctl_client));
+			ctl_client[i].fd = fd;
+		}
+}
+
+void ctl_unlink()
+{
+	if(ctl_fd >= 0)
+		unlink(ctl_path);
+}
+
+/* Listen on -u's path now, so a mistake is reported before elmon goes
+ * into the background
+ */
+void ctl_open()
+{
+struct sockaddr_un sa;
+struct stat st;
+int i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if(strlen(ctl_path) >= sizeof(sa.sun_path)) {
+		printf("%s: -u path is longer than %d\n", progname, (int)sizeof(sa.sun_path) - 1);
+		exit(49);
+	}
+	strcpy(sa.sun_path, ctl_path);
+	if(lstat(ctl_path, &st) == 0 && S_ISSOCK(st.st_mode))	/* left by an elmon that was killed */
+		unlink(ctl_path);
+	if((ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1
+	|| bind(ctl_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1
+	|| chmod(ctl_path, 0600) == -1
+	|| listen(ctl_fd, CTL_CLIENTS) == -1) {
+		perror("elmon: -u failed to listen");
+		printf("elmon: socket path=%s\n", ctl_path);
+		exit(49);
+	}
+	fcntl(ctl_fd, F_SETFL, O_NONBLOCK);
+	fcntl(ctl_fd, F_SETFD, FD_CLOEXEC);
+	for(i = 0; i < CTL_CLIENTS; i++)
+		ctl_client[i].fd = -1;
+	if(shm_segment == NULL) {	/* values needs the table -Y keeps */
+		shm_segment = MALLOC(sizeof(struct elmon_shm));
+		memset(shm_segment, 0, sizeof(struct elmon_shm));
+		enc_tee = &enc_shm;
+	}
+}
+
+/* Only once in the background, or the parent would remove the socket */
+void ctl_start()
+{
+	if(ctl_fd >= 0)
+		atexit(ctl_unlink);
+}
+
+/* Wait up to usec (-1 = forever) for the collector, or for a key press
+ * too if keys is set, serving -u meanwhile.  Returns 1 when the
+ * collector published something.
+ */
+int snapshot_wait(long usec, int keys)
+{
+struct pollfd pfd[2 + 1 + CTL_CLIENTS];
+char buf[64];
+int n;
+
+	pfd[0].fd = ring_notify[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = keys ? 0 : -1;
+	pfd[1].events = POLLIN;
+	for(;;) {
+		n = 2 + ctl_fds(&pfd[2]);
+		if(poll(pfd, n, usec < 0 ? -1 : usec / 1000) <= 0)
+			return 0;
+		if(n > 2)
+			ctl_serve(&pfd[2]);
+		if(pfd[0].revents & POLLIN)
+			break;
+		if(pfd[1].revents || usec >= 0)
+			return 0;
+	}
+	while(read(ring_notify[0], buf, sizeof(buf)) == sizeof(buf))
+		;
+	return 1;
+}
+
+/* Binary recording (-B file) and elmon --to-nmon.  The header names every
+ * table and column in the file, so an elmon built with different
+ * structures still reads it.  Then comes one frame per snapshot holding
+ * the change of every column since the last frame: integers as zigzag
+ * varints, floats as the XOR of their bits, strings only when they
+ * change, and runs of unchanged values as just a count.  Every
+ * REC_KEYFRAME frames is coded against zero so a reader can start there.
+ * The frames from a key frame on are deflated as one stream, flushed at
+ * the end of each frame, so what a frame has in common with the ones
+ * before it costs next to nothing.  The four bytes every flush ends with
+ * are left off and put back by the reader.
+ *
+ *	header:	"ELMONREC" version, the length of the rest, then the rest
+ *		zlib compressed: settings jfs-table schema
+ *	frame:	varint length, 'K' (key) or 'D' (delta), then deflated per
+ *		table the element count, the keys of a keyed table and then
+ *		the values
+ *	trailer: an 'I' frame, deflated on its own, indexing the frames by
+ *		loop, time and offset, then "ELMONIDX" and the u64 offset of
+ *		the 'I' frame
+ *
+ * Until the trailer is there <file>.idx holds the same index, see
+ * idx_checkpoint().  -f files get one too, pointing at the ZZZZ lines.
+ */
+#define REC_MAGIC	"ELMONREC"
+#define REC_IDXMAGIC	"ELMONIDX"
+#define REC_IDXFILE	"ELMONIX1"
+#define REC_VERSION	2
+#define REC_KEYFRAME	600
+#define REC_CHECKPOINT	60	/* snapshots between syncs of the output and its .idx */
+
+#define REC_INT		1
+#define REC_FLOAT	2
+#define REC_STRING	3	/* char array */
+#define REC_POINTER	4	/* char * into the cgroup path pool */
+
+struct rec_col {
+	char	*name;
+	int	offset;
+	int	size;		/* of one element of an array */
+	int	kind;
+	int	count;		/* 1 or the array length */
+};
+
+#define RCOL(s, m, k)	{ #m, offsetof(struct s, m), sizeof(((struct s *)0)->m), k, 1 }
+#define RARRAY(s, m, k)	{ #m, offsetof(struct s, m), sizeof(((struct s *)0)->m[0]), k, \
+			  sizeof(((struct s *)0)->m) / sizeof(((struct s *)0)->m[0]) }
+#define RCOLS(c)	(sizeof(c) / sizeof(struct rec_col))
+
+/* time is not recorded, it is the same as tv, see rec_time() */
+struct rec_col rec_data_cols[] = {
+	RCOL(data, tv.tv_sec, REC_INT),
+	RCOL(data, tv.tv_usec, REC_INT),
+	RCOL(data, loop, REC_INT),
+	RCOL(data, vm_ret, REC_INT),
+	RCOL(data, disks, REC_INT),
+	RCOL(data, networks, REC_INT),
+	RCOL(data, irq.cpu_max, REC_INT),
+	RCOL(data, softirq.cpu_max, REC_INT),
+#ifdef POWER
+	RCOL(data, lpar_ret, REC_INT),
+#endif /*POWER*/
+};
+
+struct rec_col rec_cpu_cols[] = {
+	RCOL(cpu_stat, user, REC_INT),
+	RCOL(cpu_stat, sys, REC_INT),
+	RCOL(cpu_stat, wait, REC_INT),
+	RCOL(cpu_stat, idle, REC_INT),
+	RCOL(cpu_stat, irq, REC_INT),
+	RCOL(cpu_stat, softirq, REC_INT),
+	RCOL(cpu_stat, steal, REC_INT),
+	RCOL(cpu_stat, nice, REC_INT),
+	RCOL(cpu_stat, intr, REC_INT),
+	RCOL(cpu_stat, ctxt, REC_INT),
+	RCOL(cpu_stat, btime, REC_INT),
+	RCOL(cpu_stat, procs, REC_INT),
+	RCOL(cpu_stat, running, REC_INT),
+	RCOL(cpu_stat, blocked, REC_INT),
+	RCOL(cpu_stat, uptime, REC_FLOAT),
+	RCOL(cpu_stat, idletime, REC_FLOAT),
+	RCOL(cpu_stat, mins1, REC_FLOAT),
+	RCOL(cpu_stat, mins5, REC_FLOAT),
+	RCOL(cpu_stat, mins15, REC_FLOAT),
+};
+
+struct rec_col rec_mem_cols[] = {
+	RCOL(mem_stat, memtotal, REC_INT),
+	RCOL(mem_stat, memfree, REC_INT),
+	RCOL(mem_stat, memshared, REC_INT),
+	RCOL(mem_stat, buffers, REC_INT),
+	RCOL(mem_stat, cached, REC_INT),
+	RCOL(mem_stat, swapcached, REC_INT),
+	RCOL(mem_stat, active, REC_INT),
+	RCOL(mem_stat, inactive, REC_INT),
+	RCOL(mem_stat, hightotal, REC_INT),
+	RCOL(mem_stat, highfree, REC_INT),
+	RCOL(mem_stat, lowtotal, REC_INT),
+	RCOL(mem_stat, lowfree, REC_INT),
+	RCOL(mem_stat, swaptotal, REC_INT),
+	RCOL(mem_stat, swapfree, REC_INT),
+#ifdef LARGEMEM
+	RCOL(mem_stat, dirty, REC_INT),
+	RCOL(mem_stat, writeback, REC_INT),
+	RCOL(mem_stat, mapped, REC_INT),
+	RCOL(mem_stat, slab, REC_INT),
+	RCOL(mem_stat, committed_as, REC_INT),
+	RCOL(mem_stat, pagetables, REC_INT),
+	RCOL(mem_stat, hugetotal, REC_INT),
+	RCOL(mem_stat, hugefree, REC_INT),
+	RCOL(mem_stat, hugesize, REC_INT),
+#else
+	RCOL(mem_stat, bigfree, REC_INT),
+#endif /*LARGEMEM*/
+};
+
+struct rec_col rec_vm_cols[] = {
+	RCOL(vm_stat, nr_dirty, REC_INT),
+	RCOL(vm_stat, nr_writeback, REC_INT),
+	RCOL(vm_stat, nr_unstable, REC_INT),
+	RCOL(vm_stat, nr_page_table_pages, REC_INT),
+	RCOL(vm_stat, nr_mapped, REC_INT),
+	RCOL(vm_stat, nr_slab, REC_INT),
+	RCOL(vm_stat, pgpgin, REC_INT),
+	RCOL(vm_stat, pgpgout, REC_INT),
+	RCOL(vm_stat, pswpin, REC_INT),
+	RCOL(vm_stat, pswpout, REC_INT),
+	RCOL(vm_stat, pgalloc_high, REC_INT),
+	RCOL(vm_stat, pgalloc_normal, REC_INT),
+	RCOL(vm_stat, pgalloc_dma, REC_INT),
+	RCOL(vm_stat, pgfree, REC_INT),
+	RCOL(vm_stat, pgactivate, REC_INT),
+	RCOL(vm_stat, pgdeactivate, REC_INT),
+	RCOL(vm_stat, pgfault, REC_INT),
+	RCOL(vm_stat, pgmajfault, REC_INT),
+	RCOL(vm_stat, pgrefill_high, REC_INT),
+	RCOL(vm_stat, pgrefill_normal, REC_INT),
+	RCOL(vm_stat, pgrefill_dma, REC_INT),
+	RCOL(vm_stat, pgsteal_high, REC_INT),
+	RCOL(vm_stat, pgsteal_normal, REC_INT),
+	RCOL(vm_stat, pgsteal_dma, REC_INT),
+	RCOL(vm_stat, pgscan_kswapd_high, REC_INT),
+	RCOL(vm_stat, pgscan_kswapd_normal, REC_INT),
+	RCOL(vm_stat, pgscan_kswapd_dma, REC_INT),
+	RCOL(vm_stat, pgscan_direct_high, REC_INT),
+	RCOL(vm_stat, pgscan_direct_normal, REC_INT),
+	RCOL(vm_stat, pgscan_direct_dma, REC_INT),
+	RCOL(vm_stat, pginodesteal, REC_INT),
+	RCOL(vm_stat, slabs_scanned, REC_INT),
+	RCOL(vm_stat, kswapd_steal, REC_INT),
+	RCOL(vm_stat, kswapd_inodesteal, REC_INT),
+	RCOL(vm_stat, pageoutrun, REC_INT),
+	RCOL(vm_stat, allocstall, REC_INT),
+	RCOL(vm_stat, pgrotated, REC_INT),
+};
+
+struct rec_col rec_nfs_cols[] = {
+	RARRAY(nfs_stat, v2c, REC_INT),
+	RARRAY(nfs_stat, v3c, REC_INT),
+	RARRAY(nfs_stat, v2s, REC_INT),
+	RARRAY(nfs_stat, v3s, REC_INT),
+};
+
+struct rec_col rec_disk_cols[] = {
+	RCOL(dsk_stat, dk_name, REC_STRING),
+	RCOL(dsk_stat, dk_major, REC_INT),
+	RCOL(dsk_stat, dk_minor, REC_INT),
+	RCOL(dsk_stat, dk_noinfo, REC_INT),
+	RCOL(dsk_stat, dk_reads, REC_INT),
+	RCOL(dsk_stat, dk_rmerge, REC_INT),
+	RCOL(dsk_stat, dk_rmsec, REC_INT),
+	RCOL(dsk_stat, dk_rkb, REC_INT),
+	RCOL(dsk_stat, dk_writes, REC_INT),
+	RCOL(dsk_stat, dk_wmerge, REC_INT),
+	RCOL(dsk_stat, dk_wmsec, REC_INT),
+	RCOL(dsk_stat, dk_wkb, REC_INT),
+	RCOL(dsk_stat, dk_xfers, REC_INT),
+	RCOL(dsk_stat, dk_bsize, REC_INT),
+	RCOL(dsk_stat, dk_time, REC_INT),
+	RCOL(dsk_stat, dk_inflight, REC_INT),
+	RCOL(dsk_stat, dk_11, REC_INT),
+	RCOL(dsk_stat, dk_partition, REC_INT),
+	RCOL(dsk_stat, dk_blocks, REC_INT),
+	RCOL(dsk_stat, dk_use, REC_INT),
+	RCOL(dsk_stat, dk_aveq, REC_INT),
+};
+
+struct rec_col rec_net_cols[] = {
+	RCOL(net_stat, if_name, REC_STRING),
+	RCOL(net_stat, if_ibytes, REC_INT),
+	RCOL(net_stat, if_obytes, REC_INT),
+	RCOL(net_stat, if_ipackets, REC_INT),
+	RCOL(net_stat, if_opackets, REC_INT),
+	RCOL(net_stat, if_ierrs, REC_INT),
+	RCOL(net_stat, if_oerrs, REC_INT),
+	RCOL(net_stat, if_idrop, REC_INT),
+	RCOL(net_stat, if_ififo, REC_INT),
+	RCOL(net_stat, if_iframe, REC_INT),
+	RCOL(net_stat, if_odrop, REC_INT),
+	RCOL(net_stat, if_ofifo, REC_INT),
+	RCOL(net_stat, if_ocarrier, REC_INT),
+	RCOL(net_stat, if_ocolls, REC_INT),
+};
+
+struct rec_col rec_psi_cols[] = {
+	RCOL(psi_stat, valid, REC_INT),
+	RCOL(psi_stat, has_full, REC_INT),
+	RARRAY(psi_stat, some.avg, REC_FLOAT),
+	RCOL(psi_stat, some.total, REC_INT),
+	RARRAY(psi_stat, full.avg, REC_FLOAT),
+	RCOL(psi_stat, full.total, REC_INT),
+	RCOL(psi_stat, triggers, REC_INT),
+};
+
+struct rec_col rec_numa_cols[] = {
+	RCOL(numa_stat, node, REC_INT),
+	RCOL(numa_stat, total, REC_INT),
+	RCOL(numa_stat, free, REC_INT),
+	RCOL(numa_stat, used, REC_INT),
+	RCOL(numa_stat, file, REC_INT),
+	RCOL(numa_stat, anon, REC_INT),
+	RCOL(numa_stat, numa_hit, REC_INT),
+	RCOL(numa_stat, numa_miss, REC_INT),
+	RCOL(numa_stat, numa_foreign, REC_INT),
+	RCOL(numa_stat, interleave_hit, REC_INT),
+	RCOL(numa_stat, local_node, REC_INT),
+	RCOL(numa_stat, other_node, REC_INT),
+};
+
+struct rec_col rec_fs_cols[] = {
+	RCOL(fs_stat, mounted, REC_INT),
+	RCOL(fs_stat, ret, REC_INT),
+	RCOL(fs_stat, blocks, REC_INT),
+	RCOL(fs_stat, bfree, REC_INT),
+};
+
+struct rec_col rec_irq_cols[] = {
+	RCOL(irq_row, name, REC_STRING),
+	RCOL(irq_row, desc, REC_STRING),
+	RCOL(irq_row, first, REC_INT),
+	RCOL(irq_row, cells, REC_INT),
+	RCOL(irq_row, global, REC_INT),
+	RCOL(irq_row, total, REC_INT),
+};
+
+struct rec_col rec_irq_cpu_cols[] = {
+	{ "cpu", 0, sizeof(int), REC_INT, 1 },
+};
+
+struct rec_col rec_irq_count_cols[] = {
+	{ "count", 0, sizeof(unsigned long long), REC_INT, 1 },
+};
+
+struct rec_col rec_cg_cols[] = {
+	RCOL(cg_sample, node, REC_INT),
+	RCOL(cg_sample, gen, REC_INT),
+	RCOL(cg_sample, path, REC_POINTER),
+	RCOL(cg_sample, usage_usec, REC_INT),
+	RCOL(cg_sample, user_usec, REC_INT),
+	RCOL(cg_sample, system_usec, REC_INT),
+	RCOL(cg_sample, throttled_usec, REC_INT),
+	RCOL(cg_sample, mem_current, REC_INT),
+	RCOL(cg_sample, anon, REC_INT),
+	RCOL(cg_sample, file, REC_INT),
+	RCOL(cg_sample, rbytes, REC_INT),
+	RCOL(cg_sample, wbytes, REC_INT),
+	RCOL(cg_sample, rios, REC_INT),
+	RCOL(cg_sample, wios, REC_INT),
+	RARRAY(cg_sample, psi[0].avg, REC_FLOAT),
+	RCOL(cg_sample, psi[0].total, REC_INT),
+	RARRAY(cg_sample, psi[1].avg, REC_FLOAT),
+	RCOL(cg_sample, psi[1].total, REC_INT),
+	RARRAY(cg_sample, psi[2].avg, REC_FLOAT),
+	RCOL(cg_sample, psi[2].total, REC_INT),
+};
+
+struct rec_col rec_procs_cols[] = {
+	RCOL(procsinfo, pi_pid, REC_INT),
+	RCOL(procsinfo, pi_comm, REC_STRING),
+	RCOL(procsinfo, pi_state, REC_INT),
+	RCOL(procsinfo, pi_ppid, REC_INT),
+	RCOL(procsinfo, pi_pgrp, REC_INT),
+	RCOL(procsinfo, pi_session, REC_INT),
+	RCOL(procsinfo, pi_tty_nr, REC_INT),
+	RCOL(procsinfo, pi_tty_pgrp, REC_INT),
+	RCOL(procsinfo, pi_flags, REC_INT),
+	RCOL(procsinfo, pi_minflt, REC_INT),
+	RCOL(procsinfo, pi_cmin_flt, REC_INT),
+	RCOL(procsinfo, pi_majflt, REC_INT),
+	RCOL(procsinfo, pi_cmaj_flt, REC_INT),
+	RCOL(procsinfo, pi_utime, REC_INT),
+	RCOL(procsinfo, pi_stime, REC_INT),
+	RCOL(procsinfo, pi_cutime, REC_INT),
+	RCOL(procsinfo, pi_cstime, REC_INT),
+	RCOL(procsinfo, pi_pri, REC_INT),
+	RCOL(procsinfo, pi_nice, REC_INT),
+	RCOL(procsinfo, pi_it_real_value, REC_INT),
+	RCOL(procsinfo, pi_start_time, REC_INT),
+	RCOL(procsinfo, pi_vsize, REC_INT),
+	RCOL(procsinfo, pi_rss, REC_INT),
+	RCOL(procsinfo, pi_rlim_cur, REC_INT),
+	RCOL(procsinfo, pi_start_code, REC_INT),
+	RCOL(procsinfo, pi_end_code, REC_INT),
+	RCOL(procsinfo, pi_start_stack, REC_INT),
+	RCOL(procsinfo, pi_esp, REC_INT),
+	RCOL(procsinfo, pi_eip, REC_INT),
+	RCOL(procsinfo, pi_pending_signal, REC_INT),
+	RCOL(procsinfo, pi_blocked_sig, REC_INT),
+	RCOL(procsinfo, pi_sigign, REC_INT),
+	RCOL(procsinfo, pi_sigcatch, REC_INT),
+	RCOL(procsinfo, pi_wchan, REC_INT),
+	RCOL(procsinfo, pi_nswap, REC_INT),
+	RCOL(procsinfo, pi_cnswap, REC_INT),
+	RCOL(procsinfo, pi_exit_signal, REC_INT),
+	RCOL(procsinfo, pi_cpu, REC_INT),
+	RCOL(procsinfo, statm_size, REC_INT),
+	RCOL(procsinfo, statm_resident, REC_INT),
+	RCOL(procsinfo, statm_share, REC_INT),
+	RCOL(procsinfo, statm_trs, REC_INT),
+	RCOL(procsinfo, statm_drs, REC_INT),
+	RCOL(procsinfo, statm_lrs, REC_INT),
+	RCOL(procsinfo, statm_dt, REC_INT),
+};
+
+#ifdef POWER
+struct rec_col rec_lpar_cols[] = {
+	RCOL(lpar_stat, version_string, REC_STRING),
+	RCOL(lpar_stat, version, REC_INT),
+	RCOL(lpar_stat, serial_number, REC_STRING),
+	RCOL(lpar_stat, system_type, REC_STRING),
+	RCOL(lpar_stat, partition_id, REC_INT),
+	RCOL(lpar_stat, BoundThrds, REC_INT),
+	RCOL(lpar_stat, CapInc, REC_INT),
+	RCOL(lpar_stat, DisWheRotPer, REC_INT),
+	RCOL(lpar_stat, MinEntCap, REC_INT),
+	RCOL(lpar_stat, MinEntCapPerVP, REC_INT),
+	RCOL(lpar_stat, MinMem, REC_INT),
+	RCOL(lpar_stat, DesMem, REC_INT),
+	RCOL(lpar_stat, MinProcs, REC_INT),
+	RCOL(lpar_stat, partition_max_entitled_capacity, REC_INT),
+	RCOL(lpar_stat, system_potential_processors, REC_INT),
+	RCOL(lpar_stat, partition_entitled_capacity, REC_INT),
+	RCOL(lpar_stat, system_active_processors, REC_INT),
+	RCOL(lpar_stat, pool_capacity, REC_INT),
+	RCOL(lpar_stat, unallocated_capacity_weight, REC_INT),
+	RCOL(lpar_stat, capacity_weight, REC_INT),
+	RCOL(lpar_stat, capped, REC_INT),
+	RCOL(lpar_stat, unallocated_capacity, REC_INT),
+	RCOL(lpar_stat, pool_idle_time, REC_INT),
+	RCOL(lpar_stat, pool_idle_saved, REC_INT),
+	RCOL(lpar_stat, pool_idle_diff, REC_INT),
+	RCOL(lpar_stat, pool_num_procs, REC_INT),
+	RCOL(lpar_stat, purr, REC_INT),
+	RCOL(lpar_stat, purr_saved, REC_INT),
+	RCOL(lpar_stat, purr_diff, REC_INT),
+	RCOL(lpar_stat, timebase, REC_INT),
+	RCOL(lpar_stat, partition_active_processors, REC_INT),
+	RCOL(lpar_stat, partition_potential_processors, REC_INT),
+	RCOL(lpar_stat, shared_processor_mode, REC_INT),
+};
+#endif /*POWER*/
+
+#define REC_T_DATA		0
+#define REC_T_CPU_TOTAL		1
+#define REC_T_CPU		2
+#define REC_T_MEM		3
+#define REC_T_VM		4
+#define REC_T_NFS		5
+#define REC_T_DISK		6
+#define REC_T_NET		7
+#define REC_T_PSI		8
+#define REC_T_NUMA		9
+#define REC_T_FS		10
+#define REC_T_IRQ		11
+#define REC_T_IRQ_CPU		12
+#define REC_T_IRQ_COUNT		13
+#define REC_T_SOFTIRQ		14
+#define REC_T_SOFTIRQ_CPU	15
+#define REC_T_SOFTIRQ_COUNT	16
+#define REC_T_CGROUP		17
+#define REC_T_PROCS		18
+#define REC_T_LPAR		19
+
+struct rec_table {
+	char	*name;
+	struct rec_col *col;
+	int	cols;
+	int	size;		/* bytes per element */
+	int	key;		/* column to match elements between frames by, -1 = position */
+} rec_table[] = {
+	{ "data",          rec_data_cols,      RCOLS(rec_data_cols),      sizeof(struct data),       -1 },
+	{ "cpu_total",     rec_cpu_cols,       RCOLS(rec_cpu_cols),       sizeof(struct cpu_stat),   -1 },
+	{ "cpu",           rec_cpu_cols,       RCOLS(rec_cpu_cols),       sizeof(struct cpu_stat),   -1 },
+	{ "mem",           rec_mem_cols,       RCOLS(rec_mem_cols),       sizeof(struct mem_stat),   -1 },
+	{ "vm",            rec_vm_cols,        RCOLS(rec_vm_cols),        sizeof(struct vm_stat),    -1 },
+	{ "nfs",           rec_nfs_cols,       RCOLS(rec_nfs_cols),       sizeof(struct nfs_stat),   -1 },
+	{ "disk",          rec_disk_cols,      RCOLS(rec_disk_cols),      sizeof(struct dsk_stat),   -1 },
+	{ "net",           rec_net_cols,       RCOLS(rec_net_cols),       sizeof(struct net_stat),   -1 },
+	{ "psi",           rec_psi_cols,       RCOLS(rec_psi_cols),       sizeof(struct psi_stat),   -1 },
+	{ "numa",          rec_numa_cols,      RCOLS(rec_numa_cols),      sizeof(struct numa_stat),  -1 },
+	{ "fs",            rec_fs_cols,        RCOLS(rec_fs_cols),        sizeof(struct fs_stat),    -1 },
+	{ "irq",           rec_irq_cols,       RCOLS(rec_irq_cols),       sizeof(struct irq_row),    -1 },
+	{ "irq_cpu",       rec_irq_cpu_cols,   RCOLS(rec_irq_cpu_cols),   sizeof(int),               -1 },
+	{ "irq_count",     rec_irq_count_cols, RCOLS(rec_irq_count_cols), sizeof(unsigned long long), -1 },
+	{ "softirq",       rec_irq_cols,       RCOLS(rec_irq_cols),       sizeof(struct irq_row),    -1 },
+	{ "softirq_cpu",   rec_irq_cpu_cols,   RCOLS(rec_irq_cpu_cols),   sizeof(int),               -1 },
+	{ "softirq_count", rec_irq_count_cols, RCOLS(rec_irq_count_cols), sizeof(unsigned long long), -1 },
+	{ "cgroup",        rec_cg_cols,        RCOLS(rec_cg_cols),        sizeof(struct cg_sample),  -1 },
+	{ "procs",         rec_procs_cols,     RCOLS(rec_procs_cols),     sizeof(struct procsinfo),   0 },
+#ifdef POWER
+	{ "lpar",          rec_lpar_cols,      RCOLS(rec_lpar_cols),      sizeof(struct lpar_stat),  -1 },
+#endif /*POWER*/
+};
+#define REC_TABLES (int)(sizeof(rec_table) / sizeof(struct rec_table))
+
+/* Where table t is in snapshot s and how many elements it has */
+char *rec_array(struct data *s, int t, int *n)
+{
+	*n = 1;
+	switch(t) {
+	case REC_T_DATA:	return (char *)s;
+	case REC_T_CPU_TOTAL:	return (char *)&s->cpu_total;
+	case REC_T_CPU:		*n = cpus;		return (char *)s->cpuN;
+	case REC_T_MEM:		return (char *)&s->mem;
+	case REC_T_VM:		return (char *)&s->vm;
+	case REC_T_NFS:		return (char *)&s->nfs;
+	case REC_T_DISK:	*n = s->disks;		return (char *)s->dk;
+	case REC_T_NET:		*n = s->networks;	return (char *)s->ifnets;
+	case REC_T_PSI:		*n = PSI_MAX;		return (char *)s->psi;
+	case REC_T_NUMA:	*n = s->numa_nodes;	return (char *)s->numa;
+	case REC_T_FS:		*n = s->fses;		return (char *)s->fs;
+	case REC_T_IRQ:		*n = s->irq.rows;	return (char *)s->irq.row;
+	case REC_T_IRQ_CPU:	*n = s->irq.ncells;	return (char *)s->irq.cpu;
+	case REC_T_IRQ_COUNT:	*n = s->irq.ncells;	return (char *)s->irq.count;
+	case REC_T_SOFTIRQ:	*n = s->softirq.rows;	return (char *)s->softirq.row;
+	case REC_T_SOFTIRQ_CPU:	*n = s->softirq.ncells;	return (char *)s->softirq.cpu;
+	case REC_T_SOFTIRQ_COUNT: *n = s->softirq.ncells; return (char *)s->softirq.count;
+	case REC_T_CGROUP:	*n = s->cgroups;	return (char *)s->cg;
+	case REC_T_PROCS:	*n = s->nprocs;		return (char *)s->procs;
+#ifdef POWER
+	case REC_T_LPAR:	return (char *)&s->lpar;
+#endif /*POWER*/
+	}
+	*n = 0;
+	return NULL;
+}
+
+/* Reader side: make room for n elements of table t in s, returns how
+ * many fit.  The fixed arrays in struct data limit some of them.
+ */
+int rec_make(struct data *s, int t, int n, char **array)
+{
+int room = n;
+
+	switch(t) {
+	case REC_T_CPU:		room = CPUMAX;		break;
+	case REC_T_DISK:	room = diskmax;		break;
+	case REC_T_NET:		room = NETMAX;		break;
+	case REC_T_PSI:		room = PSI_MAX;		break;
+	case REC_T_NUMA:	room = NUMAMAX;		break;
+	case REC_T_FS:		room = JFSMAX;		break;
+	case REC_T_IRQ:		s->irq.row = MALLOC(sizeof(struct irq_row) * n + 1);	break;
+	case REC_T_IRQ_CPU:	s->irq.cpu = MALLOC(sizeof(int) * n + 1);		break;
+	case REC_T_IRQ_COUNT:	s->irq.count = MALLOC(sizeof(unsigned long long) * n + 1); break;
+	case REC_T_SOFTIRQ:	s->softirq.row = MALLOC(sizeof(struct irq_row) * n + 1); break;
+	case REC_T_SOFTIRQ_CPU:	s->softirq.cpu = MALLOC(sizeof(int) * n + 1);		break;
+	case REC_T_SOFTIRQ_COUNT: s->softirq.count = MALLOC(sizeof(unsigned long long) * n + 1); break;
+	case REC_T_CGROUP:	s->cg = MALLOC(sizeof(struct cg_sample) * n + 1);	break;
+	case REC_T_PROCS:	s->procs = MALLOC(sizeof(struct procsinfo) * n + 1);	break;
+	default:		room = 1;		break;
+	}
+	if(n < room)
+		room = n;
+	switch(t) {
+	case REC_T_DISK:	s->disks = room;	break;
+	case REC_T_NET:		s->networks = room;	break;
+	case REC_T_NUMA:	s->numa_nodes = room;	break;
+	case REC_T_FS:		s->fses = room;		break;
+	case REC_T_IRQ:		s->irq.rows = s->irq.maxrows = room;	break;
+	case REC_T_IRQ_CPU:	s->irq.ncells = s->irq.maxcells = room;	break;
+	case REC_T_SOFTIRQ:	s->softirq.rows = s->softirq.maxrows = room;	break;
+	case REC_T_SOFTIRQ_CPU:	s->softirq.ncells = s->softirq.maxcells = room;	break;
+	case REC_T_CGROUP:	s->cgroups = s->cg_size = room;	break;
+	case REC_T_PROCS:	s->nprocs = room;	break;
+	}
+	*array = rec_array(s, t, &n);
+	return room;
+}
+
+struct rec_buf {
+	unsigned char *data;
+	long	len;
+	long	size;
+};
+
+void rec_need(struct rec_buf *b, long n)
+{
+	if(b->len + n > b->size) {
+		b->size = (b->len + n) * 2;
+		b->data = REALLOC(b->data, b->size);
+	}
+}
+
+void rec_byte(struct rec_buf *b, int c)
+{
+	rec_need(b, 1);
+	b->data[b->len++] = c;
+}
+
+void rec_varint(struct rec_buf *b, unsigned long long v)
+{
+	rec_need(b, 10);
+	while(v > 0x7f) {
+		b->data[b->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b->data[b->len++] = v;
+}
+
+void rec_zigzag(struct rec_buf *b, long long v)
+{
+	rec_varint(b, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+
+void rec_string(struct rec_buf *b, char *s, int max)
+{
+int len = strnlen(s, max);
+
+	rec_varint(b, len);
+	rec_need(b, len);
+	memcpy(&b->data[b->len], s, len);
+	b->len += len;
+}
+
+/* Deflate len bytes at in onto the end of out and flush them, less the
+ * empty block the flush ends with
+ */
+void rec_deflate(z_stream *z, struct rec_buf *out, unsigned char *in, long len)
+{
+	z->next_in = in;
+	z->avail_in = len;
+	do {
+		rec_need(out, len / 2 + 64);
+		z->next_out = &out->data[out->len];
+		z->avail_out = out->size - out->len;
+		deflate(z, Z_SYNC_FLUSH);
+		out->len = out->size - z->avail_out;
+	} while(z->avail_out == 0);
+	out->len -= 4;	/* 00 00 ff ff */
+}
+
+/* and back again, returns 0 if it is damaged */
+int rec_undeflate(z_stream *z, struct rec_buf *out, unsigned char *in, long len)
+{
+static unsigned char flush[4] = { 0, 0, 0xff, 0xff };
+int ret = Z_OK;
+int i;
+
+	for(i = 0; i < 2; i++) {
+		z->next_in = i ? flush : in;
+		z->avail_in = i ? 4 : len;
+		while(z->avail_in > 0 || z->avail_out == 0) {
+			rec_need(out, len * 4 + 1024);
+			z->next_out = &out->data[out->len];
+			z->avail_out = out->size - out->len;
+			ret = inflate(z, Z_SYNC_FLUSH);
+			out->len = out->size - z->avail_out;
+			if(ret != Z_OK)
+				break;
+		}
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+			return 0;
+	}
+	return 1;
+}
+
+/* Reading never goes past the end, it just sets bad */
+struct rec_in {
+	unsigned char *data;
+	long	len;
+	long	pos;
+	int	bad;
+};
+
+int rec_get_byte(struct rec_in *r)
+{
+	if(r->pos >= r->len) {
+		r->bad = 1;
+		return 0;
+	}
+	return r->data[r->pos++];
+}
+
+unsigned long long rec_get_varint(struct rec_in *r)
+{
+unsigned long long v = 0;
+int shift = 0;
+int c;
+
+	do {
+		c = rec_get_byte(r);
+		if(shift < 64)
+			v |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while((c & 0x80) && !r->bad);
+	return v;
+}
+
+long long rec_get_zigzag(struct rec_in *r)
+{
+unsigned long long z = rec_get_varint(r);
+
+	return (long long)(z >> 1) ^ -(long long)(z & 1);
+}
+
+/* Returns a pointer into the file and the length, the string is not terminated */
+char *rec_get_string(struct rec_in *r, int *len)
+{
+char *s;
+
+	*len = rec_get_varint(r);
+	if(*len < 0 || r->pos + *len > r->len) {
+		r->bad = 1;
+		*len = 0;
+		return "";
+	}
+	s = (char *)&r->data[r->pos];
+	r->pos += *len;
+	return s;
+}
+
+char *rec_get_strdup(struct rec_in *r)
+{
+char *s;
+char *d;
+int len;
+
+	s = rec_get_string(r, &len);
+	d = MALLOC(len + 1);
+	memcpy(d, s, len);
+	d[len] = 0;
+	return d;
+}
+
+/* Integers of any size widen to 64 bits with the sign, so a small
+ * negative change stays small.  Floats go by their bits.
+ */
+long long rec_load(char *at, int size)
+{
+	switch(size) {
+	case 1: return *(signed char *)at;
+	case 2: return *(short *)at;
+	case 4: return *(int *)at;
+	}
+	return *(long long *)at;
+}
+
+void rec_store(char *at, int size, long long v)
+{
+	switch(size) {
+	case 1: *(signed char *)at = v;	break;
+	case 2: *(short *)at = v;	break;
+	case 4: *(int *)at = v;		break;
+	default: *(long long *)at = v;	break;
+	}
+}
+
+unsigned long long rec_bits(char *at, int size)
+{
+unsigned int i;
+unsigned long long l;
+
+	if(size == 4) {
+		memcpy(&i, at, 4);
+		return i;
+	}
+	memcpy(&l, at, 8);
+	return l;
+}
+
+/* The element of the last frame to code element e against, or NULL */
+char *rec_base(struct rec_table *tb, char *old, int on, int i, int *j, char *e)
+{
+struct rec_col *k;
+long long key;
+
+	if(old == NULL)
+		return NULL;
+	if(tb->key < 0)
+		return i < on ? old + (long)i * tb->size : NULL;
+	/* keyed tables like the processes come in key order, so walk along */
+	k = &tb->col[tb->key];
+	key = rec_load(e + k->offset, k->size);
+	while(*j < on && rec_load(old + (long)*j * tb->size + k->offset, k->size) < key)
+		(*j)++;
+	if(*j < on && rec_load(old + (long)*j * tb->size + k->offset, k->size) == key)
+		return old + (long)*j * tb->size;
+	return NULL;
+}
+
+int rec_same(struct rec_col *c, char *v, char *b)
+{
+	switch(c->kind) {
+	case REC_INT:
+		return rec_load(v, c->size) == (b ? rec_load(b, c->size) : 0);
+	case REC_FLOAT:
+		return rec_bits(v, c->size) == (b ? rec_bits(b, c->size) : 0);
+	case REC_STRING:
+		return strncmp(v, b ? b : "", c->size) == 0;
+	case REC_POINTER:
+		return strcmp(*(char **)v ? *(char **)v : "", b && *(char **)b ? *(char **)b : "") == 0;
+	}
+	return 1;
+}
+
+void rec_value(struct rec_buf *out, struct rec_col *c, char *v, char *b)
+{
+	switch(c->kind) {
+	case REC_INT:
+		rec_zigzag(out, (long long)((unsigned long long)rec_load(v, c->size) - (b ? rec_load(b, c->size) : 0)));
+		break;
+	case REC_FLOAT:
+		rec_varint(out, rec_bits(v, c->size) ^ (b ? rec_bits(b, c->size) : 0));
+		break;
+	case REC_STRING:
+		rec_string(out, v, c->size);
+		break;
+	case REC_POINTER:
+		rec_string(out, *(char **)v ? *(char **)v : "", INT_MAX);
+		break;
+	}
+}
+
+void rec_put_table(struct rec_buf *out, int t, struct data *s, struct data *prev)
+{
+struct rec_table *tb = &rec_table[t];
+struct rec_col *c;
+char *cur;
+char *old = NULL;
+char *e;
+char *b;
+long long key = 0;
+long zeros = 0;
+int n;
+int on = 0;
+int i;
+int j = 0;
+int k;
+int m;
+
+	cur = rec_array(s, t, &n);
+	if(prev != NULL)
+		old = rec_array(prev, t, &on);
+	rec_varint(out, n);
+	if(tb->key >= 0) {
+		c = &tb->col[tb->key];
+		for(i = 0; i < n; i++) {
+			rec_zigzag(out, rec_load(cur + (long)i * tb->size + c->offset, c->size) - key);
+			key = rec_load(cur + (long)i * tb->size + c->offset, c->size);
+		}
+	}
+	for(i = 0; i < n; i++) {
+		e = cur + (long)i * tb->size;
+		b = rec_base(tb, old, on, i, &j, e);
+		for(k = 0; k < tb->cols; k++) {
+			if(k == tb->key)
+				continue;
+			c = &tb->col[k];
+			for(m = 0; m < c->count; m++) {
+				if(rec_same(c, e + c->offset + m * c->size, b ? b + c->offset + m * c->size : NULL)) {
+					zeros++;
+				} else {
+					rec_varint(out, zeros);
+					zeros = 0;
+					rec_value(out, c, e + c->offset + m * c->size, b ? b + c->offset + m * c->size : NULL);
+				}
+			}
+		}
+	}
+	if(zeros)
+		rec_varint(out, zeros);
+}
+
+FILE	*rec_fp = NULL;		/* -B output */
+char	*rec_text = NULL;	/* the CSV header lines, kept for --to-nmon */
+size_t	rec_text_len = 0;
+struct rec_buf rec_out;
+struct rec_buf rec_raw;		/* a frame before it is deflated */
+z_stream rec_zout;
+long long rec_offset = 0;	/* of the next frame in the file */
+long	rec_frames = 0;
+
+struct rec_index {
+	long	loop;
+	long long time;		/* milliseconds */
+	long long offset;
+	int	key;
+} *rec_idx = NULL;
+long	rec_idx_size = 0;
+
+/* Index an interval, offset is of its frame or of its ZZZZ line */
+void rec_idx_add(long loop, long long time, long long offset, int key)
+{
+	if(rec_frames == rec_idx_size) {
+		rec_idx_size = rec_idx_size ? rec_idx_size * 2 : 1024;
+		rec_idx = REALLOC(rec_idx, sizeof(struct rec_index) * rec_idx_size);
+	}
+	rec_idx[rec_frames].loop = loop;
+	rec_idx[rec_frames].time = time;	/* ms */
+	rec_idx[rec_frames].offset = offset;
+	rec_idx[rec_frames].key = key;
+	rec_frames++;
+}
+
+/* The first entry at or after snapshot to - 1 (to > 0) or time -to ms,
+ * the last one if there is none
+ */
+long rec_idx_find(long long to)
+{
+long lo = 0;
+long hi = rec_frames - 1;
+long mid;
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(to > 0 ? rec_idx[mid].loop < to - 1 : rec_idx[mid].time < -to)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* <file>.idx is "ELMONIX1" then per interval four little endian u64s:
+ * loop, time in ms, offset and 1 for a key frame.  A -j file also gets
+ * an entry for the end of each gzip member: -1, its offset in the file,
+ * its offset in the text and REC_IDX_MEMBER.  It is only added to once
+ * the output is on disk (unless -W 0), so after a crash or a power cut
+ * every entry in it points at something that is there.
+ */
+#define REC_IDX_MEMBER	2
+
+FILE	*idx_fp = NULL;
+char	idx_name[1024];
+long	idx_synced = 0;		/* rec_idx entries in the .idx */
+long long idx_zend = -1;	/* the gzip member that just ended, in the file */
+long long idx_uend = 0;		/* and in the text */
+
+void idx_open(char *name)
+{
+	snprintf(idx_name, sizeof(idx_name), "%s.idx", name);
+	if((idx_fp = fopen(idx_name, "w")) == NULL)
+		return;		/* only costs a slower start to playback */
+	fwrite(REC_IDXFILE, 1, 8, idx_fp);
+	idx_synced = 0;
+}
+
+/* Sync the output fd (-1 for no syncing) and then add the new entries */
+void idx_checkpoint(int fd)
+{
+unsigned char e[32];
+long long v[4];
+long i;
+int k;
+
+	if(fd >= 0)
+		fdatasync(fd);
+	if(idx_fp == NULL || (idx_synced == rec_frames && idx_zend < 0))
+		return;
+	for(i = idx_synced; i <= rec_frames; i++) {
+		if(i < rec_frames) {
+			v[0] = rec_idx[i].loop;
+			v[1] = rec_idx[i].time;
+			v[2] = rec_idx[i].offset;
+			v[3] = rec_idx[i].key;
+		} else if(idx_zend >= 0) {
+			v[0] = -1;
+			v[1] = idx_zend;
+			v[2] = idx_uend;
+			v[3] = REC_IDX_MEMBER;
+			idx_zend = -1;
+		} else
+			break;
+		for(k = 0; k < 32; k++)
+			e[k] = v[k / 8] >> (k % 8 * 8);
+		fwrite(e, 1, 32, idx_fp);
+	}
+	fflush(idx_fp);
+	if(fd >= 0)
+		fdatasync(fileno(idx_fp));
+	idx_synced = rec_frames;
+}
+
+void idx_close(int fd)
+{
+	if(idx_fp == NULL)
+		return;
+	idx_checkpoint(fd);
+	fclose(idx_fp);
+	idx_fp = NULL;
+}
+
+/* name.idx ready for idx_get(), or NULL if there is none */
+FILE *idx_fopen(char *name)
+{
+char buf[1024];
+FILE *f;
+
+	snprintf(buf, sizeof(buf), "%s.idx", name);
+	if((f = fopen(buf, "r")) == NULL)
+		return NULL;
+	if(fread(buf, 1, 8, f) != 8 || memcmp(buf, REC_IDXFILE, 8) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* The next entry into v[4], returns 0 at the end */
+int idx_get(FILE *f, long long *v)
+{
+unsigned char e[32];
+int k;
+
+	if(fread(e, 1, 32, f) != 32)
+		return 0;
+	memset(v, 0, sizeof(long long) * 4);
+	for(k = 0; k < 32; k++)
+		v[k / 8] |= (unsigned long long)e[k] << (k % 8 * 8);
+	return 1;
+}
+
+/* Load the entries of name.idx that point inside a file of len bytes */
+void idx_read(char *name, long long len)
+{
+long long v[4];
+FILE *f;
+
+	if((f = idx_fopen(name)) == NULL)
+		return;
+	while(idx_get(f, v)) {
+		if(v[3] == REC_IDX_MEMBER)
+			continue;	/* for rec_inflate() */
+		if(v[2] + 5 > len)
+			break;
+		rec_idx_add(v[0], v[1], v[2], v[3]);
+	}
+	fclose(f);
+}
+
+/* -f output.  The main thread prints a snapshot into a memory stream and
+ * hands the buffer to the writer thread, so a slow or stalled disk holds
+ * up neither the sampling nor the screen.  The writer takes whatever is
+ * queued in one writev() and syncs the file every out_sync snapshots.
+ * If the disk stays stuck until the queue is full, snapshots are dropped
+ * rather than the main thread waiting; the ELMON lines count them.
+ *
+ * With -j the file is gzip.  Every write is flushed, so what is in the
+ * file always decompresses, and each sync (every REC_CHECKPOINT snapshots
+ * with -W 0) ends a gzip member, so every block of snapshots decompresses
+ * on its own.  The .idx keeps offsets into the uncompressed text, and
+ * where each member ends so -P only inflates the members it plays, and
+ * is only added to once their member is complete.
+ *
+ * -L starts the next file, <name>_1, <name>_2 ... (before the extension),
+ * when the current one has grown to out_rotate_size or a snapshot is in
+ * a new hour or day.  Each file starts with the header lines, including
+ * those the sections print the first time they have something.
+ */
+#define OUT_QUEUE	64
+#define OUT_HOUR	1	/* -L hour */
+#define OUT_DAY		2	/* -L day */
+
+struct out_buf {
+	char	*data;
+	size_t	len;
+	long	loop;
+	long long time;		/* ms */
+	long	zzzz;		/* offset of its ZZZZ line in data, -1 if none */
+};
+
+struct out_buf *out_queue[OUT_QUEUE];
+unsigned long out_head = 0;	/* next slot the main thread fills */
+unsigned long out_tail = 0;	/* next slot the writer takes */
+struct out_buf *out_cur = NULL;	/* the one fp prints into */
+FILE	*out_file = NULL;	/* the real output file */
+int	out_notify[2] = { -1, -1 };	/* pipe to wake up the writer */
+int	out_running = 0;
+int	out_done = 0;		/* nothing more is coming */
+int	out_sync = REC_CHECKPOINT;	/* -W: fdatasync every n snapshots, 0 = never */
+long	out_depth_max = 0;
+long	out_dropped = 0;	/* snapshots lost to a full queue or a failed write */
+long long out_written = 0;	/* bytes */
+long	out_slowest = 0;	/* longest write and sync, microseconds */
+pthread_t writer_thread;
+
+/* The rest is the writer's once it is running */
+int	out_gzip = 0;		/* -j */
+z_stream out_z;
+unsigned char *out_zbuf = NULL;
+size_t	out_zsize = 0;
+long long out_rotate_size = 0;	/* -L <size>M, in bytes */
+int	out_rotate_period = 0;	/* -L hour or day */
+char	out_name[1024];		/* of the first file */
+int	out_files = 0;		/* started after it */
+long long out_offset = 0;	/* of the next byte of text in this file */
+long long out_file_bytes = 0;	/* written to this file */
+int	out_zbroken = 0;	/* a write to this -j file failed part way */
+long	out_file_snaps = 0;
+long	out_file_key = 0;	/* hour or day of its last snapshot */
+int	out_unsynced = 0;	/* snapshots */
+char	*out_header = NULL;	/* the header lines for the next file */
+size_t	out_header_len = 0;
+size_t	out_header_size = 0;
+size_t	out_header_skip = 0;	/* the first buffer starts with the header */
+
+struct out_buf *out_new()
+{
+struct out_buf *b;
+
+	b = MALLOC(sizeof(struct out_buf));
+	memset(b, 0, sizeof(struct out_buf));
+	b->zzzz = -1;
+	if((fp = open_memstream(&b->data, &b->len)) == NULL) {
+		perror("elmon: failed to buffer the output");
+		exit(42);
+	}
+	return b;
+}
+
+void out_free(struct out_buf *b)
+{
+	free(b->data);	/* from open_memstream */
+	FREE(b);
+}
+
+/* Writer side, returns NULL if the queue is empty */
+struct out_buf *out_pop()
+{
+unsigned long tail = __atomic_load_n(&out_tail, __ATOMIC_RELAXED);
+struct out_buf *b;
+
+	if(tail == __atomic_load_n(&out_head, __ATOMIC_ACQUIRE))
+		return NULL;
+	b = out_queue[tail % OUT_QUEUE];
+	__atomic_store_n(&out_tail, tail + 1, __ATOMIC_RELEASE);
+	return b;
+}
+
+/* Main thread side, wait says whether a full queue is waited on or drops it */
+void out_push(struct out_buf *b, int wait)
+{
+unsigned long head = __atomic_load_n(&out_head, __ATOMIC_RELAXED);
+long depth;
+
+	while((depth = head - __atomic_load_n(&out_tail, __ATOMIC_ACQUIRE)) == OUT_QUEUE) {
+		if(!wait) {
+			out_free(b);
+			__atomic_add_fetch(&out_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		usleep(10000);
+	}
+	out_queue[head % OUT_QUEUE] = b;
+	__atomic_store_n(&out_head, head + 1, __ATOMIC_RELEASE);
+	if(depth + 1 > out_depth_max)
+		out_depth_max = depth + 1;
+	if(write(out_notify[1], "w", 1) != 1)
+		/* pipe full, the writer has a wake up waiting anyway */ ;
+}
+
+/* All of iov to out_file, returns -1 if it failed */
+int out_writev(struct iovec *iov, int n)
+{
+ssize_t done;
+
+	while(n > 0) {
+		if((done = writev(fileno(out_file), iov, n)) < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		while(n > 0 && done >= (ssize_t)iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n > 0) {
+			iov->iov_base = (char *)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+/* Compress iov into out_zbuf and flush, returns the length there */
+size_t out_deflate(struct iovec *iov, int n, int flush)
+{
+size_t len = 0;
+int i;
+
+	for(i = 0; i <= n; i++) {
+		if(i < n) {
+			out_z.next_in = (Bytef *)iov[i].iov_base;
+			out_z.avail_in = iov[i].iov_len;
+		}
+		do {
+			if(out_zsize - len < 65536) {
+				out_zsize = out_zsize * 2 + 65536;
+				out_zbuf = REALLOC(out_zbuf, out_zsize);
+			}
+			out_z.next_out = out_zbuf + len;
+			out_z.avail_out = out_zsize - len;
+			deflate(&out_z, i < n ? Z_NO_FLUSH : flush);
+			len = out_zsize - out_z.avail_out;
+		} while(out_z.avail_out == 0);
+	}
+	return len;
+}
+
+/* Text into the current file, compressed with -j.  Returns -1 if it failed */
+int out_put(struct iovec *iov, int n, int flush)
+{
+struct iovec z;
+long long len = 0;
+int i;
+
+	if(out_gzip) {
+		z.iov_len = out_deflate(iov, n, flush);
+		z.iov_base = out_zbuf;
+		iov = &z;
+		n = 1;
+	}
+	for(i = 0; i < n; i++)
+		len += iov[i].iov_len;
+	if(out_writev(iov, n) == -1)
+		return -1;
+	out_file_bytes += len;
+	__atomic_add_fetch(&out_written, len, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Finish the gzip member, what comes next starts a new one.  The .idx
+ * gets where it ends unless a failed write has left the offsets unknown.
+ */
+void out_member_end()
+{
+	if(!out_gzip || out_z.total_in == 0)
+		return;
+	if(out_put(NULL, 0, Z_FINISH) == -1)
+		out_zbroken = 1;
+	else if(!out_zbroken) {
+		idx_zend = out_file_bytes;
+		idx_uend = out_offset;
+	}
+	deflateReset(&out_z);
+}
+
+/* Write n buffers to the current file and index their ZZZZ lines */
+void out_batch(struct out_buf **b, int n)
+{
+struct iovec iov[OUT_QUEUE];
+long long len;
+int i;
+
+	if(n == 0)
+		return;
+	for(len = 0, i = 0; i < n; i++) {
+		if(b[i]->zzzz >= 0 && idx_fp != NULL)
+			rec_idx_add(b[i]->loop, b[i]->time, out_offset + len + b[i]->zzzz, 1);
+		iov[i].iov_base = b[i]->data;
+		iov[i].iov_len = b[i]->len;
+		len += b[i]->len;
+		if(b[i]->loop > 0)
+			out_unsynced++;
+	}
+	if(out_put(iov, n, Z_SYNC_FLUSH) == -1) {
+		__atomic_add_fetch(&out_dropped, n, __ATOMIC_RELAXED);
+		if(idx_fp != NULL)
+			rec_frames = idx_synced;	/* no telling what got there */
+		if(out_gzip) {
+			deflateReset(&out_z);	/* readers stop at the broken member */
+			out_zbroken = 1;
+		}
+		else
+			out_offset = lseek(fileno(out_file), 0, SEEK_CUR);
+	} else
+		out_offset += len;
+	if(out_unsynced >= (out_sync > 0 ? out_sync : REC_CHECKPOINT)) {
+		out_member_end();
+		idx_checkpoint(out_sync > 0 ? fileno(out_file) : -1);
+		out_unsynced = 0;
+	}
+}
+
+/* Whether line s (up to the newline at end) is already in the header */
+int out_in_header(char *s, char *end)
+{
+char *h = out_header;
+char *hend = out_header + out_header_len;
+size_t len = end - s + 1;
+
+	while(h != NULL && h + len <= hend) {
+		if(memcmp(h, s, len) == 0)
+			return 1;
+		if((h = memchr(h, '\n', hend - h)) != NULL)
+			h++;
+	}
+	return 0;
+}
+
+/* Add the header lines of b the next file does not have yet.  Data lines
+ * have the snapshot tag in the second field or, for TOP, the third.
+ */
+void out_headings(struct out_buf *b)
+{
+char *s = b->data + out_header_skip;
+char *end = b->data + b->len;
+char *nl;
+char *f;
+
+	out_header_skip = 0;
+	for( ; s < end; s = nl + 1) {
+		if((nl = memchr(s, '\n', end - s)) == NULL)
+			break;
+		if((f = memchr(s, ',', nl - s)) == NULL)
+			continue;
+		if(f[1] == 'T' && isdigit(f[2]))
+			continue;
+		if((f = memchr(f + 1, ',', nl - f - 1)) != NULL && f[1] == 'T' && isdigit(f[2]))
+			continue;
+		if(out_in_header(s, nl))
+			continue;
+		if(out_header_len + (nl - s + 1) > out_header_size) {
+			out_header_size = (out_header_len + (nl - s + 1)) * 2;
+			out_header = REALLOC(out_header, out_header_size);
+		}
+		memcpy(out_header + out_header_len, s, nl - s + 1);
+		out_header_len += nl - s + 1;
+	}
+}
+
+/* Whether b is the first snapshot of a new file, called on each in turn */
+int out_rotate_due(struct out_buf *b)
+{
+struct tm tm;
+time_t t;
+long key = 0;
+int due;
+
+	if(b->loop <= 0)	/* the lines after the last snapshot */
+		return 0;
+	if(out_rotate_period) {
+		t = b->time / 1000;
+		localtime_r(&t, &tm);
+		key = (tm.tm_year * 366L + tm.tm_yday) * 24 + (out_rotate_period == OUT_HOUR ? tm.tm_hour : 0);
+	}
+	due = out_file_snaps > 0 && (key != out_file_key
+		|| (out_rotate_size > 0 && out_file_bytes >= out_rotate_size));
+	out_file_key = key;
+	out_file_snaps = due ? 1 : out_file_snaps + 1;
+	return due;
+}
+
+/* Close this file and carry on in the next one, unless it can't be opened */
+void out_rotate()
+{
+struct iovec iov;
+char name[1100];
+char *base;
+char *ext;
+int indexed = (idx_fp != NULL);
+FILE *f;
+
+	if((base = strrchr(out_name, '/')) == NULL)
+		base = out_name;
+	if((ext = strchr(base + 1, '.')) == NULL)
+		ext = base + strlen(base);
+	snprintf(name, sizeof(name), "%.*s_%d%s", (int)(ext - out_name), out_name, out_files + 1, ext);
+	if((f = fopen(name, "w")) == NULL)
+		return;
+	out_member_end();
+	idx_close(out_sync > 0 ? fileno(out_file) : -1);
+	fclose(out_file);
+	out_file = f;
+	out_files++;
+	out_offset = 0;
+	out_file_bytes = 0;
+	out_zbroken = 0;
+	out_unsynced = 0;
+	if(indexed) {
+		rec_frames = 0;
+		idx_open(name);
+	}
+	iov.iov_base = out_header;
+	iov.iov_len = out_header_len;
+	if(out_put(&iov, 1, Z_NO_FLUSH) == 0)
+		out_offset = out_header_len;
+}
+
+/* The writer thread, which also keeps the .idx of a -f file */
+void *writer(void *arg)
+{
+struct out_buf *b[OUT_QUEUE];
+struct pollfd pfd;
+struct timespec start;
+struct timespec end;
+long took;
+char buf[64];
+int rotate = (out_rotate_size > 0 || out_rotate_period);
+int finish;
+int n;
+int i;
+int k;
+
+	pfd.fd = out_notify[0];
+	pfd.events = POLLIN;
+	for(;;) {
+		finish = __atomic_load_n(&out_done, __ATOMIC_ACQUIRE);
+		for(n = 0; n < OUT_QUEUE && (b[n] = out_pop()) != NULL; n++)
+			;
+		if(n == 0) {
+			if(finish)
+				break;
+			poll(&pfd, 1, -1);
+			while(read(out_notify[0], buf, sizeof(buf)) == sizeof(buf))
+				;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(k = 0, i = 0; rotate && i < n; i++) {
+			if(out_rotate_due(b[i])) {
+				out_batch(&b[k], i - k);
+				out_rotate();
+				k = i;
+			}
+			if(enc == &encoders[ENC_CSV])
+				out_headings(b[i]);
+		}
+		out_batch(&b[k], n - k);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		took = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+		if(took > __atomic_load_n(&out_slowest, __ATOMIC_RELAXED))
+			__atomic_store_n(&out_slowest, took, __ATOMIC_RELAXED);
+		for(i = 0; i < n; i++)
+			out_free(b[i]);
+	}
+	out_member_end();
+	idx_close(out_sync > 0 ? fileno(out_file) : -1);
+	return NULL;
+}
+
+/* Hand over the last lines and wait for the writer to finish the file */
+void out_close()
+{
+	if(out_cur == NULL)
+		return;
+	fclose(fp);
+	fp = NULL;
+	if(out_running) {
+		out_push(out_cur, 1);
+		__atomic_store_n(&out_done, 1, __ATOMIC_RELEASE);
+		if(write(out_notify[1], "w", 1) != 1)
+			;
+		pthread_join(writer_thread, NULL);
+	} else {	/* gone before it started, the header is all there is */
+		out_batch(&out_cur, 1);
+		out_member_end();
+		idx_close(out_sync > 0 ? fileno(out_file) : -1);
+		out_free(out_cur);
+	}
+	out_cur = NULL;
+	fclose(out_file);
+}
+
+/* Send what the main thread prints to f, called name, through the writer */
+void out_open(FILE *f, char *name)
+{
+	out_file = f;
+	snprintf(out_name, sizeof(out_name), "%s", name);
+	if(out_gzip && deflateInit2(&out_z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fprintf(stderr, "elmon: failed to start compressing the output\n");
+		exit(42);
+	}
+	out_cur = out_new();
+	atexit(out_close);
+}
+
+/* -Q: push every snapshot to Graphite or StatsD instead of writing a
+ * file.  The lines go through the -f queue as they would to the file,
+ * with the shipper thread in the writer's place.  Over UDP they are
+ * packed into datagrams of up to PUSH_MTU bytes, over TCP the socket is
+ * non-blocking and written as far as it takes.  While the sink is down,
+ * or a TCP one is PUSH_BACKLOG behind, the snapshots go on the end of
+ * the spool file, up to PUSH_SPOOL bytes and dropped after that.  Once
+ * the sink is back the spool goes before anything newer, over UDP a
+ * chunk every 100 ms so the sink is not flooded.  The spool is also kept
+ * for the next run; StatsD has no times, so what comes from there counts
+ * as the time it arrives.
+ */
+#define PUSH_MTU	1432		/* a UDP payload not fragmented on most networks */
+#define PUSH_BACKLOG	(1024 * 1024)	/* bytes held for a slow TCP sink */
+#define PUSH_SPOOL	(64LL * 1024 * 1024)
+#define PUSH_CHUNK	(64 * 1024)	/* read back from the spool at a time */
+#define PUSH_RETRY	5		/* seconds between connects */
+#define PUSH_TIMEOUT	10		/* seconds a connect may take */
+#define PUSH_DOWN	0
+#define PUSH_CONNECTING	1
+#define PUSH_UP		2
+
+char	*push_to = NULL;	/* -Q */
+int	push_tcp = 0;
+struct sockaddr_in push_addr;
+long long push_spooled = 0;	/* bytes waiting in the spool, for the ELMON lines */
+
+/* The rest is the shipper's once it is running */
+int	push_fd = -1;
+int	push_state = PUSH_DOWN;
+time_t	push_tried = 0;		/* last connect */
+char	*push_buf = NULL;	/* sent from push_done to push_len */
+size_t	push_done = 0;
+size_t	push_len = 0;
+size_t	push_size = 0;
+int	push_from_spool = 0;	/* push_buf was read from the spool */
+int	push_spool = -1;
+long long push_spool_read = 0;	/* next byte to send */
+long long push_spool_len = 0;
+
+/* len bytes on the end of the spool, returns -1 if there is no room */
+int push_spool_add(char *data, size_t len)
+{
+size_t done = 0;
+ssize_t n;
+
+	if(push_spool_len + (long long)len > PUSH_SPOOL)
+		return -1;
+	while(done < len) {
+		if((n = pwrite(push_spool, data + done, len - done, push_spool_len + done)) < 0) {
+			if(errno == EINTR)
+				continue;
+			if(ftruncate(push_spool, push_spool_len) == -1)
+				/* the next one writes over it */ ;
+			return -1;
+		}
+		done += n;
+	}
+	push_spool_len += len;
+	return 0;
+}
+
+/* The sink is gone, what it did not get waits in the spool */
+void push_down()
+{
+	if(push_fd >= 0)
+		close(push_fd);
+	push_fd = -1;
+	push_state = PUSH_DOWN;
+	while(push_done > 0 && push_buf[push_done - 1] != '\n')	/* a line cut short goes again */
+		push_done--;
+	if(push_from_spool)
+		push_spool_read -= push_len - push_done;
+	else if(push_done < push_len && push_spool_add(push_buf + push_done, push_len - push_done) < 0)
+		__atomic_add_fetch(&out_dropped, 1, __ATOMIC_RELAXED);
+	push_done = push_len = 0;
+	push_from_spool = 0;
+}
+
+/* Straight on to the sink if it is keeping up, else after the spool */
+void push_add(char *data, size_t len)
+{
+	if(push_state == PUSH_UP && push_spool_len == 0 && !push_from_spool
+	&& push_len - push_done + len <= PUSH_BACKLOG) {
+		if(push_done > 0) {
+			memmove(push_buf, push_buf + push_done, push_len - push_done);
+			push_len -= push_done;
+			push_done = 0;
+		}
+		if(push_len + len > push_size) {
+			push_size = (push_len + len) * 2;
+			push_buf = REALLOC(push_buf, push_size);
+		}
+		memcpy(push_buf + push_len, data, len);
+		push_len += len;
+		return;
+	}
+	if(!push_from_spool && push_done < push_len
+	&& push_spool_add(push_buf + push_done, push_len - push_done) == 0)
+		push_done = push_len = 0;	/* the spool has it in order */
+	if(push_spool_add(data, len) < 0)
+		__atomic_add_fetch(&out_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* The next whole lines from the spool into push_buf, returns 0 if none */
+int push_fill()
+{
+ssize_t n;
+size_t len;
+
+	push_done = push_len = 0;
+	if(push_from_spool && push_spool_read == push_spool_len) {	/* all sent */
+		if(ftruncate(push_spool, 0) == -1)
+			/* then it is written over */ ;
+		push_spool_read = push_spool_len = 0;
+	}
+	push_from_spool = 0;
+	if(push_spool_read == push_spool_len)
+		return 0;
+	if(push_size < PUSH_CHUNK) {
+		push_size = PUSH_CHUNK;
+		push_buf = REALLOC(push_buf, push_size);
+	}
+	len = push_spool_len - push_spool_read < PUSH_CHUNK ? push_spool_len - push_spool_read : PUSH_CHUNK;
+	if((n = pread(push_spool, push_buf, len, push_spool_read)) <= 0) {
+		if(ftruncate(push_spool, 0) == -1)	/* cannot be read, start again */
+			;
+		push_spool_read = push_spool_len = 0;
+		return 0;
+	}
+	for(len = n; len > 0 && push_buf[len - 1] != '\n'; len--)
+		;
+	push_len = len ? len : n;	/* all of it for a line longer than a chunk */
+	push_spool_read += push_len;
+	push_from_spool = 1;
+	return 1;
+}
+
+/* Some of push_buf to the sink, returns 1 if it went, 0 if the socket
+ * is full and -1 if the sink is gone
+ */
+int push_send()
+{
+size_t end = push_len;
+char *nl;
+ssize_t n;
+
+	if(!push_tcp)	/* whole lines, as many as fit in a datagram */
+		for(end = push_done; end < push_len; end = nl - push_buf + 1) {
+			if((nl = memchr(push_buf + end, '\n', push_len - end)) == NULL)
+				nl = push_buf + push_len - 1;
+			if(nl - push_buf + 1 - push_done > PUSH_MTU && end > push_done)
+				break;
+		}
+	if((n = send(push_fd, push_buf + push_done, end - push_done, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+		if(errno == EINTR)
+			return 1;
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+			return 0;
+		return -1;
+	}
+	push_done += push_tcp ? (size_t)n : end - push_done;
+	__atomic_add_fetch(&out_written, n, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* Start connecting every PUSH_RETRY seconds and see if it has finished */
+void push_connect()
+{
+struct pollfd pfd;
+socklen_t len = sizeof(int);
+int err = 0;
+
+	if(push_state == PUSH_CONNECTING) {
+		pfd.fd = push_fd;
+		pfd.events = POLLOUT;
+		if(poll(&pfd, 1, 0) == 0) {
+			if(time(0) - push_tried > PUSH_TIMEOUT)
+				push_down();
+		} else if(getsockopt(push_fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0)
+			push_down();
+		else
+			push_state = PUSH_UP;
+		return;
+	}
+	if(time(0) - push_tried < PUSH_RETRY)
+		return;
+	push_tried = time(0);
+	if((push_fd = socket(AF_INET, (push_tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+		return;
+	if(connect(push_fd, (struct sockaddr *)&push_addr, sizeof(push_addr)) == 0)
+		push_state = PUSH_UP;
+	else if(errno == EINPROGRESS)
+		push_state = PUSH_CONNECTING;
+	else
+		push_down();
+}
+
+/* Send what can go now */
+void push_flush()
+{
+int spooled = 0;
+ssize_t n;
+char c;
+
+	if(push_state != PUSH_UP)
+		push_connect();
+	if(push_state != PUSH_UP)
+		return;
+	/* a TCP sink that closed, or the ICMP a UDP one sent back, shows
+	 * up here rather than as the next send losing its lines
+	 */
+	if(((n = recv(push_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT)) == 0 && push_tcp)
+	|| (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		push_down();
+		return;
+	}
+	for(;;) {
+		if(push_done == push_len) {
+			if(spooled && !push_tcp)
+				return;
+			if(!push_fill())
+				return;
+			spooled = 1;
+		}
+		if((n = push_send()) < 0) {
+			push_down();
+			return;
+		}
+		if(n == 0)
+			return;
+	}
+}
+
+/* Only what was not sent stays in the spool for the next run */
+void push_keep()
+{
+char buf[PUSH_CHUNK];
+long long to = 0;
+ssize_t n;
+
+	if(push_spool_read == 0)
+		return;
+	while(push_spool_read < push_spool_len
+	&& (n = pread(push_spool, buf, sizeof(buf), push_spool_read)) > 0) {
+		if(pwrite(push_spool, buf, n, to) != n)
+			break;
+		push_spool_read += n;
+		to += n;
+	}
+	if(ftruncate(push_spool, to) == -1)
+		;
+}
+
+void *shipper(void *arg)
+{
+struct out_buf *b;
+struct pollfd pfd[2];
+char buf[64];
+int finish;
+int wait;
+
+	pfd[0].fd = out_notify[0];
+	pfd[0].events = POLLIN;
+	pfd[1].events = POLLOUT;
+	push_connect();
+	for(;;) {
+		finish = __atomic_load_n(&out_done, __ATOMIC_ACQUIRE);
+		while((b = out_pop()) != NULL) {
+			push_add(b->data, b->len);
+			out_free(b);
+		}
+		push_flush();
+		__atomic_store_n(&push_spooled, push_spool_len - push_spool_read, __ATOMIC_RELAXED);
+		if(finish)
+			break;
+		pfd[1].fd = -1;
+		if(push_state == PUSH_CONNECTING || (push_state == PUSH_UP && push_tcp && push_done < push_len))
+			pfd[1].fd = push_fd;
+		wait = -1;
+		if(push_state != PUSH_UP && push_spool_len > 0)
+			wait = 1000;	/* to connect again */
+		else if(push_state == PUSH_UP && !push_tcp && push_spool_read < push_spool_len)
+			wait = 100;	/* the next chunk of the spool */
+		poll(pfd, 2, wait);
+		while(read(out_notify[0], buf, sizeof(buf)) == sizeof(buf))
+			;
+	}
+	push_down();
+	push_keep();
+	return NULL;
+}
+
+/* Check -Q and open the spool now, so a mistake is reported before elmon
+ * goes into the background
+ */
+void push_open()
+{
+struct addrinfo hints;
+struct addrinfo *ai;
+struct stat st;
+char name[1024];
+char host[256];
+char *port;
+char *s = NULL;
+
+	if(strncmp(push_to, "graphite", 8) == 0) {
+		enc = &enc_graphite;
+		push_tcp = 1;
+		s = push_to + 8;
+	} else if(strncmp(push_to, "statsd", 6) == 0) {
+		enc = &enc_statsd;
+		s = push_to + 6;
+	}
+	if(s != NULL && strncmp(s, "+tcp", 4) == 0) {
+		push_tcp = 1;
+		s += 4;
+	} else if(s != NULL && strncmp(s, "+udp", 4) == 0) {
+		push_tcp = 0;
+		s += 4;
+	}
+	if(s == NULL || *s != ':' || (port = strrchr(s, ':')) == s || atoi(port + 1) <= 0 || atoi(port + 1) > 65535) {
+		printf("%s: -Q needs graphite|statsd[+tcp|+udp]:<host>:<port>, like graphite:carbon:2003\n", progname);
+		exit(49);
+	}
+	snprintf(host, sizeof(host), "%.*s", (int)(port - s - 1), s + 1);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	if(getaddrinfo(host, NULL, &hints, &ai) != 0) {
+		printf("%s: -Q cannot find the address of %s\n", progname, host);
+		exit(49);
+	}
+	memcpy(&push_addr, ai->ai_addr, sizeof(push_addr));
+	push_addr.sin_port = htons(atoi(port + 1));
+	freeaddrinfo(ai);
+	snprintf(name, sizeof(name), "elmon_%s.spool", hostname);
+	if((push_spool = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1
+	|| flock(push_spool, LOCK_EX | LOCK_NB) == -1
+	|| fstat(push_spool, &st) == -1) {
+		perror("elmon: -Q failed to open the spool");
+		printf("elmon: spool filename=%s\n", name);
+		exit(49);
+	}
+	push_spool_len = st.st_size;
+	push_spooled = push_spool_len;
+}
+
+void out_start()
+{
+sigset_t all;
+sigset_t old;
+
+	if(out_cur == NULL)
+		return;
+	if(out_rotate_size > 0 || out_rotate_period) {	/* what is there now is the header */
+		fflush(fp);
+		out_header_size = out_header_len = out_header_skip = out_cur->len;
+		out_header = MALLOC(out_header_size + 1);
+		memcpy(out_header, out_cur->data, out_header_len);
+	}
+	if(pipe(out_notify) == -1) {
+		perror("elmon: failed to create the writer pipe");
+		exit(43);
+	}
+	fcntl(out_notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(out_notify[1], F_SETFL, O_NONBLOCK);
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if(pthread_create(&writer_thread, NULL, push_to ? shipper : writer, NULL) != 0) {
+		perror("elmon: failed to start the writer thread");
+		exit(44);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	out_running = 1;
+}
+
+/* -M: a small HTTP server for Prometheus.  prom_publish() turns each
+ * snapshot into a page once and swaps it in, and the server thread gives
+ * every scrape the current page with a reference held on it, so scrapes
+ * never read /proc or wait for the collection and a slow one keeps its
+ * page while newer ones come and go.
+ */
+#define PROM_CLIENTS	16
+#define PROM_TIMEOUT	10	/* seconds a scrape may take */
+
+struct prom_page {
+	char	*data;
+	size_t	len;
+	int	refs;
+};
+
+struct prom_client {
+	int	fd;		/* -1 for a free slot */
+	char	req[1024];
+	int	got;
+	char	head[256];	/* the response header, or all of an error */
+	int	head_len;	/* 0 until the request is in */
+	struct prom_page *page;
+	size_t	sent;		/* of head and then page */
+	time_t	start;
+};
+
+char	*prom_listen = NULL;	/* -M [address:]port */
+int	prom_fd = -1;
+struct prom_page *prom_page = NULL;
+pthread_mutex_t prom_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t prom_thread;
+
+void prom_release(struct prom_page *page)
+{
+int last;
+
+	if(page == NULL)
+		return;
+	pthread_mutex_lock(&prom_lock);
+	last = (--page->refs == 0);
+	pthread_mutex_unlock(&prom_lock);
+	if(last) {
+		FREE(page->data);
+		FREE(page);
+	}
+}
+
+/* Main thread, the samples of this snapshot become what scrapes get */
+void prom_publish()
+{
+struct prom_page *page;
+struct prom_page *old;
+struct prom_metric *m;
+char host[512];
+size_t len = 1024;
+int i;
+
+	if(prom_fd < 0)
+		return;
+	for(i = 0; i < prom_metrics; i++)
+		len += prom_metric[i].len + strlen(prom_metric[i].name) + 32;
+	if(prom_pair(host, sizeof(host), "host", hostname) < 0)
+		strcpy(host, "host=\"\"");
+	page = MALLOC(sizeof(struct prom_page));
+	page->data = MALLOC(len);
+	page->refs = 1;		/* for prom_page */
+	page->len = sprintf(page->data,
+		"# TYPE elmon_snapshot gauge\nelmon_snapshot{%s} %ld\n"
+		"# TYPE elmon_snapshot_time_seconds gauge\nelmon_snapshot_time_seconds{%s} %ld\n",
+		host, (long)loop, host, (long)timer);
+	for(i = 0; i < prom_metrics; i++) {
+		m = &prom_metric[i];
+		if(m->len == 0)
+			continue;
+		page->len += sprintf(page->data + page->len, "# TYPE %s gauge\n", m->name);
+		memcpy(page->data + page->len, m->lines, m->len);
+		page->len += m->len;
+		m->len = 0;
+	}
+	pthread_mutex_lock(&prom_lock);
+	old = prom_page;
+	prom_page = page;
+	pthread_mutex_unlock(&prom_lock);
+	prom_release(old);
+}
+
+void prom_close(struct prom_client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	prom_release(c->page);
+	c->page = NULL;
+}
+
+/* The request is in, set up the response */
+void prom_answer(struct prom_client *c)
+{
+char *status = "404 Not Found";
+char *body = "only /metrics is here\n";
+
+	if(strncmp(c->req, "GET /metrics", 12) == 0 && (c->req[12] == ' ' || c->req[12] == '?')) {
+		pthread_mutex_lock(&prom_lock);
+		if((c->page = prom_page) != NULL)
+			c->page->refs++;
+		pthread_mutex_unlock(&prom_lock);
+		status = "503 Service Unavailable";
+		body = "no snapshot yet\n";
+	}
+	if(c->page != NULL)
+		c->head_len = snprintf(c->head, sizeof(c->head), "HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long)c->page->len);
+	else
+		c->head_len = snprintf(c->head, sizeof(c->head), "HTTP/1.1 %s\r\n"
+			"Content-Type: text/plain\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n%s",
+			status, (unsigned long)strlen(body), body);
+}
+
+/* Send what the socket takes, returns 1 when it is all gone or failed */
+int prom_send(struct prom_client *c)
+{
+struct iovec iov[2];
+struct msghdr msg;
+size_t total = c->head_len + (c->page ? c->page->len : 0);
+ssize_t done;
+int n = 0;
+
+	if(c->sent < (size_t)c->head_len) {
+		iov[n].iov_base = c->head + c->sent;
+		iov[n++].iov_len = c->head_len - c->sent;
+	}
+	if(c->page != NULL && c->sent < total) {
+		iov[n].iov_base = c->page->data + (c->sent > (size_t)c->head_len ? c->sent - c->head_len : 0);
+		iov[n].iov_len = total - (c->sent > (size_t)c->head_len ? c->sent : (size_t)c->head_len);
+		n++;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	if(n == 0)
+		return 1;
+	if((done = sendmsg(c->fd, &msg, MSG_NOSIGNAL)) < 0)
+		return errno != EAGAIN && errno != EINTR;
+	c->sent += done;
+	return c->sent >= total;
+}
+
+void *prom_server(void *arg)
+{
+struct prom_client c[PROM_CLIENTS];
+struct prom_client *cl;
+struct pollfd pfd[PROM_CLIENTS + 1];
+int slot[PROM_CLIENTS + 1];
+time_t now;
+ssize_t got;
+int fd;
+int n;
+int i;
+
+	for(i = 0; i < PROM_CLIENTS; i++) {
+		c[i].fd = -1;
+		c[i].page = NULL;
+	}
+	for(;;) {
+		now = time(NULL);
+		pfd[0].fd = prom_fd;
+		pfd[0].events = POLLIN;
+		for(n = 1, i = 0; i < PROM_CLIENTS; i++) {
+			if(c[i].fd < 0)
+				continue;
+			if(now - c[i].start > PROM_TIMEOUT) {
+				prom_close(&c[i]);
+				continue;
+			}
+			pfd[n].fd = c[i].fd;
+			pfd[n].events = c[i].head_len ? POLLOUT : POLLIN;
+			slot[n++] = i;
+		}
+		if(poll(pfd, n, 1000) <= 0)
+			continue;
+		for(i = 1; i < n; i++) {
+			if(pfd[i].revents == 0)
+				continue;
+			cl = &c[slot[i]];
+			if(cl->head_len == 0) {
+				if((got = read(cl->fd, cl->req + cl->got, sizeof(cl->req) - 1 - cl->got)) <= 0) {
+					if(got == 0 || (errno != EAGAIN && errno != EINTR))
+						prom_close(cl);
+					continue;
+				}
+				cl->got += got;
+				cl->req[cl->got] = 0;
+				if(strstr(cl->req, "\r\n\r\n") == NULL && strstr(cl->req, "\n\n") == NULL
+				&& cl->got < (int)sizeof(cl->req) - 1)
+					continue;
+				prom_answer(cl);
+			}
+			if(prom_send(cl))
+				prom_close(cl);
+		}
+		if(pfd[0].revents & POLLIN)
+			while((fd = accept(prom_fd, NULL, NULL)) >= 0) {
+				for(i = 0; i < PROM_CLIENTS && c[i].fd >= 0; i++)
+					;
+				if(i == PROM_CLIENTS) {	/* too many at once, it can try again */
+					close(fd);
+					continue;
+				}
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				c[i].fd = fd;
+				c[i].got = 0;
+				c[i].head_len = 0;
+				c[i].sent = 0;
+				c[i].start = now;
+			}
+	}
+	return NULL;
+}
+
+/* Listen on -M's address now, so a port in use is reported before elmon
+ * goes into the background
+ */
+void prom_open()
+{
+struct sockaddr_in sa;
+char addr[64] = "127.0.0.1";
+char *port;
+int on = 1;
+
+	if((port = strrchr(prom_listen, ':')) != NULL) {
+		snprintf(addr, sizeof(addr), "%.*s", (int)(port - prom_listen), prom_listen);
+		port++;
+	} else
+		port = prom_listen;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(atoi(port));
+	if(atoi(port) <= 0 || atoi(port) > 65535 || inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+		printf("%s: -M needs [<address>:]<port>, like 9300 or 0.0.0.0:9300\n", progname);
+		exit(49);
+	}
+	if((prom_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+	|| setsockopt(prom_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+	|| bind(prom_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1
+	|| listen(prom_fd, PROM_CLIENTS) == -1) {
+		perror("elmon: -M failed to listen");
+		exit(49);
+	}
+	fcntl(prom_fd, F_SETFL, O_NONBLOCK);
+	fcntl(prom_fd, F_SETFD, FD_CLOEXEC);
+}
+
+void prom_start()
+{
+sigset_t all;
+sigset_t old;
+
+	if(prom_fd < 0)
+		return;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if(pthread_create(&prom_thread, NULL, prom_server, NULL) != 0) {
+		perror("elmon: failed to start the -M server thread");
+		exit(44);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* End of a snapshot, pass its lines on with a line about the writer itself */
+void out_next()
+{
+int i;
+
+	if(out_cur == NULL || !out_running)
+		return;
+	if(rec_in_name == NULL) {
+		roll_once = 1;
+		enc_begin("ELMON", NULL);
+		enc_num("queue", (long)(out_head - __atomic_load_n(&out_tail, __ATOMIC_RELAXED)), 0);
+		enc_num("queue max", out_depth_max, 0);
+		enc_num("dropped", __atomic_load_n(&out_dropped, __ATOMIC_RELAXED), 0);
+		enc_num("written KB", __atomic_load_n(&out_written, __ATOMIC_RELAXED) / 1024.0, 1);
+		enc_num("slowest write ms", __atomic_load_n(&out_slowest, __ATOMIC_RELAXED) / 1000.0, 1);
+		if(push_to != NULL)
+			enc_num("spool KB", __atomic_load_n(&push_spooled, __ATOMIC_RELAXED) / 1024.0, 1);
+		enc_num("missed", __atomic_load_n(&sched_missed, __ATOMIC_RELAXED), 0);
+		enc_num("late ms", p->late * 1000.0, 1);
+		enc_end();
+		/* when each source was read, from the start of the snapshot */
+		enc_begin("ELMONSRC", NULL);
+		for(i = 0; i < SRC_MAX; i++)
+			if(p->stamp[i] >= p->mono && p->mono > 0.0)
+				enc_num(src_name[i], (p->stamp[i] - p->mono) * 1000.0, 1);
+			else
+				enc_none(src_name[i], "");
+		enc_end();
+		roll_once = 0;
+	}
+	fclose(fp);
+	out_push(out_cur, 0);
+	out_cur = out_new();
+}
+
+int	rec_settings;
+
+void rec_setting(struct rec_buf *b, char *name, char *fmt, ...)
+{
+char buf[1024];
+va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	rec_string(b, name, INT_MAX);
+	rec_string(b, buf, INT_MAX);
+	rec_settings++;
+}
+
+/* Write the file header, after the CSV header lines went into rec_text */
+void rec_start()
+{
+struct rec_buf b;
+struct rec_buf set;
+struct rec_buf h;
+char options[MAX_OPTIONS * 4 + 1];
+unsigned char *zdata;
+uLongf zlen;
+int i;
+int k;
+
+	memset(&b, 0, sizeof(b));
+	memset(&set, 0, sizeof(set));
+	memset(&h, 0, sizeof(h));
+	rec_need(&b, 8);
+	memcpy(b.data, REC_MAGIC, 8);
+	b.len = 8;
+	rec_varint(&b, REC_VERSION);
+
+	options[0] = 0;
+	for(i = 0; i < optionCount; i++)
+		sprintf(&options[strlen(options)], "%s%d", i ? "," : "", enabled_options[i]);
+	rec_settings = 0;
+	rec_setting(&set, "host", "%s", hostname);
+	rec_setting(&set, "runname", "%s", run_name);
+	rec_setting(&set, "version", "%s", VERSION);
+	rec_setting(&set, "interval", "%d", seconds);
+	rec_setting(&set, "cpus", "%d", cpus);
+	rec_setting(&set, "max_cpus", "%d", max_cpus);
+	rec_setting(&set, "diskmax", "%d", diskmax);
+	rec_setting(&set, "disks_per_line", "%d", disks_per_line);
+	rec_setting(&set, "options", "%s", options);
+	rec_setting(&set, "disk_mode", "%d", show_disk_mode);
+	rec_setting(&set, "topmode", "%d", show_topmode);
+	rec_setting(&set, "containers", "%d", show_containers);
+	rec_setting(&set, "threshold", "%g", ignore_procdisk_threshold);
+	rec_setting(&set, "psi", "%d", psi_available);
+	rec_setting(&set, "rrd", "%d", show_rrd);
+	rec_varint(&h, rec_settings);
+	rec_need(&h, set.len);
+	memcpy(&h.data[h.len], set.data, set.len);
+	h.len += set.len;
+	FREE(set.data);
+	rec_string(&h, rec_text ? rec_text : "", INT_MAX);
+
+	rec_varint(&h, jfses);
+	for(i = 0; i < jfses; i++) {
+		rec_string(&h, jfs[i].name, JFSNAMELEN);
+		rec_string(&h, jfs[i].device, JFSNAMELEN);
+		rec_string(&h, jfs[i].type, JFSNAMELEN);
+		rec_varint(&h, jfs[i].mounted);
+	}
+
+	rec_varint(&h, REC_TABLES);
+	for(i = 0; i < REC_TABLES; i++) {
+		rec_string(&h, rec_table[i].name, INT_MAX);
+		rec_varint(&h, rec_table[i].key + 1);
+		rec_varint(&h, rec_table[i].cols);
+		for(k = 0; k < rec_table[i].cols; k++) {
+			rec_string(&h, rec_table[i].col[k].name, INT_MAX);
+			rec_varint(&h, rec_table[i].col[k].kind);
+			rec_varint(&h, rec_table[i].col[k].size);
+			rec_varint(&h, rec_table[i].col[k].count);
+		}
+	}
+	zlen = compressBound(h.len);
+	zdata = MALLOC(zlen);
+	if(compress2(zdata, &zlen, h.data, h.len, Z_BEST_COMPRESSION) != Z_OK) {
+		fprintf(stderr, "elmon: failed to compress the recording\n");
+		exit(46);
+	}
+	rec_varint(&b, h.len);
+	rec_varint(&b, zlen);
+	rec_need(&b, zlen);
+	memcpy(&b.data[b.len], zdata, zlen);
+	b.len += zlen;
+	FREE(zdata);
+	FREE(h.data);
+
+	memset(&rec_zout, 0, sizeof(rec_zout));
+	if(deflateInit2(&rec_zout, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fprintf(stderr, "elmon: failed to compress the recording\n");
+		exit(46);
+	}
+	if(fwrite(b.data, 1, b.len, rec_fp) != b.len) {
+		perror("elmon: failed to write the recording");
+		exit(46);
+	}
+	rec_offset = b.len;
+	FREE(b.data);
+}
+
+/* Write rec_raw out as a frame of type, a delta frame deflated on from
+ * the frame before.  Returns how many bytes that took or -1.
+ */
+long rec_write(int type)
+{
+unsigned char buf[10];
+struct rec_buf head;
+
+	if(type != 'D')
+		deflateReset(&rec_zout);
+	rec_out.len = 0;
+	rec_byte(&rec_out, type);
+	rec_deflate(&rec_zout, &rec_out, rec_raw.data, rec_raw.len);
+	head.data = buf;
+	head.len = 0;
+	head.size = sizeof(buf);
+	rec_varint(&head, rec_out.len);
+	if(fwrite(head.data, 1, head.len, rec_fp) != head.len
+	|| fwrite(rec_out.data, 1, rec_out.len, rec_fp) != rec_out.len)
+		return -1;
+	return head.len + rec_out.len;
+}
+
+/* One snapshot as one frame, coded against prev unless it is a key frame */
+void rec_frame(struct data *s, struct data *prev)
+{
+int key;
+long len;
+int t;
+
+	key = (prev == NULL || rec_frames % REC_KEYFRAME == 0);
+	rec_raw.len = 0;
+	for(t = 0; t < REC_TABLES; t++)
+		rec_put_table(&rec_raw, t, s, key ? NULL : prev);
+
+	rec_idx_add(s->loop, (long long)(s->time * 1000.0), rec_offset, key);
+	if((len = rec_write(key ? 'K' : 'D')) == -1) {
+		perror("elmon: failed to write the recording");
+		exit(46);
+	}
+	fflush(rec_fp);
+	rec_offset += len;
+	if(out_sync > 0 && rec_frames % out_sync == 0)
+		idx_checkpoint(fileno(rec_fp));
+}
+
+/* Add the index, a recording without one can still be read start to end */
+void rec_close()
+{
+long long time = 0;
+long long offset = 0;
+long i;
+
+	if(rec_fp == NULL)
+		return;
+	rec_raw.len = 0;
+	rec_varint(&rec_raw, rec_frames);
+	for(i = 0; i < rec_frames; i++) {
+		rec_varint(&rec_raw, rec_idx[i].loop);
+		rec_zigzag(&rec_raw, rec_idx[i].time - time);
+		rec_varint(&rec_raw, rec_idx[i].offset - offset);
+		rec_byte(&rec_raw, rec_idx[i].key);
+		time = rec_idx[i].time;
+		offset = rec_idx[i].offset;
+	}
+	rec_write('I');
+	rec_out.len = 0;
+	rec_need(&rec_out, 16);
+	memcpy(&rec_out.data[rec_out.len], REC_IDXMAGIC, 8);
+	rec_out.len += 8;
+	for(i = 0; i < 8; i++)
+		rec_out.data[rec_out.len++] = rec_offset >> (i * 8);
+	fwrite(rec_out.data, 1, rec_out.len, rec_fp);
+	fclose(rec_fp);
+	rec_fp = NULL;
+	deflateEnd(&rec_zout);
+	if(idx_fp != NULL) {	/* the trailer has it all now */
+		fclose(idx_fp);
+		idx_fp = NULL;
+		unlink(idx_name);
+	}
+}
+
+/* Reading a recording back: the file is mapped and decoded as it goes */
+struct rec_fcol {
+	int	kind;
+	int	size;
+	int	count;
+	struct rec_col *local;	/* same column in this build, or NULL */
+};
+
+struct rec_ftable {
+	int	cols;
+	int	key;
+	int	local;		/* table in this build, or -1 */
+	struct rec_fcol *col;
+};
+
+struct rec_in rec_file;
+struct rec_ftable *rec_ftable;
+int	rec_ftables;
+
+void rec_get_table(struct rec_in *r, struct rec_ftable *ft, struct data *s, struct data *prev)
+{
+struct rec_table *tb = NULL;
+struct rec_fcol *fc;
+struct rec_col *c;
+char *cur = NULL;
+char *old = NULL;
+char *e;
+char *b;
+char *str;
+long long key = 0;
+long long v;
+unsigned long long bits;
+long zeros = 0;
+int need_run = 1;
+int changed;
+int valid;
+int size = 0;
+int room = 0;
+int on = 0;
+int n;
+int i;
+int j = 0;
+int k;
+int m;
+int len;
+
+	n = rec_get_varint(r);
+	if(r->bad || n < 0 || n > r->len)
+		return;
+	if(ft->local >= 0) {
+		tb = &rec_table[ft->local];
+		size = tb->size;
+		room = rec_make(s, ft->local, n, &cur);
+		if(prev != NULL)
+			old = rec_array(prev, ft->local, &on);
+	}
+	if(ft->key >= 0) {
+		fc = &ft->col[ft->key];
+		for(i = 0; i < n; i++) {
+			key += rec_get_zigzag(r);
+			if(i < room && fc->local)
+				rec_store(cur + (long)i * size + fc->local->offset, fc->local->size, key);
+		}
+	}
+	for(i = 0; i < n && !r->bad; i++) {
+		e = (i < room) ? cur + (long)i * size : NULL;
+		b = (i < room && (tb->key < 0 || ft->key >= 0)) ? rec_base(tb, old, on, i, &j, e) : NULL;
+		for(k = 0; k < ft->cols; k++) {
+			if(k == ft->key)
+				continue;
+			fc = &ft->col[k];
+			c = fc->local;
+			for(m = 0; m < fc->count; m++) {
+				valid = (c != NULL && m < c->count && i < room);
+				if(need_run) {
+					zeros = rec_get_varint(r);
+					need_run = 0;
+				}
+				if(zeros > 0) {
+					zeros--;
+					changed = 0;
+				} else {
+					need_run = 1;
+					changed = 1;
+				}
+				switch(fc->kind) {
+				case REC_INT:
+					v = changed ? rec_get_zigzag(r) : 0;
+					if(valid)
+						rec_store(e + c->offset + m * c->size, c->size,
+							(b ? rec_load(b + c->offset + m * c->size, c->size) : 0) + v);
+					break;
+				case REC_FLOAT:
+					bits = changed ? rec_get_varint(r) : 0;
+					if(valid) {
+						bits ^= b ? rec_bits(b + c->offset + m * c->size, c->size) : 0;
+						memcpy(e + c->offset + m * c->size, &bits, c->size);
+					}
+					break;
+				case REC_STRING:
+				case REC_POINTER:
+					len = 0;
+					str = changed ? rec_get_string(r, &len) : NULL;
+					if(!valid)
+						break;
+					if(str == NULL) {	/* same as last time */
+						if(c->kind == REC_STRING)
+							str = b ? b + c->offset : "";
+						else
+							str = b && *(char **)(b + c->offset) ? *(char **)(b + c->offset) : "";
+						len = (c->kind == REC_STRING) ? strnlen(str, c->size) : strlen(str);
+					}
+					if(c->kind == REC_STRING) {
+						if(len >= c->size)
+							len = c->size - 1;
+						memcpy(e + c->offset, str, len);
+						e[c->offset + len] = 0;
+					} else {
+						/* offset into the pool for now, it may move as it grows */
+						s->cg_paths = REALLOC(s->cg_paths, s->size + len + 1);
+						memcpy(&s->cg_paths[s->size], str, len);
+						s->cg_paths[s->size + len] = 0;
+						*(char **)(e + c->offset) = (char *)s->size;
+						s->size += len + 1;
+					}
+					break;
 				}
-			key = getch();
+			}
 		}
+	}
+	if(ft->local == REC_T_CGROUP)
+		for(i = 0; i < room; i++)
+			s->cg[i].path = s->cg_paths ? &s->cg_paths[(long)s->cg[i].path] : "";
+}
 
-	if (keys == 1) {        //Key was pressed
-		keys = 0;
-		return 1;
-	}else if (keys == 2) {  //Arraw key was pressed
-		keys = 0;
-		return 2;
-	}else {                 //No keys were pressed
+z_stream rec_zin;
+struct rec_buf rec_unz;		/* the last frame inflated */
+long long rec_zin_next = -1;	/* the frame rec_zin is ready for */
+
+/* Inflate the frame at pos into r and return its type, or 0 at the end
+ * of the file, if it got cut short or is damaged.  A delta frame can
+ * only come right after the one before it, the way it is decoded.
+ */
+int rec_unpack(long long pos, struct rec_in *r)
+{
+struct rec_in f = rec_file;
+unsigned long long len;
+int type;
+
+	if(pos < 0 || pos >= rec_file.len)
 		return 0;
-	}
+	f.pos = pos;
+	f.bad = 0;
+	len = rec_get_varint(&f);
+	type = rec_get_byte(&f);
+	if(f.bad || len < 1 || len > (unsigned long long)(rec_file.len - f.pos + 1)
+	|| (type != 'K' && type != 'D' && type != 'I'))
+		return 0;
+	if(type == 'D' && pos != rec_zin_next)
+		return 0;
+	if(type != 'D')
+		inflateReset(&rec_zin);
+	rec_zin_next = -1;
+	rec_unz.len = 0;
+	if(!rec_undeflate(&rec_zin, &rec_unz, &rec_file.data[f.pos], len - 1))
+		return 0;
+	rec_zin_next = f.pos + len - 1;
+	r->data = rec_unz.data;
+	r->len = rec_unz.len;
+	r->pos = 0;
+	r->bad = 0;
+	return type;
 }
 
-void go_background(int def_loops, int def_secs)
+/* doubletime() as it was when s was taken */
+void rec_time(struct data *s)
 {
-	cursed = 0;
-	if (maxloops == -1)
-		maxloops = def_loops;
-	if (seconds  == -1)
-		seconds = def_secs;
-        add_option(SHOW_CPU);
-        add_option(SHOW_SMP);
-        add_option(SHOW_MEMORY);
-        add_option(SHOW_LARGE);
-        remove_option(SHOW_TOP);
-        add_option(SHOW_PARTITIONS);
-        add_option(SHOW_LPAR);
-        add_option(SHOW_VM);
-        add_option(SHOW_KERNEL);
-        add_option(SHOW_NET);
-        add_option(SHOW_JFS);
-        add_option(SHOW_DISK);
-        show_disk_mode    = SHOW_DISK_STATS;
+	s->time = (double)s->tv.tv_sec + s->tv.tv_usec * 1.0e-6;
+}
 
-        show_all     = 1;
-        show_topmode = 3;
+/* Decode the frame at the read position against prev.  Returns NULL at
+ * the index or the end of the file, or if the last frame got cut short.
+ */
+struct data *rec_read_frame(struct data *prev)
+{
+struct rec_in r;
+struct data *s;
+int i;
+int type;
+
+	type = rec_unpack(rec_file.pos, &r);
+	if(type != 'K' && type != 'D')
+		return NULL;
+	if(type == 'K')
+		prev = NULL;
+
+	s = snapshot_new();
+	s->size = 0;	/* bytes in cg_paths while decoding */
+	for(i = 0; i < rec_ftables && !r.bad; i++)
+		rec_get_table(&r, &rec_ftable[i], s, prev);
+	if(r.bad) {
+		snapshot_free(s);
+		return NULL;
+	}
+	rec_time(s);
+	rec_file.pos = rec_zin_next;
+	return s;
 }
 
-void proc_net()
+/* A -j file is a run of gzip members.  With where they end from its
+ * .idx, the text gets an anonymous mapping as big as all of it and each
+ * member is only inflated when something is read from it, so a jump
+ * into a month long file costs the members around it and not the whole
+ * file.  At most REC_ZKEEP members are kept, the oldest go back to the
+ * kernel.  Whatever comes after the last member in the .idx, the whole
+ * file without one, is inflated at the start, up to a damaged member or
+ * the end of an unfinished one.
+ */
+#define REC_ZKEEP	8
+
+struct rec_zmember {
+	long long zoff;		/* where it starts in the file */
+	long long uoff;		/* and in the text */
+} *rec_zm = NULL;		/* then where the rest starts */
+long	rec_zmembers = 0;	/* inflated when wanted, 0 for all at the start */
+unsigned char *rec_zfile;	/* the mapped .gz file */
+char	*rec_zdone = NULL;	/* per member */
+long	rec_zkept[REC_ZKEEP];
+long	rec_zinflated = 0;
+char	*rec_zlo = NULL;	/* the member rec_zwant() last made sure of */
+char	*rec_zhi = NULL;
+z_stream rec_z;
+
+/* Inflate the members in len bytes at in, returns how much text is in *out */
+size_t rec_zrest(unsigned char *in, size_t len, unsigned char **out)
 {
-static FILE *fp = (FILE *)-1;
-char buf[1024];
-int i=0;
+z_stream z;
+size_t size = 0;
+size_t done = 0;
 int ret;
-unsigned long junk;
 
-	if( fp == (FILE *)-1) {
-           if( (fp = fopen("/proc/net/dev","r")) == NULL) {
-		error("failed to open - /proc/net/dev");
-		networks=0;
-		return;
-	   }
+	*out = NULL;
+	memset(&z, 0, sizeof(z));
+	if(inflateInit2(&z, 15 + 16) != Z_OK) {
+		fprintf(stderr, "elmon: failed to start decompressing the recording\n");
+		exit(47);
 	}
-	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
-	if(fgets(buf,1024,fp) == NULL) goto end; /* throw away the header lines */
-/*
-Inter-|   Receive                                                |  Transmit
- face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed
-    lo:    1956      30    0    0    0     0          0         0     1956      30    0    0    0     0       0          0
-  eth0:       0       0    0    0    0     0          0         0   458718       0  781    0    0     0     781          0
-  sit0:       0       0    0    0    0     0          0         0        0       0    0    0    0     0       0          0
-  eth1:       0       0    0    0    0     0          0         0        0       0    0    0    0     0       0          0
-*/
-	for(i=0;i<NETMAX;i++) {
-		if(fgets(buf,1024,fp) == NULL)
+	z.next_in = in;
+	z.avail_in = len;
+	while(z.avail_in > 0) {
+		if(size - done < 65536) {
+			size = size * 2 + 1024 * 1024;
+			*out = REALLOC(*out, size);
+		}
+		z.next_out = *out + done;
+		z.avail_out = size - done;
+		ret = inflate(&z, Z_NO_FLUSH);
+		done = size - z.avail_out;
+		if(ret == Z_STREAM_END) {	/* the next member, if there is one */
+			if(z.avail_in < 2 || z.next_in[0] != 0x1f || z.next_in[1] != 0x8b)
+				break;
+			inflateReset(&z);
+		} else if(ret != Z_OK)
 			break;
-		strip_spaces(buf);
-				     /* 1   2   3    4   5   6   7   8   9   10   11   12  13  14  15  16 */
-		ret = sscanf(&buf[0], "%s %llu %llu %lu %lu %lu %lu %lu %lu %llu %llu %lu %lu %lu %lu %lu",
-		(char *)&p->ifnets[i].if_name,
-			&p->ifnets[i].if_ibytes,
-			&p->ifnets[i].if_ipackets,
-			&p->ifnets[i].if_ierrs,
-			&p->ifnets[i].if_idrop,
-			&p->ifnets[i].if_ififo,
-			&p->ifnets[i].if_iframe,
-			&junk,
-			&junk,
-			&p->ifnets[i].if_obytes,
-			&p->ifnets[i].if_opackets,
-			&p->ifnets[i].if_oerrs,
-			&p->ifnets[i].if_odrop,
-			&p->ifnets[i].if_ofifo,
-			&p->ifnets[i].if_ocolls,
-			&p->ifnets[i].if_ocarrier
-			);
-		if(ret != 16) 
-			fprintf(stderr,"sscanf wanted 16 returned = %d line=%s\n", ret, (char *)buf);
 	}
-	end:
-	if(reread) {
-		fclose(fp);
-		fp = (FILE *)-1;
-	} else rewind(fp);
-	networks = i;
+	inflateEnd(&z);
+	return done;
 }
 
+/* Give the whole pages of member j back, it is inflated again if wanted */
+void rec_zdrop(long j)
+{
+long page = sysconf(_SC_PAGESIZE);
+long long from = (rec_zm[j].uoff + page - 1) / page * page;
+long long to = rec_zm[j + 1].uoff / page * page;
+
+	if(to > from)
+		madvise(rec_file.data + from, to - from, MADV_DONTNEED);
+	rec_zdone[j] = 0;
+	rec_zlo = rec_zhi = NULL;
+}
 
-int proc_procsinfo(int pid, int index)
+void rec_zinflate(long j)
 {
-FILE *fp;
-char filename[64];
-char buf[1024*4];
-int size=0;
-int ret=0;
-int count=0;
+long k = rec_zinflated++ % REC_ZKEEP;
+
+	if(rec_zinflated > REC_ZKEEP)
+		rec_zdrop(rec_zkept[k]);
+	rec_zkept[k] = j;
+	rec_zdone[j] = 1;
+	inflateReset(&rec_z);
+	rec_z.next_in = rec_zfile + rec_zm[j].zoff;
+	rec_z.avail_in = rec_zm[j + 1].zoff - rec_zm[j].zoff;
+	rec_z.next_out = rec_file.data + rec_zm[j].uoff;
+	rec_z.avail_out = rec_zm[j + 1].uoff - rec_zm[j].uoff;
+	inflate(&rec_z, Z_FINISH);	/* a damaged one is left as zeros */
+}
 
-	sprintf(filename,"/proc/%d/stat",pid);
-	if( (fp = fopen(filename,"r")) == NULL) {
-		sprintf(buf,"failed to open file %s",filename);
-		error(buf);
-		return 0;
+/* Make sure the text at p is there before it is read */
+void rec_zwant(char *p)
+{
+long long at;
+long lo = 0;
+long hi = rec_zmembers - 1;
+long mid;
+
+	if(rec_zmembers == 0 || (p >= rec_zlo && p < rec_zhi))
+		return;
+	at = p - (char *)rec_file.data;
+	if(at < 0 || at >= rec_zm[rec_zmembers].uoff)
+		return;		/* the rest is there from the start */
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if(rec_zm[mid].uoff <= at)
+			lo = mid;
+		else
+			hi = mid - 1;
 	}
-	size = fread(buf, 1, 1024-1, fp);
-	if(size == -1) {
-#ifdef DEBUG
-		fprintf(stderr,"procsinfo read returned = %d assuming process stopped pid=%d\n", ret,pid);
-#endif /*DEBUG*/
-		return 0;
+	if(!rec_zdone[lo])
+		rec_zinflate(lo);
+	rec_zlo = (char *)rec_file.data + rec_zm[lo].uoff;
+	rec_zhi = (char *)rec_file.data + rec_zm[lo + 1].uoff;
+}
+
+/* Put the text of the -j file name in place of its map in r */
+void rec_inflate(struct rec_in *r, char *name)
+{
+unsigned char *rest;
+long long v[4];
+size_t len;
+FILE *f;
+long n = 0;
+
+	rec_zm = MALLOC(sizeof(struct rec_zmember));
+	rec_zm[0].zoff = 0;
+	rec_zm[0].uoff = 0;
+	if((f = idx_fopen(name)) != NULL) {
+		while(idx_get(f, v)) {
+			if(v[3] != REC_IDX_MEMBER)
+				continue;
+			/* as far as they fit the file */
+			if(v[1] <= rec_zm[n].zoff || v[1] > r->len || v[2] <= rec_zm[n].uoff
+			|| (v[1] < r->len && (v[1] + 2 > r->len || r->data[v[1]] != 0x1f || r->data[v[1] + 1] != 0x8b)))
+				break;
+			n++;
+			rec_zm = REALLOC(rec_zm, sizeof(struct rec_zmember) * (n + 1));
+			rec_zm[n].zoff = v[1];
+			rec_zm[n].uoff = v[2];
+		}
+		fclose(f);
 	}
-	fclose(fp);
-        ret = sscanf(buf, "%d (%s)",
-                &p->procs[index].pi_pid,
-                &p->procs[index].pi_comm[0]);
-	if(ret != 2) {
-		fprintf(stderr,"procsinfo sscanf returned = %d line=%s\n", ret,buf);
-		return 0;
+	len = rec_zrest(r->data + rec_zm[n].zoff, r->len - rec_zm[n].zoff, &rest);
+	if(n == 0) {
+		munmap(r->data, r->len ? r->len : 1);
+		r->data = rest;
+		r->len = len;
+		return;
 	}
-	p->procs[index].pi_comm[strlen(p->procs[index].pi_comm)-1] = 0;
+	memset(&rec_z, 0, sizeof(rec_z));
+	if(inflateInit2(&rec_z, 15 + 16) != Z_OK) {
+		fprintf(stderr, "elmon: failed to start decompressing the recording\n");
+		exit(47);
+	}
+	rec_zfile = r->data;
+	r->len = rec_zm[n].uoff + len;
+	r->data = mmap(NULL, r->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(r->data == MAP_FAILED) {
+		perror("elmon: failed to map the recording");
+		exit(47);
+	}
+	if(len > 0)
+		memcpy(r->data + rec_zm[n].uoff, rest, len);
+	if(rest != NULL)
+		FREE(rest);
+	rec_zdone = MALLOC(n);
+	memset(rec_zdone, 0, n);
+	rec_zmembers = n;
+	rec_zwant((char *)r->data);	/* the header is at the start of the first */
+}
 
-	for(count=0; count<size;count++)	/* now look for ") " as dumb Infiniban driver includes "()" */
-		if(buf[count] == ')' && buf[count+1] == ' ' ) break;
+/* -P also plays the .nmon files -f writes, sorted or not.  They hold
+ * rates, so playback turns them back into counters that give the same
+ * rates again.  Each section has a cursor that moves along the mapped
+ * file to its next line, so nothing is read before it is needed.
+ */
+struct csv_section {
+	char	name[16];	/* "CPU_ALL", "DISKBUSY1" */
+	char	*start;		/* its heading, the data comes after it */
+	char	*pos;		/* where to look for its next line */
+	int	done;		/* no more lines of it */
+};
 
-	if(count == size) {
-#ifdef DEBUG
-		fprintf(stderr,"procsinfo failed to find end of command buf=%s\n", buf);
-#endif /*DEBUG*/
-		return 0;
+char	*csv_data = NULL;	/* the mapped .nmon file */
+char	*csv_end;
+char	*csv_head_end;		/* the first ZZZZ,T line, the headings are before it */
+struct csv_section *csv_sec = NULL;
+int	csv_secs = 0;
+char	(*csv_disk)[32] = NULL;	/* disk and network names from the headings */
+char	csv_net[NETMAX][17 * sizeof(long)];
+int	csv_disks = 0;
+int	csv_nets = 0;
+int	csv_fses = 0;
+double	*csv_v = NULL;		/* the numbers of a line */
+int	play_csv = 0;		/* -P is playing a .nmon file */
+
+#define CSV_ZZZZ	0
+#define CSV_CPU_ALL	1
+#define CSV_MEM		2
+#define CSV_PROC	3
+#define CSV_NET		4
+#define CSV_NETPACKET	5
+#define CSV_JFSFILE	6
+#define CSV_CPU		7	/* then CPU01 onwards, then the disk ones */
+
+/* The line "name,..." that is not a data line, or NULL.  Only the header
+ * before the first snapshot is looked through.
+ */
+char *csv_heading(char *name)
+{
+char *line = csv_data;
+char *end = csv_head_end;
+int len = strlen(name);
+
+	while(line != NULL && line < end) {
+		if(end - line > len + 2 && memcmp(line, name, len) == 0 && line[len] == ','
+		&& !(line[len + 1] == 'T' && isdigit(line[len + 2])))
+			return line;
+		line = memchr(line, '\n', end - line);
+		if(line != NULL)
+			line++;
 	}
-	count++; count++;
+	return NULL;
+}
 
-        ret = sscanf(&buf[count], 
-"%c %d %d %d %d %d %lu %lu %lu %lu %lu %lu %lu %ld %ld %ld %ld %ld %ld %lu %lu %ld %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %d %d",
-                &p->procs[index].pi_state,
-                &p->procs[index].pi_ppid,
-                &p->procs[index].pi_pgrp,
-                &p->procs[index].pi_session,
-                &p->procs[index].pi_tty_nr,
-                &p->procs[index].pi_tty_pgrp,
-                &p->procs[index].pi_flags,
-                &p->procs[index].pi_minflt,
-                &p->procs[index].pi_cmin_flt,
-                &p->procs[index].pi_majflt,
-                &p->procs[index].pi_cmaj_flt,
-                &p->procs[index].pi_utime,
-                &p->procs[index].pi_stime,
-                &p->procs[index].pi_cutime,
-                &p->procs[index].pi_cstime,
-                &p->procs[index].pi_pri,
-                &p->procs[index].pi_nice,
-                &p->procs[index].junk,
-                &p->procs[index].pi_it_real_value,
-                &p->procs[index].pi_start_time,
-                &p->procs[index].pi_vsize,
-                &p->procs[index].pi_rss,
-                &p->procs[index].pi_rlim_cur,
-                &p->procs[index].pi_start_code,
-                &p->procs[index].pi_end_code,
-                &p->procs[index].pi_start_stack,
-                &p->procs[index].pi_esp,
-                &p->procs[index].pi_eip,
-                &p->procs[index].pi_pending_signal,
-                &p->procs[index].pi_blocked_sig,
-                &p->procs[index].pi_sigign,
-                &p->procs[index].pi_sigcatch,
-                &p->procs[index].pi_wchan,
-                &p->procs[index].pi_nswap,
-                &p->procs[index].pi_cnswap,
-                &p->procs[index].pi_exit_signal,
-		&p->procs[index].pi_cpu
-		);
-	if(ret != 37) {
-		fprintf(stderr,"procsinfo2 sscanf wanted 37 returned = %d pid=%d line=%s\n", ret,pid,buf);
-		return 0;
+/* Field n of the line at s, the first is 0 */
+char *csv_field(char *s, int n)
+{
+	for( ; n > 0 && s < csv_end && *s != '\n'; s++)
+		if(*s == ',')
+			n--;
+	return s;
+}
+
+/* Copy field n of the line at s to buf */
+char *csv_string(char *s, int n, char *buf, int size)
+{
+int i;
+
+	s = csv_field(s, n);
+	for(i = 0; i < size - 1 && s < csv_end && *s != ',' && *s != '\n'; i++)
+		buf[i] = *s++;
+	buf[i] = 0;
+	return buf;
+}
+
+/* Numbers after "name,Tnnnn," up to the end of the line, empty ones are 0 */
+int csv_numbers(char *s, double *v, int max)
+{
+int n = 0;
+char *end;
+
+	while(n < max && s < csv_end && *s != '\n') {
+		v[n++] = strtod(s, &end);
+		s = end;
+		while(s < csv_end && *s != ',' && *s != '\n')
+			s++;
+		if(s < csv_end && *s == ',')
+			s++;
+		else
+			break;
+	}
+	return n;
+}
+
+void csv_section_add(char *name)
+{
+	csv_sec = REALLOC(csv_sec, sizeof(struct csv_section) * (csv_secs + 1));
+	snprintf(csv_sec[csv_secs].name, sizeof(csv_sec[csv_secs].name), "%s", name);
+	csv_sec[csv_secs].start = csv_heading(name);
+	if(csv_sec[csv_secs].start == NULL)	/* ZZZZ has no heading */
+		csv_sec[csv_secs].start = csv_data;
+	if(rec_zmembers && csv_sec[csv_secs].start == csv_data && strcmp(name, "ZZZZ") != 0)
+		csv_sec[csv_secs].start = csv_end;	/* not inflated looking for it */
+	csv_sec[csv_secs].pos = csv_sec[csv_secs].start;
+	csv_sec[csv_secs].done = 0;
+	csv_secs++;
+}
+
+/* Start every section again, for going back in time */
+void csv_rewind()
+{
+int i;
+
+	for(i = 0; i < csv_secs; i++) {
+		csv_sec[i].pos = csv_sec[i].start;
+		csv_sec[i].done = 0;
+	}
+}
+
+/* The fields after "name,Tnnnn," for snapshot tag, or NULL if it has none */
+char *csv_line(struct csv_section *c, long tag)
+{
+char *line;
+char *next;
+char *end;
+long t;
+int len = strlen(c->name);
+
+	if(c->done)
+		return NULL;
+	for(line = c->pos; line < csv_end; line = next) {
+		rec_zwant(line);
+		next = memchr(line, '\n', csv_end - line);
+		next = next ? next + 1 : csv_end;
+		if(next - line < len + 3 || memcmp(line, c->name, len) != 0
+		|| line[len] != ',' || line[len + 1] != 'T' || !isdigit(line[len + 2]))
+			continue;
+		t = strtol(&line[len + 2], &end, 10);
+		if(t < tag)
+			continue;
+		if(t > tag) {	/* this snapshot has none, leave it for the next */
+			c->pos = line;
+			return NULL;
+		}
+		c->pos = next;
+		return *end == ',' ? end + 1 : end;
+	}
+	c->done = 1;
+	return NULL;
+}
+
+/* "hh:mm:ss,dd-MON-yyyy" of a ZZZZ line */
+double csv_time(char *s)
+{
+struct tm tm;
+char mon[4];
+int i;
+
+	memset(&tm, 0, sizeof(tm));
+	if(sscanf(s, "%d:%d:%d,%d-%3s-%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+			&tm.tm_mday, mon, &tm.tm_year) != 6)
+		return 0.0;
+	for(i = 0; i < 12; i++)
+		if(!strcasecmp(mon, month[i]))
+			tm.tm_mon = i;
+	tm.tm_year -= 1900;
+	tm.tm_isdst = -1;
+	return (double)mktime(&tm);
+}
+
+void csv_open(char *name)
+{
+char buf[256];
+char *s;
+int groups;
+int i;
+int n;
+
+	csv_data = (char *)rec_file.data;
+	csv_end = csv_data + rec_file.len;
+	play_csv = 1;
+	/* a -j file has the header in its first member */
+	csv_head_end = rec_zmembers ? csv_data + rec_zm[1].uoff : csv_end;
+	for(s = csv_data; s != NULL && s < csv_head_end; ) {
+		if(csv_head_end - s > 6 && memcmp(s, "ZZZZ,T", 6) == 0) {
+			csv_head_end = s;
+			break;
+		}
+		if((s = memchr(s, '\n', csv_head_end - s)) != NULL)
+			s++;
+	}
+	if((s = csv_heading("AAA")) == NULL && csv_heading("ZZZZ") == NULL) {
+		fprintf(stderr, "elmon: %s is not an elmon recording or .nmon file\n", name);
+		exit(47);
+	}
+	if((s = csv_heading("AAA,host")) != NULL)
+		csv_string(s, 2, hostname, sizeof(hostname));
+	if((s = csv_heading("AAA,runname")) != NULL)
+		csv_string(s, 2, run_name, sizeof(run_name));
+	if((s = csv_heading("AAA,interval")) != NULL)
+		seconds = atof(csv_string(s, 2, buf, sizeof(buf))) * 10.0 + 0.5;
+	if((s = csv_heading("AAA,disks_per_line")) != NULL)
+		disks_per_line = atoi(csv_string(s, 2, buf, sizeof(buf)));
+	if(disks_per_line <= 0)
+		disks_per_line = DPL;
+	if((s = csv_heading("AAA,cpus")) != NULL)
+		cpus = atoi(csv_string(s, 2, buf, sizeof(buf)));
+	else
+		for(cpus = 0; cpus < CPUMAX; cpus++) {
+			snprintf(buf, sizeof(buf), "CPU%02d", cpus + 1);
+			if(csv_heading(buf) == NULL)
+				break;
+		}
+	if(cpus < 1)
+		cpus = 1;
+	if(cpus > CPUMAX)
+		cpus = CPUMAX;
+	max_cpus = cpus;
+
+	/* NET,Network I/O host,eth0-read-KB/s,...,eth0-write-KB/s,... */
+	if((s = csv_heading("NET")) != NULL)
+		for(n = 2; csv_nets < NETMAX; n++) {
+			csv_string(s, n, buf, sizeof(buf));
+			if(strlen(buf) < 11 || strcmp(&buf[strlen(buf) - 10], "-read-KB/s") != 0)
+				break;
+			buf[strlen(buf) - 10] = 0;
+			snprintf(csv_net[csv_nets++], sizeof(csv_net[0]), "%s", buf);
+		}
+	/* DISKBUSY,Disk %Busy host,sda,sdb then DISKBUSY1 for the next disks_per_line */
+	for(groups = 0; ; groups++) {
+		snprintf(buf, sizeof(buf), "DISKBUSY%s", groups ? dskgrp(groups * disks_per_line) : "");
+		if((s = csv_heading(buf)) == NULL)
+			break;
+		for(n = 2; ; n++) {
+			csv_string(s, n, buf, sizeof(buf));
+			if(buf[0] == 0)
+				break;
+			if(csv_disks == diskmax)
+				diskmax *= 2;
+			csv_disk = REALLOC(csv_disk, sizeof(csv_disk[0]) * diskmax);
+			snprintf(csv_disk[csv_disks++], sizeof(csv_disk[0]), "%s", buf);
+		}
+	}
+	/* JFSFILE,JFS Filespace %Used host,/,/boot */
+	if((s = csv_heading("JFSFILE")) != NULL)
+		for(n = 2; csv_fses < JFSMAX; n++) {
+			csv_string(s, n, jfs[csv_fses].name, JFSNAMELEN);
+			if(jfs[csv_fses].name[0] == 0)
+				break;
+			strcpy(jfs[csv_fses].type, "-");
+			jfs[csv_fses++].mounted = 1;
+		}
+	jfses = csv_fses;
+
+	n = 2 * NETMAX + CPUMAX + csv_fses + (disks_per_line > csv_disks ? disks_per_line : csv_disks);
+	csv_v = MALLOC(sizeof(double) * n);
+
+	csv_section_add("ZZZZ");
+	csv_section_add("CPU_ALL");
+	csv_section_add("MEM");
+	csv_section_add("PROC");
+	csv_section_add("NET");
+	csv_section_add("NETPACKET");
+	csv_section_add("JFSFILE");
+	for(i = 1; i <= cpus; i++) {
+		snprintf(buf, sizeof(buf), "CPU%02d", i);
+		csv_section_add(buf);
+	}
+	for(i = 0; i < csv_disks; i += disks_per_line) {
+		snprintf(buf, sizeof(buf), "DISKBUSY%s", dskgrp(i));
+		csv_section_add(buf);
+		snprintf(buf, sizeof(buf), "DISKREAD%s", dskgrp(i));
+		csv_section_add(buf);
+		snprintf(buf, sizeof(buf), "DISKWRITE%s", dskgrp(i));
+		csv_section_add(buf);
+		snprintf(buf, sizeof(buf), "DISKXFER%s", dskgrp(i));
+		csv_section_add(buf);
 	}
+	idx_read(name, rec_file.len);	/* from -f, to jump without reading it all */
+}
 
-	sprintf(filename,"/proc/%d/statm",pid);
-	if( (fp = fopen(filename,"r")) == NULL) {
-		sprintf(buf,"failed to open file %s",filename);
-		error(buf);
-		return 0;
+/* Percentages go back into ticks, a tenth of a percent each */
+void csv_cpu(struct cpu_stat *c, char *s)
+{
+double v[4];
+
+	if(s == NULL || csv_numbers(s, v, 4) < 4)
+		return;
+	c->user += v[0] * 10.0 + 0.5;
+	c->sys  += v[1] * 10.0 + 0.5;
+	c->wait += v[2] * 10.0 + 0.5;
+	c->idle += v[3] * 10.0 + 0.5;
+}
+
+/* Snapshot tag of the .nmon file, counting on from prev.  Tag 0 is the
+ * start of the first interval, which is not in the file.
+ */
+struct data *csv_frame(struct data *prev, long tag)
+{
+struct data *s;
+char *line;
+double *v = csv_v;
+double elapsed;
+int first;
+int n;
+int i;
+int j;
+
+	if(tag == 0) {
+		line = csv_line(&csv_sec[CSV_ZZZZ], 1);
+		csv_rewind();
+		if(line == NULL)
+			return NULL;
+		s = snapshot_new();
+		s->time = csv_time(line) - seconds / 10.0;
+	} else {
+		if((line = csv_line(&csv_sec[CSV_ZZZZ], tag)) == NULL)
+			return NULL;
+		s = snapshot_new();
+		s->time = csv_time(line);
 	}
-	size = fread(buf, 1, 1024*4-1, fp);
-	if(size == -1) {
-		sprintf(buf,"failed to read file %s",filename);
-		error(buf);
-		return 0;
+	s->loop = tag;
+	s->tv.tv_sec = s->time;
+	if(prev != NULL) {
+		s->cpu_total = prev->cpu_total;
+		memcpy(s->cpuN, prev->cpuN, sizeof(s->cpuN));
+		memcpy(s->ifnets, prev->ifnets, sizeof(s->ifnets));
+		memcpy(s->dk, prev->dk, sizeof(struct dsk_stat) * diskmax);
+		s->mem = prev->mem;
 	}
-	fclose(fp);
+	elapsed = prev ? s->time - prev->time : 0.0;
+	if(prev != NULL && elapsed <= 0.0)
+		elapsed = seconds / 10.0;
+	s->disks = csv_disks;
+	s->networks = csv_nets;
+	s->fses = csv_fses;
+	for(i = 0; i < csv_disks; i++)
+		strcpy(s->dk[i].dk_name, csv_disk[i]);
+	for(i = 0; i < csv_nets; i++)
+		strcpy((char *)s->ifnets[i].if_name, csv_net[i]);
+	for(i = 0; i < csv_fses; i++) {
+		s->fs[i].mounted = 1;
+		s->fs[i].ret = -1;
+	}
+	if(tag == 0)
+		return s;
+
+	csv_cpu(&s->cpu_total, csv_line(&csv_sec[CSV_CPU_ALL], tag));
+	for(i = 0; i < cpus; i++)
+		csv_cpu(&s->cpuN[i], csv_line(&csv_sec[CSV_CPU + i], tag));
+	/* memtotal,hightotal,lowtotal,swaptotal,memfree,highfree,lowfree,swapfree,
+	 * memshared,cached,active,bigfree,buffers,swapcached,inactive in MB
+	 */
+	if((line = csv_line(&csv_sec[CSV_MEM], tag)) != NULL && csv_numbers(line, v, 15) == 15) {
+		s->mem.memtotal   = v[0] * 1024.0;
+		s->mem.hightotal  = v[1] * 1024.0;
+		s->mem.lowtotal   = v[2] * 1024.0;
+		s->mem.swaptotal  = v[3] * 1024.0;
+		s->mem.memfree    = v[4] * 1024.0;
+		s->mem.highfree   = v[5] * 1024.0;
+		s->mem.lowfree    = v[6] * 1024.0;
+		s->mem.swapfree   = v[7] * 1024.0;
+		s->mem.memshared  = v[8] * 1024.0;
+		s->mem.cached     = v[9] * 1024.0;
+		s->mem.active     = v[10] * 1024.0;
+		s->mem.buffers    = v[12] * 1024.0;
+		s->mem.swapcached = v[13] * 1024.0;
+		s->mem.inactive   = v[14] * 1024.0;
+	}
+	/* Runnable,Swap-in,pswitch,syscall,read,write,fork,... */
+	if((line = csv_line(&csv_sec[CSV_PROC], tag)) != NULL && csv_numbers(line, v, 7) == 7) {
+		s->cpu_total.running = v[0];
+		s->cpu_total.ctxt  += v[2] * elapsed + 0.5;
+		s->cpu_total.procs += v[6] * elapsed + 0.5;
+	}
+	if((line = csv_line(&csv_sec[CSV_NET], tag)) != NULL && csv_numbers(line, v, csv_nets * 2) == csv_nets * 2)
+		for(i = 0; i < csv_nets; i++) {
+			s->ifnets[i].if_ibytes += v[i] * 1024.0 * elapsed + 0.5;
+			s->ifnets[i].if_obytes += v[csv_nets + i] * 1024.0 * elapsed + 0.5;
+		}
+	if((line = csv_line(&csv_sec[CSV_NETPACKET], tag)) != NULL && csv_numbers(line, v, csv_nets * 2) == csv_nets * 2)
+		for(i = 0; i < csv_nets; i++) {
+			s->ifnets[i].if_ipackets += v[i] * elapsed + 0.5;
+			s->ifnets[i].if_opackets += v[csv_nets + i] * elapsed + 0.5;
+		}
+	/* the percentage used of a filesystem of a million blocks */
+	if((line = csv_line(&csv_sec[CSV_JFSFILE], tag)) != NULL && csv_numbers(line, v, csv_fses) == csv_fses)
+		for(i = 0; i < csv_fses; i++) {
+			s->fs[i].ret = 0;
+			s->fs[i].blocks = 1000000;
+			s->fs[i].bfree = 1000000 - v[i] * 10000.0;
+		}
+	for(first = 0, j = CSV_CPU + cpus; first < csv_disks; first += disks_per_line, j += 4) {
+		n = csv_disks - first;
+		if(n > disks_per_line)
+			n = disks_per_line;
+		if((line = csv_line(&csv_sec[j], tag)) != NULL && csv_numbers(line, v, n) == n)
+			for(i = 0; i < n; i++)
+				s->dk[first + i].dk_time += v[i] > 100.0 ? 0 : v[i] * elapsed + 0.5;
+		if((line = csv_line(&csv_sec[j + 1], tag)) != NULL && csv_numbers(line, v, n) == n)
+			for(i = 0; i < n; i++)
+				s->dk[first + i].dk_rkb += v[i] * elapsed + 0.5;
+		if((line = csv_line(&csv_sec[j + 2], tag)) != NULL && csv_numbers(line, v, n) == n)
+			for(i = 0; i < n; i++)
+				s->dk[first + i].dk_wkb += v[i] * elapsed + 0.5;
+		if((line = csv_line(&csv_sec[j + 3], tag)) != NULL && csv_numbers(line, v, n) == n)
+			for(i = 0; i < n; i++)
+				s->dk[first + i].dk_xfers += v[i] * elapsed + 0.5;
+	}
+	return s;
+}
 
-        ret = sscanf(&buf[0], "%lu %lu %lu %lu %lu %lu %lu",
-                &p->procs[index].statm_size,
-                &p->procs[index].statm_resident,
-                &p->procs[index].statm_share,
-                &p->procs[index].statm_trs,
-                &p->procs[index].statm_drs,
-                &p->procs[index].statm_lrs,
-                &p->procs[index].statm_dt
-		);
-	if(ret != 7) {
-		fprintf(stderr,"sscanf wanted 7 returned = %d line=%s\n", ret,buf);
+/* Put every section at the ZZZZ line of index entry i, in a file elmon
+ * wrote the lines of a snapshot all come after it.  Returns 0 if the
+ * index does not fit the file, as when it has been sorted.
+ */
+int csv_seek(long i)
+{
+char *line = csv_data + rec_idx[i].offset;
+int k;
+
+	rec_zwant(line - 1);
+	rec_zwant(line);
+	if((line > csv_data && line[-1] != '\n') || csv_end - line < 8
+	|| memcmp(line, "ZZZZ,T", 6) != 0 || !isdigit(line[6])
+	|| strtol(&line[6], NULL, 10) != rec_idx[i].loop)
 		return 0;
+	for(k = 0; k < csv_secs; k++) {
+		csv_sec[k].pos = (csv_sec[k].start > line) ? csv_sec[k].start : line;
+		csv_sec[k].done = 0;
 	}
 	return 1;
 }
-#ifdef DEBUGPROC 
-print_procs(int index)
-{
-printf("procs[%d].pid           =%d\n",index,procs[index].pi_pid);
-printf("procs[%d].comm[0]       =%s\n",index,&procs[index].pi_comm[0]);
-printf("procs[%d].state         =%c\n",index,procs[index].pi_state);
-printf("procs[%d].ppid          =%d\n",index,procs[index].pi_ppid);
-printf("procs[%d].pgrp          =%d\n",index,procs[index].pi_pgrp);
-printf("procs[%d].session       =%d\n",index,procs[index].pi_session);
-printf("procs[%d].tty_nr        =%d\n",index,procs[index].pi_tty_nr);
-printf("procs[%d].tty_pgrp      =%d\n",index,procs[index].pi_tty_pgrp);
-printf("procs[%d].flags         =%lu\n",index,procs[index].pi_flags);
-printf("procs[%d].minflt       =%lu\n",index,procs[index].pi_minflt);
-printf("procs[%d].cmin_flt     =%lu\n",index,procs[index].pi_cmin_flt);
-printf("procs[%d].majflt       =%lu\n",index,procs[index].pi_majflt);
-printf("procs[%d].cmaj_flt     =%lu\n",index,procs[index].pi_cmaj_flt);
-printf("procs[%d].utime        =%lu\n",index,procs[index].pi_utime);
-printf("procs[%d].stime        =%lu\n",index,procs[index].pi_stime);
-printf("procs[%d].cutime       =%ld\n",index,procs[index].pi_cutime);
-printf("procs[%d].cstime       =%ld\n",index,procs[index].pi_cstime);
-printf("procs[%d].pri           =%d\n",index,procs[index].pi_pri);
-printf("procs[%d].nice          =%d\n",index,procs[index].pi_nice);
-printf("procs[%d].junk          =%d\n",index,procs[index].junk);
-printf("procs[%d].it_real_value =%lu\n",index,procs[index].pi_it_real_value);
-printf("procs[%d].start_time    =%lu\n",index,procs[index].pi_start_time);
-printf("procs[%d].vsize         =%lu\n",index,procs[index].pi_vsize);
-printf("procs[%d].rss           =%lu\n",index,procs[index].pi_rss);
-printf("procs[%d].rlim_cur      =%lu\n",index,procs[index].pi_rlim_cur);
-printf("procs[%d].start_code    =%lu\n",index,procs[index].pi_start_code);
-printf("procs[%d].end_code      =%lu\n",index,procs[index].pi_end_code);
-printf("procs[%d].start_stack   =%lu\n",index,procs[index].pi_start_stack);
-printf("procs[%d].esp           =%lu\n",index,procs[index].pi_esp);
-printf("procs[%d].eip           =%lu\n",index,procs[index].pi_eip);
-printf("procs[%d].pending_signal=%lu\n",index,procs[index].pi_pending_signal);
-printf("procs[%d].blocked_sig   =%lu\n",index,procs[index].pi_blocked_sig);
-printf("procs[%d].sigign        =%lu\n",index,procs[index].pi_sigign);
-printf("procs[%d].sigcatch      =%lu\n",index,procs[index].pi_sigcatch);
-printf("procs[%d].wchan         =%lu\n",index,procs[index].pi_wchan);
-printf("procs[%d].nswap         =%lu\n",index,procs[index].pi_nswap);
-printf("procs[%d].cnswap        =%lu\n",index,procs[index].pi_cnswap);
-printf("procs[%d].exit_signal   =%d\n",index,procs[index].pi_exit_signal);
-printf("procs[%d].cpu           =%d\n",index,procs[index].pi_cpu);
-printf("OK\n");
-}
-#endif /*DEBUG*/
-/* --- */
 
-int isnumbers(char *s)
+/* The tag of the first snapshot at or after time t */
+long csv_find_time(double t)
 {
-	while(*s != 0) {
-		if( *s < '0' || *s > '9')
-			return 0;
-		s++;
+struct csv_section z = csv_sec[CSV_ZZZZ];
+char *line;
+long tag;
+long last = 1;
+
+	z.pos = z.start;
+	z.done = 0;
+	for(tag = 1; ; ) {
+		if((line = csv_line(&z, tag)) == NULL) {
+			if(z.done)
+				return last;
+			tag = strtol(&z.pos[6], NULL, 10);	/* skip to the next one there is */
+			continue;
+		}
+		last = tag;
+		if(csv_time(line) >= t)
+			return tag;
+		tag++;
 	}
-	return 1;
 }
 
-int getprocs(int details)
+/* Load the index from the end of the recording, returns 0 if there is none */
+int rec_index_read()
 {
-struct dirent *dent;
-DIR *procdir;
-int count =0;
+struct rec_in r;
+long long offset = 0;
+long long time = 0;
+long n;
+long i;
 
-	if((char *)(procdir = opendir("/proc")) == NULL) {
-		printf("opendir(/proc) failed");
+	if(rec_file.len < rec_file.pos + 16 || memcmp(&rec_file.data[rec_file.len - 16], REC_IDXMAGIC, 8) != 0)
 		return 0;
+	for(i = 0; i < 8; i++)
+		offset |= (long long)rec_file.data[rec_file.len - 8 + i] << (i * 8);
+	if(offset < rec_file.pos || offset + 2 > rec_file.len - 16)
+		return 0;
+	if(rec_unpack(offset, &r) != 'I' || (n = rec_get_varint(&r)) > r.len)
+		return 0;
+	rec_idx = MALLOC(sizeof(struct rec_index) * (n + 1));
+	for(offset = 0, i = 0; i < n; i++) {
+		rec_idx[i].loop = rec_get_varint(&r);
+		rec_idx[i].time = time += rec_get_zigzag(&r);
+		rec_idx[i].offset = offset += rec_get_varint(&r);
+		rec_idx[i].key = rec_get_byte(&r);
 	}
-	while( (char *)(dent = readdir(procdir)) != NULL ) {
-		if(dent->d_type == 4) { /* is this a directlory */
-/* mainframes report 0 = unknown every time !!!!  */
-/*
-		    printf("inode=%d type=%d name=%s\n",
-				dent->d_ino,	
-				dent->d_type,	
-				dent->d_name);
-*/
-		    if(isnumbers(dent->d_name)) {
-/*			printf("%s pid\n",dent->d_name); */
-			if(details) {
-				count=count+proc_procsinfo(atoi(dent->d_name),count);
-			} else {
-				count++;
-			}
-		    }
-/*
-		    else
-			printf("NOT numbers\n");
-*/
-		}
+	if(r.bad) {
+		FREE(rec_idx);
+		rec_idx = NULL;
+		return 0;
 	}
-	closedir(procdir);
-	return count;
+	rec_frames = rec_idx_size = n;
+	return 1;
 }
-/* --- */
 
-char graph_line[] = "+-------------------------------------------------+";
-/* Start process as specified in cmd in a child process without waiting
- * for completion
- * not sure if want to prevent this funcitonality for root user
- * when: CHLD_START, CHLD_SNAP or CHLD_END
- * cmd:  pointer to command string - assumed to be cleansed ....
- * timestamp_type: 0 - T%04d, 1 - detailed time stamp
- * loop: loop id (0 for CHLD_START)
- * the_time: time to use for timestamp generation
+/* elmon did not get to write the index, so walk the frames from the key
+ * frame at pos decoding just the loop and time
  */
-void child_start(int when,
-                char *cmd,
-                int timestamp_type,
-                int loop,
-                time_t the_time)
+void rec_index_walk(long pos)
 {
-        int i;
-        pid_t child_pid;
-        char time_stamp_str[20]="";
-        char *when_info="";
-        struct tm *tim; /* used to work out the hour/min/second */
+struct rec_in r;
+struct data *s;
+struct data *prev;
+struct data *swap;
+int type;
+
+	s = MALLOC(sizeof(struct data));
+	prev = MALLOC(sizeof(struct data));
+	memset(s, 0, sizeof(struct data));
+	memset(prev, 0, sizeof(struct data));
+	for( ; (type = rec_unpack(pos, &r)) == 'K' || type == 'D'; pos = rec_zin_next) {
+		s->loop = rec_frames;
+		if(rec_ftables > 0 && rec_ftable[0].local == REC_T_DATA)
+			rec_get_table(&r, &rec_ftable[0], s, type == 'K' ? NULL : prev);
+		rec_time(s);
+		rec_idx_add(s->loop, (long long)(s->time * 1000.0), pos, type == 'K');
+		swap = prev;
+		prev = s;
+		s = swap;
+	}
+	FREE(s);
+	FREE(prev);
+}
 
-#ifdef DEBUG2
-fprintf(fp,"child start when=%d cmd=%s time=%d loop=%d\n",when,cmd,timestamp_type,loop);
-#endif 
-        /* Validate parameter and initialize error text */
-        switch( when ) {
-                case CHLD_START:
-                        when_info = "elmon fork exec failure CHLD_START";
-                        break;
-                case CHLD_END:
-                        when_info = "elmon fork exec failure CHLD_END";
-                        break;
+/* Map the recording and set elmon up the way it was when it was recorded */
+void rec_open(char *name)
+{
+struct stat st;
+struct rec_in *r = &rec_file;
+struct rec_in h;
+unsigned long long zlen;
+uLongf hlen;
+char *sname;
+char *value;
+char *p;
+int fd;
+int n;
+int i;
+int k;
+int t;
+int c;
+int slen;
+
+	if((fd = open(name, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		perror("elmon: failed to open the recording");
+		exit(47);
+	}
+	r->len = st.st_size;
+	r->pos = 0;
+	r->bad = 0;
+	r->data = mmap(NULL, r->len ? r->len : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(r->data == MAP_FAILED) {
+		perror("elmon: failed to map the recording");
+		exit(47);
+	}
+	if(r->len > 2 && r->data[0] == 0x1f && r->data[1] == 0x8b)
+		rec_inflate(r, name);
+	if(r->len < 8 || memcmp(r->data, REC_MAGIC, 8) != 0) {
+		if(cursed) {	/* -P plays .nmon files too */
+			csv_open(name);
+			return;
+		}
+		fprintf(stderr, "elmon: %s is not an elmon recording\n", name);
+		exit(47);
+	}
+	r->pos = 8;
+	if(rec_get_varint(r) != REC_VERSION) {
+		fprintf(stderr, "elmon: %s is from a different version of elmon\n", name);
+		exit(47);
+	}
+	memset(&rec_zin, 0, sizeof(rec_zin));
+	if(inflateInit2(&rec_zin, -15) != Z_OK) {
+		fprintf(stderr, "elmon: failed to start decompressing the recording\n");
+		exit(47);
+	}
 
-                case CHLD_SNAP:
-                        /* check if old child has finished - otherwise we do nothing */
-                        if( nmon_children[CHLD_SNAP] != -1 ) {
-                                if(!cursed)fprintf(fp,"ERROR,T%04d, Starting snap command \"%s\" failed as previous child still running - killing it now\n", loop, cmd);
-                                kill( nmon_children[CHLD_SNAP],9);
-                        }
+	/* the rest of the header is read from h, the frames follow it */
+	hlen = h.len = rec_get_varint(r);
+	zlen = rec_get_varint(r);
+	h.pos = 0;
+	h.bad = 0;
+	if(r->bad || zlen > r->len - r->pos || hlen > zlen * 1032 + 64) {
+		fprintf(stderr, "elmon: %s has a damaged header\n", name);
+		exit(47);
+	}
+	h.data = MALLOC(hlen + 1);
+	if(uncompress(h.data, &hlen, &r->data[r->pos], zlen) != Z_OK || hlen != h.len) {
+		fprintf(stderr, "elmon: %s has a damaged header\n", name);
+		exit(47);
+	}
+	r->pos += zlen;
+	r = &h;
+
+	n = rec_get_varint(r);
+	for(i = 0; i < n && !r->bad; i++) {
+		sname = rec_get_strdup(r);
+		value = rec_get_strdup(r);
+		if(!strcmp(sname, "host"))
+			strncpy(hostname, value, sizeof(hostname) - 1);
+		else if(!strcmp(sname, "runname"))
+			strncpy(run_name, value, sizeof(run_name) - 1);
+		else if(!strcmp(sname, "interval"))
+			seconds = atoi(value);
+		else if(!strcmp(sname, "cpus"))
+			cpus = atoi(value);
+		else if(!strcmp(sname, "max_cpus"))
+			max_cpus = atoi(value);
+		else if(!strcmp(sname, "diskmax"))
+			diskmax = atoi(value);
+		else if(!strcmp(sname, "disks_per_line"))
+			disks_per_line = atoi(value);
+		else if(!strcmp(sname, "psi"))
+			psi_available = atoi(value);
+		else if(cursed)
+			;	/* -P leaves what is shown to the keys */
+		else if(!strcmp(sname, "options")) {
+			while(optionCount > 0)
+				remove_option(enabled_options[0]);
+			for(p = value; *p; p++)
+				if(p == value || p[-1] == ',')
+					add_option(atoi(p));
+		} else if(!strcmp(sname, "disk_mode"))
+			show_disk_mode = atoi(value);
+		else if(!strcmp(sname, "topmode"))
+			show_topmode = atoi(value);
+		else if(!strcmp(sname, "containers"))
+			show_containers = atoi(value);
+		else if(!strcmp(sname, "threshold"))
+			ignore_procdisk_threshold = atof(value);
+		else if(!strcmp(sname, "rrd")) {
+			show_rrd = atoi(value);
+			if(show_rrd)
+				enc = &encoders[ENC_RRD];
+		}
+		FREE(sname);
+		FREE(value);
+	}
+	rec_text = rec_get_strdup(r);
+	rec_text_len = strlen(rec_text);
+
+	jfses = rec_get_varint(r);
+	if(jfses > JFSMAX)
+		jfses = JFSMAX;
+	for(i = 0; i < jfses && !r->bad; i++) {
+		value = rec_get_string(r, &slen);
+		snprintf(jfs[i].name, JFSNAMELEN, "%.*s", slen, value);
+		value = rec_get_string(r, &slen);
+		snprintf(jfs[i].device, JFSNAMELEN, "%.*s", slen, value);
+		value = rec_get_string(r, &slen);
+		snprintf(jfs[i].type, JFSNAMELEN, "%.*s", slen, value);
+		jfs[i].mounted = rec_get_varint(r);
+	}
 
-                        when_info = "elmon fork exec failure CHLD_SNAP";
-                        break;
-        }
+	/* match the tables and columns in the file up with ours by name */
+	rec_ftables = rec_get_varint(r);
+	rec_ftable = MALLOC(sizeof(struct rec_ftable) * (rec_ftables + 1));
+	for(i = 0; i < rec_ftables && !r->bad; i++) {
+		sname = rec_get_strdup(r);
+		rec_ftable[i].key = (int)rec_get_varint(r) - 1;
+		rec_ftable[i].cols = rec_get_varint(r);
+		rec_ftable[i].local = -1;
+		for(t = 0; t < REC_TABLES; t++)
+			if(!strcmp(sname, rec_table[t].name))
+				rec_ftable[i].local = t;
+		FREE(sname);
+		rec_ftable[i].col = MALLOC(sizeof(struct rec_fcol) * (rec_ftable[i].cols + 1));
+		for(k = 0; k < rec_ftable[i].cols && !r->bad; k++) {
+			sname = rec_get_strdup(r);
+			rec_ftable[i].col[k].kind  = rec_get_varint(r);
+			rec_ftable[i].col[k].size  = rec_get_varint(r);
+			rec_ftable[i].col[k].count = rec_get_varint(r);
+			rec_ftable[i].col[k].local = NULL;
+			t = rec_ftable[i].local;
+			for(c = 0; t >= 0 && c < rec_table[t].cols; c++)
+				if(!strcmp(sname, rec_table[t].col[c].name)
+				&& rec_table[t].col[c].kind == rec_ftable[i].col[k].kind
+				&& (rec_table[t].col[c].kind == REC_INT || rec_table[t].col[c].kind == REC_STRING
+				    || rec_table[t].col[c].size == rec_ftable[i].col[k].size))
+					rec_ftable[i].col[k].local = &rec_table[t].col[c];
+			FREE(sname);
+		}
+		/* without the key column the elements can not be matched up */
+		t = rec_ftable[i].local;
+		if(t >= 0 && (rec_table[t].key >= 0) != (rec_ftable[i].key >= 0))
+			rec_ftable[i].local = -1;
+	}
+	if(r->bad) {
+		fprintf(stderr, "elmon: %s has a damaged header\n", name);
+		exit(47);
+	}
+	FREE(h.data);
+	r = &rec_file;
+
+	if(!rec_index_read()) {
+		/* take the .idx up to its last key frame and walk on from there */
+		idx_read(name, r->len);
+		for(i = rec_frames - 1; i >= 0; i--)
+			if(rec_idx[i].key && rec_idx[i].offset >= r->pos && rec_unpack(rec_idx[i].offset, &h) == 'K')
+				break;
+		rec_frames = (i > 0) ? i : 0;
+		rec_index_walk(rec_frames ? rec_idx[i].offset : r->pos);
+	}
+	if(rec_frames < 2) {
+		fprintf(stderr, "elmon: %s has no snapshots\n", name);
+		exit(47);
+	}
+	if(!cursed) {	/* --to-nmon goes flat out and stops at the end, -P waits there */
+		maxloops = rec_idx[rec_frames - 1].loop;
+		play_speed = 0;
+	}
+}
 
+struct data *rec_first = NULL;	/* the start of the first interval */
 
-        /* now fork off a child process. */
-        switch (child_pid = fork()) {
-                case -1:        /* fork failed. */
-                        perror(when_info);
-                        return;
+struct data *play_read(struct data *prev)
+{
+	if(play_csv)
+		return csv_frame(prev, prev ? prev->loop + 1 : 0);
+	return rec_read_frame(prev);
+}
 
-                case 0:         /* inside child process.  */
-                        /* create requested timestamp */
-                        if( timestamp_type == 1 ) {
-                                tim = localtime(&the_time);
-                                sprintf(time_stamp_str,"%02d:%02d:%02d,%02d,%02d,%04d",
-                                       tim->tm_hour, tim->tm_min, tim->tm_sec,
-                                       tim->tm_mday, tim->tm_mon + 1, tim->tm_year + 1900);
-                        }
-                        else {
-                                sprintf(time_stamp_str,"T%04d", loop);
-                        }
+/* Decode the snapshot before the one asked for and return it, so the
+ * caller carries on from there.  Binary recordings start from the key
+ * frame before it, .nmon files go back to the start if it is behind.
+ */
+struct data *play_jump(long long to, struct data *cur)
+{
+struct data *s;
+struct data *next;
+long tag;
+long i;
+long k;
+
+	if(play_csv) {
+		if(rec_frames > 0 && (i = rec_idx_find(to)) > 0 && csv_seek(i - 1))
+			return csv_frame(NULL, rec_idx[i - 1].loop);
+		tag = (to > 0) ? to - 1 : csv_find_time(-to / 1000.0);
+		if(tag < 1)
+			tag = 1;
+		if(tag - 1 <= cur->loop)
+			csv_rewind();
+		return csv_frame(NULL, tag - 1);
+	}
+	if((i = rec_idx_find(to)) < 1)
+		i = 1;
+	for(k = i - 1; k > 0 && !rec_idx[k].key; k--)
+		;
+	rec_file.pos = rec_idx[k].offset;
+	if((s = rec_read_frame(NULL)) == NULL)
+		return NULL;
+	for( ; k < i - 1; k++) {
+		if((next = rec_read_frame(s)) == NULL)
+			break;
+		snapshot_free(s);
+		s = next;
+	}
+	return s;
+}
+
+void play_push(struct data *s)
+{
+	while(!ring_push(s))
+		usleep(1000);
+	if(write(ring_notify[1], "s", 1) != 1)
+		/* pipe full, the UI has a wake up waiting anyway */ ;
+}
+
+/* Stands in for the collector thread and hands the recorded snapshots to
+ * the UI thread, at the speed they were recorded or faster.  --to-nmon
+ * stops at maxloops, -P waits at the end for a jump back.
+ */
+void *player(void *arg)
+{
+struct data *cur = rec_first;
+struct data *next;
+struct data *s;
+long long to;
+double wait;
+double step;
+int speed;
+int jumped = 0;
+
+	for(;;) {
+		if((to = __atomic_exchange_n(&play_seek, 0, __ATOMIC_ACQUIRE)) != 0) {
+			if((next = play_jump(to, cur)) != NULL) {
+				snapshot_free(cur);
+				cur = next;
+				s = snapshot_copy(cur);
+				s->restart = 1;
+				play_push(s);
+				jumped = 1;
+				__atomic_store_n(&play_end, 0, __ATOMIC_RELAXED);
+			}
+		}
+		if(__atomic_load_n(&play_hold, __ATOMIC_RELAXED) || __atomic_load_n(&play_end, __ATOMIC_RELAXED)) {
+			usleep(50000);
+			continue;
+		}
+		if((next = play_read(cur)) == NULL) {
+			if(!cursed) {
+				fprintf(stderr, "elmon: %s is damaged after snapshot %d\n", rec_in_name, cur->loop);
+				exit(47);
+			}
+			__atomic_store_n(&play_end, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		/* in steps, a jump or a change of speed should not have to wait */
+		wait = jumped ? 0.0 : next->time - cur->time;
+		jumped = 0;
+		while(wait > 0.0 && (speed = __atomic_load_n(&play_speed, __ATOMIC_RELAXED)) > 0
+		&& __atomic_load_n(&play_seek, __ATOMIC_RELAXED) == 0) {
+			step = (wait / speed < 0.05) ? wait / speed : 0.05;
+			usleep(step * 1000000.0);
+			wait -= step * speed;
+		}
+		play_push(snapshot_copy(next));
+		snapshot_free(cur);
+		cur = next;
+		if(!cursed && cur->loop >= maxloops)
+			break;
+	}
+	return NULL;
+}
+
+int rec_line_compare(const void *a, const void *b)
+{
+char *x = *(char **)a;
+char *y = *(char **)b;
 
-                        /* close all open file pointers except the defaults */
-                        for( i=3; i<5; ++i )
-                                close(i);
+	while(*x == *y && *x != '\n') {
+		x++;
+		y++;
+	}
+	return (unsigned char)*x - (unsigned char)*y;
+}
 
-                        /* Now switch to the defined command */
-                        execlp(cmd, cmd, time_stamp_str,(void *)0);
+/* --to-nmon gives the file in the order "sort" would have put it */
+void rec_sort(char *name)
+{
+struct stat st;
+char **line;
+char *data;
+char tmp[1024];
+long lines = 0;
+long i;
+FILE *out;
+int fd;
+
+	if((fd = open(name, O_RDONLY)) == -1 || fstat(fd, &st) == -1 || st.st_size == 0)
+		return;
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return;
+	for(i = 0; i < st.st_size; i++)
+		if(data[i] == '\n')
+			lines++;
+	line = MALLOC(sizeof(char *) * (lines + 1));
+	for(lines = 0, i = 0; i < st.st_size; i++)
+		if(i == 0 || data[i - 1] == '\n')
+			if(data[i] != '\n')
+				line[lines++] = &data[i];
+	/* a last line without a newline stays the last line */
+	if(data[st.st_size - 1] != '\n')
+		lines--;
+	qsort(line, lines, sizeof(char *), rec_line_compare);
+
+	snprintf(tmp, sizeof(tmp), "%s.sort", name);
+	if((out = fopen(tmp, "w")) == NULL) {
+		perror("elmon: failed to sort the output");
+		return;
+	}
+	for(i = 0; i < lines; i++)
+		fwrite(line[i], 1, strchr(line[i], '\n') - line[i] + 1, out);
+	if(data[st.st_size - 1] != '\n')
+		fwrite(line[lines], 1, data + st.st_size - line[lines], out);
+	if(fclose(out) != 0) {
+		perror("elmon: failed to sort the output");
+		unlink(tmp);
+	} else
+		rename(tmp, name);
+	munmap(data, st.st_size);
+	FREE(line);
+}
 
-                        /* If we get here the specified command could not be started */
-                        perror(when_info);
-                        exit(1);                     /* We can't do anything more */
-                        /* never reached */
+/* One snapshot of the -f disk sections for n disks, with printf as it
+ * used to be or with the encoder e
+ */
+void bench_disks(double *v, char **name, int n, struct encoder *e)
+{
+int m;
+int i;
 
-                default:        /* inside parent process. */
-                        /* In father - remember child pid for future */
-                        nmon_children[when] = child_pid;
-        }
+	enc = e;
+	for(m = 0; m < 5; m++) {
+		for(i = 0; i < n; i++) {
+			if(e != NULL) {
+				if(NEWDISKGROUP(i)) {
+					if(i > 0)
+						enc_end();
+					disk_begin(m, i);
+				}
+				enc_num(name[i], v[m * n + i], 1);
+			} else {
+				if(NEWDISKGROUP(i))
+					fprintf(fp, "%s%s%s,%s", (m > 0 || i > 0) ? "\n" : "", disk_section[m], dskgrp(i), LOOP);
+				fprintf(fp, ",%.1f", v[m * n + i]);
+			}
+		}
+		if(e != NULL)
+			enc_end();
+	}
+	if(e == NULL)
+		fprintf(fp, "\n");
+}
+
+/* elmon --bench-format [disks]: how fast the disk sections can be put
+ * out, per value printf against each encoder, and that printf and the
+ * CSV encoder give the same text
+ */
+void bench_format(int n)
+{
+struct timespec t0;
+struct timespec t1;
+double *v;
+char **name;
+double took;
+char *data;
+char *first[2];
+size_t len;
+size_t first_len[2];
+long long bytes;
+long count;
+unsigned long seed = 1;
+int i;
+int k;
+
+	if(n < 1)
+		n = 4000;
+	v = MALLOC(sizeof(double) * n * 5);
+	name = MALLOC(sizeof(char *) * n);
+	for(i = 0; i < n * 5; i++) {
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		switch((seed >> 33) % 4) {	/* idle disks, busy %, KB/s and block sizes */
+		case 0:	v[i] = 0.0;				break;
+		case 1:	v[i] = (seed >> 40) % 1000 / 10.0;	break;
+		case 2:	v[i] = (seed >> 20) % 100000000 / 97.0;	break;
+		default: v[i] = (seed >> 30) % 5120 / 3.0;	break;
+		}
+	}
+	for(i = 0; i < n; i++) {
+		name[i] = MALLOC(16);
+		snprintf(name[i], 16, "sd%d", i);
+	}
+	timer = time(NULL);
+	printf("%d disks, %d values a snapshot\n", n, n * 5);
+	for(k = -1; k == -1 || encoders[k].name != NULL; k++) {
+		count = 0;
+		bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		do {
+			loop = count + 1;
+			if((fp = open_memstream(&data, &len)) == NULL) {
+				perror("elmon: failed to buffer the output");
+				exit(42);
+			}
+			bench_disks(v, name, n, k < 0 ? NULL : &encoders[k]);
+			fclose(fp);
+			bytes += len;
+			if(count++ == 0 && k <= ENC_CSV) {
+				first[k + 1] = data;
+				first_len[k + 1] = len;
+			} else
+				free(data);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1.0e9;
+		} while(took < 2.0);
+		printf("%-7s %8.1f snapshots/s %8.1f MB/s %7.1f ns a value\n", k < 0 ? "fprintf" : encoders[k].name,
+			count / took, bytes / took / 1024.0 / 1024.0, took * 1.0e9 / count / (n * 5));
+	}
+	printf("csv output %s\n", (first_len[0] == first_len[1] && memcmp(first[0], first[1], first_len[0]) == 0) ?
+		"identical" : "DIFFERENT");
+	fp = NULL;
+}
+
+/* elmon --bench-io [intervals]: the system calls and time it takes to
+ * read the files collect() reads every interval, through the io_uring
+ * and with a pread() each
+ */
+void bench_io(int n)
+{
+struct timespec t0;
+struct timespec t1;
+struct rusage r0;
+struct rusage r1;
+double took;
+double cpu;
+long bytes;
+int mask = PROC_BATCH | (1 << P_NFS) | (1 << P_NFSD);
+int files;
+int num;
+int i;
+int k;
+
+	if(n < 1)
+		n = 10000;
+	printf("%d intervals\n", n);
+	for(k = 0; k < 2; k++) {
+#ifdef URING
+		if(k == 0) {
+			uring_setup();
+			if(uring.fd < 0) {
+				printf("io_uring  not available\n");
+				continue;
+			}
+		} else
+			uring_teardown();
+#else
+		if(k == 0) {
+			printf("io_uring  not compiled in\n");
+			continue;
+		}
+#endif /* URING */
+		proc_batch(mask);	/* open the files and size the buffers */
+		for(num = 0; num < P_NUMBER; num++)
+			if(proc[num].len < 0)	/* no NFS */
+				mask &= ~(1 << num);
+		proc_syscalls = 0;
+		getrusage(RUSAGE_SELF, &r0);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for(i = 0; i < n; i++) {
+			for(num = 0; num < P_NUMBER; num++)
+				proc[num].batched = 0;
+			proc_batch(mask);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		getrusage(RUSAGE_SELF, &r1);
+		took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1.0e9;
+		cpu = (r1.ru_utime.tv_sec - r0.ru_utime.tv_sec + r1.ru_stime.tv_sec - r0.ru_stime.tv_sec)
+		    + (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec + r1.ru_stime.tv_usec - r0.ru_stime.tv_usec) / 1.0e6;
+		for(files = 0, bytes = 0, num = 0; num < P_NUMBER; num++)
+			if((mask & (1 << num)) && proc[num].len > 0) {
+				files++;
+				bytes += proc[num].len;
+			}
+		printf("%-9s %2d files %7ld bytes %5.1f system calls %8.1f us %8.1f us CPU an interval\n",
+			k == 0 ? "io_uring" : "pread", files, bytes, (double)proc_syscalls / n,
+			took * 1.0e6 / n, cpu * 1.0e6 / n);
+	}
+	for(num = 0; num < P_NUMBER; num++)
+		proc[num].batched = 0;
 }
 
 int main(int argc, char **argv)
 {
-	int secs;
 	char mapch;
 	//int old_cpus; //Doesn't appear to be needed (Brian)
 	int mapnum;
@@ -3463,8 +12665,13 @@ int main(int argc, char **argv)
 	int	i=0;
 	int	j=0;
 	int	k=0;
+	long long seek;		/* --to-nmon window end */
+	char	col[64];		/* -f column names */
+	int	m;			/* disk section */
 	int	ret=0;
 	int	max_sorted;
+	int	fresh = 0;		/* p is a new snapshot, not a redraw */
+	char	*endptr;
 	int	skipped;
 	double	elapsed;		/* actual seconds between screen updates */
 	double	cpu_sum;
@@ -3477,7 +12684,6 @@ int main(int argc, char **argv)
 #endif /* POWER */
 	int	smp_first_time =1;
 	int	proc_first_time =1;
-	pid_t	firstproc = (pid_t)0;
 	pid_t childpid = -1;
 	int ralfmode = 0;
 	long	xfers;
@@ -3513,7 +12719,7 @@ int main(int argc, char **argv)
 	char *formatstring;
 	char user_filename[512];
 	char user_filename_set = 0;
-	struct statfs statfs_buffer;
+	int recording = 0;		/* -B */
 	float fs_size;
 	float fs_free;
 	float fs_size_used;
@@ -3546,6 +12752,10 @@ int main(int argc, char **argv)
 	WINDOW * padlpar = NULL;
 	WINDOW * padverb = NULL;
 	WINDOW * padhelp = NULL;
+	WINDOW * padirq = NULL;
+	WINDOW * padpsi = NULL;
+	WINDOW * padcg = NULL;
+	WINDOW * padnuma = NULL;
 
         char  *nmon_start = (char *)NULL;
         char  *nmon_end   = (char *)NULL;
@@ -3561,14 +12771,6 @@ int main(int argc, char **argv)
 #define MAXROWS 256
 #define MAXCOLS 150
 
-#define BANNER(pad,string) {mvwhline(pad, 0, 0, ACS_HLINE,maxcols-2); \
-                                        wmove(pad,0,0); \
-                                        wattron(pad,A_STANDOUT); \
-                                        wprintw(pad," "); \
-                                        wprintw(pad,string); \
-                                        wprintw(pad," "); \
-                                        wattroff(pad,A_STANDOUT); }
-
 	/* check the user supplied options */
 	progname = argv[0];
 	for (i=(int)strlen(progname)-1;i>0;i--)
@@ -3582,6 +12784,10 @@ int main(int argc, char **argv)
 		error_on=1;
 	if(getenv("NMONBUG1") != NULL) 
 		reread=1;
+#ifdef URING
+	if((nmon_tmp = getenv("NMONURING")) != NULL)
+		uring_on = atoi(nmon_tmp);
+#endif /* URING */
         if (getenv("NMONDEBUG") != NULL)
                 debug = 1;
 
@@ -3641,7 +12847,38 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 
 	proc_init();
 
-	while ( -1 != (i = getopt(argc, argv, "?Rhs:bc:d:DfF:r:tTxXzeEl:qpC:Vg:Nm:I:Z" ))) {
+	if(argc >= 2 && strcmp(argv[1], "--bench-format") == 0) {
+		bench_format(argc >= 3 ? atoi(argv[2]) : 4000);
+		exit(0);
+	}
+	if(argc >= 2 && strcmp(argv[1], "--bench-io") == 0) {
+		bench_io(argc >= 3 ? atoi(argv[2]) : 10000);
+		exit(0);
+	}
+	if(argc >= 3 && strcmp(argv[1], "--rra-dump") == 0) {
+		rra_dump(argv[2], argc >= 4 ? argv[3] : NULL);
+		exit(0);
+	}
+	if(argc >= 3 && strcmp(argv[1], "--to-nmon") == 0) {
+		rec_in_name = argv[2];
+		if(argc >= 5)
+			play_from = argv[4];
+		if(argc >= 6)
+			play_to = argv[5];
+		if(argc >= 4) {
+			snprintf(user_filename, sizeof(user_filename), "%s", argv[3]);
+		} else {
+			snprintf(user_filename, sizeof(user_filename) - 6, "%s", argv[2]);
+			if((str_p = strrchr(user_filename, '.')) != NULL && strchr(str_p, '/') == NULL)
+				*str_p = 0;
+			strcat(user_filename, ".nmon");
+		}
+		user_filename_set = 1;
+		cursed = 0;
+		argc = 1;
+	}
+
+	while ( -1 != (i = getopt(argc, argv, "?RA:a:khs:bc:d:DfF:B:P:r:tTxXzeEl:qpC:Vg:Nm:I:ZiSw:G:KUH:W:O:jL:M:Q:Y:u:" ))) {
 		switch (i) {
 		case '?':
 			hint();
@@ -3654,6 +12891,15 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 			if (seconds == 0 )
 				seconds = 2 * 10;  //Default to 2 seconds
 			break;
+		case 'a':
+			if((roll_base = atof(optarg) * 10) <= 0) {
+				printf("%s: -a needs the seconds between samples, like 1 or 0.5\n", progname);
+				exit(48);
+			}
+			break;
+		case 'k':
+			sched_align = 1;
+			break;
 		case 'p':
 			ralfmode = 1;
 			break;
@@ -3666,6 +12912,89 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		case 'N':
 			add_option(SHOW_NFS);
 			break;
+		case 'i':
+			add_option(SHOW_IRQ);
+			break;
+		case 'S':
+			add_option(SHOW_PSI);
+			break;
+		case 'w':
+			psi_trigger_us = atoi(optarg);
+			add_option(SHOW_PSI);
+			break;
+		case 'U':
+			add_option(SHOW_NUMA);
+			break;
+		case 'H':
+			hist_max = strtol(optarg, &endptr, 10);
+			if(*endptr == 'm' || *endptr == 'M') {	/* a memory budget instead */
+				hist_budget = hist_max * 1024 * 1024;
+				hist_max = LONG_MAX;
+			}
+			if(hist_max < 2 || hist_budget <= 0) {
+				printf("%s: -H needs a count of 2 or more or a size like 100M\n", progname);
+				exit(45);
+			}
+			break;
+		case 'W':
+			out_sync = atoi(optarg);
+			break;
+		case 'M': /* background mode serving Prometheus instead of a file */
+			prom_listen = optarg;
+			go_background(-1, 150);
+			break;
+		case 'Q': /* background mode pushing to Graphite or StatsD */
+			push_to = optarg;
+			go_background(-1, 600);
+			break;
+		case 'Y': /* background mode keeping the snapshot in shared memory */
+			shm_name = optarg;
+			go_background(-1, 10);
+			break;
+		case 'u':
+			ctl_path = optarg;
+			break;
+		case 'j':
+			out_gzip = 1;
+			break;
+		case 'L':
+			if(strcmp(optarg, "hour") == 0)
+				out_rotate_period = OUT_HOUR;
+			else if(strcmp(optarg, "day") == 0)
+				out_rotate_period = OUT_DAY;
+			else {
+				out_rotate_size = strtoll(optarg, &endptr, 10) * 1024 * 1024;
+				if(out_rotate_size <= 0 || (*endptr != 'm' && *endptr != 'M' && *endptr != 0)) {
+					printf("%s: -L needs hour, day or a size like 100M\n", progname);
+					exit(48);
+				}
+			}
+			break;
+		case 'O': /* the format of -f and -F output */
+			for(enc = encoders; enc->name != NULL; enc++)
+				if(strcmp(enc->name, optarg) == 0)
+					break;
+			if(enc->name == NULL) {
+				printf("%s: -O needs one of csv, rrd, json or influx\n", progname);
+				exit(48);
+			}
+			show_rrd = (enc == &encoders[ENC_RRD]);
+			if(enc != &encoders[ENC_CSV]) {	/* the lines are all records */
+				show_aaa = 0;
+				show_para = 0;
+				show_headings = 0;
+			}
+			break;
+		case 'K':
+			show_containers = 1;
+			add_option(SHOW_TOP);
+			show_topmode = cursed ? 2 : 3;
+			break;
+		case 'G':
+			cg_root = optarg;
+			cg_explicit = 1;
+			add_option(SHOW_CGROUP);
+			break;
 		case 'm':
 			if(chdir(optarg) == -1) {
 				perror("changing directory failed");
@@ -3680,12 +13009,16 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 			diskmax = atoi(optarg);
 			break;
 		case 'R':
-			show_rrd = 1;
-			go_background(288, 300);
+			show_rrd = 0;
+			enc = &enc_rra;
+			go_background(-1, 300);
 			show_aaa = 0;
 			show_para = 0;
 			show_headings = 0;
 			break;
+		case 'A':
+			rra_spec = optarg;
+			break;
 		case 'r': strcpy(run_name,optarg); 
 			run_name_set++;
 			break;
@@ -3694,6 +13027,15 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 			user_filename_set++;
 			go_background(288, 300);
 			break;
+		case 'P': /* play a -B recording or .nmon file on the screen */
+			rec_in_name = optarg;
+			break;
+		case 'B': /* like -F but a binary recording, see --to-nmon */
+			strcpy(user_filename,optarg);
+			user_filename_set++;
+			go_background(288, 300);
+			recording = 1;
+			break;
 
 		case 'f': /* background mode i.e. for spread sheet output */
 			go_background(288, 300);
@@ -3753,38 +13095,118 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		}
 	}
 	/* Set parameters if not set by above */
+	if (recording && enc != &encoders[ENC_CSV]) {
+		printf("%s: -B records the CSV, leave out -O and -R\n", progname);
+		exit(48);
+	}
+	if (enc == &enc_rra) {
+		if(user_filename_set || rec_in_name != NULL || out_gzip || out_rotate_size > 0 || out_rotate_period) {
+			printf("%s: -R keeps archives instead of a file, leave out -F, -P, -j and -L\n", progname);
+			exit(48);
+		}
+		if(rra_parse(rra_spec) == -1) {
+			printf("%s: -A needs tiers of step:keep like 1m:1d,5m:1w,1h:1y\n", progname);
+			exit(48);
+		}
+	}
+	if (prom_listen != NULL) {
+		if(enc != &encoders[ENC_CSV] || user_filename_set || rec_in_name != NULL) {
+			printf("%s: -M serves the metrics instead of a file, leave out -F, -B, -P, -O and -R\n", progname);
+			exit(48);
+		}
+		enc = &enc_prom;
+		top_max = PROM_TOP;
+		show_aaa = 0;
+		show_para = 0;
+		show_headings = 0;
+		prom_open();
+	}
+	if (push_to != NULL) {
+		if(enc != &encoders[ENC_CSV] || user_filename_set || rec_in_name != NULL || prom_listen != NULL
+		|| out_gzip || out_rotate_size > 0 || out_rotate_period) {
+			printf("%s: -Q sends the metrics instead of a file, leave out -F, -B, -P, -O, -R, -M, -j and -L\n", progname);
+			exit(48);
+		}
+		top_max = PROM_TOP;
+		show_aaa = 0;
+		show_para = 0;
+		show_headings = 0;
+		push_open();
+	}
+	if (shm_name != NULL) {
+		if(enc != &encoders[ENC_CSV] || user_filename_set || rec_in_name != NULL || prom_listen != NULL
+		|| push_to != NULL || out_gzip || out_rotate_size > 0 || out_rotate_period) {
+			printf("%s: -Y puts the metrics in shared memory instead of a file, leave out -F, -B, -P, -O, -R, -M, -Q, -j and -L\n", progname);
+			exit(48);
+		}
+		enc = &enc_shm;
+		top_max = PROM_TOP;
+		show_aaa = 0;
+		show_para = 0;
+		show_headings = 0;
+		shm_create();
+	}
+	if (ctl_path != NULL) {
+		if(cursed) {
+			printf("%s: -u controls elmon in the background, use it with -f, -F, -B, -M, -Q or -Y\n", progname);
+			exit(48);
+		}
+		ctl_open();
+	}
+	if (recording && (out_gzip || out_rotate_size > 0 || out_rotate_period)) {
+		printf("%s: -j and -L are for -f and -F, -B recordings are compact already\n", progname);
+		exit(48);
+	}
 	if (maxloops == -1)
 		maxloops = 9999999;
 	if (seconds  == -1)
 		seconds = 2 * 10;
+	if (roll_base > 0) {
+		if(cursed || recording || rec_in_name != NULL || enc == &enc_rra || prom_listen != NULL
+		|| push_to != NULL || shm_name != NULL || ctl_path != NULL) {
+			printf("%s: -a is for -f and -F files, leave out -B, -P, -R, -M, -Q, -Y and -u\n", progname);
+			exit(48);
+		}
+		if(seconds % roll_base != 0 || seconds / roll_base < 2) {
+			printf("%s: -s has to be a multiple of -a\n", progname);
+			exit(48);
+		}
+		roll_every = seconds / roll_base;
+		roll_pool = MALLOC(sizeof(struct roll) * ROLL_SERIES);
+		roll_reset();
+	}
+	if (psi_trigger_us > 0)
+		psi_trigger_init();
         if (cursed)
 		remove_option(SHOW_DGROUP);
+	if (rec_in_name != NULL)
+		rec_open(rec_in_name);
 
-	/* To get the pointers setup */
-	switcher();
-
-	/* Initialise the time stamps for the first loop */
-	p->time = doubletime();
-	q->time = doubletime();
+	/* Until the collector thread starts the main thread fills in the work area */
+	p = &work;
 
 	find_release();
 
 	proc_read(P_STAT);
-        for(i=1;i<proc[P_STAT].lines;i++) {
+        for(i=1;i<proc[P_STAT].lines && rec_in_name == NULL;i++) {
                 if(strncmp("cpu",proc[P_STAT].line[i],3) == 0)
                         max_cpus = cpus=i;
                 else
                         break;
         }
-	proc_read(P_STAT);
-	proc_cpu();
-	proc_read(P_UPTIME);
-	proc_read(P_LOADAVG);
-	proc_kernel();
-	memcpy(&q->cpu_total, &p->cpu_total, sizeof(struct cpu_stat));
+#ifdef POWER
+	lparcfg.timebase=0;
+	proc_read(P_CPUINFO);
+	for(i=0;i<proc[P_CPUINFO].lines-1;i++) {
+		if(!strncmp("timebase",proc[P_CPUINFO].line[i],8)) {
+			sscanf(proc[P_CPUINFO].line[i],"timebase : %lld",&lparcfg.timebase);
+			break;
+		}
+	}
+#endif /*POWER*/
 
 	p->dk = malloc(sizeof(struct dsk_stat) * diskmax+1);	
-	q->dk = malloc(sizeof(struct dsk_stat) * diskmax+1);	
+	memset(p->dk, 0, sizeof(struct dsk_stat) * diskmax);
 	disk_busy_peak = malloc(sizeof(double) * diskmax);
 	disk_rate_peak = malloc(sizeof(double) * diskmax);
 	for(i=0;i<diskmax;i++) {
@@ -3798,31 +13220,58 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 
 	n = getprocs(0);
 	p->procs = malloc(sizeof(struct procsinfo ) * n  +8);
-	q->procs = malloc(sizeof(struct procsinfo ) * n  +8);
-	p->nprocs = q->nprocs = n;
+	procs_size = n;
+	p->fs = malloc(sizeof(struct fs_stat) * JFSMAX);
 
 	/* Initialise the top processes table */
 	topper = malloc(sizeof(struct topper ) * topper_size); /* round up */
 
-	/* Get Disk Stats. */
-	proc_disk(0.0);
-	memcpy(q->dk, p->dk, sizeof(struct dsk_stat) * disks);
+	/* Probe once here, the collector thread only reads these later */
+	if(rec_in_name == NULL)
+		psi_available = (access("/proc/pressure", F_OK) == 0);
+	if(cg_rootfd == -1)
+		cg_init();
+
+	/* First snapshot, the start of the first interval */
+	if(rec_in_name != NULL) {
+		if((rec_first = play_read(NULL)) == NULL) {
+			fprintf(stderr, "elmon: %s is damaged\n", rec_in_name);
+			exit(47);
+		}
+		disks = rec_first->disks;
+		networks = rec_first->networks;
+		/* a window of a long recording, the index takes the player there */
+		if(play_from != NULL && (play_seek = play_when(play_from, rec_first->tv.tv_sec)) == 0) {
+			printf("%s: %s is not T<snapshot> or [dd-MON-yyyy] hh:mm[:ss]\n", progname, play_from);
+			exit(47);
+		}
+		if(play_to != NULL) {
+			if((seek = play_when(play_to, rec_first->tv.tv_sec)) == 0) {
+				printf("%s: %s is not T<snapshot> or [dd-MON-yyyy] hh:mm[:ss]\n", progname, play_to);
+				exit(47);
+			}
+			maxloops = rec_idx[rec_idx_find(seek)].loop;
+		}
+	} else
+		collect();
 
         /* load dgroup - if required */
         if (dgroup_loaded == 1) {
                 load_dgroup(p->dk);
         }
 
-	/* Get Network Stats. */
-	proc_net();
-	memcpy(q->ifnets, p->ifnets, sizeof(struct net_stat) * networks);
 	for(i=0;i<networks;i++) {
 		net_read_peak[i]=0.0;
 		net_write_peak[i]=0.0;
 	}
 
-	/* Set the pointer ready for the next round */
-	switcher();
+	/* From here on the UI thread only looks at snapshots */
+	if(!cursed && ctl_path == NULL)	/* the file gets each one as it comes, -u history keeps -H */
+		hist_max = 2;
+	history_add(snapshot_copy(rec_in_name ? rec_first : &work));
+	p = hist_newest;
+	if(cursed)
+		ts_save(p);
 
 	/* Initialise signal handlers so we can tidy up curses on exit */
 	signal(SIGUSR1, interrupt);
@@ -3888,15 +13337,30 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		padres = newpad(23,MAXCOLS);
 		padnfs = newpad(25,MAXCOLS);
 		padtop = newpad(MAXROWS,MAXCOLS);
+		padirq = newpad(IRQ_TOPN + 20,MAXCOLS);
+		padpsi = newpad(8,MAXCOLS);
+		padcg = newpad(CG_TOPN + 5,MAXCOLS);
+		padnuma = newpad(NUMAMAX + 5,MAXCOLS);
 
 
+	} else if(rec_in_name != NULL) {
+		/* the header lines were recorded, all that is left is the data */
+		if((fp = fopen(user_filename, "w")) == 0) {
+			perror("elmon: failed to open output file");
+			printf("elmon: output filename=%s\n", user_filename);
+			exit(42);
+		}
+		out_open(fp, user_filename);
+		fputs(rec_text, fp);
 	} else {
 		/* Output the header lines for the spread sheet */
 		timer = time(0);
 		tim = localtime(&timer);
 		tim->tm_year += 1900 - 2000;  /* read localtime() manual page!! */
 		tim->tm_mon  += 1; /* because it is 0 to 11 */
-		if(varperftmp)
+		if(prom_fd >= 0 || push_to != NULL || shm_name != NULL || enc == &enc_rra)	/* -M, -Q, -Y and -R have no file */
+			strcpy(str, "/dev/null");
+		else if(varperftmp)
 			sprintf( str, "/var/perf/tmp/%s_%02d.nmon", hostname, tim->tm_mday);
 		else if(user_filename_set)
 			strcpy( str, user_filename);
@@ -3908,6 +13372,8 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 			tim->tm_mday, 
 			tim->tm_hour, 
 			tim->tm_min);
+		if(out_gzip && !user_filename_set)
+			strcat(str, ".gz");
 		if((fp = fopen(str,"w")) ==0 ) {
 			perror("elmon: failed to open output file");
 			printf("elmon: output filename=%s\n",str);
@@ -3920,6 +13386,11 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 				printf("%d\n",childpid);
 			exit(0); /* parent returns OK */
 		}
+#ifdef URING
+		/* the ring's buffers are pinned in the parent's pages, have our own */
+		uring_teardown();
+		uring.fd = -2;
+#endif /* URING */
 		if(!debug) {
 			close(0);
 			close(1);
@@ -3932,6 +13403,17 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
                         timer = time(0);
                         child_start(CHLD_START, nmon_start, time_stamp_type, 1, timer);
                 }
+		/* -B keeps the header lines for --to-nmon to put back */
+		if(recording) {
+			rec_fp = fp;
+			if((fp = open_memstream(&rec_text, &rec_text_len)) == NULL) {
+				perror("elmon: failed to record the header");
+				exit(46);
+			}
+		} else if(prom_fd < 0 && shm_name == NULL && enc != &enc_rra)
+			out_open(fp, str);
+		if(recording || enc == &encoders[ENC_CSV])
+			idx_open(str);
 
 		if(show_aaa) {
 		fprintf(fp,"AAA,progname,%s\n", progname);
@@ -3951,6 +13433,8 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		fprintf(fp,"AAA,time,%02d:%02d.%02d\n", tim->tm_hour, tim->tm_min, tim->tm_sec);
 		fprintf(fp,"AAA,date,%02d-%3s-%02d\n", tim->tm_mday, month[tim->tm_mon-1], tim->tm_year+2000);
 		fprintf(fp,"AAA,interval,%-6.1f\n", (double)seconds / (double)10);
+		if(roll_base)
+			fprintf(fp,"AAA,sample,%-6.1f\n", (double)roll_base / (double)10);
 		fprintf(fp,"AAA,snapshots,%d\n", maxloops);
 		fprintf(fp,"AAA,cpus,%d,%d\n", cpus,cpus);
 		fprintf(fp,"AAA,proc_stat_variables,%d\n", stat8);
@@ -3961,6 +13445,7 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		}
 		fflush(NULL);
 
+		if(show_headings) {
 		for (i = 1; i <= cpus; i++)
 			fprintf(fp,"CPU%02d,CPU %d %s,User%%,Sys%%,Wait%%,Idle%%\n", i, i, run_name);
 		fprintf(fp,"CPU_ALL,CPU Total %s,User%%,Sys%%,Wait%%,Idle%%,Busy,CPUs\n", run_name);
@@ -4029,8 +13514,19 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 #endif /*POWER*/
 		if(enabled_option(SHOW_TOP)){
 			fprintf(fp,"TOP,%%CPU Utilisation\n");
-			fprintf(fp,"TOP,+PID,Time,%%CPU,%%Usr,%%Sys,Size,ResSet,ResText,ResData,ShdLib,MajorFault,MinorFault,Command\n");
+			fprintf(fp,"TOP,+PID,Time,%%CPU,%%Usr,%%Sys,Size,ResSet,ResText,ResData,ShdLib,MajorFault,MinorFault,Command,Container\n");
+			if(show_containers)
+				fprintf(fp,"TOPCONT,+Container,Time,Procs,%%CPU,%%Usr,%%Sys,Size,ResSet,MinorFault,MajorFault\n");
+		}
+		if(!recording) {
+			fprintf(fp,"ELMON,elmon Output Writer %s,queue,queue max,dropped,written KB,slowest write ms,missed,late ms\n", run_name);
+			fprintf(fp,"ELMONSRC,elmon Source Read ms %s", run_name);
+			for(i = 0; i < SRC_MAX; i++)
+				fprintf(fp,",%s", src_name[i]);
+			fprintf(fp,"\n");
+		}
 		}
+		if(show_para) {
 		linux_bbbp("/etc/release",    "/bin/cat /etc/*ease 2>/dev/null", WARNING);
 		linux_bbbp("lsb_release",    "/usr/bin/lsb_release -a 2>/dev/null", WARNING);
 		linux_bbbp("fdisk-l",          "/sbin/fdisk -l 2>/dev/null", WARNING);
@@ -4053,21 +13549,43 @@ printf("TIMESTAMP=%d.\n",time_stamp_type);
 		linux_bbbp("/proc/net/rpc/nfs",        "/bin/cat /proc/net/rpc/nfs 2>/dev/null", WARNING);
 		linux_bbbp("/proc/net/rpc/nfsd",        "/bin/cat /proc/net/rpc/nfsd 2>/dev/null", WARNING);
 		linux_bbbp("ifconfig",        "/sbin/ifconfig 2>/dev/null", WARNING);
+		}
+		if(recording) {
+			fclose(fp);
+			fp = NULL;
+			rec_start();
+			rec_frame(p, NULL);
+		}
 		sleep(1); /* to get the first stats to cover this one second */
 	     }
-	/* To get the pointers setup */
-	switcher();
+	out_start();
+	prom_start();
+	ctl_start();
+	collector_start(rec_in_name ? player : collector);
 	checkinput();
 	fflush(NULL);
-#ifdef POWER 
-lparcfg.timebase = -1; 
-#endif
 
         int last_cols = COLS;
         int last_lines = LINES;
 
-	/* Main loop of the code */
-	for(loop=1; ; loop++) {
+	/* Main loop of the code, once per snapshot or key press */
+	for(;;) {
+		fresh = snapshot_next();
+		while(q == NULL || (!fresh && !cursed)) {	/* a playback jump leaves p alone for a moment */
+			snapshot_wait(-1, 0);
+			fresh = snapshot_next();
+		}
+		if(hist_view != NULL)	/* paused, new ones only go into the history */
+			fresh = 0;
+		if(rec_in_name != NULL)	/* and playback waits */
+			__atomic_store_n(&play_hold, hist_view != NULL, __ATOMIC_RELAXED);
+		if(fresh)
+			flash_on = !flash_on;
+		loop = p->loop / roll_every;	/* -a: the snapshots written */
+		roll_tick = (p->loop % roll_every == 0);
+		disks = p->disks;
+		networks = p->networks;
+
 	        if (last_num_col == 1){
 	                maxcols = COLS;
 	        }else if (last_num_col == 2){
@@ -4091,11 +13609,17 @@ lparcfg.timebase = -1;
 		/* Reset the cursor position to top left */
 		y_1 = x_1 = x_2 = x_3 = 0;
 
-		/* Save the time and work out how long we were actually asleep */
-		p->time = doubletime();
-		elapsed = p->time - q->time;
-		timer = time(0);
+		/* The time between the two snapshots, whenever the screen got drawn,
+		 * each section then uses the time between the reads of its source
+		 */
+		elapsed = snap_elapsed(p, q, SRC_SNAP);
+		timer = p->tv.tv_sec;
 		tim = localtime(&timer);
+		if(rec_fp != NULL) {	/* -B writes the snapshot as it is */
+			if(fresh)
+				rec_frame(p, q);
+			goto snapshot_done;
+		}
 		if (cursed) { /* Top line */
 	                        if (last_cols != COLS || last_lines != LINES){
 	                                clear();
@@ -4106,14 +13630,20 @@ lparcfg.timebase = -1;
 				box(stdscr,0,0);
 				mvprintw(x_1, 1, "elmon"); 
 				mvprintw(x_1, 7, "%s", VERSION); 
-				if(flash_on && seconds > 9)  //If screen is updating more than once per second, don't flash the help message
+				if(hist_view != NULL)
+					mvprintw(x_1,15,"Paused -%-4ld", history_behind());
+				else if(flash_on && seconds > 9)  //If screen is updating more than once per second, don't flash the help message
 					mvprintw(x_1,15,"[H for help]");
 				else if (seconds < 10)
 					mvprintw(x_1,15,"[H for help]");
 				
 				mvprintw(x_1, 30, "Hostname=%s", hostname);
 
-				if (seconds % 10 == 0)    //seconds = whole number of seconds
+				if (rec_in_name != NULL)
+					mvprintw(x_1, 52, "Play %-3s T%04d ",
+						__atomic_load_n(&play_end, __ATOMIC_RELAXED) ? "end" :
+						play_speed == 0 ? "max" : play_speed == 1 ? "1x" : "10x", p->loop);
+				else if (seconds % 10 == 0)    //seconds = whole number of seconds
 					mvprintw(x_1, 52, "Refresh=%2.0fsecs ", (double)seconds / (double)10);
 				else
 					mvprintw(x_1, 52, "Refresh=%2.1fsecs ", (double)seconds / (double)10);
@@ -4168,13 +13698,19 @@ mvprintw(x_1+19, 3, "but WITHOUT ANY WARRANTY; without even the implied warranty
 mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				x_1 = x_1 + 20;
 			}
-		} else {
+		} else if(roll_tick) {
 			if (!cursed && nmon_snap && (loop % nmon_one_in) == 0 ) {
 				child_start(CHLD_SNAP, nmon_snap, time_stamp_type, loop, timer);
 			}
 
 
-			if(!show_rrd)
+			if(out_cur != NULL) {	/* the writer indexes the ZZZZ lines and rotates on them */
+				out_cur->loop = loop;
+				out_cur->time = (long long)(p->time * 1000.0);
+				if(enc == &encoders[ENC_CSV])
+					out_cur->zzzz = ftell(fp);
+			}
+			if(enc == &encoders[ENC_CSV])
 			    fprintf(fp,"ZZZZ,%s,%02d:%02d:%02d,%02d-%s-%4d\n", LOOP, 
 					tim->tm_hour, tim->tm_min, tim->tm_sec,
 					tim->tm_mday, month[tim->tm_mon], tim->tm_year+1900);
@@ -4199,13 +13735,13 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 		}
 */
 
-                if (enabled_option(SHOW_DISK) || enabled_option(SHOW_VERBOSE) || enabled_option(SHOW_DISKMAP || enabled_option(SHOW_DGROUP))) {
-                        proc_read(P_STAT);
-                        proc_disk(elapsed);
-                }
-
 
                 for(loop_options = 0; loop_options < optionCount; loop_options++){
+			elapsed = snap_elapsed(p, q, show_source(enabled_options[loop_options]));
+			/* switched on since q was taken, it has nothing to start from */
+			if(!snap_has(p, section_needs(enabled_options[loop_options]))
+			|| !snap_has(q, section_needs(enabled_options[loop_options])))
+				continue;
 
                         if (enabled_options[loop_options] == SHOW_CPU && cursed) {
 				proc_read(P_CPUINFO);
@@ -4247,19 +13783,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				display(padcpu,20);
 			}
                         if (enabled_options[loop_options] == SHOW_LONGTERM ) {
-					proc_read(P_STAT);
-					proc_cpu();
-					cpu_user = p->cpu_total.user - q->cpu_total.user; 
-					cpu_sys  = p->cpu_total.sys  - q->cpu_total.sys; 
-					cpu_wait = p->cpu_total.wait - q->cpu_total.wait; 
-					cpu_idle = p->cpu_total.idle - q->cpu_total.idle; 
-					cpu_sum = cpu_idle + cpu_user + cpu_sys + cpu_wait;
-	
-					plot_save(
-					    (double)cpu_user / (double)cpu_sum * 100.0,
-					    (double)cpu_sys  / (double)cpu_sum * 100.0,
-					    (double)cpu_wait / (double)cpu_sum * 100.0,
-					    (double)cpu_idle / (double)cpu_sum * 100.0);
 					plot_snap(padlong);
 					display(padlong,MAX_SNAP_ROWS+2);
 			}
@@ -4270,7 +13793,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					CURSE wclrtobot(padtop);
 				}*/
 				if(cpus>max_cpus && !cursed) {
-					for (i = max_cpus+1; i <= cpus; i++)
+					for (i = max_cpus+1; i <= cpus && show_headings; i++)
 						fprintf(fp,"CPU%02d,CPU %d %s,User%%,Sys%%,Wait%%,Idle%%\n", i, i, run_name);
 					max_cpus= cpus;
 				}
@@ -4292,8 +13815,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				mvwprintw(padsmp,2, 22, " Idle|0          |25         |50          |75       100|");
 	
 				}	
-					proc_read(P_STAT);
-					proc_cpu();
 				for (i = 0; i < cpus; i++) {
 					cpu_user = p->cpuN[i].user - q->cpuN[i].user; 
 					cpu_sys  = p->cpuN[i].sys  - q->cpuN[i].sys; 
@@ -4319,11 +13840,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						  RAW(irq),
 						  RAW(softirq),
 						  RAW(steal));
-					   RRD fprintf(fp,"rrdtool update cpu%02d.rrd %s:%.1f:%.1f:%.1f:%.1f\n",i,LOOP,
-					    (double)cpu_user / (double)cpu_sum * 100.0,
-					    (double)cpu_sys  / (double)cpu_sum * 100.0,
-					    (double)cpu_wait / (double)cpu_sum * 100.0,
-					    (double)cpu_idle / (double)cpu_sum * 100.0);
 					}
 				}
 				CURSE mvwprintw(padsmp,i + 3, 27, graph_line);
@@ -4332,12 +13848,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				cpu_wait = p->cpu_total.wait - q->cpu_total.wait; 
 				cpu_idle = p->cpu_total.idle - q->cpu_total.idle; 
 				cpu_sum = cpu_idle + cpu_user + cpu_sys + cpu_wait;
-	
-				RRD fprintf(fp,"rrdtool update cpu.rrd %s:%.1f:%.1f:%.1f:%.1f\n",LOOP,
-					    (double)cpu_user / (double)cpu_sum * 100.0,
-					    (double)cpu_sys  / (double)cpu_sum * 100.0,
-					    (double)cpu_wait / (double)cpu_sum * 100.0,
-					    (double)cpu_idle / (double)cpu_sum * 100.0);
+
 				if (cpus > 1 || !cursed) {
 					if(!smp_first_time || !cursed) {
 					    if(!show_raw) {
@@ -4366,8 +13877,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				display(padsmp, i + 4);
 			    }
                         if(enabled_options[loop_options] == SHOW_VERBOSE && cursed) {
-                                	proc_read(P_STAT);
-                                	proc_cpu();
 					cpu_user = p->cpu_total.user - q->cpu_total.user; 
 					cpu_sys  = p->cpu_total.sys  - q->cpu_total.sys; 
 					cpu_wait = p->cpu_total.wait - q->cpu_total.wait; 
@@ -4392,53 +13901,42 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 			}
 	#ifdef POWER
                         if (enabled_options[loop_options] == SHOW_LPAR) {
-				if(lparcfg.timebase == -1) {
-					lparcfg.timebase=0;
-					proc_read(P_CPUINFO);
-					for(i=0;i<proc[P_CPUINFO].lines-1;i++) {
-						if(!strncmp("timebase",proc[P_CPUINFO].line[i],8)) {
-							sscanf(proc[P_CPUINFO].line[i],"timebase : %lld",&lparcfg.timebase);
-							break;
-						}
-					}
-				}
-				ret = proc_lparcfg();
 				if(cursed) {
 					BANNER(padlpar,"LPAR Stats");
-					if(ret == 0) {
+					if(p->lpar_ret == 0) {
 					mvwprintw(padlpar,2, 0, "Reading data from /proc/ppc64/lparcfg failed");
 					mvwprintw(padlpar,3, 0, "Either run as the root user or ");
 					mvwprintw(padlpar,4, 0, "as the root user run: chmod ugo+r /proc/ppc64/lparcfg");
 					} else {
 					mvwprintw(padlpar,1, 0, "LPAR=%d  SerialNumber=%s  Type=%s",
-						lparcfg.partition_id, lparcfg.serial_number, lparcfg.system_type);
+						p->lpar.partition_id, p->lpar.serial_number, p->lpar.system_type);
 					mvwprintw(padlpar,2, 0, "Flags:      Shared-CPU=%-5s  Capped=%-5s",
-						lparcfg.shared_processor_mode?"true":"false",
-						lparcfg.capped?"true":"false");
+						p->lpar.shared_processor_mode?"true":"false",
+						p->lpar.capped?"true":"false");
 					mvwprintw(padlpar,3, 0, "Systems CPU Pool=%8.2f          Active=%8.2f    Total=%8.2f",
-						(float)lparcfg.pool_capacity,
-						(float)lparcfg.system_active_processors,
-						(float)lparcfg.system_potential_processors);
+						(float)p->lpar.pool_capacity,
+						(float)p->lpar.system_active_processors,
+						(float)p->lpar.system_potential_processors);
 					mvwprintw(padlpar,4, 0, "LPARs CPU    Min=%8.2f     Entitlement=%8.2f      Max=%8.2f",
-						lparcfg.MinEntCap/100.0,
-						lparcfg.partition_entitled_capacity/100.0,
-						lparcfg.partition_max_entitled_capacity/100.0);
+						p->lpar.MinEntCap/100.0,
+						p->lpar.partition_entitled_capacity/100.0,
+						p->lpar.partition_max_entitled_capacity/100.0);
 					mvwprintw(padlpar,5, 0, "Virtual CPU  Min=%8.2f          VP Now=%8.2f      Max=%8.2f",
-						(float)lparcfg.MinProcs,
-						(float)lparcfg.partition_active_processors,
-						(float)lparcfg.partition_potential_processors);
+						(float)p->lpar.MinProcs,
+						(float)p->lpar.partition_active_processors,
+						(float)p->lpar.partition_potential_processors);
 					mvwprintw(padlpar,6, 0, "Memory       Min= unknown             Now=%8.2f      Max=%8.2f",
-						(float)lparcfg.MinMem,
-						(float)lparcfg.DesMem);
+						(float)p->lpar.MinMem,
+						(float)p->lpar.DesMem);
 					mvwprintw(padlpar,7, 0, "Other     Weight=%8.2f   UnallocWeight=%8.2f Capacity=%8.2f",
-						(float)lparcfg.capacity_weight,
-						(float)lparcfg.unallocated_capacity_weight,
-						(float)lparcfg.CapInc/100.0);
+						(float)p->lpar.capacity_weight,
+						(float)p->lpar.unallocated_capacity_weight,
+						(float)p->lpar.CapInc/100.0);
 	
 					mvwprintw(padlpar,8, 0, "      BoundThrds=%8.2f UnallocCapacity=%8.2f  Increment",
-						(float)lparcfg.BoundThrds,
-						(float)lparcfg.unallocated_capacity);
-					if(lparcfg.purr_diff == 0 || lparcfg.timebase <1) {
+						(float)p->lpar.BoundThrds,
+						(float)p->lpar.unallocated_capacity);
+					if(p->lpar.purr_diff == 0 || p->lpar.timebase <1) {
 						mvwprintw(padlpar,9, 0, "lparcfg: purr field always zero, upgrade to SLES9+sp1 or RHEL4+u1");
 					} else {
 	                                        if(lpar_first_time) {
@@ -4447,37 +13945,39 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 	                                            lpar_first_time=0;
 	                                        } else {
 						    mvwprintw(padlpar,9, 0, "Physical CPU use=%8.3f ",
-								(double)lparcfg.purr_diff/(double)lparcfg.timebase/elapsed);
-						    if( lparcfg.pool_idle_time != NUMBER_NOT_VALID && lparcfg.pool_idle_saved != 0)
+								(double)p->lpar.purr_diff/(double)p->lpar.timebase/elapsed);
+						    if( p->lpar.pool_idle_time != NUMBER_NOT_VALID && p->lpar.pool_idle_saved != 0)
 							    mvwprintw(padlpar,9, 29, "PoolIdleTime=%8.2f",
-								(double)lparcfg.pool_idle_diff/(double)lparcfg.timebase/elapsed);
-						    mvwprintw(padlpar,9, 54, "[timebase=%lld]", lparcfg.timebase);
+								(double)p->lpar.pool_idle_diff/(double)p->lpar.timebase/elapsed);
+						    mvwprintw(padlpar,9, 54, "[timebase=%lld]", p->lpar.timebase);
 						}
 	                                       }
 					}
 					display(padlpar,10);
 				} else {
-					if(ret != 0)
-					    fprintf(fp,"LPAR,%s,%9.6f,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f,%d,%d,%d,%d,%d,%d,%d,%d,%lld\n", 
-						LOOP,
-						(double)lparcfg.purr_diff/(double)lparcfg.timebase/elapsed,
-						lparcfg.capped,
-						lparcfg.shared_processor_mode,
-						lparcfg.system_potential_processors,
-						lparcfg.system_active_processors,
-						lparcfg.pool_capacity,
-						lparcfg.MinEntCap/100.0,
-						lparcfg.partition_entitled_capacity/100.0,
-						lparcfg.partition_max_entitled_capacity/100.0,
-						lparcfg.MinProcs,
-						lparcfg.partition_active_processors,
-						lparcfg.partition_potential_processors,
-						lparcfg.capacity_weight,
-						lparcfg.unallocated_capacity_weight,
-						lparcfg.BoundThrds,
-						lparcfg.MinMem,
-						lparcfg.unallocated_capacity,
-						lparcfg.pool_idle_time);
+					if(p->lpar_ret != 0) {
+	#define LPARENC(variable) enc_num(#variable, p->lpar.variable, 0)
+					    enc_begin("LPAR", NULL);
+					    enc_num("PhysicalCPU", (double)p->lpar.purr_diff/(double)p->lpar.timebase/elapsed, 6);
+					    LPARENC(capped);
+					    LPARENC(shared_processor_mode);
+					    LPARENC(system_potential_processors);
+					    LPARENC(system_active_processors);
+					    LPARENC(pool_capacity);
+					    enc_num("MinEntCap", p->lpar.MinEntCap/100.0, 1);
+					    enc_num("partition_entitled_capacity", p->lpar.partition_entitled_capacity/100.0, 1);
+					    enc_num("partition_max_entitled_capacity", p->lpar.partition_max_entitled_capacity/100.0, 1);
+					    LPARENC(MinProcs);
+					    LPARENC(partition_active_processors);
+					    LPARENC(partition_potential_processors);
+					    LPARENC(capacity_weight);
+					    LPARENC(unallocated_capacity_weight);
+					    LPARENC(BoundThrds);
+					    LPARENC(MinMem);
+					    LPARENC(unallocated_capacity);
+					    LPARENC(pool_idle_time);
+					    enc_end();
+					}
 				}
 			}
 	#endif /*POWER*/
@@ -4486,8 +13986,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
                         if (enabled_options[loop_options] == SHOW_MEMORY_GRAPH && cursed) {
 				int peak_col_mem;
 				int peak_col_swap;
-				proc_read(P_MEMINFO);
-				proc_mem();
 	
 				mem_used = ((double)(p->mem.memtotal - p->mem.memfree - p->mem.buffers - p->mem.cached) / (double)p->mem.memtotal * 100);
 				mem_free =  (double)p->mem.memfree / (double)p->mem.memtotal * 100;
@@ -4590,8 +14088,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 			}
 	
                         if (enabled_options[loop_options] == SHOW_MEMORY) {
-				proc_read(P_MEMINFO);
-				proc_mem();
 				if(cursed) {
 					BANNER(padmem,"Memory Stats");
 					mvwprintw(padmem,1, 1, "               RAM     High      Low     Swap");
@@ -4641,32 +14137,28 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						p->mem.pagetables/1024.0);
 					display(padmem,10);
 				} else {
-	
-					if(show_rrd) 
-					   str_p = "rrdtool update mem.rrd %s:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f\n";
-					else
-					   str_p = "MEM,%s,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n";
-					   fprintf(fp,str_p,
-						LOOP,
-						p->mem.memtotal/1024.0,
-						p->mem.hightotal/1024.0,
-						p->mem.lowtotal/1024.0,
-						p->mem.swaptotal/1024.0,
-						p->mem.memfree/1024.0,
-						p->mem.highfree/1024.0,
-						p->mem.lowfree/1024.0,
-						p->mem.swapfree/1024.0,
-						p->mem.memshared/1024.0,
-						p->mem.cached/1024.0,
-						p->mem.active/1024.0,
+	#define MEMENC(variable) enc_num(#variable, p->mem.variable/1024.0, 1)
+					enc_begin("MEM", "mem.rrd");
+					MEMENC(memtotal);
+					MEMENC(hightotal);
+					MEMENC(lowtotal);
+					MEMENC(swaptotal);
+					MEMENC(memfree);
+					MEMENC(highfree);
+					MEMENC(lowfree);
+					MEMENC(swapfree);
+					MEMENC(memshared);
+					MEMENC(cached);
+					MEMENC(active);
 	#ifdef LARGEMEM
-						-1.0,
+					enc_num("bigfree", -1.0, 1);
 	#else
-						p->mem.bigfree/1024.0,
+					MEMENC(bigfree);
 	#endif /*LARGEMEM*/
-						p->mem.buffers/1024.0,
-						p->mem.swapcached/1024.0,
-						p->mem.inactive/1024.0);
+					MEMENC(buffers);
+					MEMENC(swapcached);
+					MEMENC(inactive);
+					enc_end();
 				}
 	/* for testing large page		p->mem.hugefree = 250;
 			p->mem.hugetotal = 1000;
@@ -4674,8 +14166,6 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 	*/
 			}
                         if (enabled_options[loop_options] == SHOW_LARGE) {
-				proc_read(P_MEMINFO);
-				proc_mem();
 				if(cursed) {
 					BANNER(padlarge,"Large (Huge) Page Stats");
 				    if(p->mem.hugetotal > 0) {
@@ -4696,20 +14186,21 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					if(p->mem.hugetotal > 0) {
 						if(first_huge == 1){
 							first_huge=0;
-							fprintf(fp,"HUGEPAGES,Huge Page Use %s,HugeTotal,HugeFree,HugeSizeMB\n", run_name);
+							if(show_headings)
+								fprintf(fp,"HUGEPAGES,Huge Page Use %s,HugeTotal,HugeFree,HugeSizeMB\n", run_name);
 						}
-						fprintf(fp,"HUGEPAGES,%s,%ld,%ld,%.1f\n", 
-							LOOP,
-							p->mem.hugetotal,
-							p->mem.hugefree,
-							p->mem.hugesize/1024.0);
+						enc_begin("HUGEPAGES", NULL);
+						enc_num("HugeTotal", p->mem.hugetotal, 0);
+						enc_num("HugeFree", p->mem.hugefree, 0);
+						enc_num("HugeSizeMB", p->mem.hugesize/1024.0, 1);
+						enc_end();
 					}
 				}
 			}
                         if (enabled_options[loop_options] == SHOW_VM) {
 	#define VMDELTA(variable) (p->vm.variable - q->vm.variable)
 	#define VMCOUNT(variable) (p->vm.variable                 )
-				ret = read_vmstat();
+				ret = p->vm_ret;
 				if(cursed) {
 					BANNER(padpage,"Virtual-Memory");
 					if(ret < 0 ) {
@@ -4785,76 +14276,52 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						remove_option(SHOW_VM);
 					} else if(vm_first_time) {
 						vm_first_time=0;
-	fprintf(fp,"VM,Paging and Virtual Memory,nr_dirty,nr_writeback,nr_unstable,nr_page_table_pages,nr_mapped,nr_slab,pgpgin,pgpgout,pswpin,pswpout,pgfree,pgactivate,pgdeactivate,pgfault,pgmajfault,pginodesteal,slabs_scanned,kswapd_steal,kswapd_inodesteal,pageoutrun,allocstall,pgrotated,pgalloc_high,pgalloc_normal,pgalloc_dma,pgrefill_high,pgrefill_normal,pgrefill_dma,pgsteal_high,pgsteal_normal,pgsteal_dma,pgscan_kswapd_high,pgscan_kswapd_normal,pgscan_kswapd_dma,pgscan_direct_high,pgscan_direct_normal,pgscan_direct_dma\n");
+						if(show_headings)
+							fprintf(fp,"VM,Paging and Virtual Memory,nr_dirty,nr_writeback,nr_unstable,nr_page_table_pages,nr_mapped,nr_slab,pgpgin,pgpgout,pswpin,pswpout,pgfree,pgactivate,pgdeactivate,pgfault,pgmajfault,pginodesteal,slabs_scanned,kswapd_steal,kswapd_inodesteal,pageoutrun,allocstall,pgrotated,pgalloc_high,pgalloc_normal,pgalloc_dma,pgrefill_high,pgrefill_normal,pgrefill_dma,pgsteal_high,pgsteal_normal,pgsteal_dma,pgscan_kswapd_high,pgscan_kswapd_normal,pgscan_kswapd_dma,pgscan_direct_high,pgscan_direct_normal,pgscan_direct_dma\n");
 					} 
-					if(show_rrd)
-						str_p = "rrdtool update vm.rrd %s" 
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld:%lld:%lld:%lld"
-						":%lld:%lld\n";
-					else
-						str_p = "VM,%s" 
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld,%lld,%lld,%lld"
-						",%lld,%lld\n";
-	
-					fprintf(fp, str_p,
-						LOOP,
-						VMCOUNT(nr_dirty),
-						VMCOUNT(nr_writeback),
-						VMCOUNT(nr_unstable),
-						VMCOUNT(nr_page_table_pages),
-						VMCOUNT(nr_mapped),
-						VMCOUNT(nr_slab),
-						VMDELTA(pgpgin),
-						VMDELTA(pgpgout),
-						VMDELTA(pswpin),
-						VMDELTA(pswpout),
-						VMDELTA(pgfree),
-						VMDELTA(pgactivate),
-						VMDELTA(pgdeactivate),
-						VMDELTA(pgfault),
-						VMDELTA(pgmajfault),
-						VMDELTA(pginodesteal),
-						VMDELTA(slabs_scanned),
-						VMDELTA(kswapd_steal),
-						VMDELTA(kswapd_inodesteal),
-						VMDELTA(pageoutrun),
-						VMDELTA(allocstall),
-						VMDELTA(pgrotated),
-						VMDELTA(pgalloc_high),
-						VMDELTA(pgalloc_normal),
-						VMDELTA(pgalloc_dma),
-						VMDELTA(pgrefill_high),
-						VMDELTA(pgrefill_normal),
-						VMDELTA(pgrefill_dma),
-						VMDELTA(pgsteal_high),
-						VMDELTA(pgsteal_normal),
-						VMDELTA(pgsteal_dma),
-						VMDELTA(pgscan_kswapd_high),
-						VMDELTA(pgscan_kswapd_normal),
-						VMDELTA(pgscan_kswapd_dma),
-						VMDELTA(pgscan_direct_high),
-						VMDELTA(pgscan_direct_normal),
-						VMDELTA(pgscan_direct_dma));
+	#define VMENC(how, variable) enc_num(#variable, how(variable), 0)
+					enc_begin("VM", "vm.rrd");
+					VMENC(VMCOUNT, nr_dirty);
+					VMENC(VMCOUNT, nr_writeback);
+					VMENC(VMCOUNT, nr_unstable);
+					VMENC(VMCOUNT, nr_page_table_pages);
+					VMENC(VMCOUNT, nr_mapped);
+					VMENC(VMCOUNT, nr_slab);
+					VMENC(VMDELTA, pgpgin);
+					VMENC(VMDELTA, pgpgout);
+					VMENC(VMDELTA, pswpin);
+					VMENC(VMDELTA, pswpout);
+					VMENC(VMDELTA, pgfree);
+					VMENC(VMDELTA, pgactivate);
+					VMENC(VMDELTA, pgdeactivate);
+					VMENC(VMDELTA, pgfault);
+					VMENC(VMDELTA, pgmajfault);
+					VMENC(VMDELTA, pginodesteal);
+					VMENC(VMDELTA, slabs_scanned);
+					VMENC(VMDELTA, kswapd_steal);
+					VMENC(VMDELTA, kswapd_inodesteal);
+					VMENC(VMDELTA, pageoutrun);
+					VMENC(VMDELTA, allocstall);
+					VMENC(VMDELTA, pgrotated);
+					VMENC(VMDELTA, pgalloc_high);
+					VMENC(VMDELTA, pgalloc_normal);
+					VMENC(VMDELTA, pgalloc_dma);
+					VMENC(VMDELTA, pgrefill_high);
+					VMENC(VMDELTA, pgrefill_normal);
+					VMENC(VMDELTA, pgrefill_dma);
+					VMENC(VMDELTA, pgsteal_high);
+					VMENC(VMDELTA, pgsteal_normal);
+					VMENC(VMDELTA, pgsteal_dma);
+					VMENC(VMDELTA, pgscan_kswapd_high);
+					VMENC(VMDELTA, pgscan_kswapd_normal);
+					VMENC(VMDELTA, pgscan_kswapd_dma);
+					VMENC(VMDELTA, pgscan_direct_high);
+					VMENC(VMDELTA, pgscan_direct_normal);
+					VMENC(VMDELTA, pgscan_direct_dma);
+					enc_end();
 				}
 			}
                         if (enabled_options[loop_options] == SHOW_KERNEL) {
-				proc_read(P_STAT);
-				proc_cpu();
-				proc_read(P_UPTIME);
-				proc_read(P_LOADAVG);
-				proc_kernel();
 				if(cursed) {
 					BANNER(padker,"Kernel Stats");
 					mvwprintw(padker,1, 1, "RunQueue       %8lld   Load Average    CPU use since boot time",
@@ -4889,33 +14356,22 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						proc_first_time=0;
 					}
 	/*fprintf(fp,"PROC,Processes %s,Runnable,Swap-in,pswitch,syscall,read,write,fork,exec,sem,msg\n", run_name);*/
-					if(show_rrd)
-						str_p = "rrdtool update proc.rrd %s:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f:%.1f\n";
-					else
-						str_p = "PROC,%s,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n";
-	
-					fprintf(fp,str_p,
-						LOOP,
-						(float)p->cpu_total.running,/*runqueue*/
-						-1.0,			/*swapin*/
-									/*pswitch*/
-						(float)(p->cpu_total.ctxt - q->cpu_total.ctxt)/elapsed,	
-						-1.0,		/*syscall*/
-						-1.0,		/*read*/
-						-1.0,		/*write*/
-								/*fork*/
-						(float)(p->cpu_total.procs - q->cpu_total.procs)/elapsed,
-						-1.0,		/*exec*/
-						-1.0,		/*sem*/
-						-1.0);		/*msg*/
+					enc_begin("PROC", "proc.rrd");
+					enc_num("Runnable", (float)p->cpu_total.running, 1);
+					enc_num("Swap-in", -1.0, 1);
+					enc_num("pswitch", (float)(p->cpu_total.ctxt - q->cpu_total.ctxt)/elapsed, 1);
+					enc_num("syscall", -1.0, 1);
+					enc_num("read", -1.0, 1);
+					enc_num("write", -1.0, 1);
+					enc_num("fork", (float)(p->cpu_total.procs - q->cpu_total.procs)/elapsed, 1);
+					enc_num("exec", -1.0, 1);
+					enc_num("sem", -1.0, 1);
+					enc_num("msg", -1.0, 1);
+					enc_end();
 				}
 			}
 	
                         if (enabled_options[loop_options] == SHOW_NFS) {
-				proc_read(P_NFS);
-				proc_read(P_NFSD);
-				proc_nfs();
-	
 				if(cursed) {
 					BANNER(padnfs,"Network Filesystem (NFS) I/O");
 					mvwprintw(padnfs,1, 0, " Version 2     Client    Server");
@@ -4949,7 +14405,8 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						
 					display(padnfs,24);
 				} else {
-					if(nfs_first_time && ! show_rrd) {
+					if(nfs_first_time) {
+					    if(show_headings) {
 						fprintf(fp,"NFSCLIV2,NFS Client v2");
 						for(i=0;i<18;i++) 
 							fprintf(fp,",%s",nfs_v2_names[i]);
@@ -4967,41 +14424,53 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						for(i=0;i<22;i++) 
 							fprintf(fp,",%s",nfs_v3_names[i]);
 						fprintf(fp,"\n");
+					    }
 						memcpy(&q->nfs,&p->nfs,sizeof(struct nfs_stat));
 						nfs_first_time=0;
 					}
-					fprintf(fp,show_rrd ? "rrdtool update nfscliv2.rrd %s" : "NFSCLIV2,%s", LOOP);
-					for(i=0;i<18;i++) {
-						fprintf(fp,show_rrd ? ":%d" : ",%d", 
-						(int)NFS_DELTA(nfs.v2c[i]));
-					}
-					fprintf(fp,"\n");
-					fprintf(fp,show_rrd ? "rrdtool update nfsvriv2.rrd %s" : "NFSSVRV2,%s,", LOOP);
-					for(i=0;i<18;i++) {
-						fprintf(fp,show_rrd ? ":%d" : ",%d", 
-						(int)NFS_DELTA(nfs.v2s[i]));
-					}
-					fprintf(fp,"\n");
-					fprintf(fp,show_rrd ? "rrdtool update nfscliv3.rrd %s" : "NFSCLIV3,%s,", LOOP);
-					for(i=0;i<22;i++) {
-						fprintf(fp,show_rrd ? ":%d" : ",%d", 
-						(int)NFS_DELTA(nfs.v3c[i]));
-					}
-					fprintf(fp,"\n");
-					fprintf(fp,show_rrd ? "rrdtool update nfsvriv3.rrd %s" : "NFSSVRV3,%s,", LOOP);
-					for(i=0;i<22;i++) {
-						fprintf(fp,show_rrd ? ":%d" : ",%d", 
-						(int)NFS_DELTA(nfs.v3s[i]));
-					}
-					fprintf(fp,"\n");
+					enc_begin("NFSCLIV2", "nfscliv2.rrd");
+					for(i=0;i<18;i++)
+						enc_num(nfs_v2_names[i], (int)NFS_DELTA(nfs.v2c[i]), 0);
+					enc_end();
+					enc_begin("NFSSVRV2", "nfsvriv2.rrd");
+					for(i=0;i<18;i++)
+						enc_num(nfs_v2_names[i], (int)NFS_DELTA(nfs.v2s[i]), 0);
+					enc_end();
+					enc_begin("NFSCLIV3", "nfscliv3.rrd");
+					for(i=0;i<22;i++)
+						enc_num(nfs_v3_names[i], (int)NFS_DELTA(nfs.v3c[i]), 0);
+					enc_end();
+					enc_begin("NFSSVRV3", "nfsvriv3.rrd");
+					for(i=0;i<22;i++)
+						enc_num(nfs_v3_names[i], (int)NFS_DELTA(nfs.v3s[i]), 0);
+					enc_end();
 				}
 			}
+                        if (enabled_options[loop_options] == SHOW_IRQ) {
+				n = show_irq(padirq, elapsed);
+				if(cursed)
+					display(padirq, n);
+			}
+                        if (enabled_options[loop_options] == SHOW_PSI) {
+				n = show_psi(padpsi, elapsed);
+				if(cursed)
+					display(padpsi, n);
+			}
+                        if (enabled_options[loop_options] == SHOW_CGROUP) {
+				n = show_cgroup(padcg, elapsed);
+				if(cursed)
+					display(padcg, n);
+			}
+                        if (enabled_options[loop_options] == SHOW_NUMA) {
+				n = show_numa(padnuma, elapsed);
+				if(cursed)
+					display(padnuma, n);
+			}
                         if (enabled_options[loop_options] == SHOW_NET) {
 				if(cursed) {
 				BANNER(padnet,"Network I/O");
 				mvwprintw(padnet,1, 0, "I/F Name Recv=KB/s Trans=KB/s packin packout insize outsize Peak->Recv Trans");
 				}
-				proc_net();
 				for (i = 0; i < networks; i++) {
 	
 	#define IFDELTA(member) ((float)( (q->ifnets[i].member > p->ifnets[i].member) ? 0 : (p->ifnets[i].member - q->ifnets[i].member)/elapsed) )
@@ -5026,22 +14495,29 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				}
 				display(padnet,networks + 2);
 				if (!cursed) {
-					fprintf(fp,show_rrd ? "rrdtool update net.rrd %s" : "NET,%s,", LOOP);
+					/* the headers end in a comma, so do the lines */
+					enc_begin("NET", "net.rrd");
 					for (i = 0; i < networks; i++) {
-						fprintf(fp,show_rrd ? ":%.1f" : "%.1f,", IFDELTA(if_ibytes) / 1024.0);
+						snprintf(col, sizeof(col), "%s-read-KB/s", (char *)p->ifnets[i].if_name);
+						enc_num(col, IFDELTA(if_ibytes) / 1024.0, 1);
 					}
 					for (i = 0; i < networks; i++) {
-						fprintf(fp,show_rrd ? ":%.1f" : "%.1f,", IFDELTA(if_obytes) / 1024.0);
+						snprintf(col, sizeof(col), "%s-write-KB/s", (char *)p->ifnets[i].if_name);
+						enc_num(col, IFDELTA(if_obytes) / 1024.0, 1);
 					}
-					fprintf(fp,"\n");
-					fprintf(fp,show_rrd ? "rrdtool update netpacket.rrd %s" : "NETPACKET,%s,", LOOP);
+					enc_text("", "");
+					enc_end();
+					enc_begin("NETPACKET", "netpacket.rrd");
 					for (i = 0; i < networks; i++) {
-						fprintf(fp,show_rrd ? ":%.1f" : "%.1f,", IFDELTA(if_ipackets) );
+						snprintf(col, sizeof(col), "%s-read/s", (char *)p->ifnets[i].if_name);
+						enc_num(col, IFDELTA(if_ipackets), 1);
 					}
 					for (i = 0; i < networks; i++) {
-						fprintf(fp,show_rrd ? ":%.1f" : "%.1f,", IFDELTA(if_opackets) );
+						snprintf(col, sizeof(col), "%s-write/s", (char *)p->ifnets[i].if_name);
+						enc_num(col, IFDELTA(if_opackets), 1);
 					}
-					fprintf(fp,"\n");
+					enc_text("", "");
+					enc_end();
 				}
 				errors=0;
 				for (i = 0; i < networks; i++) {
@@ -5079,11 +14555,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				BANNER(padjfs,"Filesystems");
 				mvwprintw(padjfs,1, 0, "Filesystem            SizeMB  FreeMB %%Used Type     MountPoint");
 	
-				for (k = 0; k < jfses; k++) {
+				for (k = 0; k < p->fses; k++) {
 					fs_size=0;
 					fs_free=0;
 					fs_size_used=100.0;
-				    if(jfs[k].mounted) {
+				    if(p->fs[k].mounted) {
 					if(!strncmp(jfs[k].name,"/proc/",6)       /* sub directorys have to be fake too */
 					       || !strncmp(jfs[k].name,"/sys/",5)
 					       || !strncmp(jfs[k].name,"/dev/",5)
@@ -5094,12 +14570,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						mvwprintw(padjfs,2+k, 0, "%-14s", jfs[k].name);
 						mvwprintw(padjfs,2+k, 43, "%-8s not a real filesystem",jfs[k].type);
 					} else {
-						statfs_buffer.f_blocks=0;
-					    if((ret=fstatfs( jfs[k].fd, &statfs_buffer)) != -1) {
-						if(statfs_buffer.f_blocks != 0) {
-						fs_size = (float)statfs_buffer.f_blocks*4.0/1024.0;
-						fs_free = (float)statfs_buffer.f_bfree*4.0/1024.0;
-						fs_size_used = ((float)statfs_buffer.f_blocks - (float)statfs_buffer.f_bfree)/(float)statfs_buffer.f_blocks*100.0;
+					    if(p->fs[k].ret != -1) {
+						if(p->fs[k].blocks != 0) {
+						fs_size = (float)p->fs[k].blocks*4.0/1024.0;
+						fs_free = (float)p->fs[k].bfree*4.0/1024.0;
+						fs_size_used = ((float)p->fs[k].blocks - (float)p->fs[k].bfree)/(float)p->fs[k].blocks*100.0;
 	
 						if( (i=strlen(jfs[k].device)) <20)
 							str_p=&jfs[k].device[0];
@@ -5130,25 +14605,22 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						mvwprintw(padjfs,2+k, 43, "%-8s not mounted",jfs[k].type);
 				    }
 				}
-				display(padjfs,2 + jfses);
+				display(padjfs,2 + p->fses);
 			    } else {
-				jfs_load(LOAD);
-				fprintf(fp,show_rrd ? "rrdtool update jfsfile.rrd %s" : "JFSFILE,%s", LOOP);
-				for (k = 0; k < jfses; k++) {
-				    if(jfs[k].mounted && strncmp(jfs[k].name,"/proc",5)
+				enc_begin("JFSFILE", "jfsfile.rrd");
+				for (k = 0; k < p->fses; k++) {
+				    if(p->fs[k].mounted && strncmp(jfs[k].name,"/proc",5)
 							&& strncmp(jfs[k].name,"/sys",4)
 							&& strncmp(jfs[k].name,"/dev/pts",8)
 					)   { /* /proc gives invalid/insane values */
-						    if(fstatfs( jfs[k].fd, &statfs_buffer) != -1) {
-						fprintf(fp, show_rrd ? ":%.1f" : ",%.1f",
-						((float)statfs_buffer.f_blocks - (float)statfs_buffer.f_bfree)/(float)statfs_buffer.f_blocks*100.0);
+						    if(p->fs[k].ret != -1) {
+						enc_num(jfs[k].name, ((float)p->fs[k].blocks - (float)p->fs[k].bfree)/(float)p->fs[k].blocks*100.0, 1);
 					    }
 					    else
-						fprintf(fp, show_rrd? ":U" : ",0.0");
+						enc_none(jfs[k].name, "0.0");
 					}
 				}
-				fprintf(fp, "\n");
-				jfs_load(UNLOAD);
+				enc_end();
 			    }
 			}
 	
@@ -5326,48 +14798,44 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 						//move(x,0);
 					}
 				} else {
-					for (i = 0; i < disks; i++) {
-						if(NEWDISKGROUP(i))
-							fprintf(fp,show_rrd ? "%srrdtool update diskbusy%s.rrd %s" : "%sDISKBUSY%s,%s",i == 0 ? "": "\n", dskgrp(i), LOOP);
-						/* check percentage is correct */
-						ftmp = DKDELTA(dk_time) / elapsed;
-						if(ftmp > 100.0 || ftmp < 0.0)
-							fprintf(fp,show_rrd ? ":U" : ",101.00");
-						else
-							fprintf(fp,show_rrd ? ":%.1f" : ",%.1f",
-								DKDELTA(dk_time) / elapsed);
-					}
-					for (i = 0; i < disks; i++) {
-						if(NEWDISKGROUP(i))
-							fprintf(fp,show_rrd ? "\nrrdtool update diskread%s.rrd %s" : "\nDISKREAD%s,%s", dskgrp(i),LOOP);
-						fprintf(fp,show_rrd ? ":%.1f" : ",%.1f",
-						    DKDELTA(dk_rkb) / elapsed);
-					}
-					for (i = 0; i < disks; i++) {
-						if(NEWDISKGROUP(i))
-							fprintf(fp,show_rrd ? "\nrrdtool update diskwrite%s.rrd %s" : "\nDISKWRITE%s,%s", dskgrp(i),LOOP);
-						fprintf(fp,show_rrd ? ":%.1f" : ",%.1f",
-						    DKDELTA(dk_wkb) / elapsed);
-					}
-					for (i = 0; i < disks; i++) {
-						if(NEWDISKGROUP(i))
-							fprintf(fp,show_rrd ? "\nrrdtool update diskxfer%s.rrd %s" : "\nDISKXFER%s,%s", dskgrp(i),LOOP);
-						xfers = DKDELTA(dk_xfers);
-						fprintf(fp,show_rrd ? ":%.1f" : ",%.1f",
-							    (double)xfers / elapsed);
-					}
-					for (i = 0; i < disks; i++) {
-						if(NEWDISKGROUP(i))
-							fprintf(fp,show_rrd ? "\nrrdtool update diskbsize%s.rrd %s" : "\nDISKBSIZE%s,%s", dskgrp(i),LOOP);
-						xfers = DKDELTA(dk_xfers);
-						fprintf(fp,show_rrd ? ":%.1f" : ",%.1f",
-							    xfers == 0 ? 0.0 : 
-							    (DKDELTA(dk_rkb) + DKDELTA(dk_wkb) ) / xfers);
+					for (m = 0; m < 5; m++) {
+						for (i = 0; i < disks; i++) {
+							if(NEWDISKGROUP(i)) {
+								if(i > 0)
+									enc_end();
+								disk_begin(m, i);
+							}
+							xfers = DKDELTA(dk_xfers);
+							switch(m) {
+							case 0:	/* check percentage is correct */
+								ftmp = DKDELTA(dk_time) / elapsed;
+								if(ftmp > 100.0 || ftmp < 0.0)
+									enc_none(p->dk[i].dk_name, "101.00");
+								else
+									enc_num(p->dk[i].dk_name, DKDELTA(dk_time) / elapsed, 1);
+								break;
+							case 1:
+								enc_num(p->dk[i].dk_name, DKDELTA(dk_rkb) / elapsed, 1);
+								break;
+							case 2:
+								enc_num(p->dk[i].dk_name, DKDELTA(dk_wkb) / elapsed, 1);
+								break;
+							case 3:
+								enc_num(p->dk[i].dk_name, (double)xfers / elapsed, 1);
+								break;
+							case 4:
+								enc_num(p->dk[i].dk_name, xfers == 0 ? 0.0 :
+									(DKDELTA(dk_rkb) + DKDELTA(dk_wkb) ) / xfers, 1);
+								break;
+							}
+						}
+						if(disks > 0)
+							enc_end();
 					}
-					fprintf(fp,"\n");
 				}
 			}
-                        if ((enabled_options[loop_options] == SHOW_DGROUP || (!cursed && dgroup_loaded))) {
+                        if (cursed ? enabled_options[loop_options] == SHOW_DGROUP : (dgroup_loaded && loop_options == 0)) {
+				elapsed = snap_elapsed(p, q, SRC_DISK);
 				if (cursed) {
 					BANNER(paddg,"Disk-Group-I/O");
 					if (dgroup_loaded != 2 || dgroup_total_disks == 0) {
@@ -5434,7 +14902,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					display(paddg, 3 + dgroup_total_groups);
 				} else {
 					if (dgroup_loaded == 2) {
-						fprintf(fp, show_rrd ? "rrdtool update dgbusy.rdd %s" : "DGBUSY,%s", LOOP);
+						enc_begin("DGBUSY", "dgbusy.rrd");
 						for (k = 0; k < dgroup_total_groups; k++) {
 							if (dgroup_name[k] != 0) {
 								disk_total = 0.0;
@@ -5444,11 +14912,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 										disk_total += DKDELTA(dk_time) / elapsed;
 									}
 								}
-								fprintf(fp, show_rrd ? ":%.1f" : ",%.1f", (float)(disk_total / dgroup_disks[k]));
+								enc_num(dgroup_name[k], (float)(disk_total / dgroup_disks[k]), 1);
 							}
 						}
-						fprintf(fp, "\n");
-						fprintf(fp, show_rrd ? "rrdtool update dgread.rdd %s" : "DGREAD,%s", LOOP);
+						enc_end();
+						enc_begin("DGREAD", "dgread.rrd");
 						for (k = 0; k < dgroup_total_groups; k++) {
 							if (dgroup_name[k] != 0) {
 								disk_total = 0.0;
@@ -5458,11 +14926,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 										disk_total += DKDELTA(dk_reads) * p->dk[i].dk_bsize / 1024.0;
 									}
 								}
-								fprintf(fp, show_rrd ? ":%.1f" : ",%.1f", disk_total / elapsed);
+								enc_num(dgroup_name[k], disk_total / elapsed, 1);
 							}
 						}
-						fprintf(fp, "\n");
-						fprintf(fp, show_rrd ? "rrdtool update dgwrite.rdd %s" : "DGWRITE,%s", LOOP);
+						enc_end();
+						enc_begin("DGWRITE", "dgwrite.rrd");
 						for (k = 0; k < dgroup_total_groups; k++) {
 							if (dgroup_name[k] != 0) {
 								disk_total = 0.0;
@@ -5472,11 +14940,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 										disk_total += DKDELTA(dk_writes) * p->dk[i].dk_bsize / 1024.0;
 									}
 								}
-								fprintf(fp, show_rrd ? ":%.1f" : ",%.1f", disk_total / elapsed);
+								enc_num(dgroup_name[k], disk_total / elapsed, 1);
 							}
 						}
-						fprintf(fp, "\n");
-						fprintf(fp, show_rrd ? "rrdtool update dgbsize.rdd %s" : "DGSIZE,%s", LOOP);
+						enc_end();
+						enc_begin("DGSIZE", "dgbsize.rrd");
 						for (k = 0; k < dgroup_total_groups; k++) {
 							if (dgroup_name[k] != 0) {
 								disk_write = 0.0;
@@ -5492,11 +14960,11 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 									disk_size = 0.0;
 								else
 									disk_size = disk_write / disk_xfers;
-								fprintf(fp, show_rrd ? ":%.1f" : ",%.1f", disk_size);
+								enc_num(dgroup_name[k], disk_size, 1);
 							}
 						}
-						fprintf(fp, "\n");
-						fprintf(fp, show_rrd ? "rrdtool update dgxfer.rdd %s" : "DGXFER,%s", LOOP);
+						enc_end();
+						enc_begin("DGXFER", "dgxfer.rrd");
 						for (k = 0; k < dgroup_total_groups; k++) {
 							if (dgroup_name[k] != 0) {
 								disk_total = 0.0;
@@ -5506,28 +14974,20 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 										disk_total  += DKDELTA(dk_xfers);
 									}
 								}
-								fprintf(fp, show_rrd ? ":%.1f" : ",%.1f", disk_total / elapsed);
+								enc_num(dgroup_name[k], disk_total / elapsed, 1);
 							}
 						}
-						fprintf(fp, "\n");
+						enc_end();
 					}
 				}
 			}
 		} //End for loop to loop through enabled options - top mode is after this so that it will always be at the end
 	
 		if (enabled_option(SHOW_TOP)) {
-			/* Get the details of the running processes */
-			firstproc = 0;
+			/* The running processes came with the snapshot */
+			elapsed = snap_elapsed(p, q, SRC_PROCS);
 			skipped = 0;
-			n = getprocs(0);
-			if (n > p->nprocs) {
-				n = n +128; /* allow for growth in the number of processes in the mean time */
-				p->procs = realloc(p->procs, sizeof(struct procsinfo ) * (n+1) ); /* add one to avoid overrun */
-				p->nprocs = n;
-			}
-
-			firstproc = 0;
-                        n = getprocs(1);
+			n = p->nprocs;
 
 			if (topper_size < n) {
 				topper = realloc(topper, sizeof(struct topper ) * (n+1) ); /* add one to avoid overrun */
@@ -5543,6 +15003,9 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					topper[max_sorted].time =  TIMEDELTA(pi_utime,i,j) + 
 								   TIMEDELTA(pi_stime,i,j);
 					topper[max_sorted].size =  p->procs[i].statm_resident;
+					topper[max_sorted].elapsed = p->procs[i].pi_stamp > q->procs[j].pi_stamp
+						&& q->procs[j].pi_stamp > 0.0 ?
+						p->procs[i].pi_stamp - q->procs[j].pi_stamp : elapsed;
 
 					max_sorted++;
 					break;
@@ -5561,13 +15024,16 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 #endif /* DISK */
 			}
 			CURSE BANNER(padtop,"Top Processes");
-			CURSE mvwprintw(padtop,0, 15, "Procs=%d mode=%d (1=Basic, 3=Perf 4=Size 5=I/O)", n, show_topmode);
-			if(cursed && first_time) {
+			CURSE mvwprintw(padtop,0, 15, "Procs=%d mode=%d (1=Basic, 2=Container 3=Perf 4=Size 5=I/O)", n, show_topmode);
+			if(cursed && (first_time || q->nprocs == 0)) {
 				first_time = 0;
 				mvwprintw(padtop,1, 1, "please wait - information being collected");
 			}
 			else {
 			switch (show_topmode) {
+			case 2:
+				j = top_containers(padtop, max_sorted);
+				break;
 			case 1:
 				CURSE mvwprintw(padtop,1, 1, "  PID      PPID  Pgrp Nice Prior Status    proc-Flag Command");
 				for (j = 0; j < max_sorted; j++) {
@@ -5577,7 +15043,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					else
 						sprintf(&pgrp[0], "%d", p->procs[i].pi_pgrp);
 					/* skip over processes with 0 CPU */
-					if(!show_all && (topper[j].time/elapsed < ignore_procdisk_threshold) && !cmdfound) 
+					if(!show_all && (topper[j].time/topper[j].elapsed < ignore_procdisk_threshold) && !cmdfound) 
 						break;
 					    //if( x + j + 2 - skipped > LINES+2) /* +2 to for safety :-) */
 						//break;
@@ -5588,7 +15054,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					    p->procs[i].pi_nice,
 					    p->procs[i].pi_pri,
 
-					    (topper[j].time * 100 / elapsed) ? "Running "
+					    (topper[j].time * 100 / topper[j].elapsed) ? "Running "
 					     : get_state(p->procs[i].pi_state),
 					    p->procs[i].pi_flags,
 					    (p->procs[i].pi_tty_nr ? "F" : " "),
@@ -5603,9 +15069,9 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					formatstring = "  PID    %%CPU ResSize    Command                                            ";
 
 				else if(COLS > 119)
-					formatstring = "  PID       %%CPU    Size     Res    Res     Res     Res    Shared    Faults  Command";
+					formatstring = "  PID       %%CPU    Size     Res    Res     Res     Res    Shared    Faults  Command                          Container";
 				else
-					formatstring = "  PID    %%CPU  Size   Res   Res   Res   Res Shared   Faults Command";
+					formatstring = "  PID    %%CPU  Size   Res   Res   Res   Res Shared   Faults Command                          Container";
 				CURSE mvwprintw(padtop,1, y_1, formatstring);
 
 				if(show_args == ARGS_ONLY)
@@ -5615,11 +15081,12 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				else
 					formatstring = "         Used    KB   Set  Text  Data   Lib    KB  Min  Maj ";
 				CURSE mvwprintw(padtop,2, 1, formatstring);
+				container_reserve(max_sorted);
 				for (j = 0; j < max_sorted; j++) {
 					i = topper[j].index;
 					if(!show_all) { 
 							/* skip processes with zero CPU/io */
-						if(show_topmode == 3 && (topper[j].time/elapsed) < ignore_procdisk_threshold && !cmdfound)
+						if(show_topmode == 3 && (topper[j].time/topper[j].elapsed) < ignore_procdisk_threshold && !cmdfound)
 							break;
 						if(show_topmode == 5 && (topper[j].io < ignore_io_threshold && !cmdfound))
 							break;
@@ -5635,19 +15102,19 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					    mvwprintw(padtop,j + 3 - skipped, 1, 
 					    "%7d %5.1f %7lu %-120s",
 					    p->procs[i].pi_pid,
-					    topper[j].time / elapsed,
+					    topper[j].time / topper[j].elapsed,
 					    p->procs[i].statm_resident*4,
 					    args_lookup(p->procs[i].pi_pid,
 							p->procs[i].pi_comm));
 					  }
 					  else {
 					if(COLS > 119)
-					    formatstring = "%8d %7.1f %7lu %7lu %7lu %7lu %7lu %5lu %6d %6d %-32s";
+					    formatstring = "%8d %7.1f %7lu %7lu %7lu %7lu %7lu %5lu %6d %6d %-32s %-24s";
 					else
-					    formatstring = "%7d %5.1f %5lu %5lu %5lu %5lu %5lu %5lu %4d %4d %-32s";
+					    formatstring = "%7d %5.1f %5lu %5lu %5lu %5lu %5lu %5lu %4d %4d %-32s %-24s";
 					    mvwprintw(padtop,j + 3 - skipped, 1, formatstring,
 					    p->procs[i].pi_pid,
-					    topper[j].time/elapsed,
+					    topper[j].time/topper[j].elapsed,
 	/* topper[j].time /1000.0 / elapsed,*/
 					    p->procs[i].statm_size*4 ,
 					    p->procs[i].statm_resident*4,
@@ -5655,35 +15122,42 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 					    p->procs[i].statm_drs*4,
 					    p->procs[i].statm_lrs*4,
 					    p->procs[i].statm_share*4,
-					    (int)(COUNTDELTA(pi_minflt) / elapsed),
-					    (int)(COUNTDELTA(pi_majflt) / elapsed),
-					    p->procs[i].pi_comm);
+					    (int)(COUNTDELTA(pi_minflt) / topper[j].elapsed),
+					    (int)(COUNTDELTA(pi_majflt) / topper[j].elapsed),
+					    p->procs[i].pi_comm,
+					    container_lookup(p->procs[i].pi_pid, p->procs[i].pi_start_time));
 					  }
 					}
 					else {
+					    if(top_max > 0 && j >= top_max)
+						break;	/* one series per process, keep it to the busiest */
 					    if((cmdfound && cmdcheck(p->procs[i].pi_comm)) || 
-						(!cmdfound && ((topper[j].time / elapsed) > ignore_procdisk_threshold)) )
+						(!cmdfound && ((topper[j].time / topper[j].elapsed) > ignore_procdisk_threshold)) )
 						 {
-					    fprintf(fp,"TOP,%07d,%s,%.1f,%.1f,%.1f,%lu,%lu,%lu,%lu,%lu,%d,%d,%s\n",
-					    /* 1 */ p->procs[i].pi_pid,
-					    /* 2 */ LOOP,
-					    /* 3 */ topper[j].time / elapsed,
-                                            /* 4 */ TIMEDELTA(pi_utime,i,topper[j].other) / elapsed,
-                                            /* 5 */ TIMEDELTA(pi_stime,i,topper[j].other) / elapsed,
-					    /* 6 */ p->procs[i].statm_size*4,
-					    /* 7 */ p->procs[i].statm_resident*4,
-					    /* 8 */ p->procs[i].statm_trs*4,
-					    /* 9 */ p->procs[i].statm_drs*4,
-					    /* 10*/ p->procs[i].statm_share*4,
-					    /* 11*/ (int)(COUNTDELTA(pi_minflt) / elapsed),
-					    /* 12*/ (int)(COUNTDELTA(pi_majflt) / elapsed),
-					    /* 13*/ p->procs[i].pi_comm);
+					    snprintf(col, sizeof(col), "%d", p->procs[i].pi_pid);
+					    enc_begin("TOP", NULL);
+					    enc_key("PID", col);
+					    enc_num("%CPU", topper[j].time / topper[j].elapsed, 1);
+					    enc_num("%Usr", TIMEDELTA(pi_utime,i,topper[j].other) / topper[j].elapsed, 1);
+					    enc_num("%Sys", TIMEDELTA(pi_stime,i,topper[j].other) / topper[j].elapsed, 1);
+					    enc_num("Size", p->procs[i].statm_size*4, 0);
+					    enc_num("ResSet", p->procs[i].statm_resident*4, 0);
+					    enc_num("ResText", p->procs[i].statm_trs*4, 0);
+					    enc_num("ResData", p->procs[i].statm_drs*4, 0);
+					    enc_num("ShdLib", p->procs[i].statm_share*4, 0);
+					    enc_num("MinorFault", (int)(COUNTDELTA(pi_minflt) / topper[j].elapsed), 0);
+					    enc_num("MajorFault", (int)(COUNTDELTA(pi_majflt) / topper[j].elapsed), 0);
+					    enc_text("Command", p->procs[i].pi_comm);
+					    enc_text("Container", container_lookup(p->procs[i].pi_pid, p->procs[i].pi_start_time));
+					    enc_end();
 
 					    if(show_args)
 						args_output(p->procs[i].pi_pid,loop, p->procs[i].pi_comm);
 					    }
 					}
 				}
+				if(!cursed && show_containers)
+					top_containers(NULL, max_sorted);
 				break;
 			    }
 			}
@@ -5704,7 +15178,7 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 			doupdate();
 		
 			column_check=0;  
-			for (i = 0; i < seconds; i++) {
+			for (;;) {
 				if (column_check == 0) {     //Only check this stuff 1 time per screen refresh
 	        			if (num_col != last_num_col){
 	        				if (x_3 > 1 ){
@@ -5726,7 +15200,8 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 	        			}
 					column_check = 1;
 				}
-				usleep(100000);   // 1/10 of a second
+				if (snapshot_wait(-1, 1))   // a key, or the next snapshot arrived
+					break;
 				int result = checkinput();
 				if (result == 2){   //An arrow key was pressed so we only want to update the help menu, not the entire screen
 					num_col_temp = num_col;
@@ -5749,25 +15224,21 @@ mvprintw(x_1+20, 3, "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.");
 				
 			}
 		}
-		else {
+		else if(roll_tick) {
+			out_next();
+			prom_publish();
+			shm_publish();
+			roll_reset();
 			fflush(NULL);
-			secs = seconds; 
-redo:
-			errno = 0;
-			ret = sleep(secs / 10); 
-			if( ret != 0 || errno != 0) {
-				fprintf(fp,"sleep got interrupted\n");
-				fprintf(fp,"ret was %d\n",ret);
-				fprintf(fp,"errno was %d\n",errno);
-				secs=ret;
-				goto redo;
-			}
 		}
 
-		switcher();
-
-		if (loop >= maxloops) {
+snapshot_done:
+		if (fresh && loop >= maxloops) {
 			CURSE endwin();
+			rec_close();
+			out_close();
+			if(rec_in_name != NULL && !cursed)
+				rec_sort(user_filename);
                         if (nmon_end) {
                                 child_start(CHLD_END, nmon_end, time_stamp_type, loop, timer);
                                 /* Give the end - processing some time - 5s for now */
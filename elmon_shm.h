@@ -0,0 +1,202 @@
+/*
+ * elmon_shm.h -- read the snapshots elmon -Y publishes in shared memory
+ * License:  GPL version 3
+ */
+
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3 as
+    published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* elmon -Y <name> keeps the latest snapshot in the POSIX shared memory
+ * segment <name> (/dev/shm/<name>) as a table of entries, one per value
+ * elmon -f would write: the section (CPU_ALL, DISKBUSY, TOP ...), the
+ * key for sections with a line each (the PID for TOP, as in "1234",
+ * else ""), the column and the value, or for text columns like the TOP
+ * command NaN and the text.
+ *
+ * There are two buffers.  elmon fills the one latest does not point at
+ * and then points latest at it, so a reader has a whole interval to copy
+ * the latest one.  Each buffer has a sequence number that is odd while
+ * elmon writes it: a reader takes it, copies what it wants, and starts
+ * again if the number has changed by then.  Reading is memory access
+ * only, as often as wanted, and never holds elmon up.
+ *
+ *	struct elmon_shm_reader r;
+ *	double busy;
+ *
+ *	if(elmon_shm_open(&r, "/elmon") == 0
+ *	&& elmon_shm_get(&r, "DISKBUSY", "", "sda", &busy) == 0)
+ *		printf("sda %.1f%% busy\n", busy);
+ *
+ * The segment stays when elmon stops, time says how old the snapshot is
+ * and the next elmon -Y with the name carries on in it.  Older C
+ * libraries need -lrt for shm_open().
+ */
+#ifndef ELMON_SHM_H
+#define ELMON_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ELMON_SHM_MAGIC		0x6e6f6d6c65ULL	/* "elmon" */
+#define ELMON_SHM_VERSION	1
+#define ELMON_SHM_ENTRIES	8192	/* in each buffer, what does not fit is counted in truncated */
+#define ELMON_SHM_SECTION	24
+#define ELMON_SHM_KEY		40
+#define ELMON_SHM_COLUMN	40
+#define ELMON_SHM_TEXT		40
+
+struct elmon_shm_entry {
+	char	section[ELMON_SHM_SECTION];
+	char	key[ELMON_SHM_KEY];
+	char	column[ELMON_SHM_COLUMN];
+	char	text[ELMON_SHM_TEXT];	/* for a text column, value is NaN */
+	double	value;
+};
+
+struct elmon_shm_buffer {
+	uint64_t seq;		/* odd while elmon writes the buffer */
+	uint64_t snapshot;	/* the T number */
+	int64_t	time;		/* seconds since 1970 */
+	uint32_t count;		/* entries */
+	uint32_t truncated;	/* values that did not fit */
+	struct elmon_shm_entry entry[ELMON_SHM_ENTRIES];
+};
+
+struct elmon_shm {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t pid;		/* of the elmon writing it */
+	uint32_t interval_ms;	/* between snapshots */
+	uint32_t latest;	/* buffer with the latest snapshot */
+	struct elmon_shm_buffer buffer[2];
+};
+
+struct elmon_shm_reader {
+	const struct elmon_shm *shm;
+};
+
+/* Map the segment, returns 0, or -1 with errno (EPROTO if it is not one
+ * this header knows)
+ */
+static inline int elmon_shm_open(struct elmon_shm_reader *r, const char *name)
+{
+struct stat st;
+void *m;
+int fd;
+
+	if((fd = shm_open(name, O_RDONLY, 0)) == -1)
+		return -1;
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct elmon_shm)) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	m = mmap(NULL, sizeof(struct elmon_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED)
+		return -1;
+	r->shm = (const struct elmon_shm *)m;
+	if(r->shm->magic != ELMON_SHM_MAGIC || r->shm->version != ELMON_SHM_VERSION) {
+		munmap(m, sizeof(struct elmon_shm));
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void elmon_shm_close(struct elmon_shm_reader *r)
+{
+	munmap((void *)r->shm, sizeof(struct elmon_shm));
+}
+
+/* The latest finished buffer and its sequence number, NULL if there has
+ * been no snapshot yet
+ */
+static inline const struct elmon_shm_buffer *elmon_shm_begin(struct elmon_shm_reader *r, uint64_t *seq)
+{
+const struct elmon_shm_buffer *b;
+
+	for(;;) {
+		b = &r->shm->buffer[__atomic_load_n(&r->shm->latest, __ATOMIC_ACQUIRE) & 1];
+		*seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+		if(*seq == 0)
+			return NULL;
+		if((*seq & 1) == 0)
+			return b;
+	}
+}
+
+/* Whether what was read from b since elmon_shm_begin() is all from one snapshot */
+static inline int elmon_shm_valid(const struct elmon_shm_buffer *b, uint64_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* Copy up to max entries of the latest snapshot, returns how many or -1
+ * if there is none yet
+ */
+static inline int elmon_shm_read(struct elmon_shm_reader *r, struct elmon_shm_entry *out, int max,
+	uint64_t *snapshot, int64_t *time)
+{
+const struct elmon_shm_buffer *b;
+uint64_t seq;
+int n;
+
+	do {
+		if((b = elmon_shm_begin(r, &seq)) == NULL)
+			return -1;
+		n = b->count < (uint32_t)max ? (int)b->count : max;
+		memcpy(out, b->entry, n * sizeof(struct elmon_shm_entry));
+		if(snapshot != NULL)
+			*snapshot = b->snapshot;
+		if(time != NULL)
+			*time = b->time;
+	} while(!elmon_shm_valid(b, seq));
+	return n;
+}
+
+/* One value of the latest snapshot, key is "" for sections without one,
+ * returns 0 or -1 if there is no such value
+ */
+static inline int elmon_shm_get(struct elmon_shm_reader *r, const char *section, const char *key,
+	const char *column, double *value)
+{
+const struct elmon_shm_buffer *b;
+uint64_t seq;
+uint32_t count;
+uint32_t i;
+int found;
+
+	do {
+		if((b = elmon_shm_begin(r, &seq)) == NULL)
+			return -1;
+		count = b->count < ELMON_SHM_ENTRIES ? b->count : ELMON_SHM_ENTRIES;
+		for(found = 0, i = 0; i < count && !found; i++)
+			if(strncmp(b->entry[i].column, column, ELMON_SHM_COLUMN) == 0
+			&& strncmp(b->entry[i].section, section, ELMON_SHM_SECTION) == 0
+			&& strncmp(b->entry[i].key, key, ELMON_SHM_KEY) == 0) {
+				*value = b->entry[i].value;
+				found = 1;
+			}
+	} while(!elmon_shm_valid(b, seq));
+	return found ? 0 : -1;
+}
+
+#endif /* ELMON_SHM_H */